@@ -22,7 +22,11 @@
 #endif
 
 #include "add-caldav-object.h"
+#include "caldav-session.h"
 #include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
+#include "caldav-upload.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -77,12 +81,10 @@ gboolean caldav_add(caldav_settings* settings, caldav_error* error) {
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
-	gchar* tmp = random_file_name(settings->file);
+	caldav_trace_setup(curl, settings, &data);
+	gchar* tmp = (settings->upload) ?
+			g_strdup(caldav_upload_digest(settings->upload)) :
+			random_file_name(settings->file);
 	gchar* s = rebuild_url(settings, NULL);
 	if (g_str_has_suffix(s, "/")) {
 		url = g_strdup_printf("%slibcaldav-%s.ics", s, tmp);
@@ -93,18 +95,24 @@ gboolean caldav_add(caldav_settings* settings, caldav_error* error) {
 	g_free(s);
 	g_free(tmp);
 	curl_easy_setopt(curl, CURLOPT_URL, url);
-	tmp = g_strdup(settings->file);
-	g_free(settings->file);
-	settings->file = verify_uid(tmp);
-	g_free(tmp);
 	/* enable uploading */
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
-	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(settings->file));
+	if (settings->upload) {
+		/* the UID was added while the object was read */
+		caldav_upload_setup(settings->upload, curl);
+	}
+	else {
+		tmp = g_strdup(settings->file);
+		g_free(settings->file);
+		settings->file = verify_uid(tmp);
+		g_free(tmp);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
+		curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(settings->file));
+	}
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	if (res != 0) {
 		error->code = -1;
 		error->str = g_strdup_printf("%s", error_buf);
@@ -140,6 +148,19 @@ gboolean caldav_add(caldav_settings* settings, caldav_error* error) {
 			g_free(location);
 		}
 	}
+	if (! result) {
+		gchar* uid = (settings->upload) ?
+				g_strdup(caldav_upload_uid(settings->upload)) :
+				get_response_header("uid", settings->file, FALSE);
+		if (settings->id->Type == CALDAV_ETAG_TYPE)
+			caldav_session_store(settings->session, settings->url, uid,
+					url, settings->id->Ident.Etag.etag, settings->file);
+		else if (settings->id->Ident.Location.location)
+			caldav_session_store(settings->session, settings->url, uid,
+					settings->id->Ident.Location.location, NULL,
+					settings->file);
+		g_free(uid);
+	}
 	g_free(settings->url);
 	settings->url = NULL;
 	if (chunk.memory)
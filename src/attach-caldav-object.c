@@ -0,0 +1,225 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "attach-caldav-object.h"
+#include "caldav-session.h"
+#include "caldav-index.h"
+#include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
+#include "caldav-upload.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Quote a file name for the Content-Disposition header.
+ * @param name File name
+ * @return quoted-string. Caller must free the memory.
+ */
+static gchar* quote_name(const gchar* name) {
+	GString* quoted = g_string_new("\"");
+
+	for (; *name; name++) {
+		if (*name == '"' || *name == '\\')
+			g_string_append_c(quoted, '\\');
+		/* no line breaks in a header */
+		if (*name != '\r' && *name != '\n')
+			g_string_append_c(quoted, *name);
+	}
+	g_string_append_c(quoted, '"');
+	return g_string_free(quoted, FALSE);
+}
+
+/**
+ * Function for adding, updating or removing a managed attachment (RFC8607)
+ * on the object in settings->id.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+gboolean caldav_attach(caldav_settings* settings, caldav_error* error) {
+	CURL* curl;
+	CURLcode res = 0;
+	char error_buf[CURL_ERROR_SIZE];
+	struct config_data data;
+	struct MemoryStruct chunk;
+	struct MemoryStruct headers;
+	struct curl_slist *http_header = NULL;
+	gboolean result = FALSE;
+	gchar* href;
+	gchar* etag;
+	gchar* query;
+	gchar* url;
+	gchar* tmp;
+
+	if (! settings->managed_attachments) {
+		error->code = 501;
+		error->str = g_strdup("Server does not support managed attachments");
+		return TRUE;
+	}
+	if (! settings->id) {
+		error->code = -1;
+		error->str = g_strdup("missing etag and/or path");
+		return TRUE;
+	}
+	if (settings->id->Type == CALDAV_ETAG_TYPE) {
+		href = settings->id->Ident.Etag.uri;
+		etag = settings->id->Ident.Etag.etag;
+	}
+	else {
+		href = settings->id->Ident.Location.location;
+		etag = settings->id->Ident.Location.etag;
+	}
+	if (! href) {
+		error->code = -1;
+		error->str = g_strdup("missing etag and/or path");
+		return TRUE;
+	}
+
+	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
+	chunk.size = 0;    /* no data at this point */
+	headers.memory = NULL;
+	headers.size = 0;
+
+	curl = get_curl(settings);
+	if (!curl) {
+		error->code = -1;
+		error->str = g_strdup("Could not initialize libcurl");
+		return TRUE;
+	}
+
+	if (settings->managed_id) {
+		gchar* id = curl_easy_escape(curl, settings->managed_id, 0);
+		query = g_strdup_printf("?action=attachment-%s&managed-id=%s",
+				(settings->upload) ? "update" : "remove", id);
+		curl_free(id);
+	}
+	else {
+		query = g_strdup("?action=attachment-add");
+	}
+	if (etag && *etag) {
+		tmp = g_strdup_printf("If-Match: \"%s\"", etag);
+		http_header = curl_slist_append(http_header, tmp);
+		g_free(tmp);
+	}
+	if (settings->upload) {
+		tmp = g_strdup_printf("Content-Type: %s", (settings->attach_type) ?
+				settings->attach_type : "application/octet-stream");
+		http_header = curl_slist_append(http_header, tmp);
+		g_free(tmp);
+		if (settings->attach_name) {
+			gchar* name = quote_name(settings->attach_name);
+			tmp = g_strdup_printf(
+					"Content-Disposition: attachment;filename=%s", name);
+			http_header = curl_slist_append(http_header, tmp);
+			g_free(tmp);
+			g_free(name);
+		}
+	}
+	http_header = curl_slist_append(http_header, "Expect:");
+	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
+	data.trace_ascii = settings->trace_ascii;
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
+	/* send all data to this function  */
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	/* we pass our 'chunk' struct to the callback function */
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	/* send all data to this function  */
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
+	/* we pass our 'headers' struct to the callback function */
+	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
+	caldav_trace_setup(curl, settings, &data);
+	tmp = remove_protocol(href);
+	url = g_strconcat(tmp, query, NULL);
+	g_free(tmp);
+	g_free(query);
+	tmp = url;
+	url = rebuild_url(settings, tmp);
+	g_free(tmp);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	if (settings->upload) {
+		caldav_upload_setup(settings->upload, curl);
+	}
+	else {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, 0L);
+	}
+	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "POST");
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
+	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+	/* adding twice would give the object two attachments */
+	res = caldav_perform(curl, settings->managed_id != NULL, &chunk, &headers);
+	if (res != 0) {
+		error->code = -1;
+		error->str = g_strdup_printf("%s", error_buf);
+		result = TRUE;
+	}
+	else {
+		long code;
+		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+		if (! parse_response(CALDAV_POST, code, chunk.memory)) {
+			error->str = g_strdup(chunk.memory);
+			error->code = code;
+			result = TRUE;
+		}
+	}
+	if (! result) {
+		if (! settings->managed_id) {
+			settings->managed_id = get_response_header("Cal-Managed-ID",
+					headers.memory, FALSE);
+		}
+		/* the attachment changed the object */
+		gchar* value = get_response_header("ETAG", headers.memory, FALSE);
+		tmp = (value) ? sanitize(value) : g_strdup("");
+		g_free(value);
+		if (settings->id->Type == CALDAV_ETAG_TYPE) {
+			g_free(settings->id->Ident.Etag.etag);
+			settings->id->Ident.Etag.etag = tmp;
+		}
+		else {
+			g_free(settings->id->Ident.Location.etag);
+			settings->id->Ident.Location.etag = tmp;
+		}
+		caldav_index* index = caldav_session_index(settings->session,
+				settings->url, FALSE);
+		if (index) {
+			tmp = caldav_index_href(href);
+			caldav_index_remove_href(index, tmp);
+			g_free(tmp);
+		}
+	}
+	g_free(url);
+	if (chunk.memory)
+		free(chunk.memory);
+	if (headers.memory)
+		free(headers.memory);
+	curl_slist_free_all(http_header);
+	curl_easy_cleanup(curl);
+	return result;
+}
@@ -0,0 +1,569 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "batch-caldav-object.h"
+#include "caldav-session.h"
+#include "response-parser.h"
+#include "caldav-multi.h"
+#include "caldav-trace.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @typedef struct batch_job
+ * Holds everything belonging to one request in transit
+ */
+typedef struct {
+	multi_job multi;		/* must come first */
+	caldav_batch_item* item;
+	CALDAV_METHOD method;
+	gchar* url;
+	gchar* body;
+	gchar* uid;				/* of a MODIFY or DELETE item */
+	gchar* found;			/* object found by UID before the transfers */
+	gchar* found_etag;
+	long found_code;
+	gboolean cached;		/* found in the session */
+	struct curl_slist* http_header;
+	struct config_data data;
+	char error_buf[CURL_ERROR_SIZE];
+} batch_job;
+
+/**
+ * @typedef struct lookup_job
+ * Search for the object of a MODIFY or DELETE item by its UID
+ */
+typedef struct {
+	multi_job multi;		/* must come first */
+	batch_job* job;
+	gchar* search;
+	struct curl_slist* http_header;
+	struct config_data data;
+	char error_buf[CURL_ERROR_SIZE];
+} lookup_job;
+
+static CALDAV_RESPONSE batch_response(long code) {
+	CALDAV_RESPONSE response;
+
+	switch (code) {
+		case 403: response = FORBIDDEN; break;
+		case 409: response = CONFLICT; break;
+		case 423: response = LOCKED; break;
+		case 501: response = NOTIMPLEMENTED; break;
+		default: response = CONFLICT; break;
+	}
+	return response;
+}
+
+/**
+ * Keep the object found for a job.
+ * @param job The job the object was searched for
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param href Path of the object. Taken over.
+ * @param etag ETAG of the object or NULL if not found. Taken over.
+ */
+static void found_object(batch_job* job, caldav_settings* settings,
+		gchar* href, gchar* etag) {
+	gchar* host = get_host(settings->url);
+
+	if (host && etag) {
+		job->found = g_strdup_printf("%s%s", host, href);
+		job->found_etag = etag;
+	}
+	else
+		g_free(etag);
+	g_free(host);
+	g_free(href);
+}
+
+/**
+ * Prepare the search for the object of a job. @see multi_ops
+ * @param multi The lookup to prepare
+ * @param data Not used
+ * @return TRUE if the request is ready to be sent, FALSE otherwise
+ */
+static gboolean prepare_lookup(multi_job* multi, gpointer data) {
+	lookup_job* lookup = (lookup_job *) multi;
+	caldav_settings* settings = multi->settings;
+
+	multi->curl = get_curl(settings);
+	if (! multi->curl) {
+		lookup->job->found_code = -1;
+		return FALSE;
+	}
+	/* a search changes nothing so it is always safe to repeat */
+	multi->idempotent = TRUE;
+	lookup->search = find_etag_query(lookup->job->uid);
+	lookup->http_header = curl_slist_append(lookup->http_header,
+			"Content-Type: application/xml; charset=\"utf-8\"");
+	lookup->http_header = curl_slist_append(lookup->http_header, "Depth: 1");
+	lookup->http_header = curl_slist_append(lookup->http_header, "Expect:");
+	lookup->http_header = curl_slist_append(lookup->http_header,
+			"Transfer-Encoding:");
+	lookup->data.trace_ascii = settings->trace_ascii;
+
+	curl_easy_setopt(multi->curl, CURLOPT_HTTPHEADER, lookup->http_header);
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEDATA, (void *)&multi->chunk);
+	curl_easy_setopt(multi->curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEHEADER, (void *)&multi->headers);
+	curl_easy_setopt(multi->curl, CURLOPT_ERRORBUFFER, lookup->error_buf);
+	caldav_trace_setup(multi->curl, settings, &lookup->data);
+	curl_easy_setopt(multi->curl, CURLOPT_POSTFIELDS, lookup->search);
+	curl_easy_setopt(multi->curl, CURLOPT_POSTFIELDSIZE, strlen(lookup->search));
+	curl_easy_setopt(multi->curl, CURLOPT_CUSTOMREQUEST, "REPORT");
+	curl_easy_setopt(multi->curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(multi->curl, CURLOPT_UNRESTRICTED_AUTH, 1);
+	curl_easy_setopt(multi->curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+	return TRUE;
+}
+
+static void finish_lookup(multi_job* multi, CURLcode res, gpointer data) {
+	lookup_job* lookup = (lookup_job *) multi;
+	batch_job* job = lookup->job;
+	caldav_error error;
+	gchar* href = NULL;
+	gchar* etag;
+	long code = 0;
+
+	if (! multi->curl || res != CURLE_OK) {
+		job->found_code = -1;
+		return;
+	}
+	error.code = 0;
+	error.str = NULL;
+	curl_easy_getinfo(multi->curl, CURLINFO_RESPONSE_CODE, &code);
+	etag = find_etag_answer(multi->settings, job->uid, code,
+			multi->chunk.memory, &href, &error);
+	found_object(job, multi->settings, href, etag);
+	job->found_code = error.code;
+	g_free(error.str);
+}
+
+static void free_lookup(multi_job* multi, gpointer data) {
+	lookup_job* lookup = (lookup_job *) multi;
+
+	if (lookup->http_header)
+		curl_slist_free_all(lookup->http_header);
+	g_free(lookup->search);
+	lookup->http_header = NULL;
+	lookup->search = NULL;
+}
+
+static const multi_ops lookup_ops = {
+	prepare_lookup,
+	finish_lookup,
+	free_lookup
+};
+
+/**
+ * Find the objects of the MODIFY and DELETE items by their UID. The
+ * session is asked first and the others are searched for concurrently,
+ * all before the first transfer is started.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param jobs The jobs to resolve
+ * @param count Number of jobs
+ * @param fresh TRUE to search the server even if the session knows the
+ * object
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if the searches could not be run, FALSE otherwise
+ */
+static gboolean resolve_jobs(caldav_settings* settings, batch_job* jobs,
+		int count, gboolean fresh, caldav_error* error) {
+	lookup_job* lookups = g_new0(lookup_job, count);
+	gboolean res = FALSE;
+	gchar* href;
+	gchar* etag;
+	int n = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		batch_job* job = &jobs[i];
+		caldav_batch_item* item = job->item;
+
+		if ((item->action != MODIFY && item->action != DELETE) ||
+				! item->object)
+			continue;
+		job->uid = get_response_header("uid", (gchar *) item->object, FALSE);
+		if (! job->uid) {
+			/* Missing required UID for object */
+			job->found_code = 1;
+			continue;
+		}
+		/* known from a previous call */
+		if (! fresh && caldav_session_lookup(settings->session, settings->url,
+					job->uid, &href, &etag)) {
+			job->cached = TRUE;
+			found_object(job, settings, href, etag);
+			continue;
+		}
+		lookups[n].multi.settings = settings;
+		lookups[n].job = job;
+		n++;
+	}
+	if (n > 0)
+		res = caldav_multi_run(settings, lookups, sizeof(lookup_job), n,
+				&lookup_ops, NULL, error);
+	g_free(lookups);
+	return res;
+}
+
+/**
+ * Prepare the request for a single batch item. @see multi_ops
+ * @param multi The job to prepare
+ * @param data Not used
+ * @return TRUE if the request is ready to be sent, FALSE otherwise.
+ * In the latter case the item has been given its result.
+ */
+static gboolean prepare_job(multi_job* multi, gpointer data) {
+	batch_job* job = (batch_job *) multi;
+	caldav_settings* settings = multi->settings;
+	caldav_batch_item* item = job->item;
+	caldav_error error;
+	gchar* etag = NULL;
+	gchar* url = NULL;
+	gchar* header;
+
+	error.code = 0;
+	error.str = NULL;
+	switch (item->action) {
+		case ADD:
+		case ID_ADD:
+			if (item->object) {
+				gchar* name = random_file_name((gchar *) item->object);
+				gchar* s = rebuild_url(settings, NULL);
+				if (g_str_has_suffix(s, "/"))
+					job->url = g_strdup_printf("%slibcaldav-%s.ics", s, name);
+				else
+					job->url = g_strdup_printf("%s/libcaldav-%s.ics", s, name);
+				g_free(s);
+				g_free(name);
+				job->body = verify_uid((gchar *) item->object);
+			}
+			job->method = CALDAV_PUT;
+			break;
+		case MODIFY:
+		case DELETE:
+			/* found by resolve_jobs */
+			url = job->found;
+			etag = job->found_etag;
+			error.code = job->found_code;
+			job->found = NULL;
+			job->found_etag = NULL;
+			job->method = (item->action == MODIFY) ? CALDAV_PUT : CALDAV_DELETE;
+			break;
+		case ID_MODIFY:
+		case ID_DELETE:
+			if (item->id) {
+				if (item->id->Type == CALDAV_ETAG_TYPE) {
+					url = remove_protocol(item->id->Ident.Etag.uri);
+					if (item->id->Ident.Etag.etag)
+						etag = g_strdup(item->id->Ident.Etag.etag);
+				}
+				else {
+					url = remove_protocol(item->id->Ident.Location.location);
+					if (item->id->Ident.Location.etag)
+						etag = g_strdup(item->id->Ident.Location.etag);
+				}
+			}
+			job->method = (item->action == ID_MODIFY) ? CALDAV_PUT : CALDAV_DELETE;
+			break;
+		default:
+			break;
+	}
+	if (url) {
+		job->url = rebuild_url(settings, url);
+		if (job->method == CALDAV_PUT && item->object)
+			job->body = g_strdup(item->object);
+		g_free(url);
+	}
+	if (! job->url || (job->method == CALDAV_PUT && ! job->body)) {
+		item->code = (error.code != 0) ? error.code : -1;
+		item->result = (error.code > 0) ? batch_response(error.code) : CONFLICT;
+		g_free(error.str);
+		g_free(etag);
+		return FALSE;
+	}
+	g_free(error.str);
+
+	multi->curl = get_curl(settings);
+	if (! multi->curl) {
+		item->code = -1;
+		item->result = CONFLICT;
+		g_free(etag);
+		return FALSE;
+	}
+	if (item->action == ADD || item->action == ID_ADD) {
+		job->http_header = curl_slist_append(job->http_header,
+				"If-None-Match: *");
+		multi->idempotent = TRUE;
+	}
+	else {
+		if (! etag || strcmp(etag, "") == 0)
+			header = g_strdup("If-Match: \"*\"");
+		else {
+			header = g_strdup_printf("If-Match: \"%s\"", etag);
+			multi->idempotent = TRUE;
+		}
+		job->http_header = curl_slist_append(job->http_header, header);
+		g_free(header);
+	}
+	g_free(etag);
+	if (job->method == CALDAV_PUT)
+		job->http_header = curl_slist_append(job->http_header,
+				"Content-Type: text/calendar; charset=\"utf-8\"");
+	job->http_header = curl_slist_append(job->http_header, "Expect:");
+	job->http_header = curl_slist_append(job->http_header,
+			"Transfer-Encoding:");
+	job->data.trace_ascii = settings->trace_ascii;
+
+	curl_easy_setopt(multi->curl, CURLOPT_HTTPHEADER, job->http_header);
+	/* send all data to this function  */
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	/* we pass our 'chunk' struct to the callback function */
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEDATA, (void *)&multi->chunk);
+	/* send all data to this function  */
+	curl_easy_setopt(multi->curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
+	/* we pass our 'headers' struct to the callback function */
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEHEADER, (void *)&multi->headers);
+	curl_easy_setopt(multi->curl, CURLOPT_ERRORBUFFER, job->error_buf);
+	caldav_trace_setup(multi->curl, settings, &job->data);
+	curl_easy_setopt(multi->curl, CURLOPT_URL, job->url);
+	if (job->method == CALDAV_PUT) {
+		curl_easy_setopt(multi->curl, CURLOPT_POSTFIELDS, job->body);
+		curl_easy_setopt(multi->curl, CURLOPT_POSTFIELDSIZE, strlen(job->body));
+		curl_easy_setopt(multi->curl, CURLOPT_CUSTOMREQUEST, "PUT");
+	}
+	else {
+		curl_easy_setopt(multi->curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+	}
+	curl_easy_setopt(multi->curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(multi->curl, CURLOPT_UNRESTRICTED_AUTH, 1);
+	curl_easy_setopt(multi->curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+	return TRUE;
+}
+
+/**
+ * Keep the index in the session up to date. @see caldav_session
+ * @param job The finished job
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ */
+static void update_session(batch_job* job, caldav_settings* settings) {
+	caldav_batch_item* item = job->item;
+	caldav_index* index;
+	gchar* uid = NULL;
+	gchar* href;
+
+	if (! settings->session)
+		return;
+	if (job->method == CALDAV_PUT && job->body)
+		uid = get_response_header("uid", job->body, FALSE);
+	if (item->result == OK && job->method == CALDAV_PUT && uid && item->id) {
+		if (item->id->Type == CALDAV_ETAG_TYPE)
+			caldav_session_store(settings->session, settings->url, uid,
+					item->id->Ident.Etag.uri, item->id->Ident.Etag.etag,
+					job->body);
+		else
+			caldav_session_store(settings->session, settings->url, uid,
+					item->id->Ident.Location.location, NULL, job->body);
+	}
+	else if ((index = caldav_session_index(
+					settings->session, settings->url, FALSE)) != NULL) {
+		/* deleted or stale */
+		if (job->url) {
+			href = caldav_index_href(job->url);
+			caldav_index_remove_href(index, href);
+			g_free(href);
+		}
+		caldav_index_remove(index, uid);
+	}
+	g_free(uid);
+}
+
+/**
+ * Store the outcome of a finished request in its batch item.
+ * @param job The finished job
+ * @param res Result of the transfer as reported by libcurl
+ */
+static void finish_job(batch_job* job, CURLcode res) {
+	caldav_batch_item* item = job->item;
+	long code = 0;
+
+	if (res != CURLE_OK) {
+		item->code = -1;
+		item->result = CONFLICT;
+		return;
+	}
+	curl_easy_getinfo(job->multi.curl, CURLINFO_RESPONSE_CODE, &code);
+	item->code = code;
+	if (! parse_response(job->method, code, job->multi.chunk.memory)) {
+		item->result = batch_response(code);
+		return;
+	}
+	item->result = OK;
+	if (job->method == CALDAV_PUT) {
+		CALDAV_ID* id = caldav_get_caldav_id();
+		gchar* etag = get_response_header("ETAG",
+				job->multi.headers.memory, FALSE);
+		gchar* location = NULL;
+
+		if (! etag)
+			location = get_response_header(
+						"Location", job->multi.headers.memory, FALSE);
+		if (location) {
+			id->Type = CALDAV_LOCATION_TYPE;
+			id->Ident.Location.location = location;
+		}
+		else {
+			id->Type = CALDAV_ETAG_TYPE;
+			id->Ident.Etag.uri = g_strdup(job->url);
+			if (etag)
+				id->Ident.Etag.etag = sanitize(etag);
+			else
+				id->Ident.Etag.etag = g_strdup("");
+		}
+		g_free(etag);
+		if (item->id)
+			caldav_free_caldav_id(&item->id);
+		item->id = id;
+	}
+}
+
+static void finish_batch_job(multi_job* multi, CURLcode res,
+		gpointer data) {
+	batch_job* job = (batch_job *) multi;
+
+	finish_job(job, res);
+	/* nothing was sent for a job given up before it was prepared */
+	if (multi->curl)
+		update_session(job, multi->settings);
+}
+
+static void free_job(multi_job* multi, gpointer data) {
+	batch_job* job = (batch_job *) multi;
+
+	if (job->http_header)
+		curl_slist_free_all(job->http_header);
+	g_free(job->url);
+	g_free(job->body);
+	g_free(job->uid);
+	g_free(job->found);
+	g_free(job->found_etag);
+	job->http_header = NULL;
+	job->url = job->body = job->uid = job->found = job->found_etag = NULL;
+}
+
+static const multi_ops batch_ops = {
+	prepare_job,
+	finish_batch_job,
+	free_job
+};
+
+/**
+ * Find the objects of the items given by UID and send the requests.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param jobs The jobs to run
+ * @param count Number of jobs
+ * @param fresh TRUE to search the server even if the session knows the
+ * object
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if the requests could not be run, FALSE otherwise.
+ */
+static gboolean run_jobs(caldav_settings* settings, batch_job* jobs,
+		int count, gboolean fresh, caldav_error* error) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		jobs[i].item->result = OK;
+		jobs[i].item->code = 0;
+	}
+	if (resolve_jobs(settings, jobs, count, fresh, error) ||
+			caldav_multi_run(settings, jobs, sizeof(batch_job), count,
+				&batch_ops, NULL, error)) {
+		for (i = 0; i < count; i++)
+			free_job(&jobs[i].multi, NULL);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * Function for adding, modifying and deleting a number of events.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param items Array of caldav_batch_item. @see caldav_batch_item
+ * @param count Number of items in the array
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if one or more items failed, FALSE otherwise.
+ */
+gboolean caldav_batch(caldav_settings* settings, caldav_batch_item* items,
+		int count, caldav_error* error) {
+	batch_job* jobs;
+	batch_job* stale;
+	int failed = 0;
+	int n = 0;
+	int i;
+
+	if (! items || count <= 0)
+		return FALSE;
+
+	jobs = g_new0(batch_job, count);
+	for (i = 0; i < count; i++) {
+		jobs[i].multi.settings = settings;
+		jobs[i].item = &items[i];
+	}
+	if (run_jobs(settings, jobs, count, FALSE, error)) {
+		g_free(jobs);
+		return TRUE;
+	}
+	/* an ETAG from the session may be stale, search for those once more */
+	stale = g_new0(batch_job, count);
+	for (i = 0; i < count; i++) {
+		if (jobs[i].cached && items[i].code == 412) {
+			stale[n].multi.settings = settings;
+			stale[n].item = &items[i];
+			n++;
+		}
+	}
+	g_free(jobs);
+	if (n > 0 && run_jobs(settings, stale, n, TRUE, error)) {
+		g_free(stale);
+		return TRUE;
+	}
+	g_free(stale);
+
+	for (i = 0; i < count; i++) {
+		if (items[i].result != OK) {
+			if (failed++ == 0)
+				error->code = items[i].code;
+		}
+	}
+	if (failed > 0) {
+		error->str = g_strdup_printf(
+				"%d of %d batch items failed", failed, count);
+		return TRUE;
+	}
+	return FALSE;
+}
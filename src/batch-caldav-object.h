@@ -0,0 +1,50 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __BATCH_CALDAV_OBJECT_H__
+#define __BATCH_CALDAV_OBJECT_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav-utils.h"
+#include "caldav.h"
+
+/**
+ * Function for adding, modifying and deleting a number of events.
+ * The requests are executed concurrently using the libcurl multi interface
+ * with at most settings->max_in_flight requests in transit at any time.
+ * Connections to the server are kept open and reused between requests.
+ * Objects given by UID (MODIFY and DELETE) are looked up before the first
+ * request is sent.
+ * Locking is never used. Every request is conditional (If-None-Match or
+ * If-Match) so lost updates are still detected by the server.
+ * The outcome for each item is stored in the item itself.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param items Array of caldav_batch_item. @see caldav_batch_item
+ * @param count Number of items in the array
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if one or more items failed, FALSE otherwise.
+ */
+gboolean caldav_batch(caldav_settings* settings, caldav_batch_item* items,
+		int count, caldav_error* error);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,233 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+/* this file calls the glib functions the header replaces */
+#define CALDAV_ALLOC_NO_WRAP
+#include "caldav-alloc.h"
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+#ifdef HAVE_MALLOC_H
+#  include <malloc.h>
+#endif
+
+#ifdef HAVE_TLS
+static __thread caldav_alloc_counters counters;
+#else
+static pthread_key_t counters_key;
+static pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+
+static void make_counters_key(void) {
+	pthread_key_create(&counters_key, g_free);
+}
+#endif
+
+/*
+ * Blocks counted as allocated and their sizes. A free is only counted
+ * for these, so memory glib allocated for the library and the library
+ * frees does not make live drop below what was counted. The blocks are
+ * spread over shards by address so threads seldom wait for each other.
+ */
+#define BLOCK_SHARDS 64
+
+typedef struct {
+	pthread_mutex_t lock;
+	GHashTable* blocks;			/* block -> size */
+} block_shard;
+
+static block_shard shards[BLOCK_SHARDS];
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+static void make_shards(void) {
+	int i;
+
+	for (i = 0; i < BLOCK_SHARDS; i++) {
+		pthread_mutex_init(&shards[i].lock, NULL);
+		shards[i].blocks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+}
+
+static block_shard* block_shard_of(gpointer mem) {
+	gsize addr = GPOINTER_TO_SIZE(mem);
+
+	pthread_once(&shards_once, make_shards);
+	/* the low bits are the same for every block because of alignment */
+	return &shards[((addr >> 4) ^ (addr >> 10)) % BLOCK_SHARDS];
+}
+
+static caldav_alloc_counters* thread_counters(void) {
+#ifdef HAVE_TLS
+	return &counters;
+#else
+	caldav_alloc_counters* counters;
+
+	pthread_once(&counters_once, make_counters_key);
+	counters = pthread_getspecific(counters_key);
+	if (! counters) {
+		counters = g_new0(caldav_alloc_counters, 1);
+		pthread_setspecific(counters_key, counters);
+	}
+	return counters;
+#endif
+}
+
+/**
+ * Size of an allocated block.
+ * @param mem The block
+ * @param requested Size asked for
+ * @return size to count
+ */
+static gsize block_size(gpointer mem, gsize requested) {
+#ifdef HAVE_MALLOC_USABLE_SIZE
+	return malloc_usable_size(mem);
+#else
+	return requested;
+#endif
+}
+
+/**
+ * Count an allocated block.
+ * @param mem The block. May be NULL.
+ * @param requested Size asked for
+ */
+static void count_alloc(gpointer mem, gsize requested) {
+	caldav_alloc_counters* counters;
+	block_shard* shard;
+	gsize size;
+
+	if (! mem)
+		return;
+	size = block_size(mem, requested);
+	shard = block_shard_of(mem);
+	pthread_mutex_lock(&shard->lock);
+	g_hash_table_insert(shard->blocks, mem, GSIZE_TO_POINTER(size));
+	pthread_mutex_unlock(&shard->lock);
+	counters = thread_counters();
+	counters->allocs++;
+	counters->bytes += size;
+	counters->live += size;
+	if (counters->live > counters->peak)
+		counters->peak = counters->live;
+}
+
+/**
+ * Count a block about to be freed if it was counted when allocated.
+ * @param mem The block. May be NULL.
+ */
+static void count_free(gpointer mem) {
+	block_shard* shard;
+	gpointer size = NULL;
+
+	if (! mem)
+		return;
+	shard = block_shard_of(mem);
+	pthread_mutex_lock(&shard->lock);
+	if (g_hash_table_lookup_extended(shard->blocks, mem, NULL, &size))
+		g_hash_table_remove(shard->blocks, mem);
+	pthread_mutex_unlock(&shard->lock);
+	thread_counters()->live -= GPOINTER_TO_SIZE(size);
+}
+
+/**
+ * Get the counters of the calling thread.
+ * @return counters owned by the thread
+ */
+caldav_alloc_counters* caldav_alloc_thread(void) {
+	return thread_counters();
+}
+
+/**
+ * Counting g_malloc.
+ * @param size Bytes to allocate
+ * @return memory to free with g_free
+ */
+gpointer caldav_alloc_malloc(gsize size) {
+	gpointer mem = g_malloc(size);
+
+	count_alloc(mem, size);
+	return mem;
+}
+
+/**
+ * Counting g_malloc0.
+ * @param size Bytes to allocate
+ * @return zeroed memory to free with g_free
+ */
+gpointer caldav_alloc_malloc0(gsize size) {
+	gpointer mem = g_malloc0(size);
+
+	count_alloc(mem, size);
+	return mem;
+}
+
+/**
+ * Counting g_realloc.
+ * @param mem Memory to resize. May be NULL.
+ * @param size New size in bytes
+ * @return memory to free with g_free
+ */
+gpointer caldav_alloc_realloc(gpointer mem, gsize size) {
+	count_free(mem);
+	mem = g_realloc(mem, size);
+	count_alloc(mem, size);
+	return mem;
+}
+
+/**
+ * Count a string allocated by glib.
+ * @param str String returned by a glib function. May be NULL.
+ * @return str
+ */
+gchar* caldav_alloc_string(gchar* str) {
+	if (str)
+		count_alloc(str, strlen(str) + 1);
+	return str;
+}
+
+/**
+ * Counting g_string_free. The segment handed to the caller is counted as
+ * allocated here since the growth of a GString is not seen.
+ * @param string GString to free
+ * @param free_segment TRUE to free the character data too
+ * @return the character data if free_segment is FALSE
+ */
+gchar* caldav_alloc_string_free(GString* string, gboolean free_segment) {
+	gsize size;
+	gchar* str;
+
+	if (! string || free_segment)
+		return g_string_free(string, free_segment);
+	size = string->allocated_len;
+	str = g_string_free(string, FALSE);
+	count_alloc(str, size);
+	return str;
+}
+
+/**
+ * Counting g_free.
+ * @param mem Memory to free. May be NULL.
+ */
+void caldav_alloc_free(gpointer mem) {
+	count_free(mem);
+	g_free(mem);
+}
@@ -0,0 +1,143 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_ALLOC_H__
+#define __CALDAV_ALLOC_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+/**
+ * @struct caldav_alloc_counters
+ * Allocations made by the library in one thread. Sizes are the sizes of
+ * the blocks returned by malloc when malloc_usable_size is available and
+ * the requested sizes otherwise. A free is only counted for a block which
+ * was counted when it was allocated.
+ */
+typedef struct {
+	guint64 allocs;
+	gint64 bytes;				/* allocated in total */
+	gint64 live;				/* allocated and not freed */
+	gint64 peak;				/* highest live since reset by caller */
+} caldav_alloc_counters;
+
+/**
+ * Get the counters of the calling thread.
+ * @return counters owned by the thread
+ */
+caldav_alloc_counters* caldav_alloc_thread(void);
+
+/**
+ * Counting g_malloc.
+ * @param size Bytes to allocate
+ * @return memory to free with g_free
+ */
+gpointer caldav_alloc_malloc(gsize size);
+
+/**
+ * Counting g_malloc0.
+ * @param size Bytes to allocate
+ * @return zeroed memory to free with g_free
+ */
+gpointer caldav_alloc_malloc0(gsize size);
+
+/**
+ * Counting g_realloc.
+ * @param mem Memory to resize. May be NULL.
+ * @param size New size in bytes
+ * @return memory to free with g_free
+ */
+gpointer caldav_alloc_realloc(gpointer mem, gsize size);
+
+/**
+ * Count a string allocated by glib.
+ * @param str String returned by a glib function. May be NULL.
+ * @return str
+ */
+gchar* caldav_alloc_string(gchar* str);
+
+/**
+ * Counting g_string_free. The segment handed to the caller is counted as
+ * allocated here since the growth of a GString is not seen.
+ * @param string GString to free
+ * @param free_segment TRUE to free the character data too
+ * @return the character data if free_segment is FALSE
+ */
+gchar* caldav_alloc_string_free(GString* string, gboolean free_segment);
+
+/**
+ * Counting g_free.
+ * @param mem Memory to free. May be NULL.
+ */
+void caldav_alloc_free(gpointer mem);
+
+/*
+ * GDestroyNotify to give containers holding memory allocated by the
+ * library, so the free is counted when profiling.
+ */
+#ifdef CALDAV_ALLOC_PROFILE
+#define CALDAV_FREE_FUNC caldav_alloc_free
+#else
+#define CALDAV_FREE_FUNC g_free
+#endif
+
+/*
+ * With --enable-alloc-profile the allocation functions used by the
+ * library are replaced by the counting ones. Memory kept inside glib
+ * containers (hash tables, arrays, GString before it is handed out and
+ * vectors from g_strsplit) is not counted, neither when it is allocated
+ * nor when the library frees it. A container freeing memory allocated by
+ * the library must be given CALDAV_FREE_FUNC rather than g_free.
+ */
+#if defined(CALDAV_ALLOC_PROFILE) && ! defined(CALDAV_ALLOC_NO_WRAP)
+#undef g_malloc
+#undef g_malloc0
+#undef g_realloc
+#undef g_new
+#undef g_new0
+#undef g_free
+#undef g_strdup
+#undef g_strndup
+#undef g_strdup_printf
+#undef g_strconcat
+#undef g_ascii_strup
+#undef g_ascii_strdown
+#undef g_markup_escape_text
+#undef g_string_free
+#define g_malloc(size) caldav_alloc_malloc(size)
+#define g_malloc0(size) caldav_alloc_malloc0(size)
+#define g_realloc(mem, size) caldav_alloc_realloc(mem, size)
+#define g_new(type, n) ((type *) caldav_alloc_malloc(sizeof(type) * (n)))
+#define g_new0(type, n) ((type *) caldav_alloc_malloc0(sizeof(type) * (n)))
+#define g_free(mem) caldav_alloc_free(mem)
+#define g_strdup(str) caldav_alloc_string(g_strdup(str))
+#define g_strndup(str, n) caldav_alloc_string(g_strndup(str, n))
+#define g_strdup_printf(...) caldav_alloc_string(g_strdup_printf(__VA_ARGS__))
+#define g_strconcat(...) caldav_alloc_string(g_strconcat(__VA_ARGS__))
+#define g_ascii_strup(str, len) caldav_alloc_string(g_ascii_strup(str, len))
+#define g_ascii_strdown(str, len) caldav_alloc_string(g_ascii_strdown(str, len))
+#define g_markup_escape_text(text, len) \
+	caldav_alloc_string(g_markup_escape_text(text, len))
+#define g_string_free(string, free_segment) \
+	caldav_alloc_string_free(string, free_segment)
+#endif
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,244 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-attach.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The position after the line feed ending the line at pos */
+static gsize line_end(const gchar* text, gsize length, gsize pos) {
+	const gchar* lf = memchr(text + pos, '\n', length - pos);
+
+	return (lf) ? (gsize) (lf - text) + 1 : length;
+}
+
+/* Where the content of a line stops, before CR LF, LF or an encoded CR */
+static gsize content_end(const gchar* text, gsize start, gsize end) {
+	if (end > start && text[end - 1] == '\n')
+		end--;
+	if (end > start && text[end - 1] == '\r')
+		end--;
+	else if (end - start >= 5 &&
+			(g_ascii_strncasecmp(text + end - 5, "&#13;", 5) == 0 ||
+			 g_ascii_strncasecmp(text + end - 5, "&#xD;", 5) == 0))
+		end -= 5;
+	return end;
+}
+
+/* Is the line a property called name */
+static gboolean has_name(const gchar* text, gsize start, gsize end,
+		const gchar* name) {
+	gsize n = strlen(name);
+
+	return (end - start > n &&
+			g_ascii_strncasecmp(text + start, name, n) == 0 &&
+			(text[start + n] == ':' || text[start + n] == ';'));
+}
+
+static gboolean is_calendar_end(const gchar* text, gsize start, gsize end) {
+	return (end - start >= 13 &&
+			g_ascii_strncasecmp(text + start, "END:VCALENDAR", 13) == 0);
+}
+
+/* The value of a property on one line */
+static gchar* line_value(const gchar* text, gsize start, gsize end) {
+	const gchar* colon = memchr(text + start, ':', end - start);
+
+	if (! colon)
+		return NULL;
+	start = colon - text + 1;
+	return g_strstrip(g_strndup(text + start,
+				content_end(text, start, end) - start));
+}
+
+/* The UID of the object the text from pos belongs to */
+static gchar* find_uid(const gchar* text, gsize length, gsize pos) {
+	gsize end;
+
+	for (; pos < length; pos = end) {
+		end = line_end(text, length, pos);
+		if (has_name(text, pos, end, "UID"))
+			return line_value(text, pos, end);
+		if (is_calendar_end(text, pos, end))
+			break;
+	}
+	return NULL;
+}
+
+/* Parameters saying the value is inline */
+static gboolean is_inline_parameter(const gchar* parameter) {
+	return (g_ascii_strcasecmp(parameter, "ENCODING=BASE64") == 0 ||
+			g_ascii_strcasecmp(parameter, "VALUE=BINARY") == 0);
+}
+
+/* Parameters not describing a reference */
+static gboolean is_value_parameter(const gchar* parameter) {
+	return (g_ascii_strncasecmp(parameter, "ENCODING=", 9) == 0 ||
+			g_ascii_strncasecmp(parameter, "VALUE=", 6) == 0);
+}
+
+/* The value of a folded property without line breaks */
+static GString* unfold(const gchar* text, gsize start, gsize end) {
+	GString* value = g_string_sized_new(end - start);
+	gsize next;
+	gsize stop;
+
+	while (start < end) {
+		next = line_end(text, end, start);
+		stop = content_end(text, start, next);
+		g_string_append_len(value, text + start, stop - start);
+		/* drop the white space a continuation line starts with */
+		start = next + 1;
+	}
+	return value;
+}
+
+/*
+ * Handle the ATTACH property in text[start, end). first is the end of its
+ * first line.
+ * @return TRUE if the property was replaced at *written, FALSE to keep it.
+ */
+static gboolean filter_attach(caldav_settings* settings, gchar* text,
+		gsize length, gsize start, gsize first, gsize end, gsize* written,
+		gchar** uid) {
+	gchar* parameters;
+	gchar** list;
+	GString* value;
+	GString* line;
+	gchar* uri = NULL;
+	gsize colon;
+	gsize size;
+	gboolean quoted = FALSE;
+	gboolean found = FALSE;
+	gint i;
+
+	/* the parameters end at the first colon which is not quoted */
+	for (colon = start + 6; colon < first; colon++) {
+		if (text[colon] == '"')
+			quoted = ! quoted;
+		else if (text[colon] == ':' && ! quoted)
+			break;
+	}
+	if (colon >= first)
+		return FALSE;
+	parameters = (text[start + 6] == ';') ?
+		g_strndup(text + start + 7, colon - start - 7) : g_strdup("");
+	list = g_strsplit(parameters, ";", 0);
+	for (i = 0; list[i] && ! found; i++)
+		found = is_inline_parameter(list[i]);
+	if (! found) {
+		g_strfreev(list);
+		g_free(parameters);
+		return FALSE;
+	}
+	if (settings->attachment) {
+		value = unfold(text, colon + 1, end);
+		g_base64_decode_inplace(value->str, &size);
+		if (! *uid)
+			*uid = find_uid(text, length, end);
+		uri = settings->attachment(*uid, parameters,
+				(const unsigned char *) value->str, size,
+				settings->attachment_data);
+		g_string_free(value, TRUE);
+	}
+	g_free(parameters);
+	if (uri) {
+		gsize stop = content_end(text, start, first);
+
+		line = g_string_new("ATTACH");
+		for (i = 0; list[i]; i++) {
+			if (! is_value_parameter(list[i]))
+				g_string_append_printf(line, ";%s", list[i]);
+		}
+		g_string_append_printf(line, ":%s", uri);
+		g_string_append_len(line, text + stop, first - stop);
+		free(uri);
+		/* a reference longer than the value leaves the value inline */
+		found = (line->len <= end - *written);
+		if (found) {
+			memcpy(text + *written, line->str, line->len);
+			*written += line->len;
+		}
+		g_string_free(line, TRUE);
+	}
+	g_strfreev(list);
+	return found;
+}
+
+/**
+ * Remove inline attachments (ATTACH with ENCODING=BASE64) from received
+ * text, or hand them to settings->attachment, as asked in the settings.
+ * The text is changed in place, so a multistatus body can be filtered
+ * before it is parsed and the attachments are not copied with it. XML
+ * with the carriage returns encoded as character references is handled
+ * like plain iCalendar.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param text A multistatus body or one or more iCalendar objects. May be
+ * NULL.
+ * @param length Number of bytes in text
+ * @return new length. text is zero terminated at it.
+ */
+gsize caldav_attach_filter(caldav_settings* settings, gchar* text,
+		gsize length) {
+	gchar* uid = NULL;
+	gsize pos = 0;
+	gsize written = 0;
+	gsize end;
+	gsize last;
+
+	if (! text || ! (settings->strip_attachments || settings->attachment))
+		return length;
+	while (pos < length) {
+		end = line_end(text, length, pos);
+		if (has_name(text, pos, end, "ATTACH")) {
+			/* the property goes on over folded lines */
+			for (last = end; last < length &&
+					(text[last] == ' ' || text[last] == '\t');)
+				last = line_end(text, length, last);
+			if (filter_attach(settings, text, length, pos, end, last,
+						&written, &uid)) {
+				pos = last;
+				continue;
+			}
+			end = last;
+		}
+		else if (settings->attachment && has_name(text, pos, end, "UID")) {
+			g_free(uid);
+			uid = line_value(text, pos, end);
+		}
+		else if (is_calendar_end(text, pos, end)) {
+			g_free(uid);
+			uid = NULL;
+		}
+		/* nothing is moved until something was removed */
+		if (written != pos)
+			memmove(text + written, text + pos, end - pos);
+		written += end - pos;
+		pos = end;
+	}
+	g_free(uid);
+	if (written < length)
+		text[written] = '\0';
+	return written;
+}
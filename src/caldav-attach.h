@@ -0,0 +1,47 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_ATTACH_H__
+#define __CALDAV_ATTACH_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav.h"
+#include "caldav-utils.h"
+
+/**
+ * Remove inline attachments (ATTACH with ENCODING=BASE64) from received
+ * text, or hand them to settings->attachment, as asked in the settings.
+ * The text is changed in place, so a multistatus body can be filtered
+ * before it is parsed and the attachments are not copied with it. XML
+ * with the carriage returns encoded as character references is handled
+ * like plain iCalendar.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param text A multistatus body or one or more iCalendar objects. May be
+ * NULL.
+ * @param length Number of bytes in text
+ * @return new length. text is zero terminated at it.
+ */
+gsize caldav_attach_filter(caldav_settings* settings, gchar* text,
+		gsize length);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,385 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-executor.h"
+#include "caldav-utils.h"
+#include "caldav-session.h"
+#include <glib.h>
+#include <pthread.h>
+
+/**
+ * @typedef struct executor_job
+ * A queued sync job
+ */
+typedef struct {
+	caldav_store* store;
+	gchar* URL;
+	caldav_sync_callback callback;
+	gpointer user_data;
+} executor_job;
+
+/**
+ * @typedef struct host_queue
+ * Jobs waiting for one host
+ */
+typedef struct {
+	gchar* host;
+	GQueue* jobs;
+	gint running;
+	gint limit;
+} host_queue;
+
+/**
+ * @struct _caldav_executor
+ * Fixed pool of worker threads serving a queue per host
+ */
+struct _caldav_executor {
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* a job was queued or a slot freed */
+	pthread_cond_t idle;		/* nothing queued or running */
+	GHashTable* hosts;			/* host -> host_queue */
+	GPtrArray* order;			/* host_queue in order of creation */
+	GHashTable* busy;			/* stores being synced */
+	guint next;					/* where the next steal starts */
+	guint queued;
+	guint running;
+	gint limit;					/* default limit per host */
+	gboolean stop;
+	debug_curl options;
+	pthread_t* threads;
+	gint count;
+};
+
+/**
+ * @typedef struct executor_worker
+ * State owned by one worker thread
+ */
+typedef struct {
+	caldav_executor* executor;
+	runtime_info* info;
+	host_queue* home;			/* host served last */
+} executor_worker;
+
+static void free_job(executor_job* job) {
+	g_free(job->URL);
+	g_free(job);
+}
+
+static void free_host(gpointer data) {
+	host_queue* queue = (host_queue *) data;
+
+	g_queue_foreach(queue->jobs, (GFunc) free_job, NULL);
+	g_queue_free(queue->jobs);
+	g_free(queue->host);
+	g_free(queue);
+}
+
+/*
+ * Caller must hold the lock.
+ */
+static host_queue* find_queue(caldav_executor* executor, const gchar* URL) {
+	host_queue* queue;
+	gchar* host = get_url_host(URL);
+
+	queue = g_hash_table_lookup(executor->hosts, host);
+	if (! queue) {
+		queue = g_new0(host_queue, 1);
+		queue->host = host;
+		queue->jobs = g_queue_new();
+		queue->limit = executor->limit;
+		g_hash_table_insert(executor->hosts, queue->host, queue);
+		g_ptr_array_add(executor->order, queue);
+	}
+	else
+		g_free(host);
+	return queue;
+}
+
+/*
+ * The first job of a queue which may run now. A job for a store which is
+ * being synced stays queued behind the jobs after it. Caller must hold
+ * the lock.
+ */
+static GList* can_run(caldav_executor* executor, host_queue* queue) {
+	GList* link;
+
+	if (! queue || queue->running >= queue->limit)
+		return NULL;
+	for (link = queue->jobs->head; link; link = link->next) {
+		executor_job* job = (executor_job *) link->data;
+		if (! g_hash_table_lookup(executor->busy, job->store))
+			return link;
+	}
+	return NULL;
+}
+
+/*
+ * Pick the next job and take it off its queue. A worker stays with the
+ * host it served last, which keeps its connections warm, and steals from
+ * the other hosts when that queue is empty or at its limit. Caller must
+ * hold the lock.
+ */
+static executor_job* next_job(executor_worker* worker) {
+	caldav_executor* executor = worker->executor;
+	host_queue* queue = worker->home;
+	executor_job* job;
+	GList* link;
+	guint i, n;
+
+	if ((link = can_run(executor, queue)) == NULL) {
+		n = executor->order->len;
+		for (i = 0; i < n; i++) {
+			queue = g_ptr_array_index(executor->order,
+					(executor->next + i) % n);
+			if ((link = can_run(executor, queue)) != NULL) {
+				executor->next = (executor->next + i + 1) % n;
+				worker->home = queue;
+				break;
+			}
+		}
+	}
+	if (! link)
+		return NULL;
+	job = (executor_job *) link->data;
+	g_queue_delete_link(queue->jobs, link);
+	return job;
+}
+
+static void run_job(executor_worker* worker, executor_job* job) {
+	runtime_info* info = worker->info;
+	CALDAV_RESPONSE result;
+
+	result = caldav_sync_store(job->store, job->URL, info);
+	if (job->callback)
+		job->callback(job->store, job->URL, result, info->error,
+				job->user_data);
+	g_free(info->error->str);
+	info->error->str = NULL;
+	info->error->code = 0;
+}
+
+static void* worker_main(gpointer data) {
+	executor_worker* worker = (executor_worker *) data;
+	caldav_executor* executor = worker->executor;
+	host_queue* queue;
+	executor_job* job;
+
+	pthread_mutex_lock(&executor->lock);
+	for (;;) {
+		if ((job = next_job(worker)) != NULL) {
+			queue = worker->home;
+			queue->running++;
+			executor->queued--;
+			executor->running++;
+			g_hash_table_insert(executor->busy, job->store, job->store);
+			pthread_mutex_unlock(&executor->lock);
+
+			run_job(worker, job);
+
+			pthread_mutex_lock(&executor->lock);
+			g_hash_table_remove(executor->busy, job->store);
+			free_job(job);
+			queue->running--;
+			executor->running--;
+			if (executor->queued == 0 && executor->running == 0)
+				pthread_cond_broadcast(&executor->idle);
+			/* a slot on this host is free again, and jobs for the store
+			 * may be waiting on any host */
+			if (executor->queued > 0)
+				pthread_cond_broadcast(&executor->work);
+		}
+		else if (executor->stop && executor->queued == 0)
+			break;
+		else
+			pthread_cond_wait(&executor->work, &executor->lock);
+	}
+	pthread_mutex_unlock(&executor->lock);
+
+	caldav_free_runtime_info(&worker->info);
+	g_free(worker);
+	return NULL;
+}
+
+/**
+ * Create an executor and start its worker threads. Every worker owns a
+ * runtime_info with its own session which is reused for all its jobs.
+ * @param threads Number of worker threads
+ * @param max_per_host Max number of jobs running against one host
+ * @param options Options copied into the runtime_info of every worker.
+ * May be NULL. @see debug_curl
+ * @param stats Totals the sessions of the workers add to. May be NULL.
+ * @see caldav_stats
+ * @return a new executor or NULL if no worker thread could be started
+ */
+caldav_executor* executor_new(int threads, int max_per_host,
+		const debug_curl* options, caldav_stats* stats) {
+	caldav_executor* executor;
+	gint i;
+
+	executor = g_new0(caldav_executor, 1);
+	pthread_mutex_init(&executor->lock, NULL);
+	pthread_cond_init(&executor->work, NULL);
+	pthread_cond_init(&executor->idle, NULL);
+	executor->hosts = g_hash_table_new_full(g_str_hash, g_str_equal,
+			NULL, free_host);
+	executor->order = g_ptr_array_new();
+	executor->busy = g_hash_table_new(g_direct_hash, g_direct_equal);
+	executor->limit = (max_per_host > 0) ? max_per_host : 1;
+	if (options)
+		executor->options = *options;
+	else {
+		runtime_info* info = caldav_get_runtime_info();
+		executor->options = *info->options;
+		caldav_free_runtime_info(&info);
+	}
+	executor->options.custom_cacert = NULL;
+	if (options && options->custom_cacert)
+		executor->options.custom_cacert = g_strdup(options->custom_cacert);
+
+	executor->threads = g_new0(pthread_t, (threads > 0) ? threads : 1);
+	for (i = 0; i < ((threads > 0) ? threads : 1); i++) {
+		executor_worker* worker = g_new0(executor_worker, 1);
+
+		worker->executor = executor;
+		worker->info = caldav_get_runtime_info();
+		*worker->info->options = executor->options;
+		worker->info->options->custom_cacert =
+			g_strdup(executor->options.custom_cacert);
+		worker->info->session = caldav_session_new();
+		if (stats)
+			caldav_session_share_stats(worker->info->session, stats);
+		if (pthread_create(&executor->threads[i], NULL, worker_main, worker)) {
+			caldav_free_runtime_info(&worker->info);
+			g_free(worker);
+			break;
+		}
+		executor->count++;
+	}
+	if (executor->count == 0) {
+		executor_destroy(executor);
+		return NULL;
+	}
+	return executor;
+}
+
+/**
+ * Queue a sync job. @see caldav_sync_store
+ * @param executor @see caldav_executor
+ * @param store Store to bring up to date
+ * @param URL Collection the store mirrors
+ * @param callback Called from the worker thread when the job is done.
+ * May be NULL.
+ * @param user_data Passed to callback
+ */
+void executor_submit(caldav_executor* executor, caldav_store* store,
+		const gchar* URL, caldav_sync_callback callback, gpointer user_data) {
+	executor_job* job;
+
+	job = g_new0(executor_job, 1);
+	job->store = store;
+	job->URL = g_strdup(URL);
+	job->callback = callback;
+	job->user_data = user_data;
+
+	pthread_mutex_lock(&executor->lock);
+	g_queue_push_tail(find_queue(executor, URL)->jobs, job);
+	executor->queued++;
+	pthread_cond_signal(&executor->work);
+	pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Change the max number of jobs running against one host.
+ * @param executor @see caldav_executor
+ * @param URL Any URL on the host
+ * @param limit New limit. Values < 1 are taken as 1.
+ */
+void executor_set_limit(caldav_executor* executor, const gchar* URL,
+		gint limit) {
+	pthread_mutex_lock(&executor->lock);
+	find_queue(executor, URL)->limit = (limit > 0) ? limit : 1;
+	pthread_cond_broadcast(&executor->work);
+	pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Number of jobs queued or running.
+ * @param executor @see caldav_executor
+ * @param URL Count only jobs for the host of this URL. NULL counts all.
+ * @return number of jobs
+ */
+guint executor_depth(caldav_executor* executor, const gchar* URL) {
+	guint depth = 0;
+
+	pthread_mutex_lock(&executor->lock);
+	if (URL) {
+		gchar* host = get_url_host(URL);
+		host_queue* queue = g_hash_table_lookup(executor->hosts, host);
+
+		if (queue)
+			depth = g_queue_get_length(queue->jobs) + queue->running;
+		g_free(host);
+	}
+	else
+		depth = executor->queued + executor->running;
+	pthread_mutex_unlock(&executor->lock);
+	return depth;
+}
+
+/**
+ * Wait until every queued job is done.
+ * @param executor @see caldav_executor
+ */
+void executor_wait(caldav_executor* executor) {
+	pthread_mutex_lock(&executor->lock);
+	while (executor->queued > 0 || executor->running > 0)
+		pthread_cond_wait(&executor->idle, &executor->lock);
+	pthread_mutex_unlock(&executor->lock);
+}
+
+/**
+ * Finish the queued jobs, stop the workers and free the executor.
+ * @param executor @see caldav_executor
+ */
+void executor_destroy(caldav_executor* executor) {
+	gint i;
+
+	if (! executor)
+		return;
+	pthread_mutex_lock(&executor->lock);
+	executor->stop = TRUE;
+	pthread_cond_broadcast(&executor->work);
+	pthread_mutex_unlock(&executor->lock);
+	for (i = 0; i < executor->count; i++)
+		pthread_join(executor->threads[i], NULL);
+
+	g_free(executor->threads);
+	g_ptr_array_free(executor->order, TRUE);
+	g_hash_table_destroy(executor->hosts);
+	g_hash_table_destroy(executor->busy);
+	g_free(executor->options.custom_cacert);
+	pthread_cond_destroy(&executor->idle);
+	pthread_cond_destroy(&executor->work);
+	pthread_mutex_destroy(&executor->lock);
+	g_free(executor);
+}
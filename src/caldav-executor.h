@@ -0,0 +1,86 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_EXECUTOR_H__
+#define __CALDAV_EXECUTOR_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav.h"
+#include "caldav-stats.h"
+
+/**
+ * Create an executor and start its worker threads. Every worker owns a
+ * runtime_info with its own session which is reused for all its jobs.
+ * @param threads Number of worker threads
+ * @param max_per_host Max number of jobs running against one host
+ * @param options Options copied into the runtime_info of every worker.
+ * May be NULL. @see debug_curl
+ * @param stats Totals the sessions of the workers add to. May be NULL.
+ * @see caldav_stats
+ * @return a new executor or NULL if no worker thread could be started
+ */
+caldav_executor* executor_new(int threads, int max_per_host,
+		const debug_curl* options, caldav_stats* stats);
+
+/**
+ * Queue a sync job. @see caldav_sync_store
+ * @param executor @see caldav_executor
+ * @param store Store to bring up to date
+ * @param URL Collection the store mirrors
+ * @param callback Called from the worker thread when the job is done.
+ * May be NULL.
+ * @param user_data Passed to callback
+ */
+void executor_submit(caldav_executor* executor, caldav_store* store,
+		const gchar* URL, caldav_sync_callback callback, gpointer user_data);
+
+/**
+ * Change the max number of jobs running against one host.
+ * @param executor @see caldav_executor
+ * @param URL Any URL on the host
+ * @param limit New limit. Values < 1 are taken as 1.
+ */
+void executor_set_limit(caldav_executor* executor, const gchar* URL,
+		gint limit);
+
+/**
+ * Number of jobs queued or running.
+ * @param executor @see caldav_executor
+ * @param URL Count only jobs for the host of this URL. NULL counts all.
+ * @return number of jobs
+ */
+guint executor_depth(caldav_executor* executor, const gchar* URL);
+
+/**
+ * Wait until every queued job is done.
+ * @param executor @see caldav_executor
+ */
+void executor_wait(caldav_executor* executor);
+
+/**
+ * Finish the queued jobs, stop the workers and free the executor.
+ * @param executor @see caldav_executor
+ */
+void executor_destroy(caldav_executor* executor);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,315 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-freebusy.h"
+#include "caldav-store.h"
+#include "caldav-utils.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+static const gchar* busy_types[] = {
+	"BUSY-TENTATIVE",
+	"BUSY",
+	"BUSY-UNAVAILABLE"
+};
+
+/**
+ * @typedef struct sweep_point
+ * Start or end of a busy period
+ */
+typedef struct {
+	time_t time;
+	int delta;		/* +1 for start, -1 for end */
+	guint type;
+} sweep_point;
+
+static gint compare_point(gconstpointer a, gconstpointer b) {
+	const sweep_point* x = (const sweep_point *) a;
+	const sweep_point* y = (const sweep_point *) b;
+
+	if (x->time != y->time)
+		return (x->time > y->time) ? 1 : -1;
+	/* starts first so adjacent periods join */
+	return y->delta - x->delta;
+}
+
+/**
+ * Merge busy periods with a sweep over their start and end points.
+ * Overlapping and adjacent periods of the same type are joined. Where
+ * types overlap the period is split and the highest type is kept.
+ * @param periods GArray of caldav_period in any order
+ * @param start Periods are clipped to start
+ * @param end Periods are clipped to end
+ * @return GArray of caldav_period sorted by start and not overlapping.
+ * Caller must free the array.
+ */
+GArray* busy_merge(GArray* periods, time_t start, time_t end) {
+	GArray* points;
+	GArray* merged;
+	sweep_point point;
+	caldav_period period;
+	int active[BUSY_TYPES];
+	int current = -1;
+	time_t since = 0;
+	guint i;
+	int type;
+
+	points = g_array_sized_new(FALSE, FALSE, sizeof(sweep_point),
+			periods->len * 2);
+	for (i = 0; i < periods->len; i++) {
+		caldav_period* p = &g_array_index(periods, caldav_period, i);
+		time_t from = MAX(p->start, start);
+		time_t to = MIN(p->end, end);
+		if (from >= to || p->type >= BUSY_TYPES)
+			continue;
+		point.type = p->type;
+		point.time = from;
+		point.delta = 1;
+		g_array_append_val(points, point);
+		point.time = to;
+		point.delta = -1;
+		g_array_append_val(points, point);
+	}
+	g_array_sort(points, compare_point);
+
+	merged = g_array_new(FALSE, FALSE, sizeof(caldav_period));
+	memset(active, '\0', sizeof(active));
+	for (i = 0; i < points->len; ) {
+		time_t now = g_array_index(points, sweep_point, i).time;
+		/* apply every point at this time before looking at the state */
+		for (; i < points->len &&
+				g_array_index(points, sweep_point, i).time == now; i++) {
+			sweep_point* p = &g_array_index(points, sweep_point, i);
+			active[p->type] += p->delta;
+		}
+		for (type = BUSY_TYPES - 1; type >= 0 && active[type] == 0; type--);
+		if (type == current)
+			continue;
+		if (current >= 0) {
+			period.start = since;
+			period.end = now;
+			period.type = current;
+			g_array_append_val(merged, period);
+		}
+		current = type;
+		since = now;
+	}
+	g_array_free(points, TRUE);
+	return merged;
+}
+
+static void append_time(GString* buf, time_t time) {
+	gchar* value = utc_to_ical_time(time);
+
+	g_string_append(buf, value);
+	g_free(value);
+}
+
+/**
+ * Build a VFREEBUSY from merged periods.
+ * @param periods GArray of caldav_period. @see busy_merge
+ * @param start DTSTART of the VFREEBUSY
+ * @param end DTEND of the VFREEBUSY
+ * @return VCALENDAR holding a VFREEBUSY. Caller must free the memory.
+ */
+gchar* busy_to_vfreebusy(GArray* periods, time_t start, time_t end) {
+	GString* buf;
+	guint i;
+
+	buf = g_string_sized_new(256 + periods->len * 64);
+	g_string_append(buf,
+			"BEGIN:VCALENDAR\r\n"
+			"PRODID:-//CalDAV Calendar//NONSGML libcaldav//EN\r\n"
+			"VERSION:2.0\r\n"
+			"BEGIN:VFREEBUSY\r\n"
+			"DTSTAMP:");
+	append_time(buf, time(NULL));
+	g_string_append(buf, "\r\nDTSTART:");
+	append_time(buf, start);
+	g_string_append(buf, "\r\nDTEND:");
+	append_time(buf, end);
+	g_string_append(buf, "\r\n");
+	for (i = 0; i < periods->len; i++) {
+		caldav_period* p = &g_array_index(periods, caldav_period, i);
+		g_string_append(buf, "FREEBUSY");
+		if (p->type != CALDAV_BUSY)
+			g_string_append_printf(buf, ";FBTYPE=%s", busy_types[p->type]);
+		g_string_append_c(buf, ':');
+		append_time(buf, p->start);
+		g_string_append_c(buf, '/');
+		append_time(buf, p->end);
+		g_string_append(buf, "\r\n");
+	}
+	g_string_append(buf,
+			"END:VFREEBUSY\r\n"
+			"END:VCALENDAR\r\n");
+	return g_string_free(buf, FALSE);
+}
+
+static void collect_busy(const gchar* key, const ical_instance* instance,
+		gpointer data) {
+	caldav_period period;
+
+	if (instance->flags &
+			(ICAL_INSTANCE_TRANSPARENT | ICAL_INSTANCE_CANCELLED))
+		return;
+	period.start = instance->start;
+	period.end = instance->end;
+	period.type = (instance->flags & ICAL_INSTANCE_TENTATIVE) ?
+		CALDAV_BUSY_TENTATIVE : CALDAV_BUSY;
+	g_array_append_val((GArray *) data, period);
+}
+
+/**
+ * Free/busy time of the events in a store. Transparent and cancelled
+ * instances are left out and tentative instances are BUSY-TENTATIVE.
+ * Recurring events are expanded. @see caldav_store_foreach_instance
+ * @param store @see caldav_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return GArray of caldav_period. @see busy_merge. Caller must free the
+ * array.
+ */
+GArray* caldav_store_busy(caldav_store* store, time_t start, time_t end) {
+	GArray* periods;
+	GArray* merged;
+
+	periods = g_array_new(FALSE, FALSE, sizeof(caldav_period));
+	caldav_store_foreach_instance(store, start, end, collect_busy, periods);
+	merged = busy_merge(periods, start, end);
+	g_array_free(periods, TRUE);
+	return merged;
+}
+
+static void parse_periods(const gchar* line, GArray* periods) {
+	const gchar* value;
+	gchar* params;
+	gchar** list;
+	caldav_period period;
+	gint64 duration;
+	int i;
+
+	value = strchr(line, ':');
+	if (! value)
+		return;
+	params = g_ascii_strup(line, value - line);
+	period.type = CALDAV_BUSY;
+	if (strstr(params, "FBTYPE=FREE"))
+		period.type = BUSY_TYPES;
+	else if (strstr(params, "FBTYPE=BUSY-TENTATIVE"))
+		period.type = CALDAV_BUSY_TENTATIVE;
+	else if (strstr(params, "FBTYPE=BUSY-UNAVAILABLE"))
+		period.type = CALDAV_BUSY_UNAVAILABLE;
+	g_free(params);
+	if (period.type == BUSY_TYPES)
+		return;
+	list = g_strsplit(value + 1, ",", 0);
+	for (i = 0; list[i]; i++) {
+		gchar* slash = strchr(list[i], '/');
+		if (! slash)
+			continue;
+		*slash++ = '\0';
+		/* RFC5545 3.8.2.6: always UTC, a TZID would be invalid */
+		period.start = ical_time_to_utc(g_strstrip(list[i]), NULL);
+		if (*slash == 'P' || *slash == '+')
+			period.end = (ical_duration(g_strstrip(slash), &duration)) ?
+				period.start + (time_t) duration : (time_t) -1;
+		else
+			period.end = ical_time_to_utc(g_strstrip(slash), NULL);
+		if (period.start != (time_t) -1 && period.end > period.start)
+			g_array_append_val(periods, period);
+	}
+	g_strfreev(list);
+}
+
+/**
+ * Add the FREEBUSY periods of every VFREEBUSY in an iCalendar. Periods of
+ * type FREE are left out and unknown types are taken as BUSY.
+ * @param calendar iCalendar holding VFREEBUSY components
+ * @param periods GArray of caldav_period to append to
+ * @return number of periods added
+ */
+guint busy_parse(const gchar* calendar, GArray* periods) {
+	GString* line;
+	const gchar* pos = calendar;
+	const gchar* eol;
+	gsize len;
+	guint before = periods->len;
+
+	if (! calendar)
+		return 0;
+	line = g_string_new("");
+	while (*pos) {
+		eol = strchr(pos, '\n');
+		if (! eol)
+			eol = pos + strlen(pos);
+		len = eol - pos;
+		if (len > 0 && pos[len - 1] == '\r')
+			len--;
+		if (len > 0 && (*pos == ' ' || *pos == '\t'))
+			/* folded */
+			g_string_append_len(line, pos + 1, len - 1);
+		else {
+			if (g_ascii_strncasecmp(line->str, "FREEBUSY", 8) == 0 &&
+					(line->str[8] == ':' || line->str[8] == ';'))
+				parse_periods(line->str, periods);
+			g_string_assign(line, "");
+			g_string_append_len(line, pos, len);
+		}
+		pos = (*eol) ? eol + 1 : eol;
+	}
+	if (g_ascii_strncasecmp(line->str, "FREEBUSY", 8) == 0 &&
+			(line->str[8] == ':' || line->str[8] == ';'))
+		parse_periods(line->str, periods);
+	g_string_free(line, TRUE);
+	return periods->len - before;
+}
+
+/**
+ * Parse and merge the FREEBUSY periods in an iCalendar in one go.
+ * @see busy_parse @see busy_merge
+ * @param calendar iCalendar holding VFREEBUSY components
+ * @return GArray of caldav_period sorted by start and not overlapping.
+ * Caller must free the array.
+ */
+GArray* busy_parse_merged(const gchar* calendar) {
+	GArray* periods;
+	GArray* merged;
+	time_t start = 0;
+	time_t end = 0;
+	guint i;
+
+	periods = g_array_new(FALSE, FALSE, sizeof(caldav_period));
+	busy_parse(calendar, periods);
+	for (i = 0; i < periods->len; i++) {
+		caldav_period* p = &g_array_index(periods, caldav_period, i);
+		if (i == 0 || p->start < start)
+			start = p->start;
+		if (i == 0 || p->end > end)
+			end = p->end;
+	}
+	merged = busy_merge(periods, start, end);
+	g_array_free(periods, TRUE);
+	return merged;
+}
@@ -0,0 +1,85 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_FREEBUSY_H__
+#define __CALDAV_FREEBUSY_H__
+
+#include <glib.h>
+#include <time.h>
+G_BEGIN_DECLS
+
+#include "caldav.h"
+
+/* number of CALDAV_FBTYPE values */
+#define BUSY_TYPES (CALDAV_BUSY_UNAVAILABLE + 1)
+
+/**
+ * Merge busy periods with a sweep over their start and end points.
+ * Overlapping and adjacent periods of the same type are joined. Where
+ * types overlap the period is split and the highest type is kept.
+ * @param periods GArray of caldav_period in any order
+ * @param start Periods are clipped to start
+ * @param end Periods are clipped to end
+ * @return GArray of caldav_period sorted by start and not overlapping.
+ * Caller must free the array.
+ */
+GArray* busy_merge(GArray* periods, time_t start, time_t end);
+
+/**
+ * Build a VFREEBUSY from merged periods.
+ * @param periods GArray of caldav_period. @see busy_merge
+ * @param start DTSTART of the VFREEBUSY
+ * @param end DTEND of the VFREEBUSY
+ * @return VCALENDAR holding a VFREEBUSY. Caller must free the memory.
+ */
+gchar* busy_to_vfreebusy(GArray* periods, time_t start, time_t end);
+
+/**
+ * Free/busy time of the events in a store. Transparent and cancelled
+ * instances are left out and tentative instances are BUSY-TENTATIVE.
+ * Recurring events are expanded. @see caldav_store_foreach_instance
+ * @param store @see caldav_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return GArray of caldav_period. @see busy_merge. Caller must free the
+ * array.
+ */
+GArray* caldav_store_busy(caldav_store* store, time_t start, time_t end);
+
+/**
+ * Add the FREEBUSY periods of every VFREEBUSY in an iCalendar. Periods of
+ * type FREE are left out and unknown types are taken as BUSY.
+ * @param calendar iCalendar holding VFREEBUSY components
+ * @param periods GArray of caldav_period to append to
+ * @return number of periods added
+ */
+guint busy_parse(const gchar* calendar, GArray* periods);
+
+/**
+ * Parse and merge the FREEBUSY periods in an iCalendar in one go.
+ * @see busy_parse @see busy_merge
+ * @param calendar iCalendar holding VFREEBUSY components
+ * @return GArray of caldav_period sorted by start and not overlapping.
+ * Caller must free the array.
+ */
+GArray* busy_parse_merged(const gchar* calendar);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,322 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-index.h"
+#include "caldav-utils.h"
+#include "caldav-recur.h"
+#include <glib.h>
+#include <string.h>
+
+/**
+ * @struct _caldav_index
+ * Both tables share the entries. uids owns them.
+ */
+struct _caldav_index {
+	GHashTable* uids;		/* UID -> index_entry */
+	GHashTable* hrefs;		/* href -> index_entry */
+};
+
+static void free_entry(gpointer data) {
+	index_entry* entry = (index_entry *) data;
+
+	g_free(entry->uid);
+	g_free(entry->href);
+	g_free(entry->etag);
+	g_free(entry);
+}
+
+/**
+ * Create a new empty index.
+ * @return index
+ */
+caldav_index* caldav_index_new(void) {
+	caldav_index* index;
+
+	index = g_new0(caldav_index, 1);
+	index->uids = g_hash_table_new_full(
+			g_str_hash, g_str_equal, NULL, free_entry);
+	index->hrefs = g_hash_table_new(g_str_hash, g_str_equal);
+	return index;
+}
+
+/**
+ * Free memory used by an index.
+ * @param index @see caldav_index
+ */
+void caldav_index_free(caldav_index* index) {
+	if (! index)
+		return;
+	g_hash_table_destroy(index->hrefs);
+	g_hash_table_destroy(index->uids);
+	g_free(index);
+}
+
+/**
+ * Remove every entry.
+ * @param index @see caldav_index
+ */
+void caldav_index_clear(caldav_index* index) {
+	g_hash_table_remove_all(index->hrefs);
+	g_hash_table_remove_all(index->uids);
+}
+
+/**
+ * Number of objects in the index.
+ * @param index @see caldav_index
+ * @return number of entries
+ */
+guint caldav_index_size(caldav_index* index) {
+	return g_hash_table_size(index->uids);
+}
+
+/**
+ * Find an object by UID.
+ * @param index @see caldav_index
+ * @param uid UID
+ * @return entry owned by the index or NULL.
+ */
+index_entry* caldav_index_lookup(caldav_index* index, const gchar* uid) {
+	if (! uid)
+		return NULL;
+	return g_hash_table_lookup(index->uids, uid);
+}
+
+/**
+ * Find an object by href.
+ * @param index @see caldav_index
+ * @param href Path on the server
+ * @return entry owned by the index or NULL.
+ */
+index_entry* caldav_index_lookup_href(caldav_index* index, const gchar* href) {
+	if (! href)
+		return NULL;
+	return g_hash_table_lookup(index->hrefs, href);
+}
+
+static void remove_entry(caldav_index* index, index_entry* entry) {
+	g_hash_table_remove(index->hrefs, entry->href);
+	/* frees entry */
+	g_hash_table_remove(index->uids, entry->uid);
+}
+
+static void entry_times(index_entry* entry, const gchar* object) {
+	gchar* value;
+	gchar* params = NULL;
+	gboolean is_date = FALSE;
+	gint64 duration;
+
+	entry->start = entry->end = (time_t) -1;
+	value = get_ical_property(object, "VEVENT", "DTSTART", &params);
+	if (! value)
+		return;
+	entry->start = ical_zoned_time_to_utc(value, params, &is_date);
+	g_free(value);
+	g_free(params);
+	value = get_ical_property(object, "VEVENT", "DTEND", &params);
+	if (value) {
+		entry->end = ical_zoned_time_to_utc(value, params, NULL);
+		g_free(value);
+		g_free(params);
+	}
+	else if ((value = get_ical_property(object, "VEVENT", "DURATION",
+					NULL)) != NULL) {
+		if (entry->start != (time_t) -1 && ical_duration(value, &duration))
+			entry->end = entry->start + (time_t) duration;
+		g_free(value);
+	}
+	else if (entry->start != (time_t) -1) {
+		/* RFC5545 3.6.1: a DATE lasts a day, a DATE-TIME has no duration */
+		entry->end = entry->start + ((is_date) ? 86400 : 0);
+	}
+}
+
+/**
+ * Add or replace an object.
+ * @param index @see caldav_index
+ * @param uid UID
+ * @param href Path on the server
+ * @param etag ETAG without quotes. May be NULL.
+ * @param object iCalendar holding the object. DTSTART and DTEND are taken
+ * from it. If NULL the times already known are kept.
+ */
+void caldav_index_put(caldav_index* index, const gchar* uid,
+		const gchar* href, const gchar* etag, const gchar* object) {
+	index_entry* entry;
+	index_entry* old;
+	time_t start = (time_t) -1;
+	time_t end = (time_t) -1;
+
+	if (! uid || ! href)
+		return;
+	if ((old = g_hash_table_lookup(index->uids, uid)) != NULL) {
+		start = old->start;
+		end = old->end;
+		remove_entry(index, old);
+	}
+	/* an href holds one object only */
+	if ((old = g_hash_table_lookup(index->hrefs, href)) != NULL)
+		remove_entry(index, old);
+	entry = g_new0(index_entry, 1);
+	entry->uid = g_strdup(uid);
+	entry->href = g_strdup(href);
+	entry->etag = g_strdup((etag) ? etag : "");
+	if (object) {
+		entry_times(entry, object);
+	}
+	else {
+		entry->start = start;
+		entry->end = end;
+	}
+	g_hash_table_replace(index->uids, entry->uid, entry);
+	g_hash_table_replace(index->hrefs, entry->href, entry);
+}
+
+/**
+ * Remove an object by UID.
+ * @param index @see caldav_index
+ * @param uid UID
+ */
+void caldav_index_remove(caldav_index* index, const gchar* uid) {
+	index_entry* entry = caldav_index_lookup(index, uid);
+
+	if (entry)
+		remove_entry(index, entry);
+}
+
+/**
+ * Remove an object by href.
+ * @param index @see caldav_index
+ * @param href Path on the server
+ */
+void caldav_index_remove_href(caldav_index* index, const gchar* href) {
+	index_entry* entry = caldav_index_lookup_href(index, href);
+
+	if (entry)
+		remove_entry(index, entry);
+}
+
+/**
+ * Add the object in one response element holding getetag and calendar-data.
+ * @param index @see caldav_index
+ * @param response Start of the response element
+ * @param length Length of the response element
+ * @param dav Prefix used for the DAV namespace. @see get_ns_prefix
+ * @param cal Prefix used for the CalDAV namespace. @see get_ns_prefix
+ * @return TRUE if an object was added
+ */
+gboolean caldav_index_put_response(caldav_index* index, const gchar* response,
+		gsize length, const gchar* dav, const gchar* cal) {
+	gchar* href = get_element_text(response, length, dav, "href");
+	gchar* etag = get_element_text(response, length, dav, "getetag");
+	gchar* object = get_element_text(response, length, cal, "calendar-data");
+	gchar* uid = get_ical_property(object, "VEVENT", "UID", NULL);
+	gboolean added = FALSE;
+
+	if (href && uid) {
+		gchar* tag = sanitize(etag);
+		gchar* path = caldav_index_href(href);
+		caldav_index_put(index, uid, path, tag, object);
+		g_free(tag);
+		g_free(path);
+		added = TRUE;
+	}
+	g_free(href);
+	g_free(etag);
+	g_free(object);
+	g_free(uid);
+	return added;
+}
+
+static void load_response(const gchar* response, gsize length,
+		const gchar* dav, const gchar* cal, gpointer data) {
+	gpointer* args = (gpointer *) data;
+
+	if (caldav_index_put_response((caldav_index *) args[0], response, length,
+				dav, cal))
+		(*(guint *) args[1])++;
+}
+
+/**
+ * Add every object in a multistatus response holding getetag and
+ * calendar-data, eg. from a calendar-query or calendar-multiget REPORT.
+ * @param index @see caldav_index. May be NULL.
+ * @param multistatus Response from server
+ * @return number of objects added
+ */
+guint caldav_index_load_report(caldav_index* index, gchar* multistatus) {
+	guint count = 0;
+	gpointer args[2];
+
+	if (! index || ! multistatus)
+		return 0;
+	args[0] = index;
+	args[1] = &count;
+	parse_multistatus(multistatus, load_response, args);
+	return count;
+}
+
+typedef struct {
+	void (*func)(index_entry* entry, gpointer data);
+	gpointer data;
+} foreach_data;
+
+static void foreach_entry(gpointer key, gpointer value, gpointer data) {
+	foreach_data* fd = (foreach_data *) data;
+
+	fd->func((index_entry *) value, fd->data);
+}
+
+/**
+ * Call func for every entry.
+ * @param index @see caldav_index
+ * @param func Called with the entry and data
+ * @param data User data
+ */
+void caldav_index_foreach(caldav_index* index,
+		void (*func)(index_entry* entry, gpointer data), gpointer data) {
+	foreach_data fd;
+
+	fd.func = func;
+	fd.data = data;
+	g_hash_table_foreach(index->uids, foreach_entry, &fd);
+}
+
+/**
+ * Turn a URL, with or without protocol and host, into a path.
+ * @param url URL
+ * @return path. Caller must free the memory.
+ */
+gchar* caldav_index_href(const gchar* url) {
+	const gchar* pos;
+
+	if (! url)
+		return NULL;
+	if (*url == '/')
+		return g_strdup(url);
+	if ((pos = strstr(url, "://")) != NULL)
+		url = pos + 3;
+	/* host[:port]/path */
+	if ((pos = strchr(url, '/')) != NULL)
+		return g_strdup(pos);
+	return g_strdup("/");
+}
@@ -0,0 +1,153 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_INDEX_H__
+#define __CALDAV_INDEX_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <time.h>
+#include "caldav.h"
+
+/**
+ * @typedef struct index_entry
+ * What is known about one object in a collection
+ */
+typedef struct {
+	gchar* uid;
+	gchar* href;		/* path on the server */
+	gchar* etag;		/* without quotes */
+	time_t start;		/* UTC, (time_t) -1 if unknown */
+	time_t end;			/* UTC, (time_t) -1 if unknown */
+} index_entry;
+
+/**
+ * @typedef struct _caldav_index caldav_index
+ * UID and href index for one collection
+ */
+typedef struct _caldav_index caldav_index;
+
+/**
+ * Create a new empty index.
+ * @return index
+ */
+caldav_index* caldav_index_new(void);
+
+/**
+ * Free memory used by an index.
+ * @param index @see caldav_index
+ */
+void caldav_index_free(caldav_index* index);
+
+/**
+ * Remove every entry.
+ * @param index @see caldav_index
+ */
+void caldav_index_clear(caldav_index* index);
+
+/**
+ * Number of objects in the index.
+ * @param index @see caldav_index
+ * @return number of entries
+ */
+guint caldav_index_size(caldav_index* index);
+
+/**
+ * Find an object by UID.
+ * @param index @see caldav_index
+ * @param uid UID
+ * @return entry owned by the index or NULL.
+ */
+index_entry* caldav_index_lookup(caldav_index* index, const gchar* uid);
+
+/**
+ * Find an object by href.
+ * @param index @see caldav_index
+ * @param href Path on the server
+ * @return entry owned by the index or NULL.
+ */
+index_entry* caldav_index_lookup_href(caldav_index* index, const gchar* href);
+
+/**
+ * Add or replace an object.
+ * @param index @see caldav_index
+ * @param uid UID
+ * @param href Path on the server
+ * @param etag ETAG without quotes. May be NULL.
+ * @param object iCalendar holding the object. DTSTART and DTEND are taken
+ * from it. If NULL the times already known are kept.
+ */
+void caldav_index_put(caldav_index* index, const gchar* uid,
+		const gchar* href, const gchar* etag, const gchar* object);
+
+/**
+ * Remove an object by UID.
+ * @param index @see caldav_index
+ * @param uid UID
+ */
+void caldav_index_remove(caldav_index* index, const gchar* uid);
+
+/**
+ * Remove an object by href.
+ * @param index @see caldav_index
+ * @param href Path on the server
+ */
+void caldav_index_remove_href(caldav_index* index, const gchar* href);
+
+/**
+ * Add every object in a multistatus response holding getetag and
+ * calendar-data, eg. from a calendar-query or calendar-multiget REPORT.
+ * @param index @see caldav_index. May be NULL.
+ * @param multistatus Response from server
+ * @return number of objects added
+ */
+guint caldav_index_load_report(caldav_index* index, gchar* multistatus);
+
+/**
+ * Add the object in one response element holding getetag and calendar-data.
+ * @param index @see caldav_index
+ * @param response Start of the response element
+ * @param length Length of the response element
+ * @param dav Prefix used for the DAV namespace. @see get_ns_prefix
+ * @param cal Prefix used for the CalDAV namespace. @see get_ns_prefix
+ * @return TRUE if an object was added
+ */
+gboolean caldav_index_put_response(caldav_index* index, const gchar* response,
+		gsize length, const gchar* dav, const gchar* cal);
+
+/**
+ * Call func for every entry.
+ * @param index @see caldav_index
+ * @param func Called with the entry and data
+ * @param data User data
+ */
+void caldav_index_foreach(caldav_index* index,
+		void (*func)(index_entry* entry, gpointer data), gpointer data);
+
+/**
+ * Turn a URL, with or without protocol and host, into a path.
+ * @param url URL
+ * @return path. Caller must free the memory.
+ */
+gchar* caldav_index_href(const gchar* url);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,328 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-limiter.h"
+#include "caldav-utils.h"
+#include "caldav-retry.h"
+#include "caldav-stats.h"
+#include "caldav-upload.h"
+#include <glib.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * @struct _limiter_ticket
+ * Limits and state for one host. Entries live until the process exits
+ * so a ticket is simply the entry of the host.
+ */
+struct _limiter_ticket {
+	gint max_in_flight;
+	gdouble rate;
+	gint burst;
+	gint in_flight;
+	gdouble tokens;				/* token bucket */
+	gint64 refill;				/* last refill, microseconds */
+	gint64 paused_until;		/* set by Retry-After, microseconds */
+};
+
+static pthread_mutex_t limiter_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t limiter_once = PTHREAD_ONCE_INIT;
+static pthread_cond_t limiter_cond;
+static GHashTable* limiter_hosts = NULL;	/* host -> limiter_ticket */
+static limiter_ticket limiter_default = { 0, 0.0, 1, 0, 0.0, 0, 0 };
+
+static void limiter_init(void) {
+	pthread_condattr_t attr;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&limiter_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	limiter_hosts = g_hash_table_new_full(
+			g_str_hash, g_str_equal, CALDAV_FREE_FUNC, CALDAV_FREE_FUNC);
+}
+
+/*
+ * Caller must hold the lock.
+ */
+static limiter_ticket* find_host(const gchar* URL) {
+	limiter_ticket* limit;
+	gchar* host = get_url_host(URL);
+
+	limit = g_hash_table_lookup(limiter_hosts, host);
+	if (! limit) {
+		limit = g_new0(limiter_ticket, 1);
+		limit->max_in_flight = limiter_default.max_in_flight;
+		limit->rate = limiter_default.rate;
+		limit->burst = limiter_default.burst;
+		limit->tokens = limit->burst;
+		limit->refill = get_monotonic_time();
+		g_hash_table_insert(limiter_hosts, host, limit);
+	}
+	else
+		g_free(host);
+	return limit;
+}
+
+static limiter_ticket* curl_host(CURL* curl) {
+	char* url = NULL;
+
+	curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
+	return find_host(url);
+}
+
+/*
+ * Take a slot if the host allows it. Caller must hold the lock.
+ * @return 0 if a slot was taken, -1 if a request must finish first,
+ * otherwise microseconds to wait
+ */
+static gint64 take_slot(limiter_ticket* limit) {
+	gint64 now = get_monotonic_time();
+
+	if (limit->rate > 0) {
+		limit->tokens += (now - limit->refill) * limit->rate / 1e6;
+		if (limit->tokens > limit->burst)
+			limit->tokens = limit->burst;
+	}
+	limit->refill = now;
+	if (limit->paused_until > now)
+		return limit->paused_until - now;
+	if (limit->max_in_flight > 0 && limit->in_flight >= limit->max_in_flight)
+		return -1;
+	if (limit->rate > 0) {
+		if (limit->tokens < 1.0)
+			return (gint64) ((1.0 - limit->tokens) * 1e6 / limit->rate) + 1;
+		limit->tokens -= 1.0;
+	}
+	limit->in_flight++;
+	return 0;
+}
+
+/**
+ * Set the limits for a host.
+ * @param URL Any URL on the host. NULL sets the default for hosts which
+ * have no limits of their own.
+ * @param max_in_flight Max number of requests in transit. 0 is unlimited.
+ * @param rate Requests per second. 0 is unlimited.
+ * @param burst Number of requests which may be sent at once before rate
+ * applies.
+ */
+void caldav_limiter_set(const gchar* URL, gint max_in_flight, gdouble rate,
+		gint burst) {
+	limiter_ticket* limit;
+
+	pthread_once(&limiter_once, limiter_init);
+	pthread_mutex_lock(&limiter_lock);
+	limit = (URL) ? find_host(URL) : &limiter_default;
+	limit->max_in_flight = (max_in_flight > 0) ? max_in_flight : 0;
+	limit->rate = (rate > 0) ? rate : 0.0;
+	limit->burst = (burst > 0) ? burst : 1;
+	if (limit->tokens > limit->burst)
+		limit->tokens = limit->burst;
+	pthread_cond_broadcast(&limiter_cond);
+	pthread_mutex_unlock(&limiter_lock);
+}
+
+/**
+ * Wait until a request may be sent to the host of a prepared handle.
+ * @param curl Handle with the URL set
+ * @param settings The call the request belongs to. Gives the deadline and
+ * cancellation token. May be NULL.
+ * @return ticket to give to caldav_limiter_release or NULL if the call
+ * was cancelled or ran out of time while waiting
+ */
+limiter_ticket* caldav_limiter_acquire(CURL* curl,
+		const caldav_settings* settings) {
+	limiter_ticket* limit;
+	gint64 delay;
+	gint64 left;
+
+	pthread_once(&limiter_once, limiter_init);
+	pthread_mutex_lock(&limiter_lock);
+	limit = curl_host(curl);
+	while ((delay = take_slot(limit)) != 0) {
+		if (caldav_expired(settings)) {
+			limit = NULL;
+			break;
+		}
+		left = caldav_remaining(settings);
+		if (settings && settings->cancel)
+			left = MIN(left, LIMITER_POLL);
+		if (delay < 0 && left == G_MAXINT64)
+			pthread_cond_wait(&limiter_cond, &limiter_lock);
+		else {
+			struct timespec ts;
+			gint64 until;
+
+			if (delay < 0 || delay > left)
+				delay = left;
+			until = get_monotonic_time() + delay;
+			ts.tv_sec = until / G_GINT64_CONSTANT(1000000);
+			ts.tv_nsec = (until % G_GINT64_CONSTANT(1000000)) * 1000;
+			pthread_cond_timedwait(&limiter_cond, &limiter_lock, &ts);
+		}
+	}
+	pthread_mutex_unlock(&limiter_lock);
+	return limit;
+}
+
+/**
+ * Non blocking version of caldav_limiter_acquire.
+ * @param curl Handle with the URL set
+ * @param ticket Where the ticket is returned
+ * @return 0 if a ticket was returned, otherwise microseconds to wait
+ * before trying again
+ */
+gint64 caldav_limiter_try(CURL* curl, limiter_ticket** ticket) {
+	limiter_ticket* limit;
+	gint64 delay;
+
+	pthread_once(&limiter_once, limiter_init);
+	pthread_mutex_lock(&limiter_lock);
+	limit = curl_host(curl);
+	delay = take_slot(limit);
+	pthread_mutex_unlock(&limiter_lock);
+	if (delay == 0)
+		*ticket = limit;
+	/* a request of another thread must finish, poll for it */
+	return (delay < 0) ? 10000 : delay;
+}
+
+/**
+ * Give back a ticket when the request is done. If the server answered
+ * 429 or 503 no more requests are sent to the host until Retry-After has
+ * passed.
+ * @param ticket Ticket from caldav_limiter_acquire or caldav_limiter_try.
+ * May be NULL.
+ * @param curl The handle used for the request
+ */
+void caldav_limiter_release(limiter_ticket* ticket, CURL* curl) {
+	long code = 0;
+	gint64 pause = 0;
+
+	if (! ticket)
+		return;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code == 429 || code == 503) {
+		pause = LIMITER_PAUSE;
+#if LIBCURL_VERSION_NUM >= 0x074200
+		{
+			curl_off_t retry_after = 0;
+
+			if (curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after)
+					== CURLE_OK && retry_after > 0)
+				pause = MIN(retry_after, LIMITER_MAX_PAUSE);
+		}
+#endif
+	}
+	pthread_mutex_lock(&limiter_lock);
+	ticket->in_flight--;
+	if (pause > 0) {
+		gint64 until = get_monotonic_time() + pause * G_GINT64_CONSTANT(1000000);
+
+		if (until > ticket->paused_until)
+			ticket->paused_until = until;
+	}
+	pthread_cond_broadcast(&limiter_cond);
+	pthread_mutex_unlock(&limiter_lock);
+}
+
+/*
+ * curl_easy_perform which notices a cancellation or the deadline within
+ * LIMITER_POLL. The progress callback alone only runs once a second
+ * while waiting for the server.
+ */
+static CURLcode perform_once(CURL* curl, const caldav_settings* settings) {
+	CURLM* multi;
+	CURLMsg* msg;
+	CURLcode res = CURLE_ABORTED_BY_CALLBACK;
+	int running = 1;
+	int msgs_left;
+
+	if (! settings || (! settings->cancel && settings->deadline <= 0))
+		return curl_easy_perform(curl);
+	if ((multi = curl_multi_init()) == NULL)
+		return curl_easy_perform(curl);
+	curl_multi_add_handle(multi, curl);
+	while (running && ! caldav_expired(settings)) {
+		curl_multi_perform(multi, &running);
+		if (running)
+			curl_multi_wait(multi, NULL, 0, LIMITER_POLL / 1000, NULL);
+	}
+	while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL) {
+		if (msg->msg == CURLMSG_DONE)
+			res = msg->data.result;
+	}
+	curl_multi_remove_handle(multi, curl);
+	curl_multi_cleanup(multi);
+	return res;
+}
+
+/**
+ * Replacement for curl_easy_perform which honours the limits of the host
+ * and sends the request again after transient failures.
+ * @see caldav_retry_delay
+ * @param curl Handle to perform
+ * @param idempotent TRUE if sending the request twice is harmless
+ * @param chunk Buffer the body is written to. Emptied before a retry.
+ * @param headers Buffer the headers are written to. Emptied before a retry.
+ * @return result of the last attempt
+ */
+CURLcode caldav_perform(CURL* curl, gboolean idempotent,
+		struct MemoryStruct* chunk, struct MemoryStruct* headers) {
+	caldav_settings* settings = NULL;
+	limiter_ticket* ticket;
+	CURLcode res;
+	gint attempt = 0;
+	gint64 delay;
+	gint64 until;
+	gint64 since = get_monotonic_time();
+
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **) &settings);
+	for (;;) {
+		if ((ticket = caldav_limiter_acquire(curl, settings)) == NULL) {
+			res = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+		res = perform_once(curl, settings);
+		caldav_limiter_release(ticket, curl);
+		caldav_stats_request(settings, curl, res, attempt + 1);
+		if ((delay = caldav_retry_delay(curl, res, idempotent, ++attempt)) < 0)
+			break;
+		if (delay >= caldav_remaining(settings))
+			break;
+		caldav_retry_reset(chunk, headers);
+		/* a body read from a source is sent again from the start */
+		if (settings && settings->upload)
+			caldav_upload_rewind(settings->upload);
+		/* sleep in steps to notice a cancellation */
+		until = get_monotonic_time() + delay;
+		while (! caldav_expired(settings) &&
+				(delay = until - get_monotonic_time()) > 0)
+			g_usleep(MIN(delay, LIMITER_POLL));
+		if (caldav_expired(settings))
+			break;
+	}
+	caldav_stats_network(settings, since);
+	return res;
+}
@@ -0,0 +1,101 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_LIMITER_H__
+#define __CALDAV_LIMITER_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav-utils.h"
+
+/* Pause in seconds after 429 or 503 without a usable Retry-After */
+#define LIMITER_PAUSE 1
+/* Longest pause in seconds accepted from Retry-After */
+#define LIMITER_MAX_PAUSE 600
+/* Microseconds between checks for cancellation while waiting */
+#define LIMITER_POLL 100000
+
+/**
+ * @typedef struct _limiter_ticket limiter_ticket
+ * Permission to have one request in transit to a host
+ */
+typedef struct _limiter_ticket limiter_ticket;
+
+/**
+ * Set the limits for a host.
+ * @param URL Any URL on the host. NULL sets the default for hosts which
+ * have no limits of their own.
+ * @param max_in_flight Max number of requests in transit. 0 is unlimited.
+ * @param rate Requests per second. 0 is unlimited.
+ * @param burst Number of requests which may be sent at once before rate
+ * applies.
+ */
+void caldav_limiter_set(const gchar* URL, gint max_in_flight, gdouble rate,
+		gint burst);
+
+/**
+ * Wait until a request may be sent to the host of a prepared handle.
+ * @param curl Handle with the URL set
+ * @param settings The call the request belongs to. Gives the deadline and
+ * cancellation token. May be NULL.
+ * @return ticket to give to caldav_limiter_release or NULL if the call
+ * was cancelled or ran out of time while waiting
+ */
+limiter_ticket* caldav_limiter_acquire(CURL* curl,
+		const caldav_settings* settings);
+
+/**
+ * Non blocking version of caldav_limiter_acquire.
+ * @param curl Handle with the URL set
+ * @param ticket Where the ticket is returned
+ * @return 0 if a ticket was returned, otherwise microseconds to wait
+ * before trying again
+ */
+gint64 caldav_limiter_try(CURL* curl, limiter_ticket** ticket);
+
+/**
+ * Give back a ticket when the request is done. If the server answered
+ * 429 or 503 no more requests are sent to the host until Retry-After has
+ * passed.
+ * @param ticket Ticket from caldav_limiter_acquire or caldav_limiter_try.
+ * May be NULL.
+ * @param curl The handle used for the request
+ */
+void caldav_limiter_release(limiter_ticket* ticket, CURL* curl);
+
+/**
+ * Replacement for curl_easy_perform which honours the limits of the host
+ * and sends the request again after transient failures. Neither waiting
+ * nor retrying goes beyond the deadline of the call or continues after
+ * it was cancelled. The call is found through CURLINFO_PRIVATE which
+ * get_curl sets. @see caldav_retry_delay
+ * @param curl Handle to perform
+ * @param idempotent TRUE if sending the request twice is harmless
+ * @param chunk Buffer the body is written to. Emptied before a retry.
+ * @param headers Buffer the headers are written to. Emptied before a retry.
+ * @return result of the last attempt
+ */
+CURLcode caldav_perform(CURL* curl, gboolean idempotent,
+		struct MemoryStruct* chunk, struct MemoryStruct* headers);
+
+G_END_DECLS
+
+#endif
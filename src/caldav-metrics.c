@@ -0,0 +1,408 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-metrics.h"
+#include "caldav-utils.h"
+#include <glib.h>
+#include <string.h>
+
+/* first bucket, the sub buckets of every octave and +Inf */
+#define METRICS_BUCKETS (METRICS_OCTAVES * METRICS_SUB_BUCKETS + 2)
+/* lists of series a table is split into */
+#define METRICS_SLOTS 64
+
+typedef struct _metrics_series metrics_series;
+
+/**
+ * @struct _metrics_series
+ * Histogram and counters for one combination of labels. Requests have
+ * a method, calls of public functions have not. Series are never freed,
+ * and once created only updated with atomic operations.
+ */
+struct _metrics_series {
+	metrics_series* next;			/* in the same slot */
+	guint hash;
+	gchar* host;
+	gchar* method;
+	const gchar* operation;
+	volatile gint buckets[METRICS_BUCKETS];
+	volatile gint64 sum;			/* microseconds */
+	volatile gint retries;
+	volatile gint status_4xx;
+	volatile gint status_5xx;
+	volatile gint locked;
+	volatile gint failed;			/* no response */
+	volatile gint64 bytes_up;
+	volatile gint64 bytes_down;
+};
+
+/**
+ * @typedef struct metrics_counter
+ * How to render one counter of metrics_series
+ */
+typedef struct {
+	const gchar* name;
+	const gchar* help;			/* NULL continues the family above */
+	const gchar* label;			/* extra label or NULL */
+	glong offset;				/* counter in metrics_series */
+	gboolean wide;				/* gint64 rather than gint */
+} metrics_counter;
+
+static const metrics_counter metrics_counters[] = {
+	{ "caldav_request_retries_total",
+		"Attempts of HTTP requests after the first.", NULL,
+		G_STRUCT_OFFSET(metrics_series, retries), FALSE },
+	{ "caldav_request_errors_total",
+		"HTTP requests failing with 4xx, 5xx or without response.",
+		"class=\"4xx\"", G_STRUCT_OFFSET(metrics_series, status_4xx), FALSE },
+	{ "caldav_request_errors_total", NULL, "class=\"5xx\"",
+		G_STRUCT_OFFSET(metrics_series, status_5xx), FALSE },
+	{ "caldav_request_errors_total", NULL, "class=\"transfer\"",
+		G_STRUCT_OFFSET(metrics_series, failed), FALSE },
+	{ "caldav_request_locked_total",
+		"HTTP requests answered with 423 Locked.", NULL,
+		G_STRUCT_OFFSET(metrics_series, locked), FALSE },
+	{ "caldav_request_sent_bytes_total",
+		"Bytes sent including headers.", NULL,
+		G_STRUCT_OFFSET(metrics_series, bytes_up), TRUE },
+	{ "caldav_request_received_bytes_total",
+		"Bytes received including headers.", NULL,
+		G_STRUCT_OFFSET(metrics_series, bytes_down), TRUE }
+};
+
+/*
+ * Series are pushed on the list of their slot with compare and exchange
+ * and never removed, so they are found and rendered without a lock.
+ */
+static volatile gpointer metrics_requests[METRICS_SLOTS];
+static volatile gpointer metrics_operations[METRICS_SLOTS];
+
+/* glib only has atomic operations on gint */
+static void add64(volatile gint64* counter, gint64 value) {
+	__sync_fetch_and_add(counter, value);
+}
+
+static gint64 get64(volatile gint64* counter) {
+	return __sync_fetch_and_add(counter, 0);
+}
+
+/*
+ * Index of the bucket for a duration in microseconds. Bucket i > 0 ends
+ * at 2^(METRICS_MIN_SHIFT + o) * (1 + (j + 1) / METRICS_SUB_BUCKETS)
+ * where o = (i - 1) / METRICS_SUB_BUCKETS and j = (i - 1) %
+ * METRICS_SUB_BUCKETS, so the relative error is the same at any scale.
+ */
+static gint bucket_index(gint64 value) {
+	gint64 base = G_GINT64_CONSTANT(1) << METRICS_MIN_SHIFT;
+	gint octave = 0;
+
+	if (value <= base)
+		return 0;
+	while (octave < METRICS_OCTAVES && value > base * 2) {
+		base *= 2;
+		octave++;
+	}
+	if (octave == METRICS_OCTAVES)
+		return METRICS_BUCKETS - 1;
+	return 1 + octave * METRICS_SUB_BUCKETS +
+		(gint) ((value - base - 1) * METRICS_SUB_BUCKETS / base);
+}
+
+static gint64 bucket_bound(gint i) {
+	gint64 base = G_GINT64_CONSTANT(1) << METRICS_MIN_SHIFT;
+
+	if (i == 0)
+		return base;
+	base <<= (i - 1) / METRICS_SUB_BUCKETS;
+	return base + base * ((i - 1) % METRICS_SUB_BUCKETS + 1) /
+		METRICS_SUB_BUCKETS;
+}
+
+static guint hash_labels(const gchar* host, gsize length,
+		const gchar* method, const gchar* operation) {
+	guint hash = 5381;
+	gsize i;
+
+	for (i = 0; i < length; i++)
+		hash = hash * 33 + g_ascii_tolower(host[i]);
+	hash = hash * 33 + '\n';
+	for (; method && *method; method++)
+		hash = hash * 33 + *method;
+	hash = hash * 33 + '\n';
+	for (; *operation; operation++)
+		hash = hash * 33 + *operation;
+	return hash;
+}
+
+static gboolean has_labels(const metrics_series* series, guint hash,
+		const gchar* host, gsize length, const gchar* method,
+		const gchar* operation) {
+	return series->hash == hash && strlen(series->host) == length &&
+		g_ascii_strncasecmp(series->host, host, length) == 0 &&
+		g_strcmp0(series->method, method) == 0 &&
+		strcmp(series->operation, operation) == 0;
+}
+
+/*
+ * Find or create the series for a set of labels. Only the first length
+ * characters of host are used. Does not allocate once the series exists.
+ */
+static metrics_series* find_series(volatile gpointer* table,
+		const gchar* host, gsize length, const gchar* method,
+		const gchar* operation) {
+	guint hash = hash_labels(host, length, method, operation);
+	volatile gpointer* slot = &table[hash % METRICS_SLOTS];
+	metrics_series* created = NULL;
+	metrics_series* series;
+	gpointer head;
+
+	for (;;) {
+		head = g_atomic_pointer_get(slot);
+		for (series = head; series; series = series->next) {
+			if (has_labels(series, hash, host, length, method, operation))
+				break;
+		}
+		if (series)
+			break;
+		if (! created) {
+			created = g_new0(metrics_series, 1);
+			created->hash = hash;
+			created->host = g_ascii_strdown(host, length);
+			created->method = g_strdup(method);
+			created->operation = operation;
+		}
+		created->next = head;
+		if (g_atomic_pointer_compare_and_exchange(slot, head, created))
+			return created;
+	}
+	/* another thread added the same labels first */
+	if (created) {
+		g_free(created->host);
+		g_free(created->method);
+		g_free(created);
+	}
+	return series;
+}
+
+static void observe(metrics_series* series, gint64 value) {
+	g_atomic_int_add(&series->buckets[bucket_index(value)], 1);
+	add64(&series->sum, value);
+}
+
+/**
+ * Count a finished request in the metrics of the process.
+ * @param request Timings of the request. @see caldav_request_stats
+ */
+void caldav_metrics_request(const caldav_request_stats* request) {
+	metrics_series* series;
+	const gchar* host;
+	gsize length;
+
+	host = find_url_host(request->url, &length);
+	series = find_series(metrics_requests, host, length,
+			(request->method) ? request->method : "UNKNOWN",
+			request->operation);
+	observe(series, (gint64) (request->total * 1e6));
+	if (request->attempt > 1)
+		g_atomic_int_add(&series->retries, 1);
+	if (request->status == 423)
+		g_atomic_int_add(&series->locked, 1);
+	if (request->status >= 400 && request->status < 500)
+		g_atomic_int_add(&series->status_4xx, 1);
+	else if (request->status >= 500)
+		g_atomic_int_add(&series->status_5xx, 1);
+	else if (request->status == 0)
+		g_atomic_int_add(&series->failed, 1);
+	add64(&series->bytes_up, request->bytes_up);
+	add64(&series->bytes_down, request->bytes_down);
+}
+
+/**
+ * Count a finished call of a public function.
+ * @param host Host the call was made for. NULL if no request was sent.
+ * @param operation Name of the public function. Must be a static string.
+ * @param elapsed Duration of the call in microseconds
+ */
+void caldav_metrics_operation(const gchar* host, const gchar* operation,
+		gint64 elapsed) {
+	metrics_series* series;
+
+	if (! host)
+		host = "";
+	series = find_series(metrics_operations, host, strlen(host), NULL,
+			operation);
+	observe(series, elapsed);
+}
+
+static gint compare_series(gconstpointer a, gconstpointer b) {
+	const metrics_series* x = *(metrics_series * const *) a;
+	const metrics_series* y = *(metrics_series * const *) b;
+	gint res;
+
+	if ((res = strcmp(x->host, y->host)) != 0)
+		return res;
+	if ((res = g_strcmp0(x->method, y->method)) != 0)
+		return res;
+	return strcmp(x->operation, y->operation);
+}
+
+static GPtrArray* sorted_series(volatile gpointer* table) {
+	GPtrArray* list = g_ptr_array_new();
+	metrics_series* series;
+	guint i;
+
+	for (i = 0; i < METRICS_SLOTS; i++) {
+		series = g_atomic_pointer_get(&table[i]);
+		for (; series; series = series->next)
+			g_ptr_array_add(list, series);
+	}
+	g_ptr_array_sort(list, compare_series);
+	return list;
+}
+
+static void append_escaped(GString* out, const gchar* value) {
+	for (; *value; value++) {
+		switch (*value) {
+			case '\\': g_string_append(out, "\\\\"); break;
+			case '"': g_string_append(out, "\\\""); break;
+			case '\n': g_string_append(out, "\\n"); break;
+			default: g_string_append_c(out, *value); break;
+		}
+	}
+}
+
+/*
+ * Append name{labels and extra label} without the closing brace.
+ */
+static void append_labels(GString* out, const gchar* name,
+		const metrics_series* series) {
+	g_string_append_printf(out, "%s{host=\"", name);
+	append_escaped(out, series->host);
+	if (series->method) {
+		g_string_append(out, "\",method=\"");
+		append_escaped(out, series->method);
+	}
+	g_string_append(out, "\",operation=\"");
+	append_escaped(out, series->operation);
+	g_string_append_c(out, '"');
+}
+
+/* seconds from microseconds without depending on the locale */
+static void append_seconds(GString* out, gint64 value) {
+	g_string_append_printf(out, "%" G_GINT64_FORMAT ".%06d",
+			value / 1000000, (gint) (value % 1000000));
+}
+
+static void append_histogram(GString* out, const gchar* name,
+		const gchar* help, GPtrArray* list) {
+	metrics_series* series;
+	guint64 count;
+	gchar* bucket;
+	gchar* sum;
+	gchar* total;
+	guint i;
+	gint j;
+
+	if (list->len == 0)
+		return;
+	bucket = g_strconcat(name, "_bucket", NULL);
+	sum = g_strconcat(name, "_sum", NULL);
+	total = g_strconcat(name, "_count", NULL);
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s histogram\n",
+			name, help, name);
+	for (i = 0; i < list->len; i++) {
+		series = g_ptr_array_index(list, i);
+		count = 0;
+		for (j = 0; j < METRICS_BUCKETS; j++) {
+			count += (guint) g_atomic_int_get(&series->buckets[j]);
+			append_labels(out, bucket, series);
+			g_string_append(out, ",le=\"");
+			if (j < METRICS_BUCKETS - 1)
+				append_seconds(out, bucket_bound(j));
+			else
+				g_string_append(out, "+Inf");
+			g_string_append_printf(out, "\"} %" G_GUINT64_FORMAT "\n", count);
+		}
+		append_labels(out, sum, series);
+		g_string_append(out, "} ");
+		append_seconds(out, get64(&series->sum));
+		g_string_append_c(out, '\n');
+		append_labels(out, total, series);
+		g_string_append_printf(out, "} %" G_GUINT64_FORMAT "\n", count);
+	}
+	g_free(bucket);
+	g_free(sum);
+	g_free(total);
+}
+
+static void append_counter(GString* out, const metrics_counter* counter,
+		GPtrArray* list) {
+	metrics_series* series;
+	gpointer field;
+	guint64 value;
+	guint i;
+
+	if (list->len == 0)
+		return;
+	if (counter->help)
+		g_string_append_printf(out, "# HELP %s %s\n# TYPE %s counter\n",
+				counter->name, counter->help, counter->name);
+	for (i = 0; i < list->len; i++) {
+		series = g_ptr_array_index(list, i);
+		field = G_STRUCT_MEMBER_P(series, counter->offset);
+		if (counter->wide)
+			value = get64((volatile gint64 *) field);
+		else
+			value = (guint) g_atomic_int_get((volatile gint *) field);
+		append_labels(out, counter->name, series);
+		if (counter->label)
+			g_string_append_printf(out, ",%s", counter->label);
+		g_string_append_printf(out, "} %" G_GUINT64_FORMAT "\n", value);
+	}
+}
+
+/**
+ * Render the metrics in the Prometheus text exposition format.
+ * @return text. Caller must free the memory.
+ */
+gchar* caldav_metrics_render(void) {
+	GString* out = g_string_new("");
+	GPtrArray* requests;
+	GPtrArray* operations;
+	guint i;
+
+	requests = sorted_series(metrics_requests);
+	operations = sorted_series(metrics_operations);
+
+	append_histogram(out, "caldav_request_duration_seconds",
+			"Duration of HTTP requests. Every attempt is counted.",
+			requests);
+	for (i = 0; i < G_N_ELEMENTS(metrics_counters); i++)
+		append_counter(out, &metrics_counters[i], requests);
+	append_histogram(out, "caldav_operation_duration_seconds",
+			"Duration of calls of public functions.", operations);
+
+	g_ptr_array_free(requests, TRUE);
+	g_ptr_array_free(operations, TRUE);
+	return g_string_free(out, FALSE);
+}
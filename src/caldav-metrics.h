@@ -0,0 +1,58 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_METRICS_H__
+#define __CALDAV_METRICS_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav.h"
+
+/* Histogram buckets are linear within each power of two of microseconds */
+#define METRICS_SUB_BUCKETS 4
+/* Upper bound of the first bucket is 2^METRICS_MIN_SHIFT microseconds */
+#define METRICS_MIN_SHIFT 10
+/* Powers of two covered above the first bucket, up to about 67 seconds */
+#define METRICS_OCTAVES 16
+
+/**
+ * Count a finished request in the metrics of the process.
+ * @param request Timings of the request. @see caldav_request_stats
+ */
+void caldav_metrics_request(const caldav_request_stats* request);
+
+/**
+ * Count a finished call of a public function.
+ * @param host Host the call was made for. NULL if no request was sent.
+ * @param operation Name of the public function. Must be a static string.
+ * @param elapsed Duration of the call in microseconds
+ */
+void caldav_metrics_operation(const gchar* host, const gchar* operation,
+		gint64 elapsed);
+
+/**
+ * Render the metrics in the Prometheus text exposition format.
+ * @return text. Caller must free the memory.
+ */
+gchar* caldav_metrics_render(void);
+
+G_END_DECLS
+
+#endif
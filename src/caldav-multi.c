@@ -0,0 +1,219 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-multi.h"
+#include "caldav-retry.h"
+#include "caldav-stats.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JOB(jobs, size, i) ((multi_job *) ((gchar *) (jobs) + (i) * (size)))
+
+static gint compare_not_before(gconstpointer a, gconstpointer b,
+		gpointer data) {
+	const multi_job* x = (const multi_job *) a;
+	const multi_job* y = (const multi_job *) b;
+
+	return (x->not_before > y->not_before) - (x->not_before < y->not_before);
+}
+
+static void free_job(multi_job* job, const multi_ops* ops, gpointer data) {
+	if (ops->free)
+		ops->free(job, data);
+	if (job->curl)
+		curl_easy_cleanup(job->curl);
+	if (job->chunk.memory)
+		free(job->chunk.memory);
+	if (job->headers.memory)
+		free(job->headers.memory);
+	job->curl = NULL;
+	job->chunk.memory = NULL;
+	job->headers.memory = NULL;
+}
+
+/**
+ * Hand the outcome of a job to the caller and free it.
+ */
+static void done_job(multi_job* job, CURLcode res, const multi_ops* ops,
+		gpointer data) {
+	ops->finish(job, res, data);
+	free_job(job, ops, data);
+}
+
+/**
+ * Run a number of requests concurrently using the libcurl multi interface
+ * with at most settings->max_in_flight requests in transit and connections
+ * reused between requests to the same server. Requests are prepared when
+ * they are about to be sent, the per host limits are honoured, failures
+ * are retried with backoff and everything still to be done is given up
+ * once the settings of a job expire.
+ * @param settings caldav_settings giving the max number of requests in
+ * transit and where the network time is accounted. @see caldav_settings
+ * @param jobs Array of jobs, each starting with a multi_job whose settings
+ * is set and the rest zeroed
+ * @param size Size of one job in the array
+ * @param count Number of jobs in the array
+ * @param ops Callbacks. @see multi_ops
+ * @param data User data passed to the callbacks
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if the requests could not be run, FALSE otherwise. The
+ * outcome of every job is given to ops->finish.
+ */
+gboolean caldav_multi_run(caldav_settings* settings, gpointer jobs,
+		gsize size, int count, const multi_ops* ops, gpointer data,
+		caldav_error* error) {
+	CURLM* multi;
+	CURLMsg* msg;
+	multi_job* job;
+	int max_in_flight;
+	int in_flight = 0;
+	int still_running = 0;
+	int msgs_left;
+	int next = 0;
+	int i;
+	GQueue* retry;
+	gint64 delay;
+	gint64 wait;
+	gint64 now;
+	gint64 poll;
+	gint64 since;
+
+	multi = curl_multi_init();
+	if (! multi) {
+		error->code = -1;
+		error->str = g_strdup("Could not initialize libcurl");
+		return TRUE;
+	}
+	max_in_flight = (settings->max_in_flight > 0) ? settings->max_in_flight : 1;
+	/* keep one connection per request in transit for reuse */
+	curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long) max_in_flight);
+#ifdef CURLPIPE_MULTIPLEX
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long) CURLPIPE_MULTIPLEX);
+#endif
+
+	/* look for cancellation more often when it can happen */
+	poll = (settings->cancel || settings->deadline > 0) ? LIMITER_POLL : 1000000;
+	retry = g_queue_new();
+	do {
+		delay = 0;
+		now = get_monotonic_time();
+		/* failed requests waiting for another attempt go first */
+		while (in_flight < max_in_flight && ! g_queue_is_empty(retry)) {
+			job = g_queue_peek_head(retry);
+			if (caldav_expired(job->settings)) {
+				g_queue_pop_head(retry);
+				done_job(job, CURLE_ABORTED_BY_CALLBACK, ops, data);
+				continue;
+			}
+			wait = (job->not_before > now) ? job->not_before - now :
+				caldav_limiter_try(job->curl, &job->ticket);
+			if (wait > 0) {
+				delay = wait;
+				break;
+			}
+			g_queue_pop_head(retry);
+			curl_multi_add_handle(multi, job->curl);
+			in_flight++;
+		}
+		while (in_flight < max_in_flight && next < count) {
+			job = JOB(jobs, size, next);
+			if (caldav_expired(job->settings)) {
+				/* cancelled or out of time, give up the rest */
+				done_job(job, CURLE_ABORTED_BY_CALLBACK, ops, data);
+				next++;
+				continue;
+			}
+			if (! job->prepared) {
+				job->prepared = TRUE;
+				if (! ops->prepare(job, data)) {
+					free_job(job, ops, data);
+					next++;
+					continue;
+				}
+				/* find the job again when the transfer is done */
+				curl_easy_setopt(job->curl, CURLOPT_PRIVATE, (char *) job);
+			}
+			/* the host may ask us to slow down */
+			if ((wait = caldav_limiter_try(job->curl, &job->ticket)) > 0) {
+				if (delay == 0 || wait < delay)
+					delay = wait;
+				break;
+			}
+			curl_multi_add_handle(multi, job->curl);
+			in_flight++;
+			next++;
+		}
+		since = get_monotonic_time();
+		curl_multi_perform(multi, &still_running);
+		caldav_stats_network(settings, since);
+		/* abort what is in transit once the call is cancelled or late */
+		for (i = 0; i < next && in_flight > 0; i++) {
+			job = JOB(jobs, size, i);
+			if (job->ticket && caldav_expired(job->settings)) {
+				curl_multi_remove_handle(multi, job->curl);
+				caldav_limiter_release(job->ticket, job->curl);
+				job->ticket = NULL;
+				done_job(job, CURLE_ABORTED_BY_CALLBACK, ops, data);
+				in_flight--;
+			}
+		}
+		while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			job = NULL;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &job);
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			if (job) {
+				caldav_limiter_release(job->ticket, job->curl);
+				job->ticket = NULL;
+				caldav_stats_request(job->settings, job->curl,
+						msg->data.result, job->attempts + 1);
+				wait = (caldav_expired(job->settings)) ? -1 :
+					caldav_retry_delay(job->curl, msg->data.result,
+						job->idempotent, ++job->attempts);
+				if (wait >= 0 && wait < caldav_remaining(job->settings)) {
+					caldav_retry_reset(&job->chunk, &job->headers);
+					job->not_before = get_monotonic_time() + wait;
+					g_queue_insert_sorted(retry, job, compare_not_before, NULL);
+				}
+				else
+					done_job(job, msg->data.result, ops, data);
+			}
+			in_flight--;
+		}
+		if (delay > poll)
+			delay = poll;
+		since = get_monotonic_time();
+		if (still_running > 0)
+			curl_multi_wait(multi, NULL, 0,
+					(delay > 0) ? delay / 1000 + 1 : poll / 1000, NULL);
+		else if (delay > 0)
+			g_usleep(delay);
+		caldav_stats_network(settings, since);
+	} while (in_flight > 0 || next < count || ! g_queue_is_empty(retry));
+	g_queue_free(retry);
+	curl_multi_cleanup(multi);
+	return FALSE;
+}
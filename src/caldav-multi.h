@@ -0,0 +1,96 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __CALDAV_MULTI_H__
+#define __CALDAV_MULTI_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav-utils.h"
+#include "caldav-limiter.h"
+
+/**
+ * @typedef struct multi_job
+ * The part of a request in transit which caldav_multi_run looks after.
+ * It comes first in the job structure of the caller so the driver can
+ * walk an array of those.
+ */
+typedef struct {
+	CURL* curl;
+	caldav_settings* settings;	/* settings of this request */
+	struct MemoryStruct chunk;
+	struct MemoryStruct headers;
+	limiter_ticket* ticket;
+	gboolean prepared;
+	gboolean idempotent;	/* conditional on a known state */
+	gint attempts;
+	gint64 not_before;		/* earliest time for the next attempt */
+} multi_job;
+
+/**
+ * @typedef struct multi_ops
+ * What caldav_multi_run calls for every job
+ */
+typedef struct {
+	/**
+	 * Create job->curl and set up the request. Body and headers are to be
+	 * written to job->chunk and job->headers.
+	 * @return TRUE if the request is ready to be sent, FALSE if the job is
+	 * done already
+	 */
+	gboolean (*prepare)(multi_job* job, gpointer data);
+	/**
+	 * Store the outcome of the request. job->curl is NULL if the job was
+	 * given up before it was prepared.
+	 */
+	void (*finish)(multi_job* job, CURLcode res, gpointer data);
+	/**
+	 * Free what the caller keeps in the job beyond the multi_job. May be
+	 * NULL.
+	 */
+	void (*free)(multi_job* job, gpointer data);
+} multi_ops;
+
+/**
+ * Run a number of requests concurrently using the libcurl multi interface
+ * with at most settings->max_in_flight requests in transit and connections
+ * reused between requests to the same server. Requests are prepared when
+ * they are about to be sent, the per host limits are honoured, failures
+ * are retried with backoff and everything still to be done is given up
+ * once the settings of a job expire.
+ * @param settings caldav_settings giving the max number of requests in
+ * transit and where the network time is accounted. @see caldav_settings
+ * @param jobs Array of jobs, each starting with a multi_job whose settings
+ * is set and the rest zeroed
+ * @param size Size of one job in the array
+ * @param count Number of jobs in the array
+ * @param ops Callbacks. @see multi_ops
+ * @param data User data passed to the callbacks
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if the requests could not be run, FALSE otherwise. The
+ * outcome of every job is given to ops->finish.
+ */
+gboolean caldav_multi_run(caldav_settings* settings, gpointer jobs,
+		gsize size, int count, const multi_ops* ops, gpointer data,
+		caldav_error* error);
+
+G_END_DECLS
+
+#endif
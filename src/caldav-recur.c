@@ -0,0 +1,977 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-recur.h"
+#include "caldav-utils.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DAY 86400
+/* stop expanding a single object after this many instances */
+#define RECUR_MAX_INSTANCES 100000
+
+enum {
+	FREQ_NONE,
+	FREQ_HOURLY,
+	FREQ_DAILY,
+	FREQ_WEEKLY,
+	FREQ_MONTHLY,
+	FREQ_YEARLY
+};
+
+/**
+ * @typedef struct ical_prop
+ * An unfolded content line
+ */
+typedef struct {
+	gchar* name;
+	gchar* params;
+	gchar* value;
+} ical_prop;
+
+/**
+ * @typedef struct ical_time
+ * A DATE or DATE-TIME value as local (civil) seconds since the epoch
+ */
+typedef struct {
+	gint64 civil;
+	GTimeZone* tz;		/* NULL for UTC */
+	gboolean is_date;
+} ical_time;
+
+/**
+ * @typedef struct rrule
+ * The supported parts of a RRULE
+ */
+typedef struct {
+	int freq;
+	int interval;
+	int count;
+	gboolean has_until;
+	time_t until;
+	int wkst;
+	int n_byday;
+	int byday_wd[64];
+	int byday_ord[64];
+	int n_bymonthday;
+	int bymonthday[64];
+	guint bymonth;		/* bit n set for month n */
+	int n_bysetpos;
+	int bysetpos[64];
+} rrule;
+
+/**
+ * @typedef struct expand_state
+ * Shared state while expanding the events in an object
+ */
+typedef struct {
+	time_t from;
+	time_t to;
+	GArray* instances;
+	GArray* exdates;	/* ical_time */
+	GArray* overridden;	/* time_t, RECURRENCE-ID of overrides */
+	GTimeZone* tz;		/* zone of DTSTART */
+	gint64 duration;
+	gboolean nominal;	/* duration is in local time */
+	guint flags;		/* ICAL_INSTANCE_* of the current event */
+	guint count;
+	time_t until;
+	gboolean more;
+	gboolean earlier;	/* instances before from were left out */
+} expand_state;
+
+static const gchar* weekdays[] = { "MO", "TU", "WE", "TH", "FR", "SA", "SU" };
+
+static gint64 floor_div(gint64 a, gint64 b) {
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+static gint64 days_from_civil(gint64 y, int m, int d) {
+	gint64 era;
+	int yoe, doy, doe;
+
+	y -= (m <= 2);
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (int) (y - era * 400);
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(gint64 z, gint64* y, int* m, int* d) {
+	gint64 era;
+	int doe, yoe, doy, mp;
+
+	z += 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = (int) (z - era * 146097);
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = yoe + era * 400 + (*m <= 2);
+}
+
+/* 0 is monday */
+static int weekday(gint64 day) {
+	return (int) (((day % 7) + 7 + 3) % 7);
+}
+
+static int days_in_month(gint64 y, int m) {
+	static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	if (m == 2 && (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0)))
+		return 29;
+	return days[m - 1];
+}
+
+static void free_prop(gpointer data) {
+	ical_prop* prop = (ical_prop *) data;
+
+	g_free(prop->name);
+	g_free(prop->params);
+	g_free(prop->value);
+	g_free(prop);
+}
+
+static void free_event(gpointer data) {
+	GPtrArray* props = (GPtrArray *) data;
+	guint i;
+
+	for (i = 0; i < props->len; i++)
+		free_prop(g_ptr_array_index(props, i));
+	g_ptr_array_free(props, TRUE);
+}
+
+static ical_prop* split_line(const gchar* line) {
+	const gchar* pos = line;
+	const gchar* params;
+	gboolean quoted = FALSE;
+	ical_prop* prop;
+
+	while (*pos && *pos != ';' && *pos != ':')
+		pos++;
+	prop = g_new0(ical_prop, 1);
+	prop->name = g_ascii_strup(line, pos - line);
+	if (*pos == ';') {
+		params = ++pos;
+		while (*pos && (quoted || *pos != ':')) {
+			if (*pos == '"')
+				quoted = ! quoted;
+			pos++;
+		}
+		prop->params = g_strndup(params, pos - params);
+	}
+	if (*pos != ':') {
+		free_prop(prop);
+		return NULL;
+	}
+	prop->value = g_strdup(pos + 1);
+	return prop;
+}
+
+/**
+ * Unfold the content lines of every VEVENT. Properties of nested
+ * components, eg. VALARM, are left out.
+ * @return GPtrArray of GPtrArray of ical_prop
+ */
+static GPtrArray* parse_events(const gchar* object) {
+	GPtrArray* events = g_ptr_array_new();
+	GPtrArray* lines = g_ptr_array_new();
+	GPtrArray* props = NULL;
+	GString* line = NULL;
+	const gchar* pos = object;
+	const gchar* eol;
+	gsize len;
+	guint i;
+	int nested = 0;
+
+	/* unfold */
+	while (*pos) {
+		eol = strchr(pos, '\n');
+		if (! eol)
+			eol = pos + strlen(pos);
+		len = eol - pos;
+		if (len > 0 && pos[len - 1] == '\r')
+			len--;
+		if (line && len > 0 && (*pos == ' ' || *pos == '\t'))
+			g_string_append_len(line, pos + 1, len - 1);
+		else {
+			if (line)
+				g_ptr_array_add(lines, g_string_free(line, FALSE));
+			line = g_string_new_len(pos, len);
+		}
+		pos = (*eol) ? eol + 1 : eol;
+	}
+	if (line)
+		g_ptr_array_add(lines, g_string_free(line, FALSE));
+
+	for (i = 0; i < lines->len; i++) {
+		gchar* text = g_ptr_array_index(lines, i);
+		if (! props) {
+			if (g_ascii_strcasecmp(text, "BEGIN:VEVENT") == 0) {
+				props = g_ptr_array_new();
+				nested = 0;
+			}
+		}
+		else if (g_ascii_strncasecmp(text, "BEGIN:", 6) == 0)
+			nested++;
+		else if (nested > 0) {
+			if (g_ascii_strncasecmp(text, "END:", 4) == 0)
+				nested--;
+		}
+		else if (g_ascii_strcasecmp(text, "END:VEVENT") == 0) {
+			g_ptr_array_add(events, props);
+			props = NULL;
+		}
+		else if (*text) {
+			ical_prop* prop = split_line(text);
+			if (prop)
+				g_ptr_array_add(props, prop);
+		}
+		g_free(text);
+	}
+	if (props)
+		free_event(props);
+	g_ptr_array_free(lines, TRUE);
+	return events;
+}
+
+static ical_prop* find_prop(GPtrArray* props, const gchar* name) {
+	guint i;
+
+	for (i = 0; i < props->len; i++) {
+		ical_prop* prop = g_ptr_array_index(props, i);
+		if (strcmp(prop->name, name) == 0)
+			return prop;
+	}
+	return NULL;
+}
+
+/**
+ * Find a parameter. Surrounding quotes are removed.
+ * @return value or NULL. Caller must free the memory.
+ */
+static gchar* find_param(const gchar* params, const gchar* name) {
+	const gchar* pos = params;
+	const gchar* start;
+	gsize len = strlen(name);
+	gboolean quoted = FALSE;
+
+	while (pos && *pos) {
+		start = pos;
+		while (*pos && (quoted || *pos != ';')) {
+			if (*pos == '"')
+				quoted = ! quoted;
+			pos++;
+		}
+		if (g_ascii_strncasecmp(start, name, len) == 0 && start[len] == '=') {
+			start += len + 1;
+			if (*start == '"' && pos - start >= 2)
+				return g_strndup(start + 1, pos - start - 2);
+			return g_strndup(start, pos - start);
+		}
+		if (*pos == ';')
+			pos++;
+	}
+	return NULL;
+}
+
+static GTimeZone* get_zone(GHashTable* zones, const gchar* params) {
+	gchar* tzid = find_param(params, "TZID");
+	const gchar* name;
+	const gchar* slash;
+	GTimeZone* tz;
+
+	/* floating times and dates, "" is never a valid TZID */
+	if (! tzid)
+		tzid = g_strdup("");
+	tz = g_hash_table_lookup(zones, tzid);
+	if (tz) {
+		g_free(tzid);
+		return tz;
+	}
+	if (! *tzid) {
+		tz = g_time_zone_new_local();
+		g_hash_table_insert(zones, tzid, tz);
+		return tz;
+	}
+	/* eg. /mozilla.org/20050126_1/Europe/Copenhagen */
+	name = tzid;
+	if (*name == '/' && (slash = strrchr(name, '/')) != name) {
+		for (slash--; slash > name && *slash != '/'; slash--);
+		name = slash + 1;
+	}
+	tz = g_time_zone_new(name);
+	g_hash_table_insert(zones, tzid, tz);
+	return tz;
+}
+
+static gboolean parse_time(const gchar* value, const gchar* params,
+		GHashTable* zones, ical_time* time) {
+	time_t civil;
+	gsize len;
+
+	civil = ical_time_to_utc(value, &time->is_date);
+	if (civil == (time_t) -1)
+		return FALSE;
+	time->civil = civil;
+	len = strlen(value);
+	if (len > 0 && value[len - 1] == 'Z')
+		time->tz = NULL;
+	else
+		time->tz = get_zone(zones, params);
+	return TRUE;
+}
+
+static time_t civil_to_utc(gint64 civil, GTimeZone* tz) {
+	gint64 local = civil;
+	gint interval;
+
+	if (! tz)
+		return (time_t) civil;
+	interval = g_time_zone_adjust_time(tz, G_TIME_TYPE_STANDARD, &local);
+	return (time_t) (local - g_time_zone_get_offset(tz, interval));
+}
+
+static time_t time_to_utc(ical_time* time) {
+	return civil_to_utc(time->civil, time->tz);
+}
+
+/**
+ * Convert an iCalendar DATE or DATE-TIME property to UTC. A TZID is
+ * looked up in the system time zone database; floating times and dates
+ * are taken in the local time zone.
+ * @param value DATE (YYYYMMDD) or DATE-TIME (YYYYMMDDTHHMMSS[Z])
+ * @param params Parameters of the property without leading ';'. May be
+ * NULL.
+ * @param is_date Pointer where TRUE is returned if value is a DATE. May be
+ * NULL.
+ * @return time_t or (time_t) -1 if value is not valid
+ */
+time_t ical_zoned_time_to_utc(const gchar* value, const gchar* params,
+		gboolean* is_date) {
+	GHashTable* zones;
+	ical_time time;
+	time_t utc = (time_t) -1;
+
+	zones = g_hash_table_new_full(g_str_hash, g_str_equal,
+			CALDAV_FREE_FUNC, (GDestroyNotify) g_time_zone_unref);
+	if (parse_time(value, params, zones, &time)) {
+		utc = time_to_utc(&time);
+		if (is_date)
+			*is_date = time.is_date;
+	}
+	g_hash_table_destroy(zones);
+	return utc;
+}
+
+static int parse_weekday(const gchar* text) {
+	int i;
+
+	for (i = 0; i < 7; i++) {
+		if (g_ascii_strncasecmp(text, weekdays[i], 2) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * Parse a RRULE
+ * @return TRUE if the rule can be expanded, FALSE otherwise
+ */
+static gboolean parse_rrule(const gchar* value, ical_time* dtstart,
+		rrule* rule) {
+	gchar** parts;
+	gchar** list;
+	gboolean ok = TRUE;
+	int i, j;
+
+	memset(rule, '\0', sizeof(rrule));
+	rule->interval = 1;
+	parts = g_strsplit(value, ";", 0);
+	for (i = 0; parts[i] && ok; i++) {
+		gchar* val = strchr(parts[i], '=');
+		if (! val)
+			continue;
+		*val++ = '\0';
+		if (g_ascii_strcasecmp(parts[i], "FREQ") == 0) {
+			if (g_ascii_strcasecmp(val, "HOURLY") == 0)
+				rule->freq = FREQ_HOURLY;
+			else if (g_ascii_strcasecmp(val, "DAILY") == 0)
+				rule->freq = FREQ_DAILY;
+			else if (g_ascii_strcasecmp(val, "WEEKLY") == 0)
+				rule->freq = FREQ_WEEKLY;
+			else if (g_ascii_strcasecmp(val, "MONTHLY") == 0)
+				rule->freq = FREQ_MONTHLY;
+			else if (g_ascii_strcasecmp(val, "YEARLY") == 0)
+				rule->freq = FREQ_YEARLY;
+			else
+				ok = FALSE;
+		}
+		else if (g_ascii_strcasecmp(parts[i], "INTERVAL") == 0) {
+			rule->interval = atoi(val);
+			if (rule->interval < 1)
+				rule->interval = 1;
+		}
+		else if (g_ascii_strcasecmp(parts[i], "COUNT") == 0)
+			rule->count = MAX(atoi(val), 1);
+		else if (g_ascii_strcasecmp(parts[i], "UNTIL") == 0) {
+			gboolean is_date;
+			time_t until = ical_time_to_utc(val, &is_date);
+			gsize len = strlen(val);
+			rule->has_until = TRUE;
+			if (is_date)
+				rule->until = civil_to_utc(until + DAY - 1, dtstart->tz);
+			else if (len > 0 && val[len - 1] == 'Z')
+				rule->until = until;
+			else
+				rule->until = civil_to_utc(until, dtstart->tz);
+		}
+		else if (g_ascii_strcasecmp(parts[i], "WKST") == 0)
+			rule->wkst = MAX(parse_weekday(val), 0);
+		else if (g_ascii_strcasecmp(parts[i], "BYDAY") == 0) {
+			list = g_strsplit(val, ",", 0);
+			for (j = 0; list[j] && rule->n_byday < 64; j++) {
+				gchar* end;
+				int ord = (int) g_ascii_strtoll(list[j], &end, 10);
+				int wd = parse_weekday(end);
+				if (wd < 0) {
+					ok = FALSE;
+					break;
+				}
+				rule->byday_wd[rule->n_byday] = wd;
+				rule->byday_ord[rule->n_byday++] = ord;
+			}
+			g_strfreev(list);
+		}
+		else if (g_ascii_strcasecmp(parts[i], "BYMONTHDAY") == 0) {
+			list = g_strsplit(val, ",", 0);
+			for (j = 0; list[j] && rule->n_bymonthday < 64; j++)
+				rule->bymonthday[rule->n_bymonthday++] = atoi(list[j]);
+			g_strfreev(list);
+		}
+		else if (g_ascii_strcasecmp(parts[i], "BYMONTH") == 0) {
+			list = g_strsplit(val, ",", 0);
+			for (j = 0; list[j]; j++) {
+				int m = atoi(list[j]);
+				if (m >= 1 && m <= 12)
+					rule->bymonth |= 1 << m;
+			}
+			g_strfreev(list);
+		}
+		else if (g_ascii_strcasecmp(parts[i], "BYSETPOS") == 0) {
+			list = g_strsplit(val, ",", 0);
+			for (j = 0; list[j] && rule->n_bysetpos < 64; j++)
+				rule->bysetpos[rule->n_bysetpos++] = atoi(list[j]);
+			g_strfreev(list);
+		}
+		else if (g_ascii_strncasecmp(parts[i], "BY", 2) == 0) {
+			/* BYHOUR, BYMINUTE, BYSECOND, BYYEARDAY, BYWEEKNO */
+			ok = FALSE;
+		}
+	}
+	g_strfreev(parts);
+	if (rule->freq == FREQ_NONE)
+		ok = FALSE;
+	if (rule->freq == FREQ_HOURLY && (rule->n_bymonthday || rule->n_bysetpos))
+		ok = FALSE;
+	return ok;
+}
+
+static gboolean byday_match(rrule* rule, int wd, int nth, int nth_last) {
+	int i;
+
+	for (i = 0; i < rule->n_byday; i++) {
+		if (rule->byday_wd[i] == wd && (rule->byday_ord[i] == 0 ||
+				rule->byday_ord[i] == nth || rule->byday_ord[i] == nth_last))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean monthday_match(rrule* rule, int day, int days) {
+	int i;
+
+	for (i = 0; i < rule->n_bymonthday; i++) {
+		if (rule->bymonthday[i] == day ||
+				(rule->bymonthday[i] < 0 && days + rule->bymonthday[i] + 1 == day))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean month_match(rrule* rule, int m) {
+	return ! rule->bymonth || (rule->bymonth & (1 << m));
+}
+
+/**
+ * Days in a month matching the rule.
+ */
+static void month_days(rrule* rule, gint64 y, int m, int mday, GArray* days) {
+	gint64 first = days_from_civil(y, m, 1);
+	int n = days_in_month(y, m);
+	int i;
+
+	for (i = 1; i <= n; i++) {
+		gboolean ok;
+		if (rule->n_bymonthday)
+			ok = monthday_match(rule, i, n);
+		else
+			ok = rule->n_byday || i == mday;
+		if (ok && rule->n_byday)
+			ok = byday_match(rule, weekday(first + i - 1),
+					(i - 1) / 7 + 1, -((n - i) / 7 + 1));
+		if (ok) {
+			gint64 day = first + i - 1;
+			g_array_append_val(days, day);
+		}
+	}
+}
+
+/**
+ * Days in a period matching the rule, in ascending order.
+ */
+static void period_days(rrule* rule, gint64 period, gint64 day0,
+		GArray* days) {
+	gint64 y, d;
+	int m, mday, i;
+
+	civil_from_days(day0, &y, &m, &mday);
+	switch (rule->freq) {
+		case FREQ_DAILY:
+			civil_from_days(period, &y, &m, &i);
+			if (month_match(rule, m) &&
+					(! rule->n_bymonthday ||
+						monthday_match(rule, i, days_in_month(y, m))) &&
+					(! rule->n_byday ||
+						byday_match(rule, weekday(period), 0, 0)))
+				g_array_append_val(days, period);
+			break;
+		case FREQ_WEEKLY:
+			for (d = period; d < period + 7; d++) {
+				civil_from_days(d, &y, &m, &i);
+				if (! month_match(rule, m))
+					continue;
+				if ((rule->n_byday && byday_match(rule, weekday(d), 0, 0)) ||
+						(! rule->n_byday && weekday(d) == weekday(day0)))
+					g_array_append_val(days, d);
+			}
+			break;
+		case FREQ_MONTHLY:
+			y = floor_div(period, 12);
+			m = (int) (period - y * 12) + 1;
+			if (month_match(rule, m))
+				month_days(rule, y, m, mday, days);
+			break;
+		case FREQ_YEARLY:
+			if (rule->bymonth || rule->n_bymonthday) {
+				for (i = 1; i <= 12; i++) {
+					if (rule->bymonth ? month_match(rule, i) : TRUE)
+						month_days(rule, period, i, mday, days);
+				}
+			}
+			else if (rule->n_byday) {
+				/* ordinals count within the year */
+				gint64 first = days_from_civil(period, 1, 1);
+				int n = (int) (days_from_civil(period + 1, 1, 1) - first);
+				for (i = 0; i < n; i++) {
+					if (byday_match(rule, weekday(first + i),
+							i / 7 + 1, -((n - 1 - i) / 7 + 1))) {
+						d = first + i;
+						g_array_append_val(days, d);
+					}
+				}
+			}
+			else if (mday <= days_in_month(period, m)) {
+				d = days_from_civil(period, m, mday);
+				g_array_append_val(days, d);
+			}
+			break;
+	}
+}
+
+static void apply_setpos(rrule* rule, GArray* days) {
+	GArray* keep;
+	guint i;
+	int j, pos;
+
+	if (! rule->n_bysetpos || days->len == 0)
+		return;
+	keep = g_array_new(FALSE, FALSE, sizeof(gint64));
+	for (i = 0; i < days->len; i++) {
+		for (j = 0; j < rule->n_bysetpos; j++) {
+			pos = rule->bysetpos[j];
+			if ((pos > 0 && (guint) pos == i + 1) ||
+					(pos < 0 && (gint64) days->len + pos == (gint64) i)) {
+				g_array_append_val(keep, g_array_index(days, gint64, i));
+				break;
+			}
+		}
+	}
+	g_array_set_size(days, 0);
+	if (keep->len > 0)
+		g_array_append_vals(days, keep->data, keep->len);
+	g_array_free(keep, TRUE);
+}
+
+static gboolean is_excluded(expand_state* state, gint64 civil, time_t start) {
+	guint i;
+
+	for (i = 0; i < state->exdates->len; i++) {
+		ical_time* ex = &g_array_index(state->exdates, ical_time, i);
+		if (ex->is_date) {
+			if (floor_div(ex->civil, DAY) == floor_div(civil, DAY))
+				return TRUE;
+		}
+		else if (time_to_utc(ex) == start)
+			return TRUE;
+	}
+	for (i = 0; i < state->overridden->len; i++) {
+		if (g_array_index(state->overridden, time_t, i) == start)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * Add an instance if it is inside the window.
+ * @return FALSE if the maximum number of instances was reached.
+ */
+static gboolean emit(expand_state* state, gint64 civil, time_t start,
+		time_t end, gboolean check) {
+	ical_instance instance;
+
+	if (start >= state->to) {
+		state->more = TRUE;
+		return TRUE;
+	}
+	if (end <= state->from && start < state->from) {
+		/* excluded or not, there may be more before the window */
+		state->earlier = TRUE;
+		return TRUE;
+	}
+	if (check && is_excluded(state, civil, start))
+		return TRUE;
+	if (state->count >= RECUR_MAX_INSTANCES) {
+		state->more = TRUE;
+		if (start < state->until)
+			state->until = start;
+		return FALSE;
+	}
+	instance.start = start;
+	instance.end = end;
+	instance.flags = state->flags;
+	g_array_append_val(state->instances, instance);
+	state->count++;
+	return TRUE;
+}
+
+static time_t instance_end(expand_state* state, gint64 civil, time_t start) {
+	if (state->nominal)
+		return civil_to_utc(civil + state->duration, state->tz);
+	return start + (time_t) state->duration;
+}
+
+static gint64 period_start(rrule* rule, gint64 period, gint64 dtstart) {
+	gint64 y;
+
+	switch (rule->freq) {
+		case FREQ_HOURLY:
+			return dtstart + period * 3600;
+		case FREQ_MONTHLY:
+			y = floor_div(period, 12);
+			return days_from_civil(y, (int) (period - y * 12) + 1, 1) * DAY;
+		case FREQ_YEARLY:
+			return days_from_civil(period, 1, 1) * DAY;
+		default:
+			return period * DAY;
+	}
+}
+
+/**
+ * Period holding a civil time
+ */
+static gint64 period_of(rrule* rule, gint64 civil, gint64 dtstart) {
+	gint64 day = floor_div(civil, DAY);
+	gint64 y;
+	int m, d;
+
+	switch (rule->freq) {
+		case FREQ_HOURLY:
+			return floor_div(civil - dtstart, 3600);
+		case FREQ_DAILY:
+			return day;
+		case FREQ_WEEKLY:
+			return day - ((weekday(day) - rule->wkst + 7) % 7);
+		case FREQ_MONTHLY:
+			civil_from_days(day, &y, &m, &d);
+			return y * 12 + m - 1;
+		default:
+			civil_from_days(day, &y, &m, &d);
+			return y;
+	}
+}
+
+static void expand_rule(expand_state* state, rrule* rule, gint64 dtstart) {
+	GArray* days;
+	gint64 day0 = floor_div(dtstart, DAY);
+	gint64 tod = dtstart - day0 * DAY;
+	gint64 step = (rule->freq == FREQ_WEEKLY) ? 7 : 1;
+	gint64 period, target, skip;
+	gint64 stop = (gint64) state->to + 2 * DAY;
+	int generated = 1;	/* DTSTART */
+	guint i;
+
+	period = period_of(rule, dtstart, dtstart);
+	if (! rule->count) {
+		/* jump to the periods near the window */
+		target = period_of(rule, (gint64) state->from - MAX(state->duration, 0)
+				- 2 * DAY, dtstart);
+		skip = (target - period) / step;
+		if (skip > rule->interval)
+			period += (skip / rule->interval) * rule->interval * step;
+	}
+	days = g_array_new(FALSE, FALSE, sizeof(gint64));
+	for (; period_start(rule, period, dtstart) <= stop;
+			period += rule->interval * step) {
+		g_array_set_size(days, 0);
+		if (rule->freq == FREQ_HOURLY) {
+			gint64 civil = period_start(rule, period, dtstart);
+			gint64 y;
+			int m, d;
+			civil_from_days(floor_div(civil, DAY), &y, &m, &d);
+			if (month_match(rule, m) && (! rule->n_byday ||
+					byday_match(rule, weekday(floor_div(civil, DAY)), 0, 0)))
+				g_array_append_val(days, civil);
+		}
+		else {
+			period_days(rule, period, day0, days);
+			apply_setpos(rule, days);
+			for (i = 0; i < days->len; i++)
+				g_array_index(days, gint64, i) =
+					g_array_index(days, gint64, i) * DAY + tod;
+		}
+		for (i = 0; i < days->len; i++) {
+			gint64 civil = g_array_index(days, gint64, i);
+			time_t start;
+			if (civil <= dtstart)
+				continue;
+			if (rule->count && generated >= rule->count)
+				goto done;
+			generated++;
+			start = civil_to_utc(civil, state->tz);
+			if (rule->has_until && start > rule->until)
+				goto done;
+			if (start >= state->to) {
+				state->more = TRUE;
+				goto done;
+			}
+			if (! emit(state, civil, start,
+						instance_end(state, civil, start), TRUE))
+				goto done;
+		}
+	}
+	/* stopped by the window */
+	state->more = TRUE;
+done:
+	g_array_free(days, TRUE);
+}
+
+static void expand_rdate(expand_state* state, ical_prop* prop,
+		GHashTable* zones) {
+	gchar** values = g_strsplit(prop->value, ",", 0);
+	ical_time time;
+	gint64 duration;
+	int i;
+
+	for (i = 0; values[i]; i++) {
+		gchar* slash = strchr(values[i], '/');
+		time_t start, end;
+		if (slash)
+			*slash++ = '\0';
+		if (! parse_time(values[i], prop->params, zones, &time))
+			continue;
+		start = time_to_utc(&time);
+		if (slash && *slash == 'P' && ical_duration(slash, &duration))
+			end = start + (time_t) duration;
+		else if (slash && parse_time(slash, prop->params, zones, &time))
+			end = time_to_utc(&time);
+		else
+			end = instance_end(state, time.civil, start);
+		if (! emit(state, time.civil, start, end, TRUE))
+			break;
+	}
+	g_strfreev(values);
+}
+
+static void collect_exdates(expand_state* state, GPtrArray* props,
+		GHashTable* zones) {
+	ical_time time;
+	guint i;
+	int j;
+
+	g_array_set_size(state->exdates, 0);
+	for (i = 0; i < props->len; i++) {
+		ical_prop* prop = g_ptr_array_index(props, i);
+		gchar** values;
+		if (strcmp(prop->name, "EXDATE") != 0)
+			continue;
+		values = g_strsplit(prop->value, ",", 0);
+		for (j = 0; values[j]; j++) {
+			if (parse_time(values[j], prop->params, zones, &time))
+				g_array_append_val(state->exdates, time);
+		}
+		g_strfreev(values);
+	}
+}
+
+static void expand_event(expand_state* state, GPtrArray* props,
+		GHashTable* zones) {
+	ical_prop* prop;
+	ical_time dtstart, dtend;
+	time_t start;
+	rrule rule;
+	guint i;
+
+	prop = find_prop(props, "DTSTART");
+	if (! prop || ! parse_time(prop->value, prop->params, zones, &dtstart))
+		return;
+	start = time_to_utc(&dtstart);
+	state->tz = dtstart.tz;
+	state->nominal = TRUE;
+	if ((prop = find_prop(props, "DTEND")) != NULL &&
+			parse_time(prop->value, prop->params, zones, &dtend)) {
+		if (dtend.tz == dtstart.tz)
+			state->duration = dtend.civil - dtstart.civil;
+		else {
+			state->duration = time_to_utc(&dtend) - start;
+			state->nominal = FALSE;
+		}
+	}
+	else if ((prop = find_prop(props, "DURATION")) != NULL &&
+			ical_duration(prop->value, &state->duration)) {
+		/* duration set */
+	}
+	else
+		state->duration = (dtstart.is_date) ? DAY : 0;
+	if (state->duration < 0)
+		state->duration = 0;
+	state->flags = 0;
+	prop = find_prop(props, "TRANSP");
+	if (prop && g_ascii_strcasecmp(prop->value, "TRANSPARENT") == 0)
+		state->flags |= ICAL_INSTANCE_TRANSPARENT;
+	prop = find_prop(props, "STATUS");
+	if (prop && g_ascii_strcasecmp(prop->value, "CANCELLED") == 0)
+		state->flags |= ICAL_INSTANCE_CANCELLED;
+	else if (prop && g_ascii_strcasecmp(prop->value, "TENTATIVE") == 0)
+		state->flags |= ICAL_INSTANCE_TENTATIVE;
+
+	if (find_prop(props, "RECURRENCE-ID")) {
+		/* an overridden instance stands on its own */
+		emit(state, dtstart.civil, start,
+				instance_end(state, dtstart.civil, start), FALSE);
+		return;
+	}
+	collect_exdates(state, props, zones);
+	if (! emit(state, dtstart.civil, start,
+				instance_end(state, dtstart.civil, start), TRUE))
+		return;
+	prop = find_prop(props, "RRULE");
+	if (prop && parse_rrule(prop->value, &dtstart, &rule))
+		expand_rule(state, &rule, dtstart.civil);
+	for (i = 0; i < props->len; i++) {
+		prop = g_ptr_array_index(props, i);
+		if (strcmp(prop->name, "RDATE") == 0)
+			expand_rdate(state, prop, zones);
+	}
+}
+
+/**
+ * Expand the events in an iCalendar object into instances. RRULE, RDATE,
+ * EXDATE and overridden instances (RECURRENCE-ID) are taken into account.
+ * Times with a TZID are converted using the system time zone database;
+ * floating times and dates are taken in the local time zone. A RRULE using BYHOUR,
+ * BYMINUTE, BYSECOND, BYYEARDAY, BYWEEKNO or a frequency below HOURLY is
+ * not expanded and only DTSTART is used.
+ * @param object iCalendar holding one or more VEVENTs
+ * @param from Only instances ending after from are returned
+ * @param to Only instances starting before to are returned
+ * @param instances GArray of ical_instance to append to. The instances
+ * are not sorted.
+ * @param until Pointer where the time is returned before which every
+ * instance has been expanded. It is to, or earlier when the expansion was
+ * cut short because of the number of instances. May be NULL.
+ * @param earlier Pointer where TRUE is returned if instances ending
+ * before from were left out. May be NULL.
+ * @return TRUE if there are instances starting at or after until which
+ * were not returned, FALSE otherwise.
+ */
+gboolean ical_expand(const gchar* object, time_t from, time_t to,
+		GArray* instances, time_t* until, gboolean* earlier) {
+	GPtrArray* events;
+	GHashTable* zones;
+	expand_state state;
+	ical_time recurrence_id;
+	guint i;
+
+	memset(&state, '\0', sizeof(expand_state));
+	state.from = from;
+	state.to = to;
+	state.until = to;
+	state.instances = instances;
+	state.exdates = g_array_new(FALSE, FALSE, sizeof(ical_time));
+	state.overridden = g_array_new(FALSE, FALSE, sizeof(time_t));
+	zones = g_hash_table_new_full(g_str_hash, g_str_equal,
+			CALDAV_FREE_FUNC, (GDestroyNotify) g_time_zone_unref);
+	events = g_ptr_array_new();
+	if (object) {
+		g_ptr_array_free(events, TRUE);
+		events = parse_events(object);
+	}
+	for (i = 0; i < events->len; i++) {
+		ical_prop* prop = find_prop(g_ptr_array_index(events, i),
+				"RECURRENCE-ID");
+		if (prop && parse_time(prop->value, prop->params, zones,
+					&recurrence_id)) {
+			time_t start = time_to_utc(&recurrence_id);
+			g_array_append_val(state.overridden, start);
+		}
+	}
+	for (i = 0; i < events->len; i++)
+		expand_event(&state, g_ptr_array_index(events, i), zones);
+
+	for (i = 0; i < events->len; i++)
+		free_event(g_ptr_array_index(events, i));
+	g_ptr_array_free(events, TRUE);
+	g_hash_table_destroy(zones);
+	g_array_free(state.exdates, TRUE);
+	g_array_free(state.overridden, TRUE);
+	if (until)
+		*until = state.until;
+	if (earlier)
+		*earlier = state.earlier;
+	return state.more;
+}
@@ -0,0 +1,83 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_RECUR_H__
+#define __CALDAV_RECUR_H__
+
+#include <glib.h>
+#include <time.h>
+G_BEGIN_DECLS
+
+/* TRANSP:TRANSPARENT */
+#define ICAL_INSTANCE_TRANSPARENT	(1 << 0)
+/* STATUS:CANCELLED */
+#define ICAL_INSTANCE_CANCELLED		(1 << 1)
+/* STATUS:TENTATIVE */
+#define ICAL_INSTANCE_TENTATIVE		(1 << 2)
+
+/**
+ * @typedef struct ical_instance
+ * One occurrence of an event in UTC
+ */
+typedef struct {
+	time_t start;
+	time_t end;
+	guint flags;	/* ICAL_INSTANCE_* of the master or override */
+} ical_instance;
+
+/**
+ * Convert an iCalendar DATE or DATE-TIME property to UTC. A TZID is
+ * looked up in the system time zone database; floating times and dates
+ * are taken in the local time zone.
+ * @param value DATE (YYYYMMDD) or DATE-TIME (YYYYMMDDTHHMMSS[Z])
+ * @param params Parameters of the property without leading ';'. May be
+ * NULL.
+ * @param is_date Pointer where TRUE is returned if value is a DATE. May be
+ * NULL.
+ * @return time_t or (time_t) -1 if value is not valid
+ */
+time_t ical_zoned_time_to_utc(const gchar* value, const gchar* params,
+		gboolean* is_date);
+
+/**
+ * Expand the events in an iCalendar object into instances. RRULE, RDATE,
+ * EXDATE and overridden instances (RECURRENCE-ID) are taken into account.
+ * Times with a TZID are converted using the system time zone database;
+ * floating times and dates are taken in the local time zone. A RRULE using BYHOUR,
+ * BYMINUTE, BYSECOND, BYYEARDAY, BYWEEKNO or a frequency below HOURLY is
+ * not expanded and only DTSTART is used.
+ * @param object iCalendar holding one or more VEVENTs
+ * @param from Only instances ending after from are returned
+ * @param to Only instances starting before to are returned
+ * @param instances GArray of ical_instance to append to. The instances
+ * are not sorted.
+ * @param until Pointer where the time is returned before which every
+ * instance has been expanded. It is to, or earlier when the expansion was
+ * cut short because of the number of instances. May be NULL.
+ * @param earlier Pointer where TRUE is returned if instances ending
+ * before from were left out. May be NULL.
+ * @return TRUE if there are instances starting at or after until which
+ * were not returned, FALSE otherwise.
+ */
+gboolean ical_expand(const gchar* object, time_t from, time_t to,
+		GArray* instances, time_t* until, gboolean* earlier);
+
+G_END_DECLS
+
+#endif
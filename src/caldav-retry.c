@@ -0,0 +1,144 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-retry.h"
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+static pthread_mutex_t retry_lock = PTHREAD_MUTEX_INITIALIZER;
+static gint retry_attempts = RETRY_ATTEMPTS;
+static gint retry_base = RETRY_BASE_DELAY;
+static gint retry_max = RETRY_MAX_DELAY;
+
+/**
+ * Set the retry policy for every request.
+ * @param max_attempts Number of attempts including the first. 1 disables
+ * retries.
+ * @param base_delay Delay in milliseconds before the first retry. Doubled
+ * for every following retry.
+ * @param max_delay Upper bound for the delay in milliseconds
+ */
+void caldav_retry_set(gint max_attempts, gint base_delay, gint max_delay) {
+	pthread_mutex_lock(&retry_lock);
+	retry_attempts = (max_attempts > 0) ? max_attempts : 1;
+	retry_base = (base_delay > 0) ? base_delay : 0;
+	retry_max = (max_delay > retry_base) ? max_delay : retry_base;
+	pthread_mutex_unlock(&retry_lock);
+}
+
+/*
+ * The request did not reach the server, sending it again is always safe.
+ */
+static gboolean not_sent(CURLcode res) {
+	switch (res) {
+		case CURLE_COULDNT_CONNECT:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/*
+ * The transfer broke off. The server may or may not have acted on it.
+ */
+static gboolean transient(CURLcode res) {
+	switch (res) {
+		case CURLE_SEND_ERROR:
+		case CURLE_RECV_ERROR:
+		case CURLE_GOT_NOTHING:
+		case CURLE_PARTIAL_FILE:
+		case CURLE_OPERATION_TIMEDOUT:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * Decide whether a finished request should be sent again. Failures where
+ * the request never reached the server and 429 are retried for every
+ * method. Failures where the server may have acted on the request (reset
+ * connection, timeout, 502, 503, 504) are only retried when the request
+ * is idempotent.
+ * @param curl The handle used for the request
+ * @param res Result of the transfer
+ * @param idempotent TRUE if sending the request twice is harmless, ie.
+ * safe methods and PUT or DELETE made conditional with If-Match or
+ * If-None-Match
+ * @param attempt Number of attempts made so far
+ * @return microseconds to wait before the next attempt or -1 if the
+ * request should not be retried. Exponential backoff with jitter.
+ */
+gint64 caldav_retry_delay(CURL* curl, CURLcode res, gboolean idempotent,
+		gint attempt) {
+	gboolean retry;
+	gint64 delay;
+	gint attempts, base, max;
+
+	pthread_mutex_lock(&retry_lock);
+	attempts = retry_attempts;
+	base = retry_base;
+	max = retry_max;
+	pthread_mutex_unlock(&retry_lock);
+
+	if (attempt >= attempts)
+		return -1;
+	if (res == CURLE_OK) {
+		long code = 0;
+
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+		retry = (code == 429) ||
+			(idempotent && (code == 502 || code == 503 || code == 504));
+	}
+	else
+		retry = not_sent(res) || (idempotent && transient(res));
+	if (! retry)
+		return -1;
+
+	/* base * 2^(attempt - 1), the upper half is random */
+	delay = (gint64) base << MIN(attempt - 1, 20);
+	if (delay > max)
+		delay = max;
+	delay = delay / 2 + g_random_int_range(0, (gint32) (delay / 2) + 1);
+	return delay * 1000;
+}
+
+/**
+ * Throw away what was received by a failed attempt.
+ * @param chunk Buffer for the body. May be NULL.
+ * @param headers Buffer for the headers. May be NULL.
+ */
+void caldav_retry_reset(struct MemoryStruct* chunk,
+		struct MemoryStruct* headers) {
+	if (chunk) {
+		free(chunk->memory);
+		chunk->memory = NULL;
+		chunk->size = 0;
+	}
+	if (headers) {
+		free(headers->memory);
+		headers->memory = NULL;
+		headers->size = 0;
+	}
+}
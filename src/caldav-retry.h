@@ -0,0 +1,74 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_RETRY_H__
+#define __CALDAV_RETRY_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav-utils.h"
+
+/* Default number of attempts for a request including the first */
+#define RETRY_ATTEMPTS 3
+/* Default delay before the first retry in milliseconds */
+#define RETRY_BASE_DELAY 250
+/* Default upper bound for the delay in milliseconds */
+#define RETRY_MAX_DELAY 8000
+
+/**
+ * Set the retry policy for every request.
+ * @param max_attempts Number of attempts including the first. 1 disables
+ * retries.
+ * @param base_delay Delay in milliseconds before the first retry. Doubled
+ * for every following retry.
+ * @param max_delay Upper bound for the delay in milliseconds
+ */
+void caldav_retry_set(gint max_attempts, gint base_delay, gint max_delay);
+
+/**
+ * Decide whether a finished request should be sent again. Failures where
+ * the request never reached the server and 429 are retried for every
+ * method. Failures where the server may have acted on the request (reset
+ * connection, timeout, 502, 503, 504) are only retried when the request
+ * is idempotent.
+ * @param curl The handle used for the request
+ * @param res Result of the transfer
+ * @param idempotent TRUE if sending the request twice is harmless, ie.
+ * safe methods and PUT or DELETE made conditional with If-Match or
+ * If-None-Match
+ * @param attempt Number of attempts made so far
+ * @return microseconds to wait before the next attempt or -1 if the
+ * request should not be retried. Exponential backoff with jitter.
+ */
+gint64 caldav_retry_delay(CURL* curl, CURLcode res, gboolean idempotent,
+		gint attempt);
+
+/**
+ * Throw away what was received by a failed attempt.
+ * @param chunk Buffer for the body. May be NULL.
+ * @param headers Buffer for the headers. May be NULL.
+ */
+void caldav_retry_reset(struct MemoryStruct* chunk,
+		struct MemoryStruct* headers);
+
+G_END_DECLS
+
+#endif
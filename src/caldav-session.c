@@ -0,0 +1,153 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-session.h"
+#include <glib.h>
+#include <string.h>
+
+/**
+ * Create a new session.
+ * @return session
+ */
+caldav_session* caldav_session_new(void) {
+	caldav_session* session;
+
+	session = g_new0(caldav_session, 1);
+	session->collections = g_hash_table_new_full(g_str_hash, g_str_equal,
+			CALDAV_FREE_FUNC, (GDestroyNotify) caldav_index_free);
+	session->stats = caldav_stats_new();
+	return session;
+}
+
+/**
+ * Free memory used by a session.
+ * @param session @see caldav_session
+ */
+void caldav_session_destroy(caldav_session* session) {
+	if (! session)
+		return;
+	g_hash_table_destroy(session->collections);
+	caldav_stats_unref(session->stats);
+	g_free(session);
+}
+
+/**
+ * Make a session add to the totals of another one.
+ * @param session @see caldav_session
+ * @param stats Totals to share. @see caldav_stats
+ */
+void caldav_session_share_stats(caldav_session* session, caldav_stats* stats) {
+	caldav_stats* old = session->stats;
+
+	session->stats = caldav_stats_ref(stats);
+	caldav_stats_unref(old);
+}
+
+/**
+ * Get the index for a collection.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param create Create an empty index if none exists
+ * @return index owned by the session or NULL. @see caldav_index
+ */
+caldav_index* caldav_session_index(caldav_session* session,
+		const gchar* collection, gboolean create) {
+	caldav_index* index;
+
+	if (! session || ! collection)
+		return NULL;
+	index = g_hash_table_lookup(session->collections, collection);
+	if (! index && create) {
+		index = caldav_index_new();
+		g_hash_table_replace(session->collections,
+				g_strdup(collection), index);
+	}
+	return index;
+}
+
+/**
+ * Look up where an object is stored.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param uid UID of the object
+ * @param href Pointer where the href is returned. Caller must free the memory.
+ * @param etag Pointer where the ETAG without quotes is returned. Caller must
+ * free the memory.
+ * @return TRUE if the object was found, FALSE otherwise.
+ */
+gboolean caldav_session_lookup(caldav_session* session,
+		const gchar* collection, const gchar* uid, gchar** href, gchar** etag) {
+	caldav_index* index;
+	index_entry* entry;
+
+	index = caldav_session_index(session, collection, FALSE);
+	if (! index || (entry = caldav_index_lookup(index, uid)) == NULL)
+		return FALSE;
+	/* without an ETAG the object must be searched for anyway */
+	if (! entry->etag || ! *entry->etag)
+		return FALSE;
+	*href = g_strdup(entry->href);
+	*etag = g_strdup(entry->etag);
+	return TRUE;
+}
+
+/**
+ * Remember where an object is stored.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param uid UID of the object
+ * @param href href of the object. A full URL is accepted.
+ * @param etag ETAG of the object without quotes
+ * @param object The object as stored or NULL if unknown
+ */
+void caldav_session_store(caldav_session* session, const gchar* collection,
+		const gchar* uid, const gchar* href, const gchar* etag,
+		const gchar* object) {
+	caldav_index* index;
+	gchar* path;
+
+	if (! uid || ! href)
+		return;
+	index = caldav_session_index(session, collection, TRUE);
+	if (! index)
+		return;
+	path = caldav_index_href(href);
+	caldav_index_put(index, uid, path, etag, object);
+	g_free(path);
+}
+
+/**
+ * Forget an object. Used when the object is deleted or when a request
+ * shows that the stored information is stale.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param uid UID of the object
+ */
+void caldav_session_forget(caldav_session* session, const gchar* collection,
+		const gchar* uid) {
+	caldav_index* index;
+
+	index = caldav_session_index(session, collection, FALSE);
+	if (index)
+		caldav_index_remove(index, uid);
+}
@@ -0,0 +1,106 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_SESSION_H__
+#define __CALDAV_SESSION_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav.h"
+#include "caldav-index.h"
+#include "caldav-stats.h"
+
+/**
+ * @struct _caldav_session
+ * State kept between calls sharing a runtime_info
+ */
+struct _caldav_session {
+	GHashTable* collections;	/* collection -> caldav_index */
+	caldav_stats* stats;		/* totals per operation */
+};
+
+/**
+ * Create a new session.
+ * @return session
+ */
+caldav_session* caldav_session_new(void);
+
+/**
+ * Free memory used by a session.
+ * @param session @see caldav_session
+ */
+void caldav_session_destroy(caldav_session* session);
+
+/**
+ * Make a session add to the totals of another one.
+ * @param session @see caldav_session
+ * @param stats Totals to share. @see caldav_stats
+ */
+void caldav_session_share_stats(caldav_session* session, caldav_stats* stats);
+
+/**
+ * Get the index for a collection.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param create Create an empty index if none exists
+ * @return index owned by the session or NULL. @see caldav_index
+ */
+caldav_index* caldav_session_index(caldav_session* session,
+		const gchar* collection, gboolean create);
+
+/**
+ * Look up where an object is stored.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param uid UID of the object
+ * @param href Pointer where the href is returned. Caller must free the memory.
+ * @param etag Pointer where the ETAG without quotes is returned. Caller must
+ * free the memory.
+ * @return TRUE if the object was found, FALSE otherwise.
+ */
+gboolean caldav_session_lookup(caldav_session* session,
+		const gchar* collection, const gchar* uid, gchar** href, gchar** etag);
+
+/**
+ * Remember where an object is stored.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param uid UID of the object
+ * @param href href of the object. A full URL is accepted.
+ * @param etag ETAG of the object without quotes
+ * @param object The object as stored or NULL if unknown
+ */
+void caldav_session_store(caldav_session* session, const gchar* collection,
+		const gchar* uid, const gchar* href, const gchar* etag,
+		const gchar* object);
+
+/**
+ * Forget an object. Used when the object is deleted or when a request
+ * shows that the stored information is stale.
+ * @param session @see caldav_session. May be NULL.
+ * @param collection URL for the collection without protocol
+ * @param uid UID of the object
+ */
+void caldav_session_forget(caldav_session* session, const gchar* collection,
+		const gchar* uid);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,297 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-stats.h"
+#include "caldav-session.h"
+#include "caldav-metrics.h"
+#include <glib.h>
+#include <pthread.h>
+#include <string.h>
+
+/**
+ * @struct _caldav_stats
+ * Totals per operation. Workers of an executor add to the totals of the
+ * session it was created with, so every access takes the lock.
+ */
+struct _caldav_stats {
+	pthread_mutex_t lock;
+	gint refs;
+	GHashTable* ops;			/* operation -> caldav_op_stats */
+	caldav_stats_callback func;
+	gpointer data;
+};
+
+/**
+ * Create empty totals.
+ * @return totals with one reference
+ */
+caldav_stats* caldav_stats_new(void) {
+	caldav_stats* stats;
+
+	stats = g_new0(caldav_stats, 1);
+	pthread_mutex_init(&stats->lock, NULL);
+	stats->refs = 1;
+	/* operation names are static strings */
+	stats->ops = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			CALDAV_FREE_FUNC);
+	return stats;
+}
+
+/**
+ * Take a reference.
+ * @param stats @see caldav_stats
+ * @return stats
+ */
+caldav_stats* caldav_stats_ref(caldav_stats* stats) {
+	pthread_mutex_lock(&stats->lock);
+	stats->refs++;
+	pthread_mutex_unlock(&stats->lock);
+	return stats;
+}
+
+/**
+ * Drop a reference. The totals are freed with the last one.
+ * @param stats @see caldav_stats. May be NULL.
+ */
+void caldav_stats_unref(caldav_stats* stats) {
+	gint refs;
+
+	if (! stats)
+		return;
+	pthread_mutex_lock(&stats->lock);
+	refs = --stats->refs;
+	pthread_mutex_unlock(&stats->lock);
+	if (refs > 0)
+		return;
+	g_hash_table_destroy(stats->ops);
+	pthread_mutex_destroy(&stats->lock);
+	g_free(stats);
+}
+
+/**
+ * Set the function called after every request.
+ * @param stats @see caldav_stats
+ * @param func Function to call or NULL
+ * @param data Passed to func
+ */
+void caldav_stats_set_callback(caldav_stats* stats,
+		caldav_stats_callback func, gpointer data) {
+	pthread_mutex_lock(&stats->lock);
+	stats->func = func;
+	stats->data = data;
+	pthread_mutex_unlock(&stats->lock);
+}
+
+/**
+ * Copy the totals.
+ * @param stats @see caldav_stats
+ * @param count Where the number of operations is returned
+ * @return array to free with g_free or NULL if empty
+ */
+caldav_op_stats* caldav_stats_snapshot(caldav_stats* stats, gint* count) {
+	caldav_op_stats* snapshot = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	gint n = 0;
+
+	pthread_mutex_lock(&stats->lock);
+	if (g_hash_table_size(stats->ops) > 0) {
+		snapshot = g_new(caldav_op_stats, g_hash_table_size(stats->ops));
+		g_hash_table_iter_init(&iter, stats->ops);
+		while (g_hash_table_iter_next(&iter, NULL, &value))
+			snapshot[n++] = *(caldav_op_stats *) value;
+	}
+	pthread_mutex_unlock(&stats->lock);
+	*count = n;
+	return snapshot;
+}
+
+/**
+ * Set the totals to zero.
+ * @param stats @see caldav_stats
+ */
+void caldav_stats_reset(caldav_stats* stats) {
+	pthread_mutex_lock(&stats->lock);
+	g_hash_table_remove_all(stats->ops);
+	pthread_mutex_unlock(&stats->lock);
+}
+
+/**
+ * Start counting for a call.
+ * @param settings The call. @see caldav_settings
+ * @param operation Name of the public function. Must be a static string.
+ */
+void caldav_stats_begin(caldav_settings* settings, const gchar* operation) {
+	caldav_alloc_counters* counters;
+
+	if (settings->stats)
+		return;
+	settings->stats = g_new0(caldav_call_stats, 1);
+	settings->stats->operation = operation;
+	settings->stats->start = get_monotonic_time();
+	counters = caldav_alloc_thread();
+	settings->stats->allocs = counters->allocs;
+	settings->stats->alloc_bytes = counters->bytes;
+	settings->stats->alloc_live = counters->live;
+	settings->stats->alloc_peak = counters->peak;
+	counters->peak = counters->live;
+}
+
+/**
+ * Count a finished request in the call and in the metrics of the process
+ * and report it to the callback.
+ * @param settings The call the request belongs to. May be NULL.
+ * @param curl The handle used for the request
+ * @param res Result of the transfer
+ * @param attempt 1 for the first attempt
+ */
+void caldav_stats_request(caldav_settings* settings, CURL* curl,
+		CURLcode res, gint attempt) {
+	caldav_request_stats request;
+	caldav_stats_callback func;
+	gpointer data;
+	caldav_stats* stats;
+	char* str = NULL;
+	long size = 0;
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t bytes = 0;
+#else
+	double bytes = 0;
+#endif
+
+	if (! settings || ! settings->stats)
+		return;
+	memset(&request, 0, sizeof(request));
+	request.operation = settings->stats->operation;
+#if LIBCURL_VERSION_NUM >= 0x074800
+	if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_METHOD, &str) == CURLE_OK)
+		request.method = str;
+#endif
+	if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &str) == CURLE_OK)
+		request.url = str;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &request.status);
+	request.result = res;
+	request.attempt = attempt;
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &request.namelookup);
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &request.connect);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &request.tls);
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &request.ttfb);
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &request.total);
+	curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &size);
+	request.bytes_up = size;
+	size = 0;
+	curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &size);
+	request.bytes_down = size;
+#if LIBCURL_VERSION_NUM >= 0x073700
+	if (curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &bytes) == CURLE_OK)
+		request.bytes_up += bytes;
+	bytes = 0;
+	if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes) == CURLE_OK)
+		request.bytes_down += bytes;
+#else
+	if (curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &bytes) == CURLE_OK)
+		request.bytes_up += (gint64) bytes;
+	bytes = 0;
+	if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &bytes) == CURLE_OK)
+		request.bytes_down += (gint64) bytes;
+#endif
+
+	settings->stats->requests++;
+	if (res != CURLE_OK || request.status >= 400)
+		settings->stats->errors++;
+	settings->stats->bytes_up += request.bytes_up;
+	settings->stats->bytes_down += request.bytes_down;
+	if (! settings->stats->host)
+		settings->stats->host = get_url_host(request.url);
+	caldav_metrics_request(&request);
+
+	if (! settings->session)
+		return;
+	stats = settings->session->stats;
+	pthread_mutex_lock(&stats->lock);
+	func = stats->func;
+	data = stats->data;
+	pthread_mutex_unlock(&stats->lock);
+	if (func)
+		func(&request, data);
+}
+
+/**
+ * Count time spent waiting for the network.
+ * @param settings The call. May be NULL.
+ * @param since Monotonic time when the wait started
+ */
+void caldav_stats_network(caldav_settings* settings, gint64 since) {
+	if (settings && settings->stats)
+		settings->stats->network += get_monotonic_time() - since;
+}
+
+/**
+ * Add the counters of a call to the totals of its session and to the
+ * metrics of the process. Called when the settings of the call are freed.
+ * @param settings The call. @see caldav_settings
+ */
+void caldav_stats_end(caldav_settings* settings) {
+	caldav_call_stats* call = settings->stats;
+	caldav_op_stats* op;
+	caldav_stats* stats;
+	caldav_alloc_counters* counters;
+	gint64 elapsed, peak;
+
+	if (! call)
+		return;
+	settings->stats = NULL;
+	elapsed = get_monotonic_time() - call->start;
+	counters = caldav_alloc_thread();
+	call->allocs = counters->allocs - call->allocs;
+	call->alloc_bytes = counters->bytes - call->alloc_bytes;
+	peak = MAX(counters->peak - call->alloc_live, 0);
+	counters->peak = MAX(counters->peak, call->alloc_peak);
+	caldav_metrics_operation(call->host, call->operation, elapsed);
+	g_free(call->host);
+	if (! settings->session) {
+		g_free(call);
+		return;
+	}
+	stats = settings->session->stats;
+	pthread_mutex_lock(&stats->lock);
+	op = g_hash_table_lookup(stats->ops, call->operation);
+	if (! op) {
+		op = g_new0(caldav_op_stats, 1);
+		op->operation = call->operation;
+		g_hash_table_insert(stats->ops, (gpointer) call->operation, op);
+	}
+	op->calls++;
+	op->requests += call->requests;
+	op->errors += call->errors;
+	op->elapsed += elapsed / 1e6;
+	op->network += call->network / 1e6;
+	op->parse += MAX(elapsed - call->network, 0) / 1e6;
+	op->bytes_up += call->bytes_up;
+	op->bytes_down += call->bytes_down;
+	op->allocs += call->allocs;
+	op->alloc_bytes += call->alloc_bytes;
+	op->alloc_peak = MAX(op->alloc_peak, peak);
+	pthread_mutex_unlock(&stats->lock);
+	g_free(call);
+}
@@ -0,0 +1,132 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_STATS_H__
+#define __CALDAV_STATS_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav.h"
+#include "caldav-utils.h"
+
+/**
+ * @typedef struct _caldav_stats caldav_stats
+ * Totals per operation shared by a session and the executors created
+ * with it
+ */
+typedef struct _caldav_stats caldav_stats;
+
+/**
+ * @struct _caldav_call_stats
+ * Counters for one call of a public function
+ */
+struct _caldav_call_stats {
+	const gchar* operation;
+	gchar* host;				/* host of the first request */
+	gint64 start;				/* monotonic microseconds */
+	gint64 network;				/* microseconds waiting for transfers */
+	guint requests;
+	guint errors;
+	gint64 bytes_up;
+	gint64 bytes_down;
+	guint64 allocs;				/* counters of the thread at start */
+	gint64 alloc_bytes;
+	gint64 alloc_live;
+	gint64 alloc_peak;			/* peak of an enclosing call */
+};
+
+/**
+ * Create empty totals.
+ * @return totals with one reference
+ */
+caldav_stats* caldav_stats_new(void);
+
+/**
+ * Take a reference.
+ * @param stats @see caldav_stats
+ * @return stats
+ */
+caldav_stats* caldav_stats_ref(caldav_stats* stats);
+
+/**
+ * Drop a reference. The totals are freed with the last one.
+ * @param stats @see caldav_stats. May be NULL.
+ */
+void caldav_stats_unref(caldav_stats* stats);
+
+/**
+ * Set the function called after every request.
+ * @param stats @see caldav_stats
+ * @param func Function to call or NULL
+ * @param data Passed to func
+ */
+void caldav_stats_set_callback(caldav_stats* stats,
+		caldav_stats_callback func, gpointer data);
+
+/**
+ * Copy the totals.
+ * @param stats @see caldav_stats
+ * @param count Where the number of operations is returned
+ * @return array to free with g_free or NULL if empty
+ */
+caldav_op_stats* caldav_stats_snapshot(caldav_stats* stats, gint* count);
+
+/**
+ * Set the totals to zero.
+ * @param stats @see caldav_stats
+ */
+void caldav_stats_reset(caldav_stats* stats);
+
+/**
+ * Start counting for a call.
+ * @param settings The call. @see caldav_settings
+ * @param operation Name of the public function. Must be a static string.
+ */
+void caldav_stats_begin(caldav_settings* settings, const gchar* operation);
+
+/**
+ * Count a finished request in the call and in the metrics of the process
+ * and report it to the callback.
+ * @param settings The call the request belongs to. May be NULL.
+ * @param curl The handle used for the request
+ * @param res Result of the transfer
+ * @param attempt 1 for the first attempt
+ */
+void caldav_stats_request(caldav_settings* settings, CURL* curl,
+		CURLcode res, gint attempt);
+
+/**
+ * Count time spent waiting for the network.
+ * @param settings The call. May be NULL.
+ * @param since Monotonic time when the wait started
+ */
+void caldav_stats_network(caldav_settings* settings, gint64 since);
+
+/**
+ * Add the counters of a call to the totals of its session and to the
+ * metrics of the process. Called when the settings of the call are freed.
+ * @param settings The call. @see caldav_settings
+ */
+void caldav_stats_end(caldav_settings* settings);
+
+G_END_DECLS
+
+#endif
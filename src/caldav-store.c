@@ -0,0 +1,1141 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-store.h"
+#include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
+#include "caldav-attach.h"
+#include <glib.h>
+#include <curl/curl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+/*
+ * File layout. Every record is a header line giving the type and the
+ * length of each field followed by the fields and a newline:
+ *
+ *   LIBCALDAV-STORE 1\n
+ *   C <len>\n<collection>\n
+ *   O <len> <len> <len> <len>\n<uid><href><etag><object>\n
+ *   D <len>\n<href>\n
+ *   T <len>\n<sync-token>\n
+ *   G <len>\n<ctag>\n
+ *
+ * Records are only ever appended. A later O or D record for the same href
+ * replaces an earlier one. A torn record at the end of the file, eg. after
+ * a crash, is cut off when the store is opened. The file is locked while
+ * it is open, so only one caldav_store ever appends to it.
+ */
+#define STORE_MAGIC "LIBCALDAV-STORE 1\n"
+#define STORE_HEADER_MAX 128
+/* rewrite the file when less than half of it is live and it exceeds this */
+#define STORE_COMPACT_SIZE (1024 * 1024)
+/* hrefs per calendar-multiget */
+#define STORE_MULTIGET 100
+
+/**
+ * @struct _caldav_store
+ * A collection mirrored in a memory-mapped append-only file
+ */
+struct _caldav_store {
+	gchar* path;
+	gchar* collection;
+	GMappedFile* map;
+	int fd;
+	GHashTable* hrefs;		/* href -> store_object */
+	GHashTable* uids;		/* UID -> store_object */
+	gchar* sync_token;
+	gchar* ctag;			/* CS:getctag of the last listing */
+	gsize size;				/* bytes in file */
+	gsize live;				/* bytes in live object records */
+	caldav_timeline* timeline;	/* built on first range query */
+};
+
+/**
+ * @typedef struct store_object
+ * An object in the store. data points into the mapped file unless the
+ * object was appended after the file was opened.
+ */
+typedef struct {
+	gchar* uid;
+	gchar* href;
+	gchar* etag;
+	const gchar* data;
+	gsize length;
+	gchar* owned;
+	gsize record;
+} store_object;
+
+static void free_object(gpointer data) {
+	store_object* object = (store_object *) data;
+
+	g_free(object->uid);
+	g_free(object->href);
+	g_free(object->etag);
+	g_free(object->owned);
+	g_free(object);
+}
+
+static void store_remove(caldav_store* store, const gchar* href) {
+	store_object* object = g_hash_table_lookup(store->hrefs, href);
+
+	if (! object)
+		return;
+	store->live -= object->record;
+	if (store->timeline)
+		caldav_timeline_remove(store->timeline, href);
+	if (g_hash_table_lookup(store->uids, object->uid) == object)
+		g_hash_table_remove(store->uids, object->uid);
+	/* frees object */
+	g_hash_table_remove(store->hrefs, href);
+}
+
+static void store_put(caldav_store* store, store_object* object) {
+	store_object* old;
+
+	store_remove(store, object->href);
+	if ((old = g_hash_table_lookup(store->uids, object->uid)) != NULL)
+		store_remove(store, old->href);
+	g_hash_table_replace(store->hrefs, object->href, object);
+	g_hash_table_replace(store->uids, object->uid, object);
+	store->live += object->record;
+	if (store->timeline) {
+		gchar* ical = g_strndup(object->data, object->length);
+		caldav_timeline_put(store->timeline, object->href, ical);
+		g_free(ical);
+	}
+}
+
+/**
+ * Apply the records found in text.
+ * @return length of the part of text holding complete records
+ */
+static gsize store_replay(caldav_store* store, const gchar* text,
+		gsize length, gboolean* valid) {
+	const gchar* pos = text;
+	const gchar* end = text + length;
+	const gchar* nl;
+	char header[STORE_HEADER_MAX];
+	unsigned long len[4];
+	gsize total;
+	int fields, i;
+
+	*valid = FALSE;
+	if (length < strlen(STORE_MAGIC) ||
+			strncmp(text, STORE_MAGIC, strlen(STORE_MAGIC)) != 0)
+		return 0;
+	*valid = TRUE;
+	pos += strlen(STORE_MAGIC);
+	while (pos < end) {
+		nl = memchr(pos, '\n', MIN((gsize) (end - pos), STORE_HEADER_MAX - 1));
+		if (! nl)
+			break;
+		memcpy(header, pos, nl - pos);
+		header[nl - pos] = '\0';
+		fields = sscanf(header + 1, " %lu %lu %lu %lu",
+				&len[0], &len[1], &len[2], &len[3]);
+		if (fields < 1)
+			break;
+		for (i = 0, total = 0; i < fields; i++)
+			total += len[i];
+		if ((gsize) (end - nl - 1) < total + 1 || nl[1 + total] != '\n')
+			break;
+		nl++;
+		switch (header[0]) {
+			case 'C':
+				g_free(store->collection);
+				store->collection = g_strndup(nl, len[0]);
+				break;
+			case 'T':
+				g_free(store->sync_token);
+				store->sync_token = g_strndup(nl, len[0]);
+				break;
+			case 'G':
+				g_free(store->ctag);
+				store->ctag = g_strndup(nl, len[0]);
+				break;
+			case 'D': {
+				gchar* href = g_strndup(nl, len[0]);
+				store_remove(store, href);
+				g_free(href);
+				break;
+			}
+			case 'O':
+				if (fields == 4) {
+					store_object* object = g_new0(store_object, 1);
+					object->uid = g_strndup(nl, len[0]);
+					object->href = g_strndup(nl + len[0], len[1]);
+					object->etag = g_strndup(nl + len[0] + len[1], len[2]);
+					object->data = nl + len[0] + len[1] + len[2];
+					object->length = len[3];
+					object->record = total + (nl - pos) + 1;
+					store_put(store, object);
+				}
+				break;
+			default:
+				/* unknown record from a newer version. Skip */
+				break;
+		}
+		pos = nl + total + 1;
+	}
+	return pos - text;
+}
+
+static gboolean store_write(int fd, const gchar* data, gsize length) {
+	ssize_t res;
+
+	while (length > 0) {
+		res = write(fd, data, length);
+		if (res < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += res;
+		length -= res;
+	}
+	return TRUE;
+}
+
+static void record_object(GString* buf, store_object* object) {
+	g_string_append_printf(buf, "O %lu %lu %lu %lu\n",
+			(unsigned long) strlen(object->uid),
+			(unsigned long) strlen(object->href),
+			(unsigned long) strlen(object->etag),
+			(unsigned long) object->length);
+	g_string_append(buf, object->uid);
+	g_string_append(buf, object->href);
+	g_string_append(buf, object->etag);
+	g_string_append_len(buf, object->data, object->length);
+	g_string_append_c(buf, '\n');
+}
+
+static void record_string(GString* buf, char type, const gchar* value) {
+	g_string_append_printf(buf, "%c %lu\n%s\n",
+			type, (unsigned long) strlen(value), value);
+}
+
+static gboolean store_append(caldav_store* store, GString* buf,
+		caldav_error* error) {
+	if (buf->len == 0)
+		return FALSE;
+	if (! store_write(store->fd, buf->str, buf->len) || fsync(store->fd) < 0) {
+		error->code = -1;
+		error->str = g_strdup_printf("%s: %s", store->path, g_strerror(errno));
+		return TRUE;
+	}
+	store->size += buf->len;
+	return FALSE;
+}
+
+static void compact_object(gpointer key, gpointer value, gpointer data) {
+	record_object((GString *) data, (store_object *) value);
+}
+
+/**
+ * Make a rename in the directory of path durable.
+ */
+static void sync_dir(const gchar* path) {
+	gchar* dir = g_path_get_dirname(path);
+	int fd = open(dir, O_RDONLY);
+
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	g_free(dir);
+}
+
+/**
+ * Write the live records to a new file and replace the old one with it.
+ * The new file is locked before it replaces the old one, so nobody can
+ * open it in between.
+ * @return descriptor for appending to the new file or -1 in case of error
+ */
+static int store_compact(caldav_store* store) {
+	GString* buf;
+	gchar* tmp;
+	int fd;
+	gboolean ok;
+
+	buf = g_string_sized_new(store->live + 1024);
+	g_string_append(buf, STORE_MAGIC);
+	record_string(buf, 'C', store->collection);
+	g_hash_table_foreach(store->hrefs, compact_object, buf);
+	if (store->sync_token)
+		record_string(buf, 'T', store->sync_token);
+	if (store->ctag)
+		record_string(buf, 'G', store->ctag);
+	tmp = g_strconcat(store->path, ".tmp", NULL);
+	fd = open(tmp, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0600);
+	ok = (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) == 0 &&
+			store_write(fd, buf->str, buf->len) && fsync(fd) == 0);
+	if (ok)
+		ok = (rename(tmp, store->path) == 0);
+	if (ok)
+		sync_dir(store->path);
+	else {
+		unlink(tmp);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+	}
+	g_free(tmp);
+	g_string_free(buf, TRUE);
+	return fd;
+}
+
+static void store_unload(caldav_store* store) {
+	if (store->fd >= 0)
+		close(store->fd);
+	store->fd = -1;
+	caldav_timeline_free(store->timeline);
+	store->timeline = NULL;
+	g_hash_table_remove_all(store->uids);
+	g_hash_table_remove_all(store->hrefs);
+	if (store->map)
+		g_mapped_file_unref(store->map);
+	store->map = NULL;
+	g_free(store->sync_token);
+	store->sync_token = NULL;
+	g_free(store->ctag);
+	store->ctag = NULL;
+	store->size = store->live = 0;
+}
+
+static gboolean store_load(caldav_store* store, const gchar* collection,
+		caldav_error* error) {
+	GError* gerror = NULL;
+	gsize length = 0;
+	gsize good = 0;
+	gboolean valid = FALSE;
+
+	/* a descriptor left by store_compact is locked already */
+	if (store->fd < 0) {
+		store->fd = open(store->path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+		if (store->fd < 0) {
+			error->code = -1;
+			error->str = g_strdup_printf(
+					"%s: %s", store->path, g_strerror(errno));
+			return TRUE;
+		}
+		if (flock(store->fd, LOCK_EX | LOCK_NB) < 0) {
+			error->code = -1;
+			error->str = g_strdup_printf("%s: %s", store->path,
+					(errno == EWOULDBLOCK) ?
+					"Store is in use" : g_strerror(errno));
+			return TRUE;
+		}
+	}
+	if (lseek(store->fd, 0, SEEK_END) > 0) {
+		store->map = g_mapped_file_new(store->path, FALSE, &gerror);
+		if (! store->map) {
+			error->code = -1;
+			error->str = g_strdup(gerror->message);
+			g_error_free(gerror);
+			return TRUE;
+		}
+		length = g_mapped_file_get_length(store->map);
+		good = store_replay(store,
+				g_mapped_file_get_contents(store->map), length, &valid);
+		if (! valid) {
+			error->code = -1;
+			error->str = g_strdup_printf("%s: Not a store", store->path);
+			return TRUE;
+		}
+		if (g_strcmp0(store->collection, collection) != 0) {
+			error->code = -1;
+			error->str = g_strdup_printf(
+					"%s: Store belongs to %s", store->path, store->collection);
+			return TRUE;
+		}
+		if (good < length) {
+			/* cut off the torn record */
+			if (ftruncate(store->fd, good) < 0) {
+				error->code = -1;
+				error->str = g_strdup_printf(
+						"%s: %s", store->path, g_strerror(errno));
+				return TRUE;
+			}
+		}
+		store->size = good;
+	}
+	else {
+		GString* buf = g_string_new(STORE_MAGIC);
+		gboolean res;
+
+		store->collection = g_strdup(collection);
+		record_string(buf, 'C', collection);
+		res = store_append(store, buf, error);
+		g_string_free(buf, TRUE);
+		if (res)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/**
+ * Rewrite the file when less than half of it is live. The old file stays
+ * in use if the new one cannot be written.
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+static gboolean store_maybe_compact(caldav_store* store, caldav_error* error) {
+	gchar* collection;
+	gboolean result;
+	int fd;
+
+	if (store->size <= STORE_COMPACT_SIZE || store->live >= store->size / 2)
+		return FALSE;
+	if ((fd = store_compact(store)) < 0)
+		return FALSE;
+	collection = g_strdup(store->collection);
+	store_unload(store);
+	store->fd = fd;
+	result = store_load(store, collection, error);
+	g_free(collection);
+	return result;
+}
+
+/**
+ * Open a store and load its content. A new store is created if path does
+ * not exist. The file is locked until the store is closed.
+ * @param path File holding the store
+ * @param collection URL for the collection without protocol
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return store or NULL in case of error
+ */
+caldav_store* caldav_store_open(const gchar* path, const gchar* collection,
+		caldav_error* error) {
+	caldav_store* store;
+
+	store = g_new0(caldav_store, 1);
+	store->path = g_strdup(path);
+	store->fd = -1;
+	store->hrefs = g_hash_table_new_full(
+			g_str_hash, g_str_equal, NULL, free_object);
+	store->uids = g_hash_table_new(g_str_hash, g_str_equal);
+	if (store_load(store, collection, error) ||
+			store_maybe_compact(store, error)) {
+		caldav_store_close(store);
+		return NULL;
+	}
+	return store;
+}
+
+/**
+ * Close a store and free its memory.
+ * @param store @see caldav_store
+ */
+void caldav_store_close(caldav_store* store) {
+	if (! store)
+		return;
+	store_unload(store);
+	g_hash_table_destroy(store->uids);
+	g_hash_table_destroy(store->hrefs);
+	g_free(store->collection);
+	g_free(store->path);
+	g_free(store);
+}
+
+/**
+ * Send a REPORT or PROPFIND to the collection.
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+static gboolean store_request(caldav_settings* settings, CALDAV_METHOD method,
+		const gchar* depth, const gchar* request, struct MemoryStruct* chunk,
+		caldav_error* error) {
+	CURL* curl;
+	CURLcode res = 0;
+	char error_buf[CURL_ERROR_SIZE];
+	struct config_data data;
+	struct MemoryStruct headers;
+	struct curl_slist *http_header = NULL;
+	gboolean result = FALSE;
+	gchar* header;
+
+	headers.memory = NULL;
+	headers.size = 0;
+
+	curl = get_curl(settings);
+	if (!curl) {
+		error->code = -1;
+		error->str = g_strdup("Could not initialize libcurl");
+		return TRUE;
+	}
+
+	header = g_strconcat("Depth: ", depth, NULL);
+	http_header = curl_slist_append(http_header,
+			"Content-Type: application/xml; charset=\"utf-8\"");
+	http_header = curl_slist_append(http_header, header);
+	http_header = curl_slist_append(http_header, "Expect:");
+	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
+	g_free(header);
+	data.trace_ascii = settings->trace_ascii;
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
+	/* send all data to this function  */
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	/* we pass our 'chunk' struct to the callback function */
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
+	/* send all data to this function  */
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
+	/* we pass our 'headers' struct to the callback function */
+	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
+	caldav_trace_setup(curl, settings, &data);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(request));
+	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST,
+			(method == CALDAV_PROPFIND) ? "PROPFIND" : "REPORT");
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
+	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+	res = caldav_perform(curl, TRUE, chunk, &headers);
+	if (res != 0) {
+		error->code = -1;
+		error->str = g_strdup_printf("%s", error_buf);
+		result = TRUE;
+	}
+	else {
+		long code;
+		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+		if (! parse_response(method, code, chunk->memory)) {
+			error->code = code;
+			error->str = g_strdup(headers.memory);
+			result = TRUE;
+		}
+	}
+	if (headers.memory)
+		free(headers.memory);
+	curl_slist_free_all(http_header);
+	curl_easy_cleanup(curl);
+	return result;
+}
+
+/**
+ * @typedef struct sync_state
+ * Result of comparing the server with the store
+ */
+typedef struct {
+	caldav_store* store;
+	gchar* collection_href;
+	GPtrArray* fetch;		/* hrefs to fetch */
+	GHashTable* seen;		/* hrefs on the server, full listings only */
+	GString* records;		/* D records to append */
+} sync_state;
+
+static void sync_response(const gchar* response, gsize length,
+		const gchar* dav, const gchar* cal, gpointer data) {
+	sync_state* state = (sync_state *) data;
+	gchar* href = get_element_text(response, length, dav, "href");
+	gchar* etag = get_element_text(response, length, dav, "getetag");
+	gchar* path;
+	store_object* object;
+
+	if (! href) {
+		g_free(etag);
+		return;
+	}
+	path = caldav_index_href(href);
+	g_free(href);
+	if (strcmp(path, state->collection_href) == 0) {
+		/* the collection itself */
+	}
+	else if (etag) {
+		gchar* tag = sanitize(etag);
+		object = g_hash_table_lookup(state->store->hrefs, path);
+		if (! object || strcmp(object->etag, tag) != 0)
+			g_ptr_array_add(state->fetch, g_strdup(path));
+		if (state->seen)
+			g_hash_table_replace(state->seen, g_strdup(path), NULL);
+		g_free(tag);
+	}
+	else if (g_hash_table_lookup(state->store->hrefs, path)) {
+		/* no properties: removed from the collection (404) */
+		record_string(state->records, 'D', path);
+		store_remove(state->store, path);
+	}
+	g_free(path);
+	g_free(etag);
+}
+
+static void sync_unseen(gpointer key, gpointer value, gpointer data) {
+	sync_state* state = (sync_state *) data;
+
+	if (! g_hash_table_lookup_extended(state->seen, key, NULL, NULL))
+		record_string(state->records, 'D', (gchar *) key);
+}
+
+/**
+ * Remove objects not in a full listing from the server.
+ */
+static void sync_remove_unseen(sync_state* state) {
+	GString* removed = g_string_new("");
+	GString* records = state->records;
+	const gchar* pos;
+	const gchar* end;
+
+	/* collect first, the table cannot change while it is walked */
+	state->records = removed;
+	g_hash_table_foreach(state->store->hrefs, sync_unseen, state);
+	state->records = records;
+	pos = removed->str;
+	end = removed->str + removed->len;
+	while (pos < end) {
+		unsigned long len = strtoul(pos + 2, NULL, 10);
+		const gchar* href = strchr(pos, '\n') + 1;
+		gchar* tmp = g_strndup(href, len);
+		store_remove(state->store, tmp);
+		g_free(tmp);
+		pos = href + len + 1;
+	}
+	g_string_append_len(records, removed->str, removed->len);
+	g_string_free(removed, TRUE);
+}
+
+static const char* sync_request =
+"<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+"<D:sync-collection xmlns:D=\"DAV:\">"
+"  <D:sync-token>%s</D:sync-token>"
+"  <D:sync-level>1</D:sync-level>"
+"  <D:prop>"
+"    <D:getetag/>"
+"  </D:prop>"
+"</D:sync-collection>";
+
+static const char* etag_request =
+"<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+"<C:calendar-query xmlns:D=\"DAV:\""
+"                 xmlns:C=\"urn:ietf:params:xml:ns:caldav\">"
+"  <D:prop>"
+"    <D:getetag/>"
+"  </D:prop>"
+"  <C:filter>"
+"    <C:comp-filter name=\"VCALENDAR\">"
+"      <C:comp-filter name=\"VEVENT\"/>"
+"    </C:comp-filter>"
+"  </C:filter>"
+"</C:calendar-query>";
+
+#define CTAG_NS "http://calendarserver.org/ns/"
+
+static const char* ctag_request =
+"<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+"<D:propfind xmlns:D=\"DAV:\" xmlns:CS=\"" CTAG_NS "\">"
+"  <D:prop>"
+"    <CS:getctag/>"
+"  </D:prop>"
+"</D:propfind>";
+
+static const char* multiget_head =
+"<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+"<C:calendar-multiget xmlns:D=\"DAV:\""
+"                 xmlns:C=\"urn:ietf:params:xml:ns:caldav\">"
+"  <D:prop>"
+"    <D:getetag/>"
+"    <C:calendar-data/>"
+"  </D:prop>";
+
+static const char* multiget_foot = "</C:calendar-multiget>";
+
+/**
+ * Ask for the changes since the last sync.
+ * @return new sync token or NULL in case of error
+ */
+static gchar* sync_collection(sync_state* state, caldav_settings* settings,
+		caldav_error* error) {
+	struct MemoryStruct chunk;
+	gchar* token;
+	gchar* request;
+	gchar* dav;
+	gchar* result = NULL;
+
+	chunk.memory = NULL;
+	chunk.size = 0;
+	token = g_markup_escape_text(
+			(state->store->sync_token) ? state->store->sync_token : "", -1);
+	request = g_strdup_printf(sync_request, token);
+	g_free(token);
+	if (! store_request(settings, CALDAV_REPORT, "0", request, &chunk, error)) {
+		parse_multistatus(chunk.memory, sync_response, state);
+		dav = get_ns_prefix(chunk.memory, FALSE);
+		result = get_element_text(chunk.memory, chunk.size, dav, "sync-token");
+		g_free(dav);
+		if (! result) {
+			error->code = -1;
+			error->str = g_strdup("No sync-token in response");
+		}
+	}
+	g_free(request);
+	if (chunk.memory)
+		free(chunk.memory);
+	return result;
+}
+
+/**
+ * Prefix the response uses for the calendarserver.org namespace.
+ * @return prefix including ':' or "" for the default namespace
+ */
+static gchar* ctag_prefix(const gchar* text) {
+	const gchar* uri;
+	const gchar* start;
+	const gchar* end;
+
+	if (! text || (uri = strstr(text, CTAG_NS)) == NULL || uri - text < 2)
+		return g_strdup("");
+	/* xmlns:CS="http://... */
+	end = uri - 2;
+	if (*end != '=')
+		return g_strdup("");
+	for (start = end; start > text && start[-1] != ':' &&
+			! g_ascii_isspace(start[-1]); start--)
+		;
+	if (start > text && start[-1] == ':')
+		return g_strdup_printf("%.*s:", (int) (end - start), start);
+	return g_strdup("");
+}
+
+/**
+ * Ask for the CTag of the collection, a calendarserver.org extension
+ * which changes whenever a member of the collection does.
+ * @return CTag or NULL if the server has none
+ */
+static gchar* sync_ctag(caldav_settings* settings) {
+	struct MemoryStruct chunk;
+	caldav_error error;
+	gchar* prefix;
+	gchar* result = NULL;
+
+	chunk.memory = NULL;
+	chunk.size = 0;
+	error.code = 0;
+	error.str = NULL;
+	if (! store_request(settings, CALDAV_PROPFIND, "0", ctag_request,
+				&chunk, &error)) {
+		prefix = ctag_prefix(chunk.memory);
+		result = get_element_text(chunk.memory, chunk.size, prefix, "getctag");
+		g_free(prefix);
+		if (result && ! *result) {
+			g_free(result);
+			result = NULL;
+		}
+	}
+	g_free(error.str);
+	if (chunk.memory)
+		free(chunk.memory);
+	return result;
+}
+
+/**
+ * Compare the ETAG of every object on the server with the store.
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+static gboolean sync_etags(sync_state* state, caldav_settings* settings,
+		caldav_error* error) {
+	struct MemoryStruct chunk;
+	gboolean result;
+
+	chunk.memory = NULL;
+	chunk.size = 0;
+	result = store_request(settings, CALDAV_REPORT, "1", etag_request, &chunk, error);
+	if (! result)
+		parse_multistatus(chunk.memory, sync_response, state);
+	if (chunk.memory)
+		free(chunk.memory);
+	return result;
+}
+
+static void fetch_response(const gchar* response, gsize length,
+		const gchar* dav, const gchar* cal, gpointer data) {
+	sync_state* state = (sync_state *) data;
+	gchar* href = get_element_text(response, length, dav, "href");
+	gchar* etag = get_element_text(response, length, dav, "getetag");
+	gchar* ical = get_element_text(response, length, cal, "calendar-data");
+	gchar* uid = get_ical_property(ical, "VEVENT", "UID", NULL);
+
+	if (href && etag && uid) {
+		store_object* object = g_new0(store_object, 1);
+		gsize start = state->records->len;
+
+		object->uid = uid;
+		object->href = caldav_index_href(href);
+		object->etag = sanitize(etag);
+		object->owned = ical;
+		object->data = ical;
+		object->length = strlen(ical);
+		record_object(state->records, object);
+		object->record = state->records->len - start;
+		store_put(state->store, object);
+		ical = uid = NULL;
+	}
+	g_free(href);
+	g_free(etag);
+	g_free(ical);
+	g_free(uid);
+}
+
+/**
+ * Fetch changed objects with calendar-multiget.
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+static gboolean sync_fetch(sync_state* state, caldav_settings* settings,
+		caldav_error* error) {
+	struct MemoryStruct chunk;
+	GString* request;
+	guint i, n;
+	gboolean result = FALSE;
+
+	for (i = 0; i < state->fetch->len && ! result; i += STORE_MULTIGET) {
+		request = g_string_new(multiget_head);
+		for (n = i; n < state->fetch->len && n < i + STORE_MULTIGET; n++) {
+			gchar* href = g_markup_escape_text(
+					g_ptr_array_index(state->fetch, n), -1);
+			g_string_append_printf(request, "<D:href>%s</D:href>", href);
+			g_free(href);
+		}
+		g_string_append(request, multiget_foot);
+		chunk.memory = NULL;
+		chunk.size = 0;
+		result = store_request(settings, CALDAV_REPORT, "1", request->str,
+				&chunk, error);
+		if (! result) {
+			/* before the objects are copied out of the response */
+			chunk.size = caldav_attach_filter(settings, chunk.memory,
+					chunk.size);
+			parse_multistatus(chunk.memory, fetch_response, state);
+		}
+		if (chunk.memory)
+			free(chunk.memory);
+		g_string_free(request, TRUE);
+	}
+	return result;
+}
+
+/**
+ * Bring the store up to date with the server. Uses sync-collection
+ * (RFC6578) when the server supports it, otherwise the ETAGs of every
+ * object are compared unless the CS:getctag of the collection is the same
+ * as after the last comparison. Changed objects are fetched with
+ * calendar-multiget. The file is compacted afterwards when less than half of it is live.
+ * @param store @see caldav_store
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+gboolean caldav_store_sync(caldav_store* store, caldav_settings* settings,
+		caldav_error* error) {
+	sync_state state;
+	caldav_error sync_error;
+	gchar* token;
+	gchar* ctag = NULL;
+	gboolean result = FALSE;
+	guint i;
+
+	memset(&state, '\0', sizeof(sync_state));
+	state.store = store;
+	state.collection_href = caldav_index_href(settings->url);
+	state.fetch = g_ptr_array_new();
+	state.records = g_string_new("");
+	sync_error.code = 0;
+	sync_error.str = NULL;
+
+	/* without a token every member is listed */
+	if (! store->sync_token)
+		state.seen = g_hash_table_new_full(
+				g_str_hash, g_str_equal, CALDAV_FREE_FUNC, NULL);
+	token = sync_collection(&state, settings, &sync_error);
+	if (! token && store->sync_token && sync_error.code > 0) {
+		/* token no longer valid (RFC6578 3.2). Start over */
+		g_free(sync_error.str);
+		sync_error.str = NULL;
+		sync_error.code = 0;
+		g_free(store->sync_token);
+		store->sync_token = NULL;
+		state.seen = g_hash_table_new_full(
+				g_str_hash, g_str_equal, CALDAV_FREE_FUNC, NULL);
+		token = sync_collection(&state, settings, &sync_error);
+	}
+	if (! token) {
+		/* sync-collection not supported */
+		g_free(sync_error.str);
+		sync_error.str = NULL;
+		sync_error.code = 0;
+		ctag = sync_ctag(settings);
+		if (ctag && g_strcmp0(ctag, store->ctag) == 0) {
+			/* nothing changed since the last listing */
+			if (state.seen)
+				g_hash_table_destroy(state.seen);
+			state.seen = NULL;
+			g_free(ctag);
+			ctag = NULL;
+		}
+		else {
+			if (! state.seen)
+				state.seen = g_hash_table_new_full(
+						g_str_hash, g_str_equal, CALDAV_FREE_FUNC, NULL);
+			result = sync_etags(&state, settings, error);
+		}
+	}
+	if (! result && state.seen)
+		sync_remove_unseen(&state);
+	if (! result)
+		result = sync_fetch(&state, settings, error);
+	if (! result && token) {
+		g_free(store->sync_token);
+		store->sync_token = token;
+		record_string(state.records, 'T', token);
+		token = NULL;
+	}
+	if (! result && ctag) {
+		g_free(store->ctag);
+		store->ctag = ctag;
+		record_string(state.records, 'G', ctag);
+		ctag = NULL;
+	}
+	/* whatever was fetched is kept even if a later step failed */
+	if (store_append(store, state.records, (result) ? &sync_error : error))
+		result = TRUE;
+	else if (! result)
+		result = store_maybe_compact(store, error);
+	g_free(sync_error.str);
+
+	g_free(token);
+	g_free(ctag);
+	for (i = 0; i < state.fetch->len; i++)
+		g_free(g_ptr_array_index(state.fetch, i));
+	g_ptr_array_free(state.fetch, TRUE);
+	if (state.seen)
+		g_hash_table_destroy(state.seen);
+	g_string_free(state.records, TRUE);
+	g_free(state.collection_href);
+	return result;
+}
+
+/**
+ * Copy of a stored object.
+ * @param store @see caldav_store
+ * @param uid UID of the object
+ * @return object or NULL. Caller must free the memory.
+ */
+gchar* caldav_store_get(caldav_store* store, const gchar* uid) {
+	store_object* object;
+
+	if (! uid || (object = g_hash_table_lookup(store->uids, uid)) == NULL)
+		return NULL;
+	return g_strndup(object->data, object->length);
+}
+
+/* a VCALENDAR being put together from stored objects */
+typedef struct {
+	GString* timezones;	/* distinct VTIMEZONEs */
+	GHashTable* tzids;	/* TZID of every VTIMEZONE in timezones */
+	GString* events;
+} store_calendar;
+
+static void append_timezones(store_object* object, store_calendar* cal) {
+	const gchar* end = object->data + object->length;
+	const gchar* first;
+	const gchar* last;
+	const gchar* tzid;
+	gchar* key;
+
+	for (first = object->data; (first = g_strstr_len(first, end - first,
+					"BEGIN:VTIMEZONE")); first = last) {
+		if ((last = g_strstr_len(first, end - first, "END:VTIMEZONE")) == NULL)
+			return;
+		last += 13;
+		tzid = g_strstr_len(first, last - first, "\nTZID:");
+		if (! tzid)
+			continue;
+		tzid += 6;
+		key = g_strndup(tzid, strcspn(tzid, "\r\n"));
+		if (g_hash_table_lookup_extended(cal->tzids, key, NULL, NULL)) {
+			g_free(key);
+			continue;
+		}
+		g_hash_table_insert(cal->tzids, key, NULL);
+		g_string_append_len(cal->timezones, first, last - first);
+		g_string_append(cal->timezones, "\r\n");
+	}
+}
+
+static void append_object(store_object* object, store_calendar* cal) {
+	const gchar* end = object->data + object->length;
+	const gchar* first;
+	const gchar* last = NULL;
+	const gchar* pos;
+
+	first = g_strstr_len(object->data, object->length, "BEGIN:VEVENT");
+	if (! first)
+		return;
+	for (pos = first; (pos = g_strstr_len(pos, end - pos, "END:VEVENT"));
+			pos += 10)
+		last = pos + 10;
+	if (! last)
+		return;
+	append_timezones(object, cal);
+	g_string_append_len(cal->events, first, last - first);
+	g_string_append(cal->events, "\r\n");
+}
+
+static void append_events(gpointer key, gpointer value, gpointer data) {
+	append_object((store_object *) value, (store_calendar *) data);
+}
+
+static void calendar_init(store_calendar* cal, gsize size) {
+	cal->timezones = g_string_new("");
+	cal->tzids = g_hash_table_new_full(g_str_hash, g_str_equal,
+			CALDAV_FREE_FUNC, NULL);
+	cal->events = g_string_sized_new(size + 256);
+}
+
+/**
+ * The VCALENDAR with the time zones ahead of the events they are used by.
+ * @param cal store_calendar. Freed by the call.
+ * @return VCALENDAR. Caller must free the memory.
+ */
+static gchar* calendar_finish(store_calendar* cal) {
+	GString* buf;
+
+	buf = g_string_sized_new(cal->timezones->len + cal->events->len + 128);
+	g_string_append(buf,
+			"BEGIN:VCALENDAR\r\n"
+			"PRODID:-//CalDAV Calendar//NONSGML libcaldav//EN\r\n"
+			"VERSION:2.0\r\n");
+	g_string_append_len(buf, cal->timezones->str, cal->timezones->len);
+	g_string_append_len(buf, cal->events->str, cal->events->len);
+	g_string_append(buf, "END:VCALENDAR");
+	g_string_free(cal->timezones, TRUE);
+	g_string_free(cal->events, TRUE);
+	g_hash_table_destroy(cal->tzids);
+	return g_string_free(buf, FALSE);
+}
+
+/**
+ * Every stored event in one VCALENDAR. The time zones of the stored
+ * objects come first, each TZID once.
+ * @param store @see caldav_store
+ * @return VCALENDAR. Caller must free the memory.
+ */
+gchar* caldav_store_get_all(caldav_store* store) {
+	store_calendar cal;
+
+	calendar_init(&cal, store->live);
+	g_hash_table_foreach(store->hrefs, append_events, &cal);
+	return calendar_finish(&cal);
+}
+
+/**
+ * Number of stored objects.
+ * @param store @see caldav_store
+ * @return number of objects
+ */
+guint caldav_store_size(caldav_store* store) {
+	return g_hash_table_size(store->hrefs);
+}
+
+static void fill_index(gpointer key, gpointer value, gpointer data) {
+	store_object* object = (store_object *) value;
+	gchar* ical = g_strndup(object->data, object->length);
+
+	caldav_index_put((caldav_index *) data, object->uid, object->href,
+			object->etag, ical);
+	g_free(ical);
+}
+
+/**
+ * Copy the location of every stored object into an index.
+ * @param store @see caldav_store
+ * @param index @see caldav_index
+ */
+void caldav_store_fill_index(caldav_store* store, caldav_index* index) {
+	if (index)
+		g_hash_table_foreach(store->hrefs, fill_index, index);
+}
+
+static void timeline_object(gpointer key, gpointer value, gpointer data) {
+	store_object* object = (store_object *) value;
+	gchar* ical = g_strndup(object->data, object->length);
+
+	caldav_timeline_put((caldav_timeline *) data, object->href, ical);
+	g_free(ical);
+}
+
+/**
+ * Call a function for every instance of the stored events overlapping a
+ * period. Recurring events are expanded. The instances are kept in memory
+ * from the first call and updated when the store changes.
+ * @param store @see caldav_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @param func Function called for every instance with the href of the
+ * object as key. @see timeline_func
+ * @param data User data passed to func
+ */
+void caldav_store_foreach_instance(caldav_store* store, time_t start,
+		time_t end, timeline_func func, gpointer data) {
+	if (! store->timeline) {
+		store->timeline = caldav_timeline_new();
+		g_hash_table_foreach(store->hrefs, timeline_object, store->timeline);
+	}
+	caldav_timeline_query(store->timeline, start, end, func, data);
+}
+
+static void collect_href(const gchar* key, const ical_instance* instance,
+		gpointer data) {
+	g_hash_table_replace((GHashTable *) data, (gpointer) key, NULL);
+}
+
+/**
+ * Every stored event with an instance overlapping a period in one
+ * VCALENDAR. The time zones of those objects come first, each TZID once.
+ * @param store @see caldav_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return VCALENDAR. Caller must free the memory.
+ */
+gchar* caldav_store_get_range(caldav_store* store, time_t start, time_t end) {
+	GHashTable* found;
+	GHashTableIter iter;
+	gpointer key;
+	store_calendar cal;
+
+	found = g_hash_table_new(g_str_hash, g_str_equal);
+	caldav_store_foreach_instance(store, start, end, collect_href, found);
+	calendar_init(&cal, 0);
+	g_hash_table_iter_init(&iter, found);
+	while (g_hash_table_iter_next(&iter, &key, NULL)) {
+		store_object* object = g_hash_table_lookup(store->hrefs, key);
+		if (object)
+			append_object(object, &cal);
+	}
+	g_hash_table_destroy(found);
+	return calendar_finish(&cal);
+}
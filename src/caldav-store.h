@@ -0,0 +1,118 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_STORE_H__
+#define __CALDAV_STORE_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav-utils.h"
+#include "caldav.h"
+#include "caldav-index.h"
+#include "caldav-timeline.h"
+
+/**
+ * Open a store and load its content. A new store is created if path does
+ * not exist. The file is locked until the store is closed.
+ * @param path File holding the store
+ * @param collection URL for the collection without protocol
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return store or NULL in case of error
+ */
+caldav_store* caldav_store_open(const gchar* path, const gchar* collection,
+		caldav_error* error);
+
+/**
+ * Close a store and free its memory.
+ * @param store @see caldav_store
+ */
+void caldav_store_close(caldav_store* store);
+
+/**
+ * Bring the store up to date with the server. Uses sync-collection
+ * (RFC6578) when the server supports it, otherwise the ETAGs of every
+ * object are compared unless the CS:getctag of the collection is the same
+ * as after the last comparison. Changed objects are fetched with
+ * calendar-multiget. The file is compacted afterwards when less than half of it is live.
+ * @param store @see caldav_store
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+gboolean caldav_store_sync(caldav_store* store, caldav_settings* settings,
+		caldav_error* error);
+
+/**
+ * Copy of a stored object.
+ * @param store @see caldav_store
+ * @param uid UID of the object
+ * @return object or NULL. Caller must free the memory.
+ */
+gchar* caldav_store_get(caldav_store* store, const gchar* uid);
+
+/**
+ * Every stored event in one VCALENDAR. The time zones of the stored
+ * objects come first, each TZID once.
+ * @param store @see caldav_store
+ * @return VCALENDAR. Caller must free the memory.
+ */
+gchar* caldav_store_get_all(caldav_store* store);
+
+/**
+ * Number of stored objects.
+ * @param store @see caldav_store
+ * @return number of objects
+ */
+guint caldav_store_size(caldav_store* store);
+
+/**
+ * Copy the location of every stored object into an index.
+ * @param store @see caldav_store
+ * @param index @see caldav_index
+ */
+void caldav_store_fill_index(caldav_store* store, caldav_index* index);
+
+/**
+ * Call a function for every instance of the stored events overlapping a
+ * period. Recurring events are expanded. The instances are kept in memory
+ * from the first call and updated when the store changes.
+ * @param store @see caldav_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @param func Function called for every instance with the href of the
+ * object as key. @see timeline_func
+ * @param data User data passed to func
+ */
+void caldav_store_foreach_instance(caldav_store* store, time_t start,
+		time_t end, timeline_func func, gpointer data);
+
+/**
+ * Every stored event with an instance overlapping a period in one
+ * VCALENDAR. The time zones of those objects come first, each TZID once.
+ * @param store @see caldav_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return VCALENDAR. Caller must free the memory.
+ */
+gchar* caldav_store_get_range(caldav_store* store, time_t start, time_t end);
+
+G_END_DECLS
+
+#endif
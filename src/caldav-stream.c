@@ -0,0 +1,310 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-stream.h"
+#include "caldav-attach.h"
+#include <glib.h>
+#include <string.h>
+
+/* namespace for the calendar-data element */
+#define CALDAV_NS "urn:ietf:params:xml:ns:caldav"
+
+/**
+ * @struct _caldav_stream
+ * State kept between the writes of one response
+ */
+struct _caldav_stream {
+	caldav_settings* settings;	/* how attachments are handled */
+	caldav_sink sink;
+	gpointer data;
+	gboolean raw;
+	CURL* curl;
+	caldav_index* index;
+	struct MemoryStruct* chunk;	/* body when the status is not 207 */
+	GString* buffer;			/* received and not yet parsed */
+	gsize scanned;				/* the end of the response is not before */
+	gchar* dav;					/* NULL until the root element is seen */
+	gchar* cal;					/* NULL if declared in every response */
+	gchar* open;
+	gchar* close;
+	gchar* timezone;			/* VTIMEZONE waiting for the head */
+	gboolean have_timezone;
+	gboolean head;				/* VCALENDAR head written */
+	gboolean stopped;			/* the sink stopped the download */
+};
+
+/**
+ * Create a stream for a request.
+ * @param settings The call. settings->sink, settings->sink_data and
+ * settings->sink_raw tell where the calendar goes.
+ * @param curl The handle the response arrives on
+ * @param index Index cleared and filled with the objects received.
+ * May be NULL.
+ * @param chunk Buffer for the body when the status is not 207
+ * @return stream to free with caldav_stream_free
+ */
+caldav_stream* caldav_stream_new(caldav_settings* settings, CURL* curl,
+		caldav_index* index, struct MemoryStruct* chunk) {
+	caldav_stream* stream = g_new0(caldav_stream, 1);
+
+	stream->settings = settings;
+	stream->sink = settings->sink;
+	stream->data = settings->sink_data;
+	stream->raw = settings->sink_raw;
+	stream->curl = curl;
+	stream->index = index;
+	stream->chunk = chunk;
+	stream->buffer = g_string_new("");
+	return stream;
+}
+
+static void emit(caldav_stream* stream, const gchar* text, gsize length) {
+	if (stream->stopped || length == 0)
+		return;
+	if (stream->sink(text, length, stream->data) != 0)
+		stream->stopped = TRUE;
+}
+
+/**
+ * Cut a component out of calendar data the way parse_caldav_report does.
+ * @param object Calendar data
+ * @param type Component to find
+ * @return the first component of type or NULL. Caller must free the memory.
+ */
+static gchar* get_component(const gchar* object, const gchar* type) {
+	gchar* begin = g_strconcat("BEGIN:", type, NULL);
+	gchar* end = g_strconcat("END:", type, NULL);
+	gchar* component = NULL;
+	const gchar* pos;
+	const gchar* stop;
+
+	if ((pos = strstr(object, begin)) != NULL) {
+		pos += strlen(begin);
+		while (g_ascii_isspace(*pos))
+			pos++;
+		if ((stop = strstr(pos, end)) != NULL)
+			component = g_strdup_printf("%s\r\n%.*s%s\r\n",
+					begin, (int) (stop - pos), pos, end);
+	}
+	g_free(begin);
+	g_free(end);
+	return component;
+}
+
+/**
+ * Write the event of one object into the single VCALENDAR. Like
+ * parse_caldav_report only the first time zone found is kept.
+ * @param stream @see caldav_stream
+ * @param object Calendar data of the object
+ */
+static void emit_normalized(caldav_stream* stream, const gchar* object) {
+	gchar* component;
+
+	if (! stream->have_timezone &&
+			(component = get_component(object, "VTIMEZONE")) != NULL) {
+		stream->have_timezone = TRUE;
+		if (stream->head) {
+			emit(stream, component, strlen(component));
+			g_free(component);
+		}
+		else
+			stream->timezone = component;
+	}
+	if ((component = get_component(object, "VEVENT")) == NULL)
+		return;
+	if (! stream->head) {
+		/* nothing is written for a collection without events */
+		stream->head = TRUE;
+		emit(stream, VCAL_HEAD, strlen(VCAL_HEAD));
+		if (stream->timezone) {
+			emit(stream, stream->timezone, strlen(stream->timezone));
+			g_free(stream->timezone);
+			stream->timezone = NULL;
+		}
+	}
+	emit(stream, component, strlen(component));
+	g_free(component);
+}
+
+/**
+ * Handle one complete response element.
+ * @param stream @see caldav_stream
+ * @param response Start of the response element
+ * @param length Length of the response element
+ */
+static void parse_element(caldav_stream* stream, const gchar* response,
+		gsize length) {
+	gchar* cal = stream->cal;
+	gchar* object;
+
+	if (! cal) {
+		gchar* text = g_strndup(response, length);
+		cal = get_ns_prefix(text, TRUE);
+		g_free(text);
+	}
+	if (stream->index)
+		caldav_index_put_response(stream->index, response, length,
+				stream->dav, cal);
+	object = get_element_text(response, length, cal, "calendar-data");
+	if (object) {
+		gsize len = caldav_attach_filter(stream->settings, object,
+				strlen(object));
+
+		if (! stream->raw)
+			emit_normalized(stream, object);
+		else if (len > 0) {
+			emit(stream, object, len);
+			if (object[len - 1] != '\n')
+				emit(stream, "\r\n", 2);
+		}
+		g_free(object);
+	}
+	if (cal != stream->cal)
+		g_free(cal);
+}
+
+/**
+ * Drop parsed text from the front of the buffer.
+ * @param stream @see caldav_stream
+ * @param length Number of bytes to drop
+ */
+static void consume(caldav_stream* stream, gsize length) {
+	g_string_erase(stream->buffer, 0, length);
+	stream->scanned = (stream->scanned > length) ?
+		stream->scanned - length : 0;
+}
+
+/**
+ * Find the namespace prefixes on the multistatus element.
+ * @param stream @see caldav_stream
+ * @return TRUE once the start tag has been received
+ */
+static gboolean parse_root(caldav_stream* stream) {
+	gchar* text = stream->buffer->str;
+	gchar* root;
+	gchar* end;
+	gchar* tag;
+
+	if ((root = strstr(text, "multistatus")) == NULL ||
+			(end = strchr(root, '>')) == NULL)
+		return FALSE;
+	tag = g_strndup(text, end - text + 1);
+	stream->dav = get_ns_prefix(tag, FALSE);
+	/* otherwise it is declared on the elements of each response */
+	if (strstr(tag, CALDAV_NS))
+		stream->cal = get_ns_prefix(tag, TRUE);
+	g_free(tag);
+	stream->open = g_strconcat("<", stream->dav, "response>", NULL);
+	stream->close = g_strconcat("</", stream->dav, "response>", NULL);
+	consume(stream, end - text + 1);
+	/* the collection replaces whatever was known */
+	if (stream->index)
+		caldav_index_clear(stream->index);
+	return TRUE;
+}
+
+/**
+ * Handle every complete response element in the buffer and keep the rest.
+ * @param stream @see caldav_stream
+ */
+static void parse_buffer(caldav_stream* stream) {
+	GString* buffer = stream->buffer;
+	gsize open_len, close_len;
+	gchar* start;
+	gchar* stop;
+
+	if (! stream->dav && ! parse_root(stream))
+		return;
+	open_len = strlen(stream->open);
+	close_len = strlen(stream->close);
+	while (! stream->stopped) {
+		if ((start = strstr(buffer->str, stream->open)) == NULL) {
+			/* keep what may be the beginning of a split tag */
+			if (buffer->len >= open_len)
+				consume(stream, buffer->len - open_len + 1);
+			return;
+		}
+		consume(stream, start - buffer->str);
+		stop = strstr(buffer->str + MAX(stream->scanned, open_len),
+				stream->close);
+		if (! stop) {
+			/* search again from here when more has arrived */
+			stream->scanned = MAX(buffer->len + 1, close_len) - close_len;
+			return;
+		}
+		stop += close_len;
+		parse_element(stream, buffer->str, stop - buffer->str);
+		consume(stream, stop - buffer->str);
+	}
+}
+
+/**
+ * Write function for libcurl. Bodies of responses other than 207 Multi-Status
+ * are collected in the chunk given to caldav_stream_new.
+ * @param ptr Received data
+ * @param size Size of a member
+ * @param nmemb Number of members
+ * @param data @see caldav_stream
+ * @return number of bytes consumed, 0 when the sink stopped the download
+ */
+size_t caldav_stream_write(void* ptr, size_t size, size_t nmemb, void* data) {
+	caldav_stream* stream = (caldav_stream *) data;
+	size_t realsize = size * nmemb;
+	long code = 0;
+
+	curl_easy_getinfo(stream->curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code != 207)
+		return WriteMemoryCallback(ptr, size, nmemb, stream->chunk);
+	if (stream->stopped)
+		return 0;
+	g_string_append_len(stream->buffer, ptr, realsize);
+	parse_buffer(stream);
+	return (stream->stopped) ? 0 : realsize;
+}
+
+/**
+ * Finish the calendar after the transfer has ended.
+ * @param stream @see caldav_stream
+ * @return TRUE if the sink stopped the download, FALSE otherwise.
+ */
+gboolean caldav_stream_finish(caldav_stream* stream) {
+	if (! stream->raw && stream->head)
+		emit(stream, VCAL_FOOT, strlen(VCAL_FOOT));
+	return stream->stopped;
+}
+
+/**
+ * Free memory used by a stream.
+ * @param stream @see caldav_stream
+ */
+void caldav_stream_free(caldav_stream* stream) {
+	if (! stream)
+		return;
+	g_string_free(stream->buffer, TRUE);
+	g_free(stream->dav);
+	g_free(stream->cal);
+	g_free(stream->open);
+	g_free(stream->close);
+	g_free(stream->timezone);
+	g_free(stream);
+}
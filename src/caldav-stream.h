@@ -0,0 +1,77 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_STREAM_H__
+#define __CALDAV_STREAM_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav.h"
+#include "caldav-utils.h"
+#include "caldav-index.h"
+
+/**
+ * @typedef struct _caldav_stream caldav_stream
+ * Hands the calendar data of a multistatus response to a sink while the
+ * response arrives. Only one response element is held at a time.
+ */
+typedef struct _caldav_stream caldav_stream;
+
+/**
+ * Create a stream for a request.
+ * @param settings The call. settings->sink, settings->sink_data and
+ * settings->sink_raw tell where the calendar goes.
+ * @param curl The handle the response arrives on
+ * @param index Index cleared and filled with the objects received.
+ * May be NULL.
+ * @param chunk Buffer for the body when the status is not 207
+ * @return stream to free with caldav_stream_free
+ */
+caldav_stream* caldav_stream_new(caldav_settings* settings, CURL* curl,
+		caldav_index* index, struct MemoryStruct* chunk);
+
+/**
+ * Write function for libcurl. Bodies of responses other than 207 Multi-Status
+ * are collected in the chunk given to caldav_stream_new.
+ * @param ptr Received data
+ * @param size Size of a member
+ * @param nmemb Number of members
+ * @param data @see caldav_stream
+ * @return number of bytes consumed, 0 when the sink stopped the download
+ */
+size_t caldav_stream_write(void* ptr, size_t size, size_t nmemb, void* data);
+
+/**
+ * Finish the calendar after the transfer has ended.
+ * @param stream @see caldav_stream
+ * @return TRUE if the sink stopped the download, FALSE otherwise.
+ */
+gboolean caldav_stream_finish(caldav_stream* stream);
+
+/**
+ * Free memory used by a stream.
+ * @param stream @see caldav_stream
+ */
+void caldav_stream_free(caldav_stream* stream);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,433 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-timeline.h"
+#include "caldav-alloc.h"
+#include <glib.h>
+#include <string.h>
+
+/* how far back of now series are expanded when added */
+#define TIMELINE_HISTORY (366 * 86400)
+/* how far ahead of now series are expanded when added */
+#define TIMELINE_HORIZON (2 * 366 * 86400)
+
+/**
+ * @typedef struct timeline_series
+ * The instances belonging to one object
+ */
+typedef struct {
+	gchar* key;
+	gchar* object;		/* kept when instances remain outside the range */
+	time_t horizon;
+	gboolean open;		/* instances remain beyond horizon */
+	gboolean early;		/* instances remain before the begin of timeline */
+	gboolean dead;		/* removed, its entries are tombstones */
+	guint count;		/* entries in the timeline */
+	time_t longest;		/* length of its longest instance */
+} timeline_series;
+
+/**
+ * @typedef struct timeline_entry
+ * An expanded instance
+ */
+typedef struct {
+	ical_instance instance;
+	timeline_series* series;
+} timeline_entry;
+
+/**
+ * @struct _caldav_timeline
+ * Instances in an array sorted by start. Since no instance is longer than
+ * span, every instance overlapping [from, to) starts in [from - span, to)
+ * which is found with a binary search. Removed series leave their entries
+ * behind as tombstones until the next merge, which also shortens span when
+ * the longest instance went with them.
+ */
+struct _caldav_timeline {
+	GArray* entries;	/* sorted by start */
+	GArray* pending;	/* added since last query, not sorted */
+	GHashTable* series;	/* key -> timeline_series */
+	GPtrArray* dead;	/* removed series with tombstones */
+	guint tombstones;	/* entries belonging to dead series */
+	guint open;			/* series with instances beyond their horizon */
+	guint early;		/* series with instances before begin */
+	time_t span;		/* length of longest instance */
+	gboolean respan;	/* a series as long as span was removed */
+	time_t begin;		/* every instance ending after begin is expanded */
+	time_t horizon;
+};
+
+static void free_series(gpointer data) {
+	timeline_series* series = (timeline_series *) data;
+
+	g_free(series->key);
+	g_free(series->object);
+	g_free(series);
+}
+
+static gint compare_entry(gconstpointer a, gconstpointer b) {
+	const timeline_entry* x = (const timeline_entry *) a;
+	const timeline_entry* y = (const timeline_entry *) b;
+
+	return (x->instance.start > y->instance.start) -
+		(x->instance.start < y->instance.start);
+}
+
+/**
+ * Create an empty timeline expanding series from one year back to two
+ * years ahead. @see caldav_timeline_new_range
+ * @return caldav_timeline
+ */
+caldav_timeline* caldav_timeline_new(void) {
+	time_t now = time(NULL);
+
+	return caldav_timeline_new_range(now - TIMELINE_HISTORY,
+			now + TIMELINE_HORIZON);
+}
+
+/**
+ * Create an empty timeline. Instances in [begin, horizon) are expanded when
+ * an object is added. The rest are expanded when a query reaches outside,
+ * backwards once and kept, forwards on every such query.
+ * @param begin Start of the range in UTC
+ * @param horizon End of the range in UTC
+ * @return caldav_timeline
+ */
+caldav_timeline* caldav_timeline_new_range(time_t begin, time_t horizon) {
+	caldav_timeline* timeline;
+
+	timeline = g_new0(caldav_timeline, 1);
+	timeline->entries = g_array_new(FALSE, FALSE, sizeof(timeline_entry));
+	timeline->pending = g_array_new(FALSE, FALSE, sizeof(timeline_entry));
+	timeline->series = g_hash_table_new_full(
+			g_str_hash, g_str_equal, NULL, free_series);
+	timeline->dead = g_ptr_array_new();
+	timeline->begin = begin;
+	timeline->horizon = MAX(horizon, begin);
+	return timeline;
+}
+
+/**
+ * Free a timeline
+ * @param timeline @see caldav_timeline
+ */
+void caldav_timeline_free(caldav_timeline* timeline) {
+	guint i;
+
+	if (! timeline)
+		return;
+	g_array_free(timeline->entries, TRUE);
+	g_array_free(timeline->pending, TRUE);
+	g_hash_table_destroy(timeline->series);
+	for (i = 0; i < timeline->dead->len; i++)
+		free_series(g_ptr_array_index(timeline->dead, i));
+	g_ptr_array_free(timeline->dead, TRUE);
+	g_free(timeline);
+}
+
+/**
+ * Keep the object of a series while instances remain outside the range
+ */
+static void series_keep(timeline_series* series, const gchar* object) {
+	if (series->open || series->early) {
+		if (! series->object)
+			series->object = g_strdup(object);
+	}
+	else {
+		g_free(series->object);
+		series->object = NULL;
+	}
+}
+
+/**
+ * Remove the instances of an object. The entries stay behind as
+ * tombstones which a later query drops.
+ * @param timeline @see caldav_timeline
+ * @param key Key identifying the object
+ */
+void caldav_timeline_remove(caldav_timeline* timeline, const gchar* key) {
+	timeline_series* series = g_hash_table_lookup(timeline->series, key);
+
+	if (! series)
+		return;
+	g_hash_table_steal(timeline->series, key);
+	if (series->open)
+		timeline->open--;
+	if (series->early)
+		timeline->early--;
+	if (series->count == 0) {
+		free_series(series);
+		return;
+	}
+	series->dead = TRUE;
+	timeline->tombstones += series->count;
+	if (series->longest >= timeline->span)
+		timeline->respan = TRUE;
+	g_ptr_array_add(timeline->dead, series);
+}
+
+static void add_entry(caldav_timeline* timeline, timeline_series* series,
+		ical_instance* instance) {
+	timeline_entry entry;
+
+	entry.instance = *instance;
+	entry.series = series;
+	if (instance->end - instance->start > series->longest)
+		series->longest = instance->end - instance->start;
+	if (series->longest > timeline->span)
+		timeline->span = series->longest;
+	g_array_append_val(timeline->pending, entry);
+	series->count++;
+}
+
+/**
+ * Add or replace the instances of an object. Instances inside the range
+ * of the timeline are expanded at once, the others when a query reaches
+ * outside of it.
+ * @param timeline @see caldav_timeline
+ * @param key Key identifying the object, eg. its href
+ * @param object iCalendar holding the object. @see ical_expand
+ */
+void caldav_timeline_put(caldav_timeline* timeline, const gchar* key,
+		const gchar* object) {
+	timeline_series* series;
+	GArray* instances;
+	time_t until;
+	guint i;
+
+	caldav_timeline_remove(timeline, key);
+	series = g_new0(timeline_series, 1);
+	series->key = g_strdup(key);
+	instances = g_array_new(FALSE, FALSE, sizeof(ical_instance));
+	if (ical_expand(object, timeline->begin, timeline->horizon,
+				instances, &until, &series->early)) {
+		series->open = TRUE;
+		series->horizon = until;
+		timeline->open++;
+	}
+	if (series->early)
+		timeline->early++;
+	series_keep(series, object);
+	for (i = 0; i < instances->len; i++) {
+		ical_instance* instance = &g_array_index(instances, ical_instance, i);
+		/* only instances started before the horizon are complete */
+		if (series->open && instance->start >= series->horizon)
+			continue;
+		add_entry(timeline, series, instance);
+	}
+	g_array_free(instances, TRUE);
+	g_hash_table_insert(timeline->series, series->key, series);
+}
+
+/**
+ * Move the begin of the timeline back to from, expanding the instances
+ * of the series which have any before the current begin.
+ */
+static void timeline_extend(caldav_timeline* timeline, time_t from) {
+	GHashTableIter iter;
+	gpointer value;
+	GArray* instances;
+	time_t part, until;
+	guint i;
+
+	if (from >= timeline->begin)
+		return;
+	instances = g_array_new(FALSE, FALSE, sizeof(ical_instance));
+	g_hash_table_iter_init(&iter, timeline->series);
+	while (timeline->early > 0 && g_hash_table_iter_next(&iter, NULL, &value)) {
+		timeline_series* series = (timeline_series *) value;
+		gboolean early = FALSE;
+		if (! series->early)
+			continue;
+		/* in parts if the expansion is cut short */
+		for (part = from; ; part = until) {
+			g_array_set_size(instances, 0);
+			ical_expand(series->object, part, timeline->begin, instances,
+					&until, (part == from) ? &early : NULL);
+			for (i = 0; i < instances->len; i++) {
+				ical_instance* instance =
+					&g_array_index(instances, ical_instance, i);
+				/* those ending later are there already, those starting
+				 * after until are found by the next part */
+				if (instance->end <= timeline->begin &&
+						instance->start < until &&
+						(part == from || instance->start >= part))
+					add_entry(timeline, series, instance);
+			}
+			if (until >= timeline->begin || until <= part)
+				break;
+		}
+		series->early = early;
+		if (! series->early) {
+			timeline->early--;
+			series_keep(series, NULL);
+		}
+	}
+	g_array_free(instances, TRUE);
+	timeline->begin = from;
+}
+
+/**
+ * Drop the tombstones of an array
+ */
+static void drop_tombstones(GArray* entries) {
+	guint i, n;
+
+	for (i = 0, n = 0; i < entries->len; i++) {
+		timeline_entry* entry = &g_array_index(entries, timeline_entry, i);
+		if (entry->series->dead)
+			continue;
+		if (n != i)
+			g_array_index(entries, timeline_entry, n) = *entry;
+		n++;
+	}
+	g_array_set_size(entries, n);
+}
+
+/**
+ * Length of the longest instance left
+ */
+static time_t longest_entry(GArray* entries) {
+	time_t span = 0;
+	guint i;
+
+	for (i = 0; i < entries->len; i++) {
+		timeline_entry* entry = &g_array_index(entries, timeline_entry, i);
+		if (entry->instance.end - entry->instance.start > span)
+			span = entry->instance.end - entry->instance.start;
+	}
+	return span;
+}
+
+/**
+ * Merge the pending entries into the sorted array. Tombstones are dropped
+ * on the way, or when they make up half of the entries or the longest
+ * instance is among them.
+ */
+static void timeline_merge(caldav_timeline* timeline) {
+	GArray* merged;
+	timeline_entry* a;
+	timeline_entry* b;
+	guint i = 0, j = 0;
+
+	if (timeline->pending->len == 0) {
+		if (timeline->tombstones == 0 || (! timeline->respan &&
+				timeline->tombstones * 2 < timeline->entries->len))
+			return;
+		drop_tombstones(timeline->entries);
+	}
+	else {
+		drop_tombstones(timeline->pending);
+		g_array_sort(timeline->pending, compare_entry);
+		merged = g_array_sized_new(FALSE, FALSE, sizeof(timeline_entry),
+				timeline->entries->len + timeline->pending->len);
+		a = (timeline_entry *) timeline->entries->data;
+		b = (timeline_entry *) timeline->pending->data;
+		while (i < timeline->entries->len || j < timeline->pending->len) {
+			if (i < timeline->entries->len && a[i].series->dead)
+				i++;
+			else if (j == timeline->pending->len ||
+					(i < timeline->entries->len &&
+						a[i].instance.start <= b[j].instance.start))
+				g_array_append_val(merged, a[i++]);
+			else
+				g_array_append_val(merged, b[j++]);
+		}
+		g_array_free(timeline->entries, TRUE);
+		timeline->entries = merged;
+		g_array_set_size(timeline->pending, 0);
+	}
+	for (i = 0; i < timeline->dead->len; i++)
+		free_series(g_ptr_array_index(timeline->dead, i));
+	g_ptr_array_set_size(timeline->dead, 0);
+	if (timeline->respan) {
+		timeline->span = longest_entry(timeline->entries);
+		timeline->respan = FALSE;
+	}
+	timeline->tombstones = 0;
+}
+
+/**
+ * Index of the first entry starting at or after start
+ */
+static guint lower_bound(GArray* entries, time_t start) {
+	guint lo = 0, hi = entries->len, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (g_array_index(entries, timeline_entry, mid).instance.start < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Find the instances overlapping a period. Instances are found in
+ * ascending order of start time except for series expanded beyond the
+ * horizon of the timeline which come last.
+ * @param timeline @see caldav_timeline
+ * @param from Start of period in UTC
+ * @param to End of period in UTC
+ * @param func Function called for every instance
+ * @param data User data passed to func
+ */
+void caldav_timeline_query(caldav_timeline* timeline, time_t from, time_t to,
+		timeline_func func, gpointer data) {
+	timeline_entry* entry;
+	GHashTableIter iter;
+	gpointer value;
+	guint i;
+
+	timeline_extend(timeline, from);
+	timeline_merge(timeline);
+	for (i = lower_bound(timeline->entries, from - timeline->span);
+			i < timeline->entries->len; i++) {
+		entry = &g_array_index(timeline->entries, timeline_entry, i);
+		if (entry->instance.start >= to)
+			break;
+		if (entry->series->dead)
+			continue;
+		if (entry->instance.end > from || entry->instance.start >= from)
+			func(entry->series->key, &entry->instance, data);
+	}
+	if (timeline->open == 0)
+		return;
+	g_hash_table_iter_init(&iter, timeline->series);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		timeline_series* series = (timeline_series *) value;
+		GArray* instances;
+		if (! series->open || series->horizon >= to)
+			continue;
+		instances = g_array_new(FALSE, FALSE, sizeof(ical_instance));
+		ical_expand(series->object, from, to, instances, NULL, NULL);
+		for (i = 0; i < instances->len; i++) {
+			ical_instance* instance =
+				&g_array_index(instances, ical_instance, i);
+			if (instance->start >= series->horizon)
+				func(series->key, instance, data);
+		}
+		g_array_free(instances, TRUE);
+	}
+}
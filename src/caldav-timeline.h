@@ -0,0 +1,101 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_TIMELINE_H__
+#define __CALDAV_TIMELINE_H__
+
+#include <glib.h>
+#include <time.h>
+G_BEGIN_DECLS
+
+#include "caldav-recur.h"
+
+/**
+ * @typedef struct _caldav_timeline caldav_timeline
+ * Instances of a set of objects ordered by start time
+ */
+typedef struct _caldav_timeline caldav_timeline;
+
+/**
+ * Called for every instance found by caldav_timeline_query
+ * @param key Key of the object given to caldav_timeline_put
+ * @param instance The instance. @see ical_instance
+ * @param data User data
+ */
+typedef void (*timeline_func)(const gchar* key, const ical_instance* instance,
+		gpointer data);
+
+/**
+ * Create an empty timeline expanding series from one year back to two
+ * years ahead. @see caldav_timeline_new_range
+ * @return caldav_timeline
+ */
+caldav_timeline* caldav_timeline_new(void);
+
+/**
+ * Create an empty timeline. Instances in [begin, horizon) are expanded when
+ * an object is added. The rest are expanded when a query reaches outside,
+ * backwards once and kept, forwards on every such query.
+ * @param begin Start of the range in UTC
+ * @param horizon End of the range in UTC
+ * @return caldav_timeline
+ */
+caldav_timeline* caldav_timeline_new_range(time_t begin, time_t horizon);
+
+/**
+ * Free a timeline
+ * @param timeline @see caldav_timeline
+ */
+void caldav_timeline_free(caldav_timeline* timeline);
+
+/**
+ * Add or replace the instances of an object. Instances inside the range
+ * of the timeline are expanded at once, the others when a query reaches
+ * outside of it.
+ * @param timeline @see caldav_timeline
+ * @param key Key identifying the object, eg. its href
+ * @param object iCalendar holding the object. @see ical_expand
+ */
+void caldav_timeline_put(caldav_timeline* timeline, const gchar* key,
+		const gchar* object);
+
+/**
+ * Remove the instances of an object. The entries stay behind as
+ * tombstones which a later query drops.
+ * @param timeline @see caldav_timeline
+ * @param key Key identifying the object
+ */
+void caldav_timeline_remove(caldav_timeline* timeline, const gchar* key);
+
+/**
+ * Find the instances overlapping a period. Instances are found in
+ * ascending order of start time except for series expanded beyond the
+ * horizon of the timeline which come last.
+ * @param timeline @see caldav_timeline
+ * @param from Start of period in UTC
+ * @param to End of period in UTC
+ * @param func Function called for every instance
+ * @param data User data passed to func
+ */
+void caldav_timeline_query(caldav_timeline* timeline, time_t from, time_t to,
+		timeline_func func, gpointer data);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,161 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-trace.h"
+#include "caldav-utils.h"
+#include "caldav-stats.h"
+#include <glib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static caldav_trace_callback trace_func = NULL;
+static gpointer trace_data = NULL;
+static gdouble trace_sample = 0.0;
+static glong trace_max_body = -1;
+static volatile gulong trace_next = 0;
+
+/**
+ * Set where traces go. @see caldav_set_trace
+ * @param func Function receiving the events or NULL
+ * @param data Passed to func
+ * @param sample Fraction of requests to trace
+ * @param max_body Max number of bytes reported of a body. -1 is unlimited.
+ */
+void caldav_trace_set(caldav_trace_callback func, gpointer data,
+		gdouble sample, glong max_body) {
+	pthread_mutex_lock(&trace_lock);
+	trace_func = func;
+	trace_data = data;
+	trace_sample = CLAMP(sample, 0.0, 1.0);
+	trace_max_body = (max_body < 0) ? -1 : max_body;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static gint64 wall_time(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (gint64) tv.tv_sec * G_GINT64_CONSTANT(1000000) + tv.tv_usec;
+}
+
+/*
+ * CURLOPT_DEBUGFUNCTION for traced requests
+ */
+static int trace_event(CURL* handle, curl_infotype type, char* ptr,
+		size_t size, void* userp) {
+	struct config_data* data = (struct config_data *) userp;
+	caldav_trace_event event;
+	gsize* seen = NULL;
+	gint64 now;
+	(void) handle;
+
+	switch (type) {
+		case CURLINFO_TEXT:
+			event.type = CALDAV_TRACE_INFO;
+			break;
+		case CURLINFO_HEADER_OUT:
+			/* a new attempt or redirect starts over */
+			data->body_out = data->body_in = 0;
+			event.type = CALDAV_TRACE_HEADER_OUT;
+			break;
+		case CURLINFO_DATA_OUT:
+			event.type = CALDAV_TRACE_DATA_OUT;
+			seen = &data->body_out;
+			break;
+		case CURLINFO_HEADER_IN:
+			event.type = CALDAV_TRACE_HEADER_IN;
+			break;
+		case CURLINFO_DATA_IN:
+			event.type = CALDAV_TRACE_DATA_IN;
+			seen = &data->body_in;
+			break;
+		default:
+			/* TLS records say nothing the other events do not */
+			return 0;
+	}
+	event.data = ptr;
+	event.length = size;
+	event.offset = 0;
+	event.truncated = 0;
+	if (seen) {
+		if (data->max_body >= 0 && *seen >= (gsize) data->max_body) {
+			*seen += size;
+			return 0;
+		}
+		event.offset = *seen;
+		if (data->max_body >= 0 && *seen + size > (gsize) data->max_body) {
+			event.length = data->max_body - *seen;
+			event.truncated = 1;
+		}
+		*seen += size;
+	}
+	now = get_monotonic_time();
+	if (data->start == 0)
+		data->start = now;
+	event.request = data->request;
+	event.operation = data->operation;
+	event.timestamp = wall_time();
+	event.elapsed = now - data->start;
+	data->func(&event, data->user_data);
+	return 0;
+}
+
+/**
+ * Decide whether the next request made with a handle is traced and set
+ * up the handle for it. Requests which are not traced get no debug
+ * function at all.
+ * @param curl The handle
+ * @param settings The call the request belongs to
+ * @param data State of the trace. Must live as long as the request.
+ * data->trace_ascii must be set.
+ */
+void caldav_trace_setup(CURL* curl, caldav_settings* settings,
+		struct config_data* data) {
+	gdouble sample;
+
+	pthread_mutex_lock(&trace_lock);
+	data->func = trace_func;
+	data->user_data = trace_data;
+	data->max_body = trace_max_body;
+	sample = trace_sample;
+	pthread_mutex_unlock(&trace_lock);
+	data->operation = (settings->stats) ? settings->stats->operation : NULL;
+	data->request = 0;
+	data->start = 0;
+	data->body_out = data->body_in = 0;
+
+	if (data->func) {
+		if (! settings->debug &&
+				(sample <= 0.0 || g_random_double() >= sample))
+			return;
+		data->request = __sync_add_and_fetch(&trace_next, 1);
+		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, trace_event);
+	}
+	else if (settings->debug)
+		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
+	else
+		return;
+	curl_easy_setopt(curl, CURLOPT_DEBUGDATA, data);
+	curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+}
@@ -0,0 +1,54 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_TRACE_H__
+#define __CALDAV_TRACE_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav.h"
+#include "caldav-utils.h"
+
+/**
+ * Set where traces go. @see caldav_set_trace
+ * @param func Function receiving the events or NULL
+ * @param data Passed to func
+ * @param sample Fraction of requests to trace
+ * @param max_body Max number of bytes reported of a body. -1 is unlimited.
+ */
+void caldav_trace_set(caldav_trace_callback func, gpointer data,
+		gdouble sample, glong max_body);
+
+/**
+ * Decide whether the next request made with a handle is traced and set
+ * up the handle for it. Requests which are not traced get no debug
+ * function at all.
+ * @param curl The handle
+ * @param settings The call the request belongs to
+ * @param data State of the trace. Must live as long as the request.
+ * data->trace_ascii must be set.
+ */
+void caldav_trace_setup(CURL* curl, caldav_settings* settings,
+		struct config_data* data);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,316 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-upload.h"
+#include "md5.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* bytes asked from the source at a time while looking for the UID */
+#define UPLOAD_BLOCK 65536
+
+/* a UID is added in front of this */
+#define END_VEVENT "END:VEVENT"
+
+/**
+ * @struct _caldav_upload
+ * What is sent is source[0, cut) followed by insert and source[resume, end)
+ */
+struct _caldav_upload {
+	caldav_source source;
+	gpointer data;
+	gint64 cut;
+	gchar* insert;			/* UID line added or "" */
+	gsize insert_len;
+	gint64 resume;
+	gint64 end;				/* trailing white space is not sent */
+	gint64 size;			/* bytes sent */
+	gint64 position;		/* next byte to send */
+	gchar* uid;
+	gchar digest[33];
+};
+
+/* Read length bytes unless the object ends first */
+static gint64 read_block(caldav_upload* upload, gchar* buffer,
+		gint64 offset, gint64 length) {
+	gint64 done = 0;
+	long n;
+
+	while (done < length) {
+		n = upload->source(buffer + done, length - done, offset + done,
+				upload->data);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+/* Position after the last byte before offset which is not white space */
+static gint64 chomped(caldav_upload* upload, gchar* buffer, gint64 block,
+		gint64 offset) {
+	gint64 start;
+	gint64 i;
+
+	while (offset > 0) {
+		start = MAX(offset - block, 0);
+		if (read_block(upload, buffer, start, offset - start) != offset - start)
+			return -1;
+		for (i = offset - start - 1; i >= 0; i--) {
+			if (! g_ascii_isspace(buffer[i]))
+				return start + i + 1;
+		}
+		offset = start;
+	}
+	return 0;
+}
+
+/**
+ * Read an object through to the end to find its UID. If it has none a UID
+ * is inserted before END:VEVENT when the object is sent, like verify_uid
+ * does for an object in memory. Trailing white space is not sent.
+ * @param source Function reading the object
+ * @param data Pointer given to source
+ * @param length Size of the object in bytes
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return upload to free with caldav_upload_free. NULL if the object could
+ * not be read.
+ */
+caldav_upload* caldav_upload_new(caldav_source source, gpointer data,
+		gint64 length, caldav_error* error) {
+	caldav_upload* upload;
+	MD5_CONTEXT md5;
+	gchar* buffer;
+	gchar* found;
+	GString* uid = NULL;
+	gchar prefix[4];
+	gint column = 0;
+	gboolean in_uid = FALSE;
+	gint64 offset = 0;
+	gint64 pos = -1;
+	gint64 last = -1;
+	gint64 n;
+	gint64 i;
+	gint64 block;
+	gsize carry = 0;
+	gsize keep;
+
+	if (! source || length < 0) {
+		error->code = -1;
+		error->str = g_strdup("Could not read object");
+		return NULL;
+	}
+	upload = g_new0(caldav_upload, 1);
+	upload->source = source;
+	upload->data = data;
+	/* room for the end of the previous block when END:VEVENT is split */
+	block = MIN(UPLOAD_BLOCK, MAX(length, 1));
+	buffer = g_malloc(block + strlen(END_VEVENT));
+	caldav_md5_init(&md5);
+	while (offset < length) {
+		n = read_block(upload, buffer + carry, offset,
+				MIN(block, length - offset));
+		if (n != MIN(block, length - offset))
+			break;
+		caldav_md5_update(&md5, (unsigned char *) buffer + carry, n);
+		for (i = 0; i < n; i++) {
+			gchar c = buffer[carry + i];
+
+			if (! g_ascii_isspace(c))
+				last = offset + i;
+			/* the first line named UID, as get_response_header finds it */
+			if (c == '\r' || c == '\n') {
+				in_uid = FALSE;
+				column = 0;
+			}
+			else if (column < 4) {
+				prefix[column++] = c;
+				if (column == 4 && ! uid &&
+						g_ascii_strncasecmp(prefix, "uid:", 4) == 0) {
+					uid = g_string_new("");
+					in_uid = TRUE;
+				}
+			}
+			else if (in_uid) {
+				g_string_append_c(uid, c);
+			}
+		}
+		if (pos < 0) {
+			found = g_strstr_len(buffer, carry + n, END_VEVENT);
+			if (found)
+				pos = offset - carry + (found - buffer);
+		}
+		offset += n;
+		keep = MIN(strlen(END_VEVENT) - 1, carry + n);
+		memmove(buffer, buffer + carry + n - keep, keep);
+		carry = keep;
+	}
+	caldav_md5_hex_final(upload->digest, &md5);
+	upload->end = last + 1;
+	if (offset == length && ! uid && pos >= 0) {
+		upload->cut = chomped(upload, buffer, block, pos);
+		upload->resume = pos;
+		upload->insert = g_strdup_printf(
+				"\r\nUID:libcaldav-%s@tempuri.org\r\n", upload->digest);
+		upload->uid = g_strdup_printf(
+				"libcaldav-%s@tempuri.org", upload->digest);
+	}
+	else {
+		upload->cut = upload->resume = upload->end;
+		upload->insert = g_strdup("");
+		if (uid)
+			upload->uid = g_strstrip(g_string_free(uid, FALSE));
+		uid = NULL;
+	}
+	if (uid)
+		g_string_free(uid, TRUE);
+	g_free(buffer);
+	if (offset < length || upload->cut < 0) {
+		error->code = -1;
+		error->str = g_strdup("Could not read object");
+		caldav_upload_free(upload);
+		return NULL;
+	}
+	upload->insert_len = strlen(upload->insert);
+	upload->size = upload->cut + upload->insert_len +
+			(upload->end - upload->resume);
+	return upload;
+}
+
+/**
+ * Send the bytes from a source as they are, eg. an attachment. Nothing is
+ * read before the request is sent.
+ * @param source Function reading the data
+ * @param data Pointer given to source
+ * @param length Number of bytes to send
+ * @return upload to free with caldav_upload_free.
+ */
+caldav_upload* caldav_upload_new_raw(caldav_source source, gpointer data,
+		gint64 length) {
+	caldav_upload* upload = g_new0(caldav_upload, 1);
+
+	upload->source = source;
+	upload->data = data;
+	upload->cut = upload->resume = upload->end = MAX(length, 0);
+	upload->insert = g_strdup("");
+	upload->size = upload->end;
+	return upload;
+}
+
+/**
+ * UID of the object sent.
+ * @param upload @see caldav_upload
+ * @return UID. NULL if the object has no UID and no VEVENT to add one to,
+ * or if the data was sent as it is.
+ */
+const gchar* caldav_upload_uid(caldav_upload* upload) {
+	return upload->uid;
+}
+
+/**
+ * MD5 sum of the object as given. The same as random_file_name would
+ * return for the object in memory.
+ * @param upload @see caldav_upload
+ * @return hex digest. Empty if the data was sent as it is.
+ */
+const gchar* caldav_upload_digest(caldav_upload* upload) {
+	return upload->digest;
+}
+
+static size_t upload_read(char* buffer, size_t size, size_t nitems,
+		void* data) {
+	caldav_upload* upload = (caldav_upload *) data;
+	gint64 wanted = size * nitems;
+	gint64 insert_end = upload->cut + upload->insert_len;
+	gint64 offset;
+	long n;
+
+	if (upload->position >= upload->size)
+		return 0;
+	if (upload->position < upload->cut) {
+		n = upload->source(buffer, MIN(wanted, upload->cut - upload->position),
+				upload->position, upload->data);
+	}
+	else if (upload->position < insert_end) {
+		n = MIN(wanted, insert_end - upload->position);
+		memcpy(buffer, upload->insert + (upload->position - upload->cut), n);
+	}
+	else {
+		offset = upload->resume + (upload->position - insert_end);
+		n = upload->source(buffer, MIN(wanted, upload->end - offset),
+				offset, upload->data);
+	}
+	/* the object is shorter than it was when the UID was looked for */
+	if (n <= 0)
+		return CURL_READFUNC_ABORT;
+	upload->position += n;
+	return n;
+}
+
+static int upload_seek(void* data, curl_off_t offset, int origin) {
+	caldav_upload* upload = (caldav_upload *) data;
+
+	if (origin != SEEK_SET || offset < 0 || offset > upload->size)
+		return CURL_SEEKFUNC_CANTSEEK;
+	upload->position = offset;
+	return CURL_SEEKFUNC_OK;
+}
+
+/**
+ * Make a request send the object as its body.
+ * @param upload @see caldav_upload
+ * @param curl The handle to send it on
+ */
+void caldav_upload_setup(caldav_upload* upload, CURL* curl) {
+	upload->position = 0;
+	curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+	curl_easy_setopt(curl, CURLOPT_READFUNCTION, upload_read);
+	curl_easy_setopt(curl, CURLOPT_READDATA, (void *) upload);
+	curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, upload_seek);
+	curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *) upload);
+	curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE,
+			(curl_off_t) upload->size);
+}
+
+/**
+ * Start over from the first byte. Called before every attempt.
+ * @param upload @see caldav_upload
+ */
+void caldav_upload_rewind(caldav_upload* upload) {
+	upload->position = 0;
+}
+
+/**
+ * Free memory used by an upload.
+ * @param upload @see caldav_upload
+ */
+void caldav_upload_free(caldav_upload* upload) {
+	if (! upload)
+		return;
+	g_free(upload->insert);
+	g_free(upload->uid);
+	g_free(upload);
+}
@@ -0,0 +1,99 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __CALDAV_UPLOAD_H__
+#define __CALDAV_UPLOAD_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <curl/curl.h>
+#include "caldav.h"
+#include "caldav-utils.h"
+
+/**
+ * @typedef struct _caldav_upload caldav_upload
+ * An object sent from a caldav_source. The object is read once before it
+ * is sent to find its UID and again for every attempt to send it, so it is
+ * never held in memory.
+ */
+
+/**
+ * Read an object through to the end to find its UID. If it has none a UID
+ * is inserted before END:VEVENT when the object is sent, like verify_uid
+ * does for an object in memory. Trailing white space is not sent.
+ * @param source Function reading the object
+ * @param data Pointer given to source
+ * @param length Size of the object in bytes
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return upload to free with caldav_upload_free. NULL if the object could
+ * not be read.
+ */
+caldav_upload* caldav_upload_new(caldav_source source, gpointer data,
+		gint64 length, caldav_error* error);
+
+/**
+ * Send the bytes from a source as they are, eg. an attachment. Nothing is
+ * read before the request is sent.
+ * @param source Function reading the data
+ * @param data Pointer given to source
+ * @param length Number of bytes to send
+ * @return upload to free with caldav_upload_free.
+ */
+caldav_upload* caldav_upload_new_raw(caldav_source source, gpointer data,
+		gint64 length);
+
+/**
+ * UID of the object sent.
+ * @param upload @see caldav_upload
+ * @return UID. NULL if the object has no UID and no VEVENT to add one to,
+ * or if the data was sent as it is.
+ */
+const gchar* caldav_upload_uid(caldav_upload* upload);
+
+/**
+ * MD5 sum of the object as given. The same as random_file_name would
+ * return for the object in memory.
+ * @param upload @see caldav_upload
+ * @return hex digest. Empty if the data was sent as it is.
+ */
+const gchar* caldav_upload_digest(caldav_upload* upload);
+
+/**
+ * Make a request send the object as its body.
+ * @param upload @see caldav_upload
+ * @param curl The handle to send it on
+ */
+void caldav_upload_setup(caldav_upload* upload, CURL* curl);
+
+/**
+ * Start over from the first byte. Called before every attempt.
+ * @param upload @see caldav_upload
+ */
+void caldav_upload_rewind(caldav_upload* upload);
+
+/**
+ * Free memory used by an upload.
+ * @param upload @see caldav_upload
+ */
+void caldav_upload_free(caldav_upload* upload);
+
+G_END_DECLS
+
+#endif
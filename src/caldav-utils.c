@@ -25,6 +25,11 @@
 #include "response-parser.h"
 #include "caldav.h"
 #include "md5.h"
+#include "caldav-session.h"
+#include "caldav-limiter.h"
+#include "caldav-stats.h"
+#include "caldav-trace.h"
+#include "caldav-upload.h"
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,8 +55,13 @@ static gchar CALDAV[] = "urn:ietf:params:xml:ns:caldav";
  * @param nohex
  */
 void dump(const char* text, FILE* stream, char* ptr, size_t size, char nohex) {
+	static const char hex[] = "0123456789abcdef";
+	/* offset, hex and text of the widest line */
+	char line[24 + 3 * 0x10 + 0x40 + 1];
+	unsigned char b;
 	size_t i;
 	size_t c;
+	size_t n;
 
 	unsigned int width=0x10;
 
@@ -59,15 +69,22 @@ void dump(const char* text, FILE* stream, char* ptr, size_t size, char nohex) {
 		/* without the hex output, we can fit more on screen */
 		width = 0x40;
 	fprintf(stream, "%s, %zd bytes (0x%zx)\n", text, size, size);
+	/* stderr is not buffered, so write whole lines */
 	for(i=0; i<size; i+= width) {
-		fprintf(stream, "%04zx: ", i);
+		n = sprintf(line, "%04zx: ", i);
 		if(!nohex) {
 			/* hex not disabled, show it */
 			for(c = 0; c < width; c++) {
-				if(i+c < size)
-					fprintf(stream, "%02x ", ptr[i+c]);
-				else
-					fputs("   ", stream);
+				if(i+c < size) {
+					b = (unsigned char) ptr[i+c];
+					line[n++] = hex[b >> 4];
+					line[n++] = hex[b & 0x0f];
+					line[n++] = ' ';
+				}
+				else {
+					memcpy(line + n, "   ", 3);
+					n += 3;
+				}
 			}
 		}
 		for(c = 0; (c < width) && (i+c < size); c++) {
@@ -76,14 +93,16 @@ void dump(const char* text, FILE* stream, char* ptr, size_t size, char nohex) {
 				i+=(c+2-width);
 				break;
 			}
-			fprintf(stream, "%c",(ptr[i+c]>=0x20) && (ptr[i+c]<0x80)?ptr[i+c]:'.');
+			b = (unsigned char) ptr[i+c];
+			line[n++] = (b >= 0x20 && b < 0x80) ? b : '.';
 			/* check again for 0D0A, to avoid an extra \n if it's at width */
 			if (nohex && (i+c+2 < size) && ptr[i+c+1]==0x0D && ptr[i+c+2]==0x0A) {
 				i+=(c+3-width);
 				break;
 			}
 		}
-		fputc('\n', stream); /* newline */
+		line[n++] = '\n';
+		fwrite(line, 1, n, stream);
 	}
 	fflush(stream);
 }
@@ -217,6 +236,26 @@ void init_caldav_settings(caldav_settings* settings) {
 	settings->end = 0;
 	settings->etag = NULL;
 	settings->id = NULL;
+	settings->max_in_flight = 1;
+	settings->session = NULL;
+	settings->connect_timeout = 0;
+	settings->timeout = 0;
+	settings->low_speed_time = 0;
+	settings->deadline = 0;
+	settings->cancel = NULL;
+	settings->stats = NULL;
+	settings->sink = NULL;
+	settings->sink_data = NULL;
+	settings->sink_raw = FALSE;
+	settings->upload = NULL;
+	settings->etag_cached = FALSE;
+	settings->strip_attachments = FALSE;
+	settings->attachment = NULL;
+	settings->attachment_data = NULL;
+	settings->managed_attachments = FALSE;
+	settings->managed_id = NULL;
+	settings->attach_name = NULL;
+	settings->attach_type = NULL;
 }
 
 /**
@@ -224,6 +263,8 @@ void init_caldav_settings(caldav_settings* settings) {
  * @param settings @see caldav_settings
  */
 void free_caldav_settings(caldav_settings* settings) {
+	/* the call is over */
+	caldav_stats_end(settings);
 	if (settings->username) {
 		g_free(settings->username);
 		settings->username = NULL;
@@ -258,6 +299,27 @@ void free_caldav_settings(caldav_settings* settings) {
 	}
 	if (settings->id)
 		caldav_free_caldav_id(&settings->id);
+	settings->max_in_flight = 1;
+	settings->session = NULL;
+	settings->deadline = 0;
+	settings->cancel = NULL;
+	settings->sink = NULL;
+	settings->sink_data = NULL;
+	if (settings->upload) {
+		caldav_upload_free(settings->upload);
+		settings->upload = NULL;
+	}
+	settings->etag_cached = FALSE;
+	settings->strip_attachments = FALSE;
+	settings->attachment = NULL;
+	settings->attachment_data = NULL;
+	settings->managed_attachments = FALSE;
+	g_free(settings->managed_id);
+	settings->managed_id = NULL;
+	g_free(settings->attach_name);
+	settings->attach_name = NULL;
+	g_free(settings->attach_type);
+	settings->attach_type = NULL;
 }
 
 static gchar* place_after_hostname(const gchar* start, const gchar* stop) {
@@ -472,11 +534,11 @@ static void freeNamespace(Namespace** ns) {
 	ns = tmp = NULL;
 }
 
-static const char* VCAL_HEAD =
+const char* VCAL_HEAD =
 "BEGIN:VCALENDAR\r\n"
 "PRODID:-//CalDAV Calendar//NONSGML libcaldav//EN\r\n"
 "VERSION:2.0\r\n";
-static const char* VCAL_FOOT = "END:VCALENDAR";
+const char* VCAL_FOOT = "END:VCALENDAR";
 
 /**
  * Parse response from CalDAV server. Internal function.
@@ -624,14 +686,14 @@ gchar* parse_caldav_report(char* report, const char* element, const char* type)
  * @return the CalDAV DateTime
  */
 gchar* get_caldav_datetime(time_t* time) {
-	struct tm *current;
+	struct tm current;
 	gchar* datetime;
 
 	tzset();
-	current = localtime(time);
+	localtime_r(time, &current);
 	datetime = g_strdup_printf("%d%.2d%.2dT%.2d%.2d%.2dZ",
-		current->tm_year/* + 1900*/, current->tm_mon/* + 1*/, current->tm_mday,
-		current->tm_hour, current->tm_min, current->tm_sec);
+		current.tm_year/* + 1900*/, current.tm_mon/* + 1*/, current.tm_mday,
+		current.tm_hour, current.tm_min, current.tm_sec);
 	return datetime;
 }
 
@@ -845,9 +907,9 @@ GSList* get_tag_list(gchar* text) {
 		do {
 			gchar* element = get_tag_ns(NULL, the_tag, elem);
 			pair = g_new0(Pair, 1);
-			pair->href = g_strdup(get_tag_ns(NULL, href, element));
-			gchar* tmp = sanitize(get_tag_ns(NULL, etag, element));
-			pair->etag = g_strdup(tmp);
+			pair->href = get_tag_ns(NULL, href, element);
+			gchar* tmp = get_tag_ns(NULL, etag, element);
+			pair->etag = sanitize(tmp);
 			g_free(tmp);
 			list = g_slist_prepend(list, pair);
 			elem  = elem + strlen(token);
@@ -909,6 +971,97 @@ gchar* get_host(gchar* url) {
 	return result;
 }
 
+/**
+ * Find host[:port] in an URL with or without protocol and login
+ * @param url URL. May be NULL.
+ * @param length Set to the length of host[:port]
+ * @return start of host[:port] in url
+ */
+const gchar* find_url_host(const gchar* url, gsize* length) {
+	const gchar* start;
+	const gchar* end;
+	const gchar* at;
+
+	if (! url) {
+		*length = 0;
+		return "";
+	}
+	start = strstr(url, "//");
+	start = (start) ? start + 2 : url;
+	end = start + strcspn(start, "/");
+	for (at = end; at > start && *(at - 1) != '@'; at--)
+		;
+	if (at > start)
+		start = at;
+	*length = end - start;
+	return start;
+}
+
+/**
+ * Fetch host[:port] from an URL with or without protocol and login
+ * @param url URL
+ * @return host in lower case
+ */
+gchar* get_url_host(const gchar* url) {
+	const gchar* start;
+	gsize length;
+
+	start = find_url_host(url, &length);
+	return g_ascii_strdown(start, length);
+}
+
+/**
+ * Monotonic clock for measuring delays
+ * @return microseconds since an unspecified point in time
+ */
+gint64 get_monotonic_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * G_GINT64_CONSTANT(1000000) + ts.tv_nsec / 1000;
+}
+
+/**
+ * Check if a call must stop
+ * @param settings caldav_settings
+ * @return TRUE if the call was cancelled or its deadline has passed
+ */
+gboolean caldav_expired(const caldav_settings* settings) {
+	if (! settings)
+		return FALSE;
+	if (settings->cancel && g_atomic_int_get(&settings->cancel->cancelled))
+		return TRUE;
+	return settings->deadline > 0 &&
+		get_monotonic_time() >= settings->deadline;
+}
+
+/**
+ * Time left for a call
+ * @param settings caldav_settings
+ * @return microseconds until the deadline or G_MAXINT64 if there is none
+ */
+gint64 caldav_remaining(const caldav_settings* settings) {
+	gint64 left;
+
+	if (! settings || settings->deadline <= 0)
+		return G_MAXINT64;
+	left = settings->deadline - get_monotonic_time();
+	return (left > 0) ? left : 0;
+}
+
+/*
+ * Abort the transfer when the call is cancelled or out of time.
+ */
+#if LIBCURL_VERSION_NUM >= 0x072000
+static int progress_callback(void* data, curl_off_t dltotal, curl_off_t dlnow,
+		curl_off_t ultotal, curl_off_t ulnow) {
+#else
+static int progress_callback(void* data, double dltotal, double dlnow,
+		double ultotal, double ulnow) {
+#endif
+	return caldav_expired((caldav_settings *) data) ? 1 : 0;
+}
+
 /**
  * rebuild a raw URL with https if needed from the settings
  * @param settings caldav_settings
@@ -931,6 +1084,34 @@ gchar* rebuild_url(caldav_settings* settings, gchar* uri){
 	return url;
 }
 
+/**
+ * Turn a Location returned from the server into an absolute URL
+ * @param settings caldav_settings
+ * @param location Absolute URL, absolute path or path relative to the
+ * collection
+ * @return URL
+ */
+gchar* resolve_location(caldav_settings* settings, const gchar* location) {
+	gchar* url;
+	gchar* host;
+	gchar* base;
+
+	if (strstr(location, "://"))
+		return g_strdup(location);
+	if (*location == '/') {
+		host = get_host(settings->url);
+		base = g_strconcat(host, location, NULL);
+		g_free(host);
+	}
+	else if (g_str_has_suffix(settings->url, "/"))
+		base = g_strconcat(settings->url, location, NULL);
+	else
+		base = g_strconcat(settings->url, "/", location, NULL);
+	url = rebuild_url(settings, base);
+	g_free(base);
+	return url;
+}
+
 /**
  * Prepare a curl connection
  * @param settings caldav_settings
@@ -971,6 +1152,30 @@ CURL* get_curl(caldav_settings* setting) {
 		url = rebuild_url(setting, NULL);
 		curl_easy_setopt(curl, CURLOPT_URL, url);
 		g_free(url);
+		/* timeouts must not use signals in threaded programs */
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+		if (setting->connect_timeout > 0)
+			curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS,
+					setting->connect_timeout);
+		if (setting->timeout > 0)
+			curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, setting->timeout);
+		if (setting->low_speed_time > 0) {
+			curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+			curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,
+					setting->low_speed_time);
+		}
+		if (setting->deadline > 0 || setting->cancel) {
+#if LIBCURL_VERSION_NUM >= 0x072000
+			curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progress_callback);
+			curl_easy_setopt(curl, CURLOPT_XFERINFODATA, setting);
+#else
+			curl_easy_setopt(curl, CURLOPT_PROGRESSFUNCTION, progress_callback);
+			curl_easy_setopt(curl, CURLOPT_PROGRESSDATA, setting);
+#endif
+			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+		}
+		/* lets caldav_perform find the call. Multi jobs replace it */
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, (char *) setting);
 	}
 	return (curl) ? curl : NULL;
 }
@@ -1032,7 +1237,6 @@ static char* search_head =
 "                  xmlns:C=\"urn:ietf:params:xml:ns:caldav\">"
 "  <D:prop>"
 "    <D:getetag/>"
-"    <C:calendar-data/>"
 "  </D:prop>"
 "  <C:filter>"
 "    <C:comp-filter name=\"VCALENDAR\">"
@@ -1050,28 +1254,125 @@ static char* search_tail =
 "</C:calendar-query>";
 
 /**
- * Search CalDAV store for a specific object's ETAG
- * @param chunk struct MemoryStruct containing response from server
+ * Body of the REPORT searching a collection for an object by UID.
+ * @param uid UID of the object
+ * @return calendar-query. Caller must free the memory.
+ */
+gchar* find_etag_query(const gchar* uid) {
+	/*
+	 * ICalendar server does not support collation
+	 * <C:text-match collation=\"i;ascii-casemap\">%s</C:text-match>
+	 * <C:text-match>%s</C:text-match>
+	 */
+	return g_strdup_printf(
+		"%s\r\n<C:text-match collation=\"i;ascii-casemap\">%s</C:text-match>\r\n%s",
+		search_head, uid, search_tail);
+}
+
+/**
+ * Read the answer to the REPORT from find_etag_query. The object found is
+ * remembered in the session.
  * @param settings caldav_settings
+ * @param uid UID searched for
+ * @param code HTTP status of the answer
+ * @param body Body of the answer. May be NULL.
+ * @param href Pointer where the href of the object is returned. Caller
+ * must free the memory.
+ * @param error caldav_error
+ * @return ETAG from the object without quotes or NULL
+ */
+gchar* find_etag_answer(caldav_settings* settings, const gchar* uid,
+		long code, const gchar* body, gchar** href, caldav_error* error) {
+	gchar* etag = NULL;
+	GSList* list;
+	GSList* head;
+	guint count;
+
+	*href = NULL;
+	if (! parse_response(CALDAV_REPORT, code, (gchar *) body)) {
+		error->code = code;
+		error->str = g_strdup(body);
+		return NULL;
+	}
+	/* only getetag is asked for so every response is one resource */
+	list = get_tag_list((gchar *) body);
+	count = g_slist_length(list);
+	if (count == 1 && ((Pair *) list->data)->href) {
+		Pair* pair = (Pair *) list->data;
+		*href = g_strdup(pair->href);
+		etag = g_strdup(pair->etag);
+		caldav_session_store(settings->session, settings->url, uid,
+				*href, etag, NULL);
+	}
+	else if (count > 1) {
+		error->code = -1;
+		error->str = g_strdup("Multiple objects found");
+	}
+	else {
+		error->code = code;
+		if (body)
+			error->str = g_strdup(body);
+		else
+			error->str = g_strdup("No object found");
+	}
+	for (head = list; head; head = g_slist_next(head)) {
+		Pair* p = (Pair *) head->data;
+		g_free(p->href);
+		g_free(p->etag);
+		g_free(p);
+	}
+	g_slist_free(list);
+	return etag;
+}
+
+/**
+ * Search CalDAV store for a specific object's ETAG. The session is asked
+ * first, in which case settings->etag_cached is set.
+ * @param settings caldav_settings. settings->file or
+ * settings->upload holds the object.
+ * @param href Pointer where the href of the object is returned. Caller
+ * must free the memory.
  * @param error caldav_error
- * @return ETAG from the object or NULL
+ * @return ETAG from the object without quotes or NULL
  */
-gchar* find_etag(struct MemoryStruct* chunk,
-  				 caldav_settings* settings,
+gchar* find_etag(caldav_settings* settings,
+				 gchar** href,
 				 caldav_error* error) {
 	CURL* curl;
 	CURLcode res = 0;
 	char error_buf[CURL_ERROR_SIZE];
 	struct config_data data;
+	struct MemoryStruct chunk;
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
 	gchar* search;
 	gchar* uid;
 	gchar* etag = NULL;
 	
-	if (! chunk)
+	if (! href)
 		return NULL;
-	
+	*href = NULL;
+
+	if (settings->upload)
+		uid = g_strdup(caldav_upload_uid(settings->upload));
+	else
+		uid = get_response_header("uid", settings->file, FALSE);
+	if (uid == NULL) {
+		error->code = 1;
+		error->str = g_strdup("Error: Missing required UID for object");
+		return NULL;
+	}
+	/* known from a previous call */
+	if (caldav_session_lookup(settings->session, settings->url, uid,
+				href, &etag)) {
+		settings->etag_cached = TRUE;
+		g_free(uid);
+		return etag;
+	}
+	settings->etag_cached = FALSE;
+
+	chunk.memory = NULL;
+	chunk.size = 0;
 	headers.memory = NULL;
 	headers.size = 0;
 
@@ -1081,12 +1382,13 @@ gchar* find_etag(struct MemoryStruct* chunk,
 		error->str = g_strdup("Could not initialize libcurl");
 		g_free(settings->file);
 		settings->file = NULL;
+		g_free(uid);
 		return NULL;
 	}
 
 	http_header = curl_slist_append(http_header,
 			"Content-Type: application/xml; charset=\"utf-8\"");
-	http_header = curl_slist_append(http_header, "Depth: infinity");
+	http_header = curl_slist_append(http_header, "Depth: 1");
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
 	data.trace_ascii = settings->trace_ascii;
@@ -1094,34 +1396,14 @@ gchar* find_etag(struct MemoryStruct* chunk,
 	/* send all data to this function  */
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
 	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)chunk);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
 	/* send all data to this function  */
 	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,	WriteHeaderCallback);
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
-	gchar* file = g_strdup(settings->file);
-	if ((uid = get_response_header("uid", file, FALSE)) == NULL) {
-		g_free(file);
-		error->code = 1;
-		error->str = g_strdup("Error: Missing required UID for object");
-		return NULL;
-	}
-	g_free(file);
-	/*
-	 * ICalendar server does not support collation
-	 * <C:text-match collation=\"i;ascii-casemap\">%s</C:text-match>
-	 * <C:text-match>%s</C:text-match>
-	 */
-	search = g_strdup_printf(
-		"%s\r\n<C:text-match collation=\"i;ascii-casemap\">%s</C:text-match>\r\n%s",
-		search_head, uid, search_tail);
-	g_free(uid);
+	caldav_trace_setup(curl, settings, &data);
+	search = find_etag_query(uid);
 	/* enable uploading */
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, search);
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(search));
@@ -1129,7 +1411,7 @@ gchar* find_etag(struct MemoryStruct* chunk,
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	g_free(search);
 	curl_slist_free_all(http_header);
 	http_header = NULL;
@@ -1142,33 +1424,12 @@ gchar* find_etag(struct MemoryStruct* chunk,
 	else {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-		if (! parse_response(CALDAV_REPORT, code, chunk->memory)) {
-			error->code = code;
-			error->str = g_strdup(chunk->memory);
-		}
-		else {
-			/* test if result contains more than one resource */
-			if (single_resource(chunk->memory, "VEVENT")) {
-				gchar* url = NULL;
-				url = get_url(chunk->memory);
-				if (url) {
-					etag = get_etag(chunk->memory);
-				}
-				else {
-					error->code = code;
-					if (chunk->memory)
-						error->str = g_strdup(chunk->memory);
-					else
-						error->str = g_strdup("No object found");
-				}
-				g_free(url);
-			}
-			else {
-				error->code = -1;
-				error->str = g_strdup("Multiple objects found");
-			}
-		}
+		etag = find_etag_answer(settings, uid, code, chunk.memory, href,
+				error);
 	}
+	g_free(uid);
+	if (chunk.memory)
+		free(chunk.memory);
 	if (headers.memory)
 		free(headers.memory);
 	curl_easy_cleanup(curl);
@@ -1188,4 +1449,291 @@ gchar* remove_protocol(gchar* text) {
 		url = g_strdup(text);
 	
 	return url;
+}
+
+/**
+ * Convert an iCalendar DATE or DATE-TIME value to time_t. Unlike get_time_t
+ * the result is a real UTC time_t. The value is read as UTC whether it
+ * carries the UTC designator or not, so only use it for values which are
+ * UTC by definition, eg. FREEBUSY. @see ical_zoned_time_to_utc
+ * @param value DATE (YYYYMMDD) or DATE-TIME (YYYYMMDDTHHMMSS[Z])
+ * @param is_date Pointer where TRUE is returned if value is a DATE. May be
+ * NULL.
+ * @return time_t or (time_t) -1 if value is not valid
+ */
+time_t ical_time_to_utc(const gchar* value, gboolean* is_date) {
+	int year, month, day, hour = 0, min = 0, sec = 0;
+	long days;
+	int era, yoe, doy, doe;
+
+	if (! value || sscanf(value, "%4d%2d%2d", &year, &month, &day) != 3)
+		return (time_t) -1;
+	if (value[8] == 'T') {
+		if (sscanf(value + 9, "%2d%2d%2d", &hour, &min, &sec) != 3)
+			return (time_t) -1;
+	}
+	if (is_date)
+		*is_date = (value[8] != 'T');
+	if (month < 1 || month > 12 || day < 1 || day > 31)
+		return (time_t) -1;
+	/* days since 1970-01-01 in the proleptic Gregorian calendar */
+	year -= (month <= 2);
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	days = (long) era * 146097 + doe - 719468;
+	return (time_t) days * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+/**
+ * Find the value of a property in the first component of a given type
+ * @param text iCal to search in
+ * @param type Component, eg. VEVENT
+ * @param name Property name, eg. DTSTART
+ * @param params Pointer where the parameters (without leading ';') are
+ * returned. May be NULL. Caller must free the memory.
+ * @return value or NULL if not found. Caller must free the memory.
+ */
+gchar* get_ical_property(const gchar* text, const gchar* type,
+		const gchar* name, gchar** params) {
+	gchar* begin;
+	gchar* end_type;
+	const gchar* pos;
+	const gchar* stop;
+	const gchar* line;
+	gsize len = strlen(name);
+	gboolean quoted;
+
+	if (params)
+		*params = NULL;
+	if (! text)
+		return NULL;
+	begin = g_strconcat("BEGIN:", type, NULL);
+	end_type = g_strconcat("END:", type, NULL);
+	pos = strstr(text, begin);
+	stop = (pos) ? strstr(pos, end_type) : NULL;
+	g_free(begin);
+	g_free(end_type);
+	if (! pos || ! stop)
+		return NULL;
+	for (line = pos; line && line < stop; line = strchr(line, '\n')) {
+		if (*line == '\n')
+			line++;
+		if (g_ascii_strncasecmp(line, name, len) != 0 ||
+				(line[len] != ':' && line[len] != ';'))
+			continue;
+		pos = line + len;
+		quoted = FALSE;
+		while (*pos && *pos != '\r' && *pos != '\n' &&
+				(quoted || *pos != ':')) {
+			if (*pos == '"')
+				quoted = ! quoted;
+			pos++;
+		}
+		if (*pos != ':')
+			return NULL;
+		if (params && pos > line + len)
+			*params = g_strndup(line + len + 1, pos - line - len - 1);
+		line = ++pos;
+		/* stop at end of line or an escaped CR (&#13;) in XML */
+		while (*pos && *pos != '\r' && *pos != '\n' && *pos != '&')
+			pos++;
+		return g_strndup(line, pos - line);
+	}
+	return NULL;
+}
+
+/**
+ * Find the prefix a response uses for a namespace
+ * @param text Response from server
+ * @param caldav TRUE for the CalDAV namespace, FALSE for DAV
+ * @return prefix including ':' or "" if the namespace has no prefix.
+ * Caller must free the memory.
+ */
+gchar* get_ns_prefix(gchar* text, gboolean caldav) {
+	Namespace** ns;
+	gchar* prefix = NULL;
+	int p;
+
+	ns = getNamespace(text);
+	if (ns) {
+		for (p = 0; ns[p]; p++) {
+			if (strcmp(ns[p]->NS, (caldav) ? CALDAV : DAV) == 0) {
+				prefix = (*ns[p]->prefix) ?
+					g_strconcat(ns[p]->prefix, ":", NULL) : g_strdup("");
+				break;
+			}
+		}
+		freeNamespace(ns);
+		g_free(ns);
+	}
+	return (prefix) ? prefix : g_strdup("");
+}
+
+/**
+ * Walk every response element in a multistatus response
+ * @param text Response from server
+ * @param func Function called for each response element
+ * @param data User data passed to func
+ * @return number of response elements
+ */
+guint parse_multistatus(gchar* text, multistatus_func func, gpointer data) {
+	gchar* dav;
+	gchar* cal;
+	gchar* open;
+	gchar* close;
+	const gchar* pos;
+	const gchar* stop;
+	guint count = 0;
+
+	if (! text)
+		return 0;
+	dav = get_ns_prefix(text, FALSE);
+	cal = get_ns_prefix(text, TRUE);
+	open = g_strconcat("<", dav, "response>", NULL);
+	close = g_strconcat("</", dav, "response>", NULL);
+	pos = text;
+	while ((pos = strstr(pos, open)) != NULL &&
+			(stop = strstr(pos, close)) != NULL) {
+		stop += strlen(close);
+		func(pos, stop - pos, dav, cal, data);
+		count++;
+		pos = stop;
+	}
+	g_free(open);
+	g_free(close);
+	g_free(dav);
+	g_free(cal);
+	return count;
+}
+
+static gchar* xml_unescape(const gchar* text, gsize length) {
+	GString* out = g_string_sized_new(length);
+	const gchar* end = text + length;
+	const gchar* amp;
+
+	while (text < end) {
+		if (end - text > 9 && strncmp(text, "<![CDATA[", 9) == 0) {
+			const gchar* close = g_strstr_len(text, end - text, "]]>");
+			if (! close)
+				close = end;
+			g_string_append_len(out, text + 9, close - text - 9);
+			text = (close < end) ? close + 3 : end;
+			continue;
+		}
+		if (*text != '&' ||
+				(amp = memchr(text, ';', MIN(end - text, 10))) == NULL) {
+			g_string_append_c(out, *text++);
+			continue;
+		}
+		if (strncmp(text, "&lt;", 4) == 0)
+			g_string_append_c(out, '<');
+		else if (strncmp(text, "&gt;", 4) == 0)
+			g_string_append_c(out, '>');
+		else if (strncmp(text, "&amp;", 5) == 0)
+			g_string_append_c(out, '&');
+		else if (strncmp(text, "&quot;", 6) == 0)
+			g_string_append_c(out, '"');
+		else if (strncmp(text, "&apos;", 6) == 0)
+			g_string_append_c(out, '\'');
+		else if (text[1] == '#') {
+			gunichar c = (text[2] == 'x' || text[2] == 'X') ?
+				strtoul(text + 3, NULL, 16) : strtoul(text + 2, NULL, 10);
+			g_string_append_unichar(out, c);
+		}
+		else
+			g_string_append_len(out, text, amp - text + 1);
+		text = amp + 1;
+	}
+	return g_string_free(out, FALSE);
+}
+
+/**
+ * Fetch the text of the first element with a given name
+ * @param text XML to search in
+ * @param length Length of text
+ * @param prefix Namespace prefix including ':'. @see get_ns_prefix
+ * @param name Element name
+ * @return text of the element with XML entities and CDATA decoded or NULL
+ * if not found. Caller must free the memory.
+ */
+gchar* get_element_text(const gchar* text, gsize length,
+		const gchar* prefix, const gchar* name) {
+	gchar* open = g_strconcat("<", prefix, name, NULL);
+	gchar* close = g_strconcat("</", prefix, name, ">", NULL);
+	const gchar* stop = text + length;
+	const gchar* pos = text;
+	const gchar* end;
+	gchar* result = NULL;
+	gsize len = strlen(open);
+
+	/* skip elements which merely share the beginning of the name */
+	while ((pos = g_strstr_len(pos, stop - pos, open)) != NULL &&
+			pos[len] != '>' && pos[len] != ' ' && pos[len] != '/')
+		pos += len;
+	if (pos && pos[len] != '/' &&
+			(pos = memchr(pos, '>', stop - pos)) != NULL) {
+		pos++;
+		end = g_strstr_len(pos, stop - pos, close);
+		if (end)
+			result = xml_unescape(pos, end - pos);
+	}
+	g_free(open);
+	g_free(close);
+	return result;
+}
+
+/**
+ * Convert a UTC time_t to an iCalendar DATE-TIME in UTC
+ * @param time UTC time
+ * @return YYYYMMDDTHHMMSSZ. Caller must free the memory.
+ */
+gchar* utc_to_ical_time(time_t time) {
+	struct tm tm;
+
+	gmtime_r(&time, &tm);
+	return g_strdup_printf("%04d%02d%02dT%02d%02d%02dZ",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * Convert an iCalendar DURATION value to seconds. A day is taken as
+ * 86400 seconds.
+ * @param value DURATION, eg. PT1H30M
+ * @param seconds Pointer where the duration is returned
+ * @return TRUE if value is valid, FALSE otherwise
+ */
+gboolean ical_duration(const gchar* value, gint64* seconds) {
+	const gchar* pos = value;
+	gchar* end;
+	gint64 sign = 1;
+	gint64 total = 0;
+	gint64 n;
+
+	if (*pos == '+' || *pos == '-')
+		sign = (*pos++ == '-') ? -1 : 1;
+	if (*pos++ != 'P')
+		return FALSE;
+	while (*pos) {
+		if (*pos == 'T') {
+			pos++;
+			continue;
+		}
+		if (! g_ascii_isdigit(*pos))
+			return FALSE;
+		n = g_ascii_strtoll(pos, &end, 10);
+		switch (*end) {
+			case 'W': total += n * 7 * 86400; break;
+			case 'D': total += n * 86400; break;
+			case 'H': total += n * 3600; break;
+			case 'M': total += n * 60; break;
+			case 'S': total += n; break;
+			default: return FALSE;
+		}
+		pos = end + 1;
+	}
+	*seconds = sign * total;
+	return TRUE;
 }
\ No newline at end of file
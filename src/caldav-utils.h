@@ -26,6 +26,7 @@ G_BEGIN_DECLS
 #include <stdlib.h>
 #include <curl/curl.h>
 #include "caldav.h"
+#include "caldav-alloc.h"
 
 /**
  * @typedef struct _CALDAV_SETTINGS caldav_settings
@@ -33,6 +34,18 @@ G_BEGIN_DECLS
  */
 typedef struct _CALDAV_SETTINGS caldav_settings;
 
+/**
+ * @typedef struct _caldav_call_stats caldav_call_stats
+ * Counters for one call of a public function. @see caldav-stats.h
+ */
+typedef struct _caldav_call_stats caldav_call_stats;
+
+/**
+ * @typedef struct _caldav_upload caldav_upload
+ * Object read from a caldav_source while it is sent. @see caldav-upload.h
+ */
+typedef struct _caldav_upload caldav_upload;
+
 /**
  * @struct _CALDAV_SETTINGS
  * A struct used to exchange all user input between various parts
@@ -54,6 +67,34 @@ struct _CALDAV_SETTINGS {
 	time_t end;
 	gchar* etag;
 	CALDAV_ID* id;
+	int max_in_flight;
+	caldav_session* session;
+	gboolean etag_cached;		/* find_etag answered from the session */
+	long connect_timeout;
+	long timeout;
+	long low_speed_time;
+	gint64 deadline;		/* monotonic microseconds, 0 is none */
+	caldav_cancel* cancel;
+	caldav_call_stats* stats;	/* NULL when not collected */
+	caldav_sink sink;			/* GETALL is written here when set */
+	gpointer sink_data;
+	gboolean sink_raw;
+	caldav_upload* upload;		/* sent instead of file when set */
+	gboolean strip_attachments;	/* inline ATTACH values are dropped */
+	caldav_attachment_callback attachment;	/* or handed here */
+	gpointer attachment_data;
+	gboolean managed_attachments;	/* RFC8607 in the DAV header */
+	gchar* managed_id;			/* attachment to update or remove, or added */
+	gchar* attach_name;			/* file name of the attachment sent */
+	gchar* attach_type;			/* media type of the attachment sent */
+};
+
+/**
+ * @struct _caldav_cancel
+ * Cancellation token shared between threads
+ */
+struct _caldav_cancel {
+	volatile gint cancelled;
 };
 
 /**
@@ -72,10 +113,19 @@ struct MemoryStruct {
 };
 
 /** @struct config_data
- * Used to exchange user options to the library
+ * Used to exchange user options to the library. Also holds the state of
+ * a traced request. @see caldav_trace_setup
  */
 struct config_data {
 	char trace_ascii;
+	caldav_trace_callback func;	/* NULL prints to stderr */
+	gpointer user_data;
+	const gchar* operation;
+	gulong request;
+	gint64 start;				/* monotonic time of the first event */
+	glong max_body;
+	gsize body_out;
+	gsize body_in;
 };
 
 typedef struct {
@@ -197,6 +247,41 @@ gchar* get_url(gchar* text);
  */
 gchar* get_host(gchar* url);
 
+/**
+ * Find host[:port] in an URL with or without protocol and login
+ * @param url URL. May be NULL.
+ * @param length Set to the length of host[:port]
+ * @return start of host[:port] in url
+ */
+const gchar* find_url_host(const gchar* url, gsize* length);
+
+/**
+ * Fetch host[:port] from an URL with or without protocol and login
+ * @param url URL
+ * @return host in lower case
+ */
+gchar* get_url_host(const gchar* url);
+
+/**
+ * Monotonic clock for measuring delays
+ * @return microseconds since an unspecified point in time
+ */
+gint64 get_monotonic_time(void);
+
+/**
+ * Check if a call must stop
+ * @param settings caldav_settings
+ * @return TRUE if the call was cancelled or its deadline has passed
+ */
+gboolean caldav_expired(const caldav_settings* settings);
+
+/**
+ * Time left for a call
+ * @param settings caldav_settings
+ * @return microseconds until the deadline or G_MAXINT64 if there is none
+ */
+gint64 caldav_remaining(const caldav_settings* settings);
+
 /**
  * Fetch the etag element from XML
  * @param text String
@@ -242,6 +327,15 @@ GSList* get_tag_list(gchar* text);
  */
 gchar* rebuild_url(caldav_settings* setting, gchar* uri);
 
+/**
+ * Turn a Location returned from the server into an absolute URL
+ * @param settings caldav_settings
+ * @param location Absolute URL, absolute path or path relative to the
+ * collection
+ * @return URL
+ */
+gchar* resolve_location(caldav_settings* settings, const gchar* location);
+
 /**
  * Prepare a curl connection
  * @param settings caldav_settings
@@ -250,14 +344,38 @@ gchar* rebuild_url(caldav_settings* setting, gchar* uri);
 CURL* get_curl(caldav_settings* setting);
 
 /**
- * Search CalDAV store for a specific object's ETAG
- * @param chunk struct MemoryStruct containing response from server
+ * Body of the REPORT searching a collection for an object by UID.
+ * @param uid UID of the object
+ * @return calendar-query. Caller must free the memory.
+ */
+gchar* find_etag_query(const gchar* uid);
+
+/**
+ * Read the answer to the REPORT from find_etag_query. The object found is
+ * remembered in the session.
  * @param settings caldav_settings
+ * @param uid UID searched for
+ * @param code HTTP status of the answer
+ * @param body Body of the answer. May be NULL.
+ * @param href Pointer where the href of the object is returned. Caller
+ * must free the memory.
  * @param error caldav_error
- * @return ETAG from the object or NULL
+ * @return ETAG from the object without quotes or NULL
  */
-gchar* find_etag(struct MemoryStruct* chunk,
-  				 caldav_settings* settings,
+gchar* find_etag_answer(caldav_settings* settings, const gchar* uid,
+		long code, const gchar* body, gchar** href, caldav_error* error);
+
+/**
+ * Search CalDAV store for a specific object's ETAG. The session is asked
+ * first, in which case settings->etag_cached is set.
+ * @param settings caldav_settings. settings->file holds the object.
+ * @param href Pointer where the href of the object is returned. Caller
+ * must free the memory.
+ * @param error caldav_error
+ * @return ETAG from the object without quotes or NULL
+ */
+gchar* find_etag(caldav_settings* settings,
+				 gchar** href,
 				 caldav_error* error);
 
 /**
@@ -285,6 +403,97 @@ time_t get_time_t(const gchar* date);
 
 gchar* sanitize(gchar* s);
 
+/**
+ * Convert an iCalendar DATE or DATE-TIME value to time_t. Unlike get_time_t
+ * the result is a real UTC time_t. The value is read as UTC whether it
+ * carries the UTC designator or not, so only use it for values which are
+ * UTC by definition, eg. FREEBUSY. @see ical_zoned_time_to_utc
+ * @param value DATE (YYYYMMDD) or DATE-TIME (YYYYMMDDTHHMMSS[Z])
+ * @param is_date Pointer where TRUE is returned if value is a DATE. May be
+ * NULL.
+ * @return time_t or (time_t) -1 if value is not valid
+ */
+time_t ical_time_to_utc(const gchar* value, gboolean* is_date);
+
+/**
+ * Convert a UTC time_t to an iCalendar DATE-TIME in UTC
+ * @param time UTC time
+ * @return YYYYMMDDTHHMMSSZ. Caller must free the memory.
+ */
+gchar* utc_to_ical_time(time_t time);
+
+/**
+ * Convert an iCalendar DURATION value to seconds. A day is taken as
+ * 86400 seconds.
+ * @param value DURATION, eg. PT1H30M
+ * @param seconds Pointer where the duration is returned
+ * @return TRUE if value is valid, FALSE otherwise
+ */
+gboolean ical_duration(const gchar* value, gint64* seconds);
+
+/**
+ * Find the value of a property in the first component of a given type
+ * @param text iCal to search in
+ * @param type Component, eg. VEVENT
+ * @param name Property name, eg. DTSTART
+ * @param params Pointer where the parameters (without leading ';') are
+ * returned. May be NULL. Caller must free the memory.
+ * @return value or NULL if not found. Caller must free the memory.
+ */
+gchar* get_ical_property(const gchar* text, const gchar* type,
+		const gchar* name, gchar** params);
+
+/**
+ * Find the prefix a response uses for a namespace
+ * @param text Response from server
+ * @param caldav TRUE for the CalDAV namespace, FALSE for DAV
+ * @return prefix including ':' or "" if the namespace has no prefix.
+ * Caller must free the memory.
+ */
+gchar* get_ns_prefix(gchar* text, gboolean caldav);
+
+/**
+ * Called for every response element in a multistatus.
+ * @param response Start of the response element
+ * @param length Length of the response element
+ * @param dav Prefix used for the DAV namespace. @see get_ns_prefix
+ * @param cal Prefix used for the CalDAV namespace. @see get_ns_prefix
+ * @param data User data
+ */
+typedef void (*multistatus_func)(const gchar* response, gsize length,
+		const gchar* dav, const gchar* cal, gpointer data);
+
+/**
+ * Walk every response element in a multistatus response
+ * @param text Response from server
+ * @param func Function called for each response element
+ * @param data User data passed to func
+ * @return number of response elements
+ */
+guint parse_multistatus(gchar* text, multistatus_func func, gpointer data);
+
+/**
+ * First lines of the calendar made by parse_caldav_report
+ */
+extern const char* VCAL_HEAD;
+
+/**
+ * Last line of the calendar made by parse_caldav_report
+ */
+extern const char* VCAL_FOOT;
+
+/**
+ * Fetch the text of the first element with a given name
+ * @param text XML to search in
+ * @param length Length of text
+ * @param prefix Namespace prefix including ':'. @see get_ns_prefix
+ * @param name Element name
+ * @return text of the element with XML entities and CDATA decoded or NULL
+ * if not found. Caller must free the memory.
+ */
+gchar* get_element_text(const gchar* text, gsize length,
+		const gchar* prefix, const gchar* name);
+
 G_END_DECLS
 
 #endif
@@ -30,6 +30,19 @@
 #include "get-display-name.h"
 #include "options-caldav-server.h"
 #include "get-freebusy-report.h"
+#include "batch-caldav-object.h"
+#include "import-caldav-object.h"
+#include "attach-caldav-object.h"
+#include "caldav-session.h"
+#include "caldav-store.h"
+#include "caldav-freebusy.h"
+#include "caldav-executor.h"
+#include "caldav-limiter.h"
+#include "caldav-retry.h"
+#include "caldav-stats.h"
+#include "caldav-metrics.h"
+#include "caldav-trace.h"
+#include "caldav-upload.h"
 #include <curl/curl.h>
 #include <glib.h>
 #include <stdio.h>
@@ -39,12 +52,44 @@
 #include <gcrypt.h>
 #include <pthread.h>
 #include <errno.h>
+#include <unistd.h>
 
 GCRY_THREAD_OPTION_PTHREAD_IMPL;
 
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static int global_refs = 0;
+
+/*
+ * Take a reference on the global state. Caller must hold global_lock.
+ */
+static gboolean global_acquire(void) {
+	if (global_refs == 0) {
+		gcry_control(GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+		if (gnutls_global_init() != GNUTLS_E_SUCCESS)
+			return TRUE;
+		if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+			gnutls_global_deinit();
+			return TRUE;
+		}
+	}
+	global_refs++;
+	return FALSE;
+}
+
+/*
+ * Fallback for applications not calling caldav_global_init, or calling
+ * the library after the last caldav_global_cleanup. The reference taken
+ * here is never released.
+ */
+static void global_init_implicit(void) {
+	pthread_mutex_lock(&global_lock);
+	if (global_refs == 0)
+		global_acquire();
+	pthread_mutex_unlock(&global_lock);
+}
+
 static void init_runtime(runtime_info* info) {
-	gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
-    gnutls_global_init();
+	global_init_implicit();
     if (! info)
 		return;
     if (! info->error)
@@ -56,9 +101,30 @@ static void init_runtime(runtime_info* info) {
 		info->options->verify_ssl_certificate = 1;
 		info->options->use_locking = 1;
 		info->options->custom_cacert = NULL;
+		info->options->max_in_flight = 4;
+		info->options->connect_timeout = CALDAV_CONNECT_TIMEOUT;
+		info->options->low_speed_time = CALDAV_LOW_SPEED_TIME;
     }
 }
 
+/*
+ * Copy the timeouts and the handling of attachments of a runtime_info and
+ * start the clock for the call.
+ */
+static void init_timeouts(caldav_settings* settings, runtime_info* info) {
+	settings->connect_timeout = info->options->connect_timeout;
+	settings->timeout = info->options->timeout;
+	settings->low_speed_time = info->options->low_speed_time;
+	settings->cancel = info->options->cancel;
+	settings->strip_attachments = (info->options->strip_attachments) ?
+		TRUE : FALSE;
+	settings->attachment = info->options->attachment_callback;
+	settings->attachment_data = info->options->attachment_data;
+	if (info->options->deadline > 0)
+		settings->deadline = get_monotonic_time() +
+			(gint64) info->options->deadline * 1000;
+}
+
 /**
  * @param curl An instance of libcurl.
  * @param settings Defines CalDAV resource. Receiver is responsible for freeing
@@ -110,11 +176,42 @@ static gboolean make_caldav_call(caldav_settings* settings,
 		case MODIFY: result = caldav_modify(settings, info->error); break;
 		case GETCALNAME: result = caldav_getname(settings, info->error); break;
 		case FREEBUSY: result = caldav_freebusy(settings, info->error); break;
+		case ATTACH: result = caldav_attach(settings, info->error); break;
 		default: break;
 	}
 	return result;
 }
 
+/*
+ * A 412 after the ETAG came from the session means the object changed
+ * behind our back. The entry is already forgotten so one more try
+ * searches the server for the current ETAG.
+ * @param settings An instance of caldav_settings. @see caldav_settings
+ * @param object the object as handed to the failed call
+ * @param URL the URL as handed to the failed call
+ * @return TRUE if there was an error.
+ */
+static gboolean retry_stale_etag(caldav_settings* settings,
+				 const char* object,
+				 const char* URL,
+				 runtime_info* info) {
+	if (! settings->etag_cached || info->error->code != 412)
+		return TRUE;
+	settings->etag_cached = FALSE;
+	g_free(info->error->str);
+	info->error->str = NULL;
+	info->error->code = 0;
+	g_free(settings->file);
+	settings->file = g_strdup(object);
+	g_free(settings->username);
+	g_free(settings->password);
+	g_free(settings->url);
+	parse_url(settings, URL);
+	if (settings->ACTION == DELETE)
+		return caldav_delete(settings, info->error);
+	return caldav_modify(settings, info->error);
+}
+
 /**
  * @deprecated since this function can cause lost updates.
  * Function for adding a new event.
@@ -131,27 +228,17 @@ CALDAV_RESPONSE caldav_add_object(const char* object,
 	return caldav_id_add_object(NULL, object, URL, info);
 }
 
-/**
- * Function for adding an event.
- * id will contain unique identification for object. Either ETAG or Location.
- * @param id @see CALDAV_ID
- * @param object Appointment following ICal format (RFC2445). Receiver is
- * responsible for freeing the memory.
- * @param URL Defines CalDAV resource. Receiver is responsible for freeing
- * the memory. [http://][username[:password]@]host[:port]/url-path.
- * See (RFC1738).
- * @param info Pointer to a runtime_info structure. @see runtime_info
- * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
- */
-CALDAV_RESPONSE caldav_id_add_object(CALDAV_ID** id,
-					 const char* object,
+static CALDAV_RESPONSE add_object(CALDAV_ID** id,
+				     const char* object,
+				     caldav_source source,
+				     void* user_data,
+				     gint64 length,
 				     const char* URL,
-				     runtime_info* info) {
+				     runtime_info* info,
+				     const gchar* operation) {
 	caldav_settings settings;
 	CALDAV_RESPONSE caldav_response;
 
-	g_return_val_if_fail(info != NULL, TRUE);
-
 	init_runtime(info);
 	init_caldav_settings(&settings);
 	settings.file = g_strdup(object);
@@ -168,8 +255,16 @@ CALDAV_RESPONSE caldav_id_add_object(CALDAV_ID** id,
 		settings.use_locking = 1;
 	else
 		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, operation);
 	parse_url(&settings, URL);
-	gboolean res = make_caldav_call(&settings, info);
+	/* the object is read once for its UID before it is sent */
+	if (source)
+		settings.upload = caldav_upload_new(source, user_data, length,
+				info->error);
+	gboolean res = (source && ! settings.upload) ||
+			make_caldav_call(&settings, info);
 	if (res) {
 		if (info->error->code > 0) {
 			switch (info->error->code) {
@@ -187,25 +282,18 @@ CALDAV_RESPONSE caldav_id_add_object(CALDAV_ID** id,
 	}
 	else {
 		if (settings.id && settings.id->Type == CALDAV_LOCATION_TYPE) {
-			gchar* start = get_element_value(settings.file, "DTSTART");
-			if (start) {
-				settings.start = get_time_t(start);
-				g_free(start);
-				//start = get_caldav_datetime(&s);
-				gchar* end = get_element_value(settings.file, "DTEND");
-				if (end) {
-					settings.end = get_time_t(end);
-					g_free(end);
-					//end = get_caldav_datetime(&e);
-					g_free(settings.username);
-					g_free(settings.password);
-					g_free(settings.url);
-					parse_url(&settings, URL);
-					if (caldav_request_etag(&settings, info->error) == OK) {
-						settings.id->Ident.Location.etag = g_strdup(settings.etag);
-					}
-				}
-			}
+			caldav_error error;
+
+			error.code = 0;
+			error.str = NULL;
+			g_free(settings.username);
+			g_free(settings.password);
+			g_free(settings.url);
+			parse_url(&settings, URL);
+			/* an ETAG is nice to have, the object has been stored anyway */
+			if (! caldav_request_etag(&settings, &error))
+				settings.id->Ident.Location.etag = g_strdup(settings.etag);
+			g_free(error.str);
 		}
 		caldav_response = OK;
 	}
@@ -218,6 +306,27 @@ CALDAV_RESPONSE caldav_id_add_object(CALDAV_ID** id,
 	return caldav_response;
 }
 
+/**
+ * Function for adding an event.
+ * id will contain unique identification for object. Either ETAG or Location.
+ * @param id @see CALDAV_ID
+ * @param object Appointment following ICal format (RFC2445). Receiver is
+ * responsible for freeing the memory.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_add_object(CALDAV_ID** id,
+					 const char* object,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+
+	return add_object(id, object, NULL, NULL, 0, URL, info, G_STRFUNC);
+}
+
 /**
  * Function for deleting an event.
  * @param id @see CALDAV_ID
@@ -259,8 +368,13 @@ CALDAV_RESPONSE caldav_id_delete_object(CALDAV_ID* id,
 		settings.use_locking = 1;
 	else
 		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
 	parse_url(&settings, URL);
 	gboolean res = make_caldav_call(&settings, info);
+	if (res && settings.ACTION == DELETE)
+		res = retry_stale_etag(&settings, object, URL, info);
 	if (res) {
 		if (info->error->code > 0) {
 			switch (info->error->code) {
@@ -315,27 +429,17 @@ CALDAV_RESPONSE caldav_modify_object(const char* object,
 	return caldav_id_modify_object(NULL, object, URL, info);
 }
 
-/**
- * Function for modifying an event.
- * id will contain unique identification for object. Either ETAG or Location.
- * @param id @see CALDAV_ID
- * @param object Appointment following ICal format (RFC2445). Receiver is
- * responsible for freeing the memory.
- * @param URL Defines CalDAV resource. Receiver is responsible for freeing
- * the memory. [http://][username[:password]@]host[:port]/url-path.
- * See (RFC1738).
- * @param info Pointer to a runtime_info structure. @see runtime_info
- * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
- */
-CALDAV_RESPONSE caldav_id_modify_object(CALDAV_ID** id,
-					 const char* object,
+static CALDAV_RESPONSE modify_object(CALDAV_ID** id,
+				     const char* object,
+				     caldav_source source,
+				     void* user_data,
+				     gint64 length,
 				     const char* URL,
-				     runtime_info* info) {
+				     runtime_info* info,
+				     const gchar* operation) {
 	caldav_settings settings;
 	CALDAV_RESPONSE caldav_response;
 
-	g_return_val_if_fail(info != NULL, TRUE);
-
 	init_runtime(info);
 	init_caldav_settings(&settings);
 	settings.file = g_strdup(object);
@@ -360,8 +464,18 @@ CALDAV_RESPONSE caldav_id_modify_object(CALDAV_ID** id,
 		settings.use_locking = 1;
 	else
 		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, operation);
 	parse_url(&settings, URL);
-	gboolean res = make_caldav_call(&settings, info);
+	/* the object is read once for its UID before it is sent */
+	if (source)
+		settings.upload = caldav_upload_new(source, user_data, length,
+				info->error);
+	gboolean res = (source && ! settings.upload) ||
+			make_caldav_call(&settings, info);
+	if (res && settings.ACTION == MODIFY)
+		res = retry_stale_etag(&settings, object, URL, info);
 	if (res) {
 		if (info->error->code > 0) {
 			switch (info->error->code) {
@@ -379,25 +493,18 @@ CALDAV_RESPONSE caldav_id_modify_object(CALDAV_ID** id,
 	}
 	else {
 		if (settings.id && settings.id->Type == CALDAV_LOCATION_TYPE) {
-			gchar* start = get_element_value(settings.file, "DTSTART");
-			if (start) {
-				settings.start = get_time_t(start);
-				g_free(start);
-				//start = get_caldav_datetime(&s);
-				gchar* end = get_element_value(settings.file, "DTEND");
-				if (end) {
-					settings.end = get_time_t(end);
-					g_free(end);
-					//end = get_caldav_datetime(&e);
-					g_free(settings.username);
-					g_free(settings.password);
-					g_free(settings.url);
-					parse_url(&settings, URL);
-					if (caldav_request_etag(&settings, info->error) == OK) {
-						settings.id->Ident.Location.etag = g_strdup(settings.etag);
-					}
-				}
-			}
+			caldav_error error;
+
+			error.code = 0;
+			error.str = NULL;
+			g_free(settings.username);
+			g_free(settings.password);
+			g_free(settings.url);
+			parse_url(&settings, URL);
+			/* an ETAG is nice to have, the object has been stored anyway */
+			if (! caldav_request_etag(&settings, &error))
+				settings.id->Ident.Location.etag = g_strdup(settings.etag);
+			g_free(error.str);
 		}
 		caldav_response = OK;
 	}
@@ -411,37 +518,168 @@ CALDAV_RESPONSE caldav_id_modify_object(CALDAV_ID** id,
 }
 
 /**
- * Function for getting a collection of events determined by time range.
- * @param result A pointer to struct _response where the result is to stored.
- * @see response. Caller is responsible for freeing the memory.
- * @param start time_t variable specifying start and end for range. Both
- * are included in range.
- * @param end time_t variable specifying start and end for range. Both
- * are included in range.
+ * Function for modifying an event.
+ * id will contain unique identification for object. Either ETAG or Location.
+ * @param id @see CALDAV_ID
+ * @param object Appointment following ICal format (RFC2445). Receiver is
+ * responsible for freeing the memory.
  * @param URL Defines CalDAV resource. Receiver is responsible for freeing
  * the memory. [http://][username[:password]@]host[:port]/url-path.
  * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
  * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
  */
-CALDAV_RESPONSE caldav_get_object(response *result,
-				  time_t start,
-				  time_t end,
-				  const char* URL,
-				  runtime_info* info) {
-	caldav_settings settings;
-	CALDAV_RESPONSE caldav_response;
+CALDAV_RESPONSE caldav_id_modify_object(CALDAV_ID** id,
+					 const char* object,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+
+	return modify_object(id, object, NULL, NULL, 0, URL, info, G_STRFUNC);
+}
+
+static long read_fd(char* buffer, size_t length, gint64 offset,
+		void* user_data) {
+	int fd = *(int *) user_data;
+	ssize_t n;
+
+	do {
+		n = pread(fd, buffer, length, (off_t) offset);
+	} while (n < 0 && errno == EINTR);
+	return (n < 0) ? -1 : n;
+}
+
+/**
+ * Function for adding an event which is not held in memory. The object is
+ * read from source while it is sent, without copies. Like
+ * caldav_id_add_object a UID is added before END:VEVENT if the object has
+ * none, which is found by reading the object once before it is sent.
+ * id will contain unique identification for object. Either ETAG or Location.
+ * @param id @see CALDAV_ID
+ * @param source Function reading the object. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the object could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_add_object_source(CALDAV_ID** id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(source != NULL, CONFLICT);
+
+	return add_object(id, NULL, source, user_data, length, URL, info,
+			G_STRFUNC);
+}
+
+/**
+ * Function for adding an event read from a file descriptor.
+ * @see caldav_id_add_object_source
+ * @param id @see CALDAV_ID
+ * @param fd File descriptor for a regular file holding the object. It is
+ * read with pread so the file offset is not changed.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the file could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_add_object_fd(CALDAV_ID** id,
+					 int fd,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(fd >= 0, CONFLICT);
+
+	return add_object(id, NULL, read_fd, &fd, length, URL, info, G_STRFUNC);
+}
+
+/**
+ * Function for modifying an event which is not held in memory.
+ * @see caldav_id_add_object_source
+ * If id is NULL the object is found on the server by its UID like
+ * caldav_modify_object does.
+ * @param id @see CALDAV_ID
+ * @param source Function reading the object. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the object could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_modify_object_source(CALDAV_ID** id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(source != NULL, CONFLICT);
+
+	return modify_object(id, NULL, source, user_data, length, URL, info,
+			G_STRFUNC);
+}
 
+/**
+ * Function for modifying an event read from a file descriptor.
+ * @see caldav_id_modify_object_source
+ * @param id @see CALDAV_ID
+ * @param fd File descriptor for a regular file holding the object. It is
+ * read with pread so the file offset is not changed.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the file could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_modify_object_fd(CALDAV_ID** id,
+					 int fd,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info) {
 	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(fd >= 0, CONFLICT);
+
+	return modify_object(id, NULL, read_fd, &fd, length, URL, info,
+			G_STRFUNC);
+}
+
+static CALDAV_RESPONSE attach_object(CALDAV_ID** id,
+				     const char* managed_id,
+				     caldav_source source,
+				     void* user_data,
+				     gint64 length,
+				     const char* filename,
+				     const char* content_type,
+				     char** new_id,
+				     const char* URL,
+				     runtime_info* info,
+				     const gchar* operation) {
+	caldav_settings settings;
+	CALDAV_RESPONSE caldav_response;
 
 	init_runtime(info);
-	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
-	}
 	init_caldav_settings(&settings);
-	settings.ACTION = GET;
-	settings.start = start;
-	settings.end = end;
+	settings.ACTION = ATTACH;
+	settings.id = caldav_copy_caldav_id(*id);
+	settings.managed_id = g_strdup(managed_id);
+	settings.attach_name = g_strdup(filename);
+	settings.attach_type = g_strdup(content_type);
 	if (info->options->debug)
 		settings.debug = TRUE;
 	else
@@ -450,14 +688,15 @@ CALDAV_RESPONSE caldav_get_object(response *result,
 		settings.trace_ascii = 1;
 	else
 		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, operation);
 	parse_url(&settings, URL);
-	gboolean res = make_caldav_call(&settings, info);
-	if (res) {
-		result->msg = NULL;
+	/* the attachment is sent as it is */
+	if (source)
+		settings.upload = caldav_upload_new_raw(source, user_data, length);
+	if (make_caldav_call(&settings, info)) {
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: caldav_response = FORBIDDEN; break;
@@ -473,7 +712,10 @@ CALDAV_RESPONSE caldav_get_object(response *result,
 		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
+		if (new_id)
+			*new_id = g_strdup(settings.managed_id);
+		caldav_free_caldav_id(id);
+		*id = caldav_copy_caldav_id(settings.id);
 		caldav_response = OK;
 	}
 	free_caldav_settings(&settings);
@@ -481,29 +723,125 @@ CALDAV_RESPONSE caldav_get_object(response *result,
 }
 
 /**
- * Function for getting all events from the collection.
- * @param result A pointer to struct _response where the result is to stored.
- * @see response. Caller is responsible for freeing the memory.
+ * Function for adding a managed attachment (RFC8607) to an event. The
+ * attachment is stored by the server, which references it from the event
+ * with an ATTACH property holding a URL, so the event itself stays small.
+ * id must hold the ETAG or Location of the event and will hold the new ETAG
+ * of the event afterwards, empty if the server did not return one.
+ * @param id @see CALDAV_ID
+ * @param source Function reading the attachment. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the attachment in bytes
+ * @param filename Name of the attachment. May be NULL.
+ * @param content_type Media type of the attachment. NULL for
+ * application/octet-stream.
+ * @param managed_id Pointer where the id the server gave the attachment is
+ * returned. Caller must free the memory. May be NULL.
  * @param URL Defines CalDAV resource. Receiver is responsible for freeing
  * the memory. [http://][username[:password]@]host[:port]/url-path.
  * See (RFC1738).
- * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, CONFLICT, or NOTIMPLEMENTED if the server does
+ * not support managed attachments. @see CALDAV_RESPONSE
  */
-CALDAV_RESPONSE caldav_getall_object(response* result,
+CALDAV_RESPONSE caldav_id_add_attachment(CALDAV_ID** id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+					 const char* filename,
+					 const char* content_type,
+					 char** managed_id,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(id && *id && source, CONFLICT);
+
+	return attach_object(id, NULL, source, user_data, length, filename,
+			content_type, managed_id, URL, info, G_STRFUNC);
+}
+
+/**
+ * Function for replacing the data of a managed attachment (RFC8607).
+ * @see caldav_id_add_attachment
+ * @param id @see CALDAV_ID
+ * @param managed_id Id the server gave the attachment
+ * @param source Function reading the attachment. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the attachment in bytes
+ * @param filename Name of the attachment. May be NULL.
+ * @param content_type Media type of the attachment. NULL for
+ * application/octet-stream.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, CONFLICT, or NOTIMPLEMENTED if the server does
+ * not support managed attachments. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_update_attachment(CALDAV_ID** id,
+					 const char* managed_id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+					 const char* filename,
+					 const char* content_type,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(id && *id && managed_id && source, CONFLICT);
+
+	return attach_object(id, managed_id, source, user_data, length, filename,
+			content_type, NULL, URL, info, G_STRFUNC);
+}
+
+/**
+ * Function for removing a managed attachment (RFC8607) from an event.
+ * @see caldav_id_add_attachment
+ * @param id @see CALDAV_ID
+ * @param managed_id Id the server gave the attachment
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, CONFLICT, or NOTIMPLEMENTED if the server does
+ * not support managed attachments. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_remove_attachment(CALDAV_ID** id,
+					 const char* managed_id,
 				     const char* URL,
 				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(id && *id && managed_id, CONFLICT);
+
+	return attach_object(id, managed_id, NULL, NULL, 0, NULL, NULL, NULL, URL,
+			info, G_STRFUNC);
+}
+
+/**
+ * Function for adding, modifying and deleting a number of events in one call.
+ * @param items Array of caldav_batch_item. @see caldav_batch_item
+ * @param count Number of items in the array
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every item succeeded, otherwise the result for the first
+ * failed item. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_batch_objects(caldav_batch_item* items,
+					 int count,
+					 const char* URL,
+					 runtime_info* info) {
 	caldav_settings settings;
 	CALDAV_RESPONSE caldav_response;
+	CURL* curl;
+	gboolean res = TRUE;
+	int i;
 
 	g_return_val_if_fail(info != NULL, TRUE);
 
 	init_runtime(info);
-	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
-	}
 	init_caldav_settings(&settings);
-	settings.ACTION = GETALL;
 	if (info->options->debug)
 		settings.debug = TRUE;
 	else
@@ -512,14 +850,24 @@ CALDAV_RESPONSE caldav_getall_object(response* result,
 		settings.trace_ascii = 1;
 	else
 		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
+	settings.use_locking = 0;
+	settings.max_in_flight = info->options->max_in_flight;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
 	parse_url(&settings, URL);
-	gboolean res = make_caldav_call(&settings, info);
+	curl = get_curl(&settings);
+	if (!curl) {
+		info->error->code = -1;
+		info->error->str = g_strdup("Could not initialize libcurl");
+	}
+	else {
+		/* probe the server once for the whole batch */
+		if (test_caldav_enabled(curl, &settings, info->error))
+			res = caldav_batch(&settings, items, count, info->error);
+		curl_easy_cleanup(curl);
+	}
 	if (res) {
-		result->msg = NULL;
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: caldav_response = FORBIDDEN; break;
@@ -533,27 +881,482 @@ CALDAV_RESPONSE caldav_getall_object(response* result,
 			/* fall-back to conflicting state */
 			caldav_response = CONFLICT;
 		}
+		for (i = 0; items && i < count; i++) {
+			if (items[i].code == 0) {
+				/* never sent */
+				items[i].code = info->error->code;
+				items[i].result = caldav_response;
+			}
+		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
 		caldav_response = OK;
 	}
 	free_caldav_settings(&settings);
 	return caldav_response;
 }
 
+static void collect_resource(const gchar* uid, gchar* resource,
+		gpointer data) {
+	GSList** objects = (GSList **) data;
+
+	/* a NULL object (override which cannot be merged) fails in the batch */
+	*objects = g_slist_prepend(*objects, resource);
+}
+
 /**
- * Function for getting the stored display name for the collection.
- * @param result A pointer to struct _response where the result is to stored.
- * @see response. Caller is responsible for freeing the memory.
+ * Function for adding every event in an iCalendar containing several
+ * events. Components sharing a UID are stored as one object.
+ * @param items Address to a pointer where an array of caldav_batch_item is
+ * returned. Caller is responsible for freeing the memory.
+ * @param count Pointer where the number of items is returned
+ * @param calendar iCalendar (RFC2445) containing one or more VEVENTs.
  * @param URL Defines CalDAV resource. Receiver is responsible for freeing
  * the memory. [http://][username[:password]@]host[:port]/url-path.
  * See (RFC1738).
- * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every event was added, otherwise the result for the first
+ * failed event. @see CALDAV_RESPONSE
  */
-CALDAV_RESPONSE caldav_get_displayname(response* result,
-				       const char* URL,
-				       runtime_info* info) {
+CALDAV_RESPONSE caldav_batch_add_calendar(caldav_batch_item** items,
+					 int* count,
+					 const char* calendar,
+					 const char* URL,
+					 runtime_info* info) {
+	GSList* objects = NULL;
+	GSList* head;
+	ical_splitter* splitter;
+	int i;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(items != NULL && count != NULL, CONFLICT);
+
+	splitter = ical_splitter_new(collect_resource, &objects, 0);
+	if (calendar)
+		ical_splitter_feed(splitter, calendar, strlen(calendar));
+	ical_splitter_finish(splitter);
+	ical_splitter_free(splitter);
+	objects = g_slist_reverse(objects);
+	*count = g_slist_length(objects);
+	*items = g_new0(caldav_batch_item, *count);
+	for (i = 0, head = objects; head; head = g_slist_next(head), i++) {
+		(*items)[i].action = ADD;
+		(*items)[i].object = (const char *) head->data;
+	}
+	g_slist_free(objects);
+	return caldav_batch_objects(*items, *count, URL, info);
+}
+
+/**
+ * Function for freeing memory for an array of caldav_batch_item returned
+ * by caldav_batch_add_calendar.
+ * @param items Address to a pointer to an array of caldav_batch_item
+ * @param count Number of items in the array
+ */
+void caldav_free_batch_items(caldav_batch_item** items, int count) {
+	caldav_batch_item* tmp;
+	int i;
+
+	if (*items) {
+		tmp = *items;
+		for (i = 0; i < count; i++) {
+			g_free((gchar *) tmp[i].object);
+			if (tmp[i].id)
+				caldav_free_caldav_id(&tmp[i].id);
+		}
+		g_free(tmp);
+		*items = tmp = NULL;
+	}
+}
+
+static CALDAV_RESPONSE import_calendar(int fd,
+				 const char* buffer,
+				 size_t length,
+				 const char* URL,
+				 caldav_import_callback callback,
+				 void* user_data,
+				 runtime_info* info,
+				 const gchar* operation) {
+	caldav_settings settings;
+	CALDAV_RESPONSE caldav_response;
+	CURL* curl;
+	gboolean res = TRUE;
+
+	init_runtime(info);
+	init_caldav_settings(&settings);
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
+	if (info->options->trace_ascii)
+		settings.trace_ascii = 1;
+	else
+		settings.trace_ascii = 0;
+	settings.use_locking = 0;
+	settings.max_in_flight = info->options->max_in_flight;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, operation);
+	parse_url(&settings, URL);
+	curl = get_curl(&settings);
+	if (!curl) {
+		info->error->code = -1;
+		info->error->str = g_strdup("Could not initialize libcurl");
+	}
+	else {
+		/* probe the server once for the whole import */
+		if (test_caldav_enabled(curl, &settings, info->error))
+			res = caldav_import(&settings, fd, buffer, length,
+					callback, user_data, info->error);
+		curl_easy_cleanup(curl);
+	}
+	if (res) {
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: caldav_response = FORBIDDEN; break;
+				case 409: caldav_response = CONFLICT; break;
+				case 423: caldav_response = LOCKED; break;
+				case 501: caldav_response = NOTIMPLEMENTED; break;
+				default: caldav_response = CONFLICT; break;
+			}
+		}
+		else {
+			/* fall-back to conflicting state */
+			caldav_response = CONFLICT;
+		}
+	}
+	else {
+		caldav_response = OK;
+	}
+	free_caldav_settings(&settings);
+	return caldav_response;
+}
+
+/**
+ * Function for importing an iCalendar stream into a collection.
+ * @param fd File descriptor to read the iCalendar (RFC2445) from.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Called with the outcome for every object. May be NULL.
+ * @param user_data Passed to callback.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every object was stored, otherwise the result for the first
+ * failed object. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_import_fd(int fd,
+				 const char* URL,
+				 caldav_import_callback callback,
+				 void* user_data,
+				 runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(fd >= 0, CONFLICT);
+
+	return import_calendar(fd, NULL, 0, URL, callback, user_data, info,
+			G_STRFUNC);
+}
+
+/**
+ * Function for importing an iCalendar held in memory into a collection.
+ * @param buffer iCalendar (RFC2445). Need not be zero terminated.
+ * @param length Length of buffer.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Called with the outcome for every object. May be NULL.
+ * @param user_data Passed to callback.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every object was stored, otherwise the result for the first
+ * failed object. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_import_buffer(const char* buffer,
+				 size_t length,
+				 const char* URL,
+				 caldav_import_callback callback,
+				 void* user_data,
+				 runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(buffer != NULL, CONFLICT);
+
+	return import_calendar(-1, buffer, length, URL, callback, user_data,
+			info, G_STRFUNC);
+}
+
+/**
+ * Function for getting a collection of events determined by time range.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param start time_t variable specifying start and end for range. Both
+ * are included in range.
+ * @param end time_t variable specifying start and end for range. Both
+ * are included in range.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_get_object(response *result,
+				  time_t start,
+				  time_t end,
+				  const char* URL,
+				  runtime_info* info) {
+	caldav_settings settings;
+	CALDAV_RESPONSE caldav_response;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+
+	init_runtime(info);
+	if (!result) {
+		result = malloc(sizeof(response *));
+		memset(result, '\0', sizeof(response *));
+	}
+	init_caldav_settings(&settings);
+	settings.ACTION = GET;
+	settings.start = start;
+	settings.end = end;
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
+	if (info->options->trace_ascii)
+		settings.trace_ascii = 1;
+	else
+		settings.trace_ascii = 0;
+	if (info->options->use_locking)
+		settings.use_locking = 1;
+	else
+		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
+	parse_url(&settings, URL);
+	gboolean res = make_caldav_call(&settings, info);
+	if (res) {
+		result->msg = NULL;
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: caldav_response = FORBIDDEN; break;
+				case 409: caldav_response = CONFLICT; break;
+				case 423: caldav_response = LOCKED; break;
+				case 501: caldav_response = NOTIMPLEMENTED; break;
+				default: caldav_response = CONFLICT; break;
+			}
+		}
+		else {
+			/* fall-back to conflicting state */
+			caldav_response = CONFLICT;
+		}
+	}
+	else {
+		result->msg = g_strdup(settings.file);
+		caldav_response = OK;
+	}
+	free_caldav_settings(&settings);
+	return caldav_response;
+}
+
+/**
+ * Function for getting all events from the collection.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_getall_object(response* result,
+				     const char* URL,
+				     runtime_info* info) {
+	caldav_settings settings;
+	CALDAV_RESPONSE caldav_response;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+
+	init_runtime(info);
+	if (!result) {
+		result = malloc(sizeof(response *));
+		memset(result, '\0', sizeof(response *));
+	}
+	init_caldav_settings(&settings);
+	settings.ACTION = GETALL;
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
+	if (info->options->trace_ascii)
+		settings.trace_ascii = 1;
+	else
+		settings.trace_ascii = 0;
+	if (info->options->use_locking)
+		settings.use_locking = 1;
+	else
+		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
+	parse_url(&settings, URL);
+	gboolean res = make_caldav_call(&settings, info);
+	if (res) {
+		result->msg = NULL;
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: caldav_response = FORBIDDEN; break;
+				case 409: caldav_response = CONFLICT; break;
+				case 423: caldav_response = LOCKED; break;
+				case 501: caldav_response = NOTIMPLEMENTED; break;
+				default: caldav_response = CONFLICT; break;
+			}
+		}
+		else {
+			/* fall-back to conflicting state */
+			caldav_response = CONFLICT;
+		}
+	}
+	else {
+		result->msg = g_strdup(settings.file);
+		caldav_response = OK;
+	}
+	free_caldav_settings(&settings);
+	return caldav_response;
+}
+
+static CALDAV_RESPONSE getall_to_sink(caldav_sink sink,
+				     void* user_data,
+				     gboolean raw,
+				     const char* URL,
+				     runtime_info* info,
+				     const gchar* operation) {
+	caldav_settings settings;
+	CALDAV_RESPONSE caldav_response;
+
+	init_runtime(info);
+	init_caldav_settings(&settings);
+	settings.ACTION = GETALL;
+	settings.sink = sink;
+	settings.sink_data = user_data;
+	settings.sink_raw = raw;
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
+	if (info->options->trace_ascii)
+		settings.trace_ascii = 1;
+	else
+		settings.trace_ascii = 0;
+	if (info->options->use_locking)
+		settings.use_locking = 1;
+	else
+		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, operation);
+	parse_url(&settings, URL);
+	gboolean res = make_caldav_call(&settings, info);
+	if (res) {
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: caldav_response = FORBIDDEN; break;
+				case 409: caldav_response = CONFLICT; break;
+				case 423: caldav_response = LOCKED; break;
+				case 501: caldav_response = NOTIMPLEMENTED; break;
+				default: caldav_response = CONFLICT; break;
+			}
+		}
+		else {
+			/* fall-back to conflicting state */
+			caldav_response = CONFLICT;
+		}
+	}
+	else {
+		caldav_response = OK;
+	}
+	free_caldav_settings(&settings);
+	return caldav_response;
+}
+
+/**
+ * Function for getting all events from the collection without holding
+ * them in memory. The calendar is handed to sink while the response
+ * arrives, so memory use is bounded by the largest single object rather
+ * than by the collection. Unlike caldav_getall_object XML entities in the
+ * calendar data are decoded. A time zone first found after an event was
+ * written follows that event. Since output cannot be taken back a download
+ * failing after it started is not retried.
+ * @param sink Function receiving the calendar. @see caldav_sink
+ * @param user_data Passed to sink.
+ * @param raw FALSE for one VCALENDAR with the events of the collection like
+ * caldav_getall_object returns, TRUE for the calendar data of every object
+ * as stored, one VCALENDAR after the other.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if sink stopped the
+ * download. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_getall_object_sink(caldav_sink sink,
+				     void* user_data,
+				     gboolean raw,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(sink != NULL, CONFLICT);
+
+	return getall_to_sink(sink, user_data, raw, URL, info, G_STRFUNC);
+}
+
+static int write_fd(const char* data, size_t length, void* user_data) {
+	int fd = *(int *) user_data;
+	ssize_t written;
+
+	while (length > 0) {
+		written = write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += written;
+		length -= written;
+	}
+	return 0;
+}
+
+/**
+ * Function for writing all events from the collection to a file
+ * descriptor. @see caldav_getall_object_sink
+ * @param fd File descriptor to write the calendar to
+ * @param raw FALSE for one VCALENDAR, TRUE for the calendar data of every
+ * object as stored.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if writing failed.
+ * @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_getall_object_fd(int fd,
+				     gboolean raw,
+				     const char* URL,
+				     runtime_info* info) {
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(fd >= 0, CONFLICT);
+
+	return getall_to_sink(write_fd, &fd, raw, URL, info, G_STRFUNC);
+}
+
+/**
+ * Function for getting the stored display name for the collection.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_get_displayname(response* result,
+				       const char* URL,
+				       runtime_info* info) {
 	caldav_settings settings;
 	CALDAV_RESPONSE caldav_response;
 
@@ -578,6 +1381,9 @@ CALDAV_RESPONSE caldav_get_displayname(response* result,
 		settings.use_locking = 1;
 	else
 		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
 	parse_url(&settings, URL);
 	gboolean res = make_caldav_call(&settings, info);
 	if (res) {
@@ -622,6 +1428,9 @@ int caldav_enabled_resource(const char* URL, runtime_info* info) {
 	init_runtime(info);
 	init_caldav_settings(&settings);
 
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
 	parse_url(&settings, URL);
 	curl = get_curl(&settings);
 	if (!curl) {
@@ -639,12 +1448,12 @@ int caldav_enabled_resource(const char* URL, runtime_info* info) {
 		settings.use_locking = 1;
 	else
 		settings.use_locking = 0;
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
 
-	if (info->options->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, &settings, &data);
 	gboolean res = test_caldav_enabled(curl, &settings, info->error);
 	free_caldav_settings(&settings);
 	curl_easy_cleanup(curl);
@@ -654,7 +1463,7 @@ int caldav_enabled_resource(const char* URL, runtime_info* info) {
 /**
  * Function for getting free/busy information.
  * @param result A pointer to struct _response where the result is to stored.
- * @see response. Caller is responsible for freeing the memory.
+ * May be NULL. @see response. Caller is responsible for freeing the memory.
  * @param start time_t variable specifying start and end for range. Both
  * are included in range.
  * @param end time_t variable specifying start and end for range. Both
@@ -671,34 +1480,124 @@ CALDAV_RESPONSE caldav_get_freebusy(response *result,
 				  runtime_info* info) {
 	caldav_settings settings;
 	CALDAV_RESPONSE caldav_response;
+	response* local = NULL;
 
 	g_return_val_if_fail(info != NULL, TRUE);
 
 	init_runtime(info);
-	if (!result) {
-		result = malloc(sizeof(response *));
-		memset(result, '\0', sizeof(response *));
+	if (!result)
+		result = local = g_new0(response, 1);
+	init_caldav_settings(&settings);
+	settings.ACTION = FREEBUSY;
+	settings.start = start;
+	settings.end = end;
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
+	if (info->options->trace_ascii)
+		settings.trace_ascii = 1;
+	else
+		settings.trace_ascii = 0;
+	if (info->options->use_locking)
+		settings.use_locking = 1;
+	else
+		settings.use_locking = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
+	parse_url(&settings, URL);
+	gboolean res = make_caldav_call(&settings, info);
+	if (res) {
+		result->msg = NULL;
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: caldav_response = FORBIDDEN; break;
+				case 409: caldav_response = CONFLICT; break;
+				case 423: caldav_response = LOCKED; break;
+				case 501: caldav_response = NOTIMPLEMENTED; break;
+				default: caldav_response = CONFLICT; break;
+			}
+		}
+		else {
+			/* fall-back to conflicting state */
+			caldav_response = CONFLICT;
+		}
+	}
+	else {
+		GArray* periods;
+		result->msg = g_strdup(settings.file);
+		periods = busy_parse_merged(result->msg);
+		g_free(result->periods);
+		result->count = periods->len;
+		result->periods = (caldav_period *) g_array_free(periods, FALSE);
+		caldav_response = OK;
+	}
+	free_caldav_settings(&settings);
+	caldav_free_response(&local);
+	return caldav_response;
+}
+
+/**
+ * Function for getting free/busy information from several calendars at
+ * once. The free-busy-query requests are sent concurrently, at most
+ * info->options->max_in_flight at a time, over connections shared between
+ * the requests. The FREEBUSY periods in each answer are parsed, merged and
+ * stored in the item for the calendar.
+ * @param items Array of caldav_freebusy_item with URL set for each
+ * calendar. @see caldav_freebusy_item. Free the periods with
+ * caldav_free_freebusy_items.
+ * @param count Number of items in the array
+ * @param start Start of range in UTC seconds since the epoch
+ * @param end End of range in UTC seconds since the epoch
+ * @param merged Pointer to a caldav_freebusy_item where the busy periods
+ * of all calendars merged together are stored. May be NULL.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every calendar answered, otherwise the result for the
+ * first failed calendar. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_get_freebusy_multi(caldav_freebusy_item* items,
+				int count,
+				time_t start,
+				time_t end,
+				caldav_freebusy_item* merged,
+				runtime_info* info) {
+	caldav_settings* settings;
+	CALDAV_RESPONSE caldav_response;
+	GArray* all;
+	GArray* periods;
+	gboolean res;
+	int i;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+
+	init_runtime(info);
+	if (! items || count <= 0)
+		return OK;
+	settings = g_new0(caldav_settings, count);
+	for (i = 0; i < count; i++) {
+		init_caldav_settings(&settings[i]);
+		if (info->options->debug)
+			settings[i].debug = TRUE;
+		else
+			settings[i].debug = FALSE;
+		if (info->options->trace_ascii)
+			settings[i].trace_ascii = 1;
+		else
+			settings[i].trace_ascii = 0;
+		settings[i].max_in_flight = info->options->max_in_flight;
+		settings[i].session = info->session;
+		init_timeouts(&settings[i], info);
+		/* the calendars share the counters of one call */
+		if (i == 0)
+			caldav_stats_begin(&settings[0], G_STRFUNC);
+		else
+			settings[i].stats = settings[0].stats;
+		parse_url(&settings[i], items[i].URL);
 	}
-	init_caldav_settings(&settings);
-	settings.ACTION = FREEBUSY;
-	settings.start = start;
-	settings.end = end;
-	if (info->options->debug)
-		settings.debug = TRUE;
-	else
-		settings.debug = FALSE;
-	if (info->options->trace_ascii)
-		settings.trace_ascii = 1;
-	else
-		settings.trace_ascii = 0;
-	if (info->options->use_locking)
-		settings.use_locking = 1;
-	else
-		settings.use_locking = 0;
-	parse_url(&settings, URL);
-	gboolean res = make_caldav_call(&settings, info);
+	res = caldav_freebusy_multi(settings, items, count, start, end,
+			info->error);
 	if (res) {
-		result->msg = NULL;
 		if (info->error->code > 0) {
 			switch (info->error->code) {
 				case 403: caldav_response = FORBIDDEN; break;
@@ -714,13 +1613,47 @@ CALDAV_RESPONSE caldav_get_freebusy(response *result,
 		}
 	}
 	else {
-		result->msg = g_strdup(settings.file);
 		caldav_response = OK;
 	}
-	free_caldav_settings(&settings);
+	if (merged) {
+		/* union of the calendars which answered */
+		all = g_array_new(FALSE, FALSE, sizeof(caldav_period));
+		for (i = 0; i < count; i++) {
+			if (items[i].periods)
+				g_array_append_vals(all, items[i].periods, items[i].count);
+		}
+		periods = busy_merge(all, start, end);
+		g_array_free(all, TRUE);
+		merged->result = caldav_response;
+		merged->code = (res) ? info->error->code : 0;
+		merged->count = periods->len;
+		merged->periods = (caldav_period *) g_array_free(periods, FALSE);
+	}
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			settings[i].stats = NULL;	/* owned by settings[0] */
+		free_caldav_settings(&settings[i]);
+	}
+	g_free(settings);
 	return caldav_response;
 }
 
+/**
+ * Function for freeing the periods in an array of caldav_freebusy_item.
+ * The array itself is owned by the caller.
+ * @param items Array of caldav_freebusy_item
+ * @param count Number of items in the array
+ */
+void caldav_free_freebusy_items(caldav_freebusy_item* items, int count) {
+	int i;
+
+	for (i = 0; items && i < count; i++) {
+		g_free(items[i].periods);
+		items[i].periods = NULL;
+		items[i].count = 0;
+	}
+}
+
 /**
  * Function which supports sending various options inside the library.
  * @param curl_options A struct debug_curl. See debug_curl.
@@ -779,6 +1712,9 @@ char** caldav_get_server_options(const char* URL, runtime_info* info) {
 	tmp = option_list = NULL;
 	init_caldav_settings(&settings);
 
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
 	parse_url(&settings, URL);
 	curl = get_curl(&settings);
 	if (!curl) {
@@ -807,6 +1743,148 @@ char** caldav_get_server_options(const char* URL, runtime_info* info) {
 	return (option_list) ? option_list : NULL;
 }
 
+/**
+ * Function for initializing the libraries used by libcaldav (libcurl,
+ * gnutls and libgcrypt). The first call must happen before any threads
+ * using the library are started. Calls can be nested and every call
+ * must be matched by a call to caldav_global_cleanup. A call to the
+ * library while it is not initialized, because this function was never
+ * called or everything was released again, does the same initialization
+ * itself and keeps it until the process ends.
+ * @return TRUE if initialization failed, FALSE otherwise.
+ */
+gboolean caldav_global_init(void) {
+	gboolean result;
+
+	pthread_mutex_lock(&global_lock);
+	result = global_acquire();
+	pthread_mutex_unlock(&global_lock);
+	return result;
+}
+
+/**
+ * Function for releasing what caldav_global_init acquired. The last
+ * call must happen after all threads using the library are finished.
+ */
+void caldav_global_cleanup(void) {
+	pthread_mutex_lock(&global_lock);
+	if (global_refs > 0 && --global_refs == 0) {
+		curl_global_cleanup();
+		gnutls_global_deinit();
+	}
+	pthread_mutex_unlock(&global_lock);
+}
+
+/**
+ * Function for limiting the requests sent to a host. The limits apply to
+ * every thread in the process. A request waits until the host has a free
+ * slot and a token in its bucket. When a host answers 429 or 503 no more
+ * requests are sent to it until the time given by Retry-After has passed.
+ * By default there are no limits besides Retry-After.
+ * @param URL Any URL on the host. NULL sets the default for hosts without
+ * limits of their own.
+ * @param max_in_flight Max number of requests in transit. 0 is unlimited.
+ * @param rate Max number of requests per second. 0 is unlimited.
+ * @param burst Number of requests which can be sent at once before rate
+ * applies.
+ */
+void caldav_set_host_limit(const char* URL,
+				int max_in_flight,
+				double rate,
+				int burst) {
+	caldav_limiter_set(URL, max_in_flight, rate, burst);
+}
+
+/**
+ * Function for setting how requests are retried after transient
+ * failures. The policy applies to every thread in the process. Requests
+ * which never reached the server and requests answered with 429 are
+ * always retried. Requests which broke off or were answered with 502,
+ * 503 or 504 are only retried when sending them twice is harmless: GET,
+ * OPTIONS, PROPFIND, REPORT and PUT or DELETE made conditional on an
+ * ETAG. The delay doubles for every attempt and half of it is random.
+ * By default a request is tried 3 times starting with 250 ms.
+ * @param max_attempts Number of attempts including the first. 1 disables
+ * retries.
+ * @param base_delay Delay in milliseconds before the first retry.
+ * @param max_delay Upper bound for the delay in milliseconds.
+ */
+void caldav_set_retry_policy(int max_attempts,
+				int base_delay,
+				int max_delay) {
+	caldav_retry_set(max_attempts, base_delay, max_delay);
+}
+
+/**
+ * Function for sending traces of requests to a callback instead of
+ * printing them to stderr.
+ * @param callback Function receiving the events or NULL to go back to
+ * printing requests made with the debug option to stderr.
+ * @param user_data Passed to callback.
+ * @param sample Fraction of requests to trace, from 0 to 1.
+ * @param max_body Max number of bytes reported of each request and
+ * response body. 0 reports no body, -1 everything.
+ */
+void caldav_set_trace(caldav_trace_callback callback,
+				void* user_data,
+				double sample,
+				long max_body) {
+	caldav_trace_set(callback, user_data, sample, max_body);
+}
+
+/**
+ * Function for getting a cancellation token. Set it in the options of a
+ * runtime_info to make the calls using it cancellable. @see debug_curl
+ * @return caldav_cancel. @see caldav_free_cancel
+ */
+caldav_cancel* caldav_get_cancel(void) {
+	return g_new0(caldav_cancel, 1);
+}
+
+/**
+ * Function for cancelling every call using a token. Can be called from
+ * any thread. Requests in transit are aborted and calls return with an
+ * error as soon as possible, also from the executor and batch functions.
+ * @param cancel Pointer to a caldav_cancel. @see caldav_get_cancel
+ */
+void caldav_cancel_calls(caldav_cancel* cancel) {
+	g_return_if_fail(cancel != NULL);
+
+	g_atomic_int_set(&cancel->cancelled, 1);
+}
+
+/**
+ * Function for checking if a token was cancelled.
+ * @param cancel Pointer to a caldav_cancel. @see caldav_get_cancel
+ * @return 1 if cancelled, 0 otherwise.
+ */
+int caldav_is_cancelled(caldav_cancel* cancel) {
+	g_return_val_if_fail(cancel != NULL, 0);
+
+	return g_atomic_int_get(&cancel->cancelled) ? 1 : 0;
+}
+
+/**
+ * Function for making a cancelled token usable again.
+ * @param cancel Pointer to a caldav_cancel. @see caldav_get_cancel
+ */
+void caldav_reset_cancel(caldav_cancel* cancel) {
+	g_return_if_fail(cancel != NULL);
+
+	g_atomic_int_set(&cancel->cancelled, 0);
+}
+
+/**
+ * Function for freeing a token. It must not be used by any call anymore.
+ * @param cancel Address to a pointer to a caldav_cancel.
+ */
+void caldav_free_cancel(caldav_cancel** cancel) {
+	if (*cancel) {
+		g_free(*cancel);
+		*cancel = NULL;
+	}
+}
+
 /**
  * Function for getting an initialized runtime_info structure
  * @return runtime_info. @see runtime_info
@@ -822,6 +1900,9 @@ runtime_info* caldav_get_runtime_info() {
   	rt_info->options->verify_ssl_certificate = 1;
   	rt_info->options->use_locking = 1;
   	rt_info->options->custom_cacert = NULL; 
+  	rt_info->options->max_in_flight = 4;
+  	rt_info->options->connect_timeout = CALDAV_CONNECT_TIMEOUT;
+  	rt_info->options->low_speed_time = CALDAV_LOW_SPEED_TIME;
 	
 	return rt_info;
 }
@@ -849,11 +1930,428 @@ void caldav_free_runtime_info(runtime_info** info) {
 		    g_free(ri->options);
 		    ri->options = NULL;
 		}
+		if (ri->session)
+			caldav_free_session(&ri->session);
 		g_free(ri);
 		*info = ri = NULL;
     }
 }
 
+/**
+ * Function for getting a new session.
+ * @return caldav_session. @see caldav_session
+ */
+caldav_session* caldav_get_session() {
+	return caldav_session_new();
+}
+
+/**
+ * Function for freeing memory for a session.
+ * @param session Address to a pointer to a caldav_session.
+ */
+void caldav_free_session(caldav_session** session) {
+	if (*session) {
+		caldav_session_destroy(*session);
+		*session = NULL;
+	}
+}
+
+/**
+ * Function for getting a callback after every HTTP request made with a
+ * session.
+ * @param session Pointer to a caldav_session.
+ * @param callback Function to call or NULL to stop the calls.
+ * @param user_data Passed to callback.
+ */
+void caldav_set_stats_callback(caldav_session* session,
+				caldav_stats_callback callback,
+				void* user_data) {
+	g_return_if_fail(session != NULL);
+
+	caldav_stats_set_callback(session->stats, callback, user_data);
+}
+
+/**
+ * Function for getting a snapshot of the totals per operation collected
+ * by a session.
+ * @param session Pointer to a caldav_session.
+ * @param count Pointer where the number of operations is returned.
+ * @return Array of caldav_op_stats or NULL if nothing was collected.
+ * Free it with caldav_free_stats. @see caldav_op_stats
+ */
+caldav_op_stats* caldav_get_stats(caldav_session* session, int* count) {
+	g_return_val_if_fail(session != NULL, NULL);
+	g_return_val_if_fail(count != NULL, NULL);
+
+	return caldav_stats_snapshot(session->stats, count);
+}
+
+/**
+ * Function for setting the totals of a session to zero.
+ * @param session Pointer to a caldav_session.
+ */
+void caldav_reset_stats(caldav_session* session) {
+	g_return_if_fail(session != NULL);
+
+	caldav_stats_reset(session->stats);
+}
+
+/**
+ * Function for freeing memory returned by caldav_get_stats.
+ * @param stats Address to a pointer to an array of caldav_op_stats.
+ */
+void caldav_free_stats(caldav_op_stats** stats) {
+	if (*stats) {
+		g_free(*stats);
+		*stats = NULL;
+	}
+}
+
+/**
+ * Function for getting the metrics of every call made by the process in
+ * the Prometheus text exposition format.
+ * @return Text to serve on a /metrics endpoint. Caller is responsible for
+ * freeing the memory.
+ */
+char* caldav_get_metrics(void) {
+	return caldav_metrics_render();
+}
+
+/**
+ * Function for finding an object in the local index of a collection
+ * without contacting the server.
+ * @param uid UID of the object
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param start Pointer where DTSTART is returned or NULL.
+ * @param end Pointer where DTEND is returned or NULL.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return CALDAV_ID or NULL if the object is not known.
+ */
+CALDAV_ID* caldav_lookup_object(const char* uid,
+				const char* URL,
+				time_t* start,
+				time_t* end,
+				runtime_info* info) {
+	caldav_settings settings;
+	caldav_index* index;
+	index_entry* entry;
+	CALDAV_ID* id = NULL;
+
+	g_return_val_if_fail(info != NULL, NULL);
+
+	if (! uid || ! info->session)
+		return NULL;
+	init_caldav_settings(&settings);
+	parse_url(&settings, URL);
+	index = caldav_session_index(info->session, settings.url, FALSE);
+	if (index && (entry = caldav_index_lookup(index, uid)) != NULL) {
+		gchar* host = get_host(settings.url);
+		gchar* path = g_strconcat(host, entry->href, NULL);
+		id = caldav_get_caldav_id();
+		id->Type = CALDAV_ETAG_TYPE;
+		id->Ident.Etag.uri = rebuild_url(&settings, path);
+		id->Ident.Etag.etag = g_strdup(entry->etag);
+		if (start)
+			*start = entry->start;
+		if (end)
+			*end = entry->end;
+		g_free(host);
+		g_free(path);
+	}
+	free_caldav_settings(&settings);
+	return id;
+}
+
+/**
+ * Function for opening a local mirror of a collection. The file is created
+ * if it does not exist and otherwise mapped into memory, so a restart does
+ * not need to download the collection again. The objects in the mirror are
+ * added to the index of the session. @see caldav_lookup_object
+ * The file is locked until the mirror is closed, so opening it a second
+ * time, in this or another process, fails.
+ * @param path File holding the mirror
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return caldav_store or NULL in case of error. The error is found in
+ * info->error. @see caldav_close_store
+ */
+caldav_store* caldav_open_store(const char* path,
+				const char* URL,
+				runtime_info* info) {
+	caldav_settings settings;
+	caldav_store* store;
+
+	g_return_val_if_fail(info != NULL, NULL);
+	g_return_val_if_fail(path != NULL, NULL);
+
+	init_runtime(info);
+	init_caldav_settings(&settings);
+	parse_url(&settings, URL);
+	store = caldav_store_open(path, settings.url, info->error);
+	if (store && info->session)
+		caldav_store_fill_index(store,
+			caldav_session_index(info->session, settings.url, TRUE));
+	free_caldav_settings(&settings);
+	return store;
+}
+
+/**
+ * Function for bringing a local mirror up to date. Only objects which
+ * changed since the last call are downloaded. sync-collection (RFC6578) is
+ * used if the server supports it, otherwise ETAGs are compared. The
+ * comparison is skipped while the CS:getctag of the collection is unchanged.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_sync_store(caldav_store* store,
+				const char* URL,
+				runtime_info* info) {
+	caldav_settings settings;
+	CALDAV_RESPONSE caldav_response;
+
+	g_return_val_if_fail(info != NULL, TRUE);
+	g_return_val_if_fail(store != NULL, TRUE);
+
+	init_runtime(info);
+	init_caldav_settings(&settings);
+	if (info->options->debug)
+		settings.debug = TRUE;
+	else
+		settings.debug = FALSE;
+	if (info->options->trace_ascii)
+		settings.trace_ascii = 1;
+	else
+		settings.trace_ascii = 0;
+	settings.session = info->session;
+	init_timeouts(&settings, info);
+	caldav_stats_begin(&settings, G_STRFUNC);
+	parse_url(&settings, URL);
+	gboolean res = caldav_store_sync(store, &settings, info->error);
+	if (info->session) {
+		/* objects removed on the server must leave the index too */
+		caldav_index* index =
+			caldav_session_index(info->session, settings.url, TRUE);
+		caldav_index_clear(index);
+		caldav_store_fill_index(store, index);
+	}
+	if (res) {
+		if (info->error->code > 0) {
+			switch (info->error->code) {
+				case 403: caldav_response = FORBIDDEN; break;
+				case 409: caldav_response = CONFLICT; break;
+				case 423: caldav_response = LOCKED; break;
+				case 501: caldav_response = NOTIMPLEMENTED; break;
+				default: caldav_response = CONFLICT; break;
+			}
+		}
+		else {
+			/* fall-back to conflicting state */
+			caldav_response = CONFLICT;
+		}
+	}
+	else {
+		caldav_response = OK;
+	}
+	free_caldav_settings(&settings);
+	return caldav_response;
+}
+
+/**
+ * Function for getting an object from a local mirror.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param uid UID of the object
+ * @return The object or NULL if not found. Caller is responsible for
+ * freeing the memory.
+ */
+char* caldav_store_get_object(caldav_store* store, const char* uid) {
+	g_return_val_if_fail(store != NULL, NULL);
+
+	return caldav_store_get(store, uid);
+}
+
+/**
+ * Function for getting all events from a local mirror.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @return Ok or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_store_getall_object(response* result,
+				caldav_store* store) {
+	g_return_val_if_fail(result != NULL, CONFLICT);
+	g_return_val_if_fail(store != NULL, CONFLICT);
+
+	result->msg = caldav_store_get_all(store);
+	return OK;
+}
+
+/**
+ * Function for getting the events from a local mirror which have an
+ * instance overlapping a period. Recurring events are expanded locally so
+ * no request is sent to the server. Unlike caldav_getrange_object the
+ * period is given as plain UTC seconds since the epoch.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return Ok or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_store_getrange_object(response* result,
+				caldav_store* store,
+				time_t start,
+				time_t end) {
+	g_return_val_if_fail(result != NULL, CONFLICT);
+	g_return_val_if_fail(store != NULL, CONFLICT);
+
+	result->msg = caldav_store_get_range(store, start, end);
+	return OK;
+}
+
+/**
+ * Function for getting free/busy information from a local mirror without
+ * contacting the server. Recurring events are expanded, transparent and
+ * cancelled instances are left out and tentative instances are reported
+ * as BUSY-TENTATIVE. Unlike caldav_get_freebusy the period is given as
+ * plain UTC seconds since the epoch.
+ * @param result A pointer to struct _response where the VFREEBUSY is to
+ * stored. @see response. Caller is responsible for freeing the memory.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return Ok or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_store_get_freebusy(response* result,
+				caldav_store* store,
+				time_t start,
+				time_t end) {
+	GArray* periods;
+
+	g_return_val_if_fail(result != NULL, CONFLICT);
+	g_return_val_if_fail(store != NULL, CONFLICT);
+
+	periods = caldav_store_busy(store, start, end);
+	result->msg = busy_to_vfreebusy(periods, start, end);
+	g_free(result->periods);
+	result->count = periods->len;
+	result->periods = (caldav_period *) g_array_free(periods, FALSE);
+	return OK;
+}
+
+/**
+ * Function for closing a local mirror and freeing its memory.
+ * @param store Address to a pointer to a caldav_store.
+ */
+void caldav_close_store(caldav_store** store) {
+	if (*store) {
+		caldav_store_close(*store);
+		*store = NULL;
+	}
+}
+
+/**
+ * Function for getting an executor which syncs local mirrors on a fixed
+ * pool of worker threads. Every worker owns its own session which is
+ * reused between jobs. Jobs are queued per host and at most max_per_host
+ * of them run against the same host at a time. A worker keeps serving
+ * the host it served last and takes jobs from the other hosts when that
+ * queue is empty or at its limit, so a slow server does not hold up the
+ * others.
+ * @param threads Number of worker threads
+ * @param max_per_host Max number of jobs running against one host
+ * @param info Pointer to a runtime_info structure whose options are used
+ * by the workers. May be NULL. @see runtime_info
+ * @return caldav_executor or NULL if no worker thread could be started.
+ * @see caldav_free_executor
+ */
+caldav_executor* caldav_get_executor(int threads,
+				int max_per_host,
+				runtime_info* info) {
+	init_runtime(info);
+	return executor_new(threads, max_per_host, (info) ? info->options : NULL,
+			(info && info->session) ? info->session->stats : NULL);
+}
+
+/**
+ * Function for queueing a sync of a local mirror. @see caldav_sync_store
+ * A store queued again while a sync of it runs waits until that sync is
+ * done, so two workers never use the same store. The store must not be
+ * used by other threads meanwhile.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Called when the job is done. May be NULL.
+ * @param user_data Passed to callback.
+ */
+void caldav_executor_sync(caldav_executor* executor,
+				caldav_store* store,
+				const char* URL,
+				caldav_sync_callback callback,
+				void* user_data) {
+	g_return_if_fail(executor != NULL);
+	g_return_if_fail(store != NULL);
+
+	executor_submit(executor, store, URL, callback, user_data);
+}
+
+/**
+ * Function for changing the max number of concurrent jobs for one host.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ * @param URL Any URL on the host
+ * @param limit Max number of jobs running against the host
+ */
+void caldav_executor_set_host_limit(caldav_executor* executor,
+				const char* URL,
+				int limit) {
+	g_return_if_fail(executor != NULL);
+
+	executor_set_limit(executor, URL, limit);
+}
+
+/**
+ * Function for getting the number of jobs queued or running.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ * @param URL Count only the jobs for the host of this URL. NULL counts
+ * every job.
+ * @return Number of jobs
+ */
+int caldav_executor_queue_depth(caldav_executor* executor, const char* URL) {
+	g_return_val_if_fail(executor != NULL, 0);
+
+	return executor_depth(executor, URL);
+}
+
+/**
+ * Function for waiting until every queued job is done.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ */
+void caldav_executor_wait(caldav_executor* executor) {
+	g_return_if_fail(executor != NULL);
+
+	executor_wait(executor);
+}
+
+/**
+ * Function for freeing an executor. Queued jobs are finished first.
+ * @param executor Address to a pointer to a caldav_executor.
+ */
+void caldav_free_executor(caldav_executor** executor) {
+	if (*executor) {
+		executor_destroy(*executor);
+		*executor = NULL;
+	}
+}
+
 /**
  * Function for getting an initialized response structure
  * @return response. @see _response
@@ -879,6 +2377,7 @@ void caldav_free_response(response** resp) {
 		r = *resp;
 		if (r->msg)
 			g_free(r->msg);
+		g_free(r->periods);
 		g_free(r);
 		*resp = r = NULL;
 	}
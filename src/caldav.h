@@ -12,6 +12,14 @@
  * This document is the documentation for the public interface to libcaldav.
  * If you want to study the implementation look for the developers API.
  *
+ * Thread safety. Call caldav_global_init before starting threads and
+ * caldav_global_cleanup after they are finished. After that every
+ * function can be called concurrently from any number of threads as long
+ * as each thread uses its own runtime_info, caldav_session and
+ * caldav_store. These objects are not locked internally, so sharing one
+ * between threads requires the caller to serialize access to it.
+ * Results (response, caldav_error, ...) belong to the calling thread.
+ *
  * The libray and documentation is Copyright (c) 2008 Michael Rasmussen
  * (mir@datanom.net)
  *
@@ -48,6 +56,33 @@ G_BEGIN_DECLS
 
 #include <time.h>
 
+/**
+ * @typedef struct _caldav_cancel caldav_cancel
+ * Opaque token for cancelling calls from another thread.
+ * @see caldav_get_cancel
+ */
+typedef struct _caldav_cancel caldav_cancel;
+
+/**
+ * @typedef caldav_attachment_callback
+ * Receives an attachment stored inline in an object (an ATTACH property
+ * with ENCODING=BASE64) when the object is received. @see debug_curl
+ * @param uid UID of the object holding the attachment. NULL if it has none.
+ * @param parameters Parameters of the property, eg.
+ * "FMTTYPE=image/png;ENCODING=BASE64;VALUE=BINARY"
+ * @param data The attachment, decoded. Only valid during the call.
+ * @param length Number of bytes in data
+ * @param user_data Pointer given in debug_curl.
+ * @return URI for the attachment, allocated with malloc, which replaces
+ * the inline value. The library frees it. NULL drops the property. The
+ * value is kept inline if the URI does not fit in the space it used.
+ */
+typedef char* (*caldav_attachment_callback)(const char* uid,
+					 const char* parameters,
+					 const unsigned char* data,
+					 size_t length,
+					 void* user_data);
+
 /* For debug purposes */
 /**
  * @typedef struct debug_curl
@@ -63,6 +98,44 @@ typedef struct {
   int		verify_ssl_certificate;
   int		use_locking;
   char*		custom_cacert; 
+  int		max_in_flight; /** @var int max_in_flight
+						    * Max number of concurrent requests in batch calls
+						    */
+  long		connect_timeout; /** @var long connect_timeout
+							  * Milliseconds to wait for a connection. 0 uses
+							  * the default of libcurl.
+							  */
+  long		timeout;	/** @var long timeout
+						 * Milliseconds a single request may take. 0 is
+						 * unlimited.
+						 */
+  long		low_speed_time; /** @var long low_speed_time
+							 * Seconds without any data before a request is
+							 * given up. 0 is unlimited.
+							 */
+  long		deadline;	/** @var long deadline
+						 * Milliseconds a whole call may take including
+						 * retries and waiting for the host. 0 is unlimited.
+						 */
+  caldav_cancel* cancel; /** @var caldav_cancel* cancel
+						  * Token which aborts every call using these options
+						  * when cancelled. May be NULL. Not owned.
+						  */
+  int		strip_attachments; /** @var int strip_attachments
+								* 0 or 1. Inline attachments (ATTACH with
+								* ENCODING=BASE64) are removed from the
+								* objects received.
+								*/
+  caldav_attachment_callback attachment_callback;
+						/** @var caldav_attachment_callback
+						 * attachment_callback
+						 * When set inline attachments in the objects
+						 * received are handed here instead of being kept.
+						 * Takes precedence over strip_attachments.
+						 */
+  void*		attachment_data; /** @var void* attachment_data
+							  * Passed to attachment_callback
+							  */
 } debug_curl;
 
 /**
@@ -85,6 +158,27 @@ struct _caldav_error {
 				*/
 };
 
+/**
+ * @typedef struct _caldav_session caldav_session
+ * Opaque structure holding information shared between calls, eg. where
+ * objects are stored in a collection. @see caldav_get_session
+ */
+typedef struct _caldav_session caldav_session;
+
+/**
+ * @typedef struct _caldav_store caldav_store
+ * Opaque structure for a collection mirrored in a local file.
+ * @see caldav_open_store
+ */
+typedef struct _caldav_store caldav_store;
+
+/**
+ * @typedef struct _caldav_executor caldav_executor
+ * Opaque structure for a pool of worker threads syncing local mirrors.
+ * @see caldav_get_executor
+ */
+typedef struct _caldav_executor caldav_executor;
+
 /**
  * @typedef struct runtime_info
  * Pointer to a runtime structure holding debug and error information
@@ -92,10 +186,37 @@ struct _caldav_error {
 typedef struct {
     caldav_error*   error;
     debug_curl*	    options;
+    caldav_session* session;	/* NULL disables caching between calls */
 } runtime_info;
 
 /* CalDAV is defined in RFC4791 */
 
+/**
+ * @enum CALDAV_FBTYPE specifies the type of a busy period (RFC5545 3.2.9).
+ * Where periods of different types overlap the highest type wins.
+ */
+typedef enum {
+	CALDAV_BUSY_TENTATIVE,
+	CALDAV_BUSY,
+	CALDAV_BUSY_UNAVAILABLE
+} CALDAV_FBTYPE;
+
+/**
+ * @typedef struct caldav_period
+ * A busy period in UTC seconds since the epoch.
+ */
+typedef struct {
+	time_t start;			/** @var time_t start
+							 * Start of period, included
+							 */
+	time_t end;				/** @var time_t end
+							 * End of period, not included
+							 */
+	CALDAV_FBTYPE type;		/** @var CALDAV_FBTYPE type
+							 * FBTYPE of period
+							 */
+} caldav_period;
+
 /* Buffer to hold response */
 /**
  * @typedef struct _response response
@@ -111,6 +232,13 @@ struct _response {
 	char* msg; /** @var char* msg
 				* String for storing response
 				*/
+	caldav_period* periods; /** @var caldav_period* periods
+				* Busy periods found in msg, sorted and merged. Only set
+				* by the free/busy functions.
+				*/
+	int count; /** @var int count
+				* Number of periods
+				*/
 };
 
 /**
@@ -121,6 +249,7 @@ struct _response {
  * MODIFY. Modify a CalDAV calendar object.
  * GET. Get one or more CalDAV calendar object(s).
  * GETALL. Get all CalDAV calendar objects.
+ * ATTACH. Add, update or remove a managed attachment (RFC8607).
  */
 typedef enum {
 	UNKNOWN,
@@ -135,7 +264,8 @@ typedef enum {
 	OPTIONS,
 	ID_DELETE,
 	ID_MODIFY,
-	ID_ADD
+	ID_ADD,
+	ATTACH
 } CALDAV_ACTION;
 
 /**
@@ -168,11 +298,306 @@ typedef struct {
 	} Ident;
 } CALDAV_ID;
 
+/**
+ * @typedef struct caldav_batch_item
+ * A struct describing one object in a batch request.
+ * @see caldav_batch_objects
+ */
+typedef struct {
+	CALDAV_ACTION action;	/** @var CALDAV_ACTION action
+							 * ADD, MODIFY, DELETE, ID_ADD, ID_MODIFY or ID_DELETE
+							 */
+	const char* object;		/** @var const char* object
+							 * Appointment following ICal format (RFC2445).
+							 * Not used for ID_DELETE.
+							 */
+	CALDAV_ID* id;			/** @var CALDAV_ID* id
+							 * Required for ID_MODIFY and ID_DELETE. After a
+							 * successful add or modify it contains the new
+							 * identification for the object.
+							 */
+	CALDAV_RESPONSE result;	/** @var CALDAV_RESPONSE result
+							 * Outcome for this object
+							 */
+	long code;				/** @var long code
+							 * HTTP status for this object. < 0 internal error.
+							 */
+} caldav_batch_item;
+
+/**
+ * @typedef struct caldav_freebusy_item
+ * A struct describing one calendar in a free/busy request.
+ * @see caldav_get_freebusy_multi
+ */
+typedef struct {
+	const char* URL;		/** @var const char* URL
+							 * Defines CalDAV resource.
+							 * [http://][username[:password]@]host[:port]/url-path
+							 */
+	CALDAV_RESPONSE result;	/** @var CALDAV_RESPONSE result
+							 * Outcome for this calendar
+							 */
+	long code;				/** @var long code
+							 * HTTP status for this calendar. < 0 internal error.
+							 */
+	caldav_period* periods;	/** @var caldav_period* periods
+							 * Busy periods sorted by start and not overlapping
+							 */
+	int count;				/** @var int count
+							 * Number of periods
+							 */
+} caldav_freebusy_item;
+
+/**
+ * @typedef caldav_sync_callback
+ * Called when a sync job queued on an executor is done. The call is made
+ * from the worker thread which ran the job.
+ * @param store The store given to caldav_executor_sync
+ * @param URL The URL given to caldav_executor_sync
+ * @param result Outcome of the sync. @see caldav_sync_store
+ * @param error Error details if result is not OK. Only valid during the call.
+ * @param user_data Pointer given to caldav_executor_sync.
+ */
+typedef void (*caldav_sync_callback)(caldav_store* store,
+					 const char* URL,
+					 CALDAV_RESPONSE result,
+					 const caldav_error* error,
+					 void* user_data);
+
+/**
+ * @typedef struct caldav_request_stats
+ * Timings and sizes of one HTTP request as reported by libcurl. Times are
+ * seconds from the start of the request. A retried request is reported
+ * once for every attempt.
+ */
+typedef struct {
+	const char* operation;	/** @var const char* operation
+							 * Name of the public function making the request
+							 */
+	const char* method;		/** @var const char* method
+							 * HTTP method. NULL with libcurl older than 7.72.
+							 */
+	const char* url;		/** @var const char* url
+							 * URL of the request
+							 */
+	long status;			/** @var long status
+							 * HTTP status. 0 if no response was received.
+							 */
+	int result;				/** @var int result
+							 * CURLcode of the transfer
+							 */
+	int attempt;			/** @var int attempt
+							 * 1 for the first attempt
+							 */
+	double namelookup;		/** @var double namelookup
+							 * Name resolved
+							 */
+	double connect;			/** @var double connect
+							 * TCP connection established
+							 */
+	double tls;				/** @var double tls
+							 * TLS handshake done. 0 for plain HTTP.
+							 */
+	double ttfb;			/** @var double ttfb
+							 * First byte of the response received
+							 */
+	double total;			/** @var double total
+							 * Request done
+							 */
+	gint64 bytes_up;		/** @var gint64 bytes_up
+							 * Bytes sent including headers
+							 */
+	gint64 bytes_down;		/** @var gint64 bytes_down
+							 * Bytes received including headers
+							 */
+} caldav_request_stats;
+
+/**
+ * @typedef caldav_stats_callback
+ * Called after every HTTP request made with a session.
+ * @see caldav_set_stats_callback
+ * @param stats Timings of the request. Only valid during the call.
+ * @param user_data Pointer given to caldav_set_stats_callback.
+ */
+typedef void (*caldav_stats_callback)(const caldav_request_stats* stats,
+					 void* user_data);
+
+/**
+ * @typedef struct caldav_op_stats
+ * Totals for all calls of one public function. @see caldav_get_stats
+ */
+typedef struct {
+	const char* operation;	/** @var const char* operation
+							 * Name of the public function
+							 */
+	unsigned long calls;	/** @var unsigned long calls
+							 * Number of calls
+							 */
+	unsigned long requests;	/** @var unsigned long requests
+							 * Number of round trips including retries
+							 */
+	unsigned long errors;	/** @var unsigned long errors
+							 * Round trips failing in transfer or with
+							 * status >= 400
+							 */
+	double elapsed;			/** @var double elapsed
+							 * Seconds spent in the calls
+							 */
+	double network;			/** @var double network
+							 * Seconds spent waiting for transfers, retries
+							 * and rate limits
+							 */
+	double parse;			/** @var double parse
+							 * Seconds spent building requests and parsing
+							 * responses, ie. elapsed - network
+							 */
+	gint64 bytes_up;		/** @var gint64 bytes_up
+							 * Bytes sent including headers
+							 */
+	gint64 bytes_down;		/** @var gint64 bytes_down
+							 * Bytes received including headers
+							 */
+	unsigned long allocs;	/** @var unsigned long allocs
+							 * Allocations made by the library. Only
+							 * counted when built with
+							 * --enable-alloc-profile
+							 */
+	gint64 alloc_bytes;		/** @var gint64 alloc_bytes
+							 * Bytes allocated by the library. Only
+							 * counted when built with
+							 * --enable-alloc-profile
+							 */
+	gint64 alloc_peak;		/** @var gint64 alloc_peak
+							 * Largest growth of memory held by the
+							 * library during one call. Only counted when
+							 * built with --enable-alloc-profile
+							 */
+} caldav_op_stats;
+
+/**
+ * @enum CALDAV_TRACE_TYPE specifies what a trace event holds.
+ * CALDAV_TRACE_INFO. Informational text from libcurl.
+ * CALDAV_TRACE_HEADER_OUT. Request headers.
+ * CALDAV_TRACE_DATA_OUT. Part of the request body.
+ * CALDAV_TRACE_HEADER_IN. A response header.
+ * CALDAV_TRACE_DATA_IN. Part of the response body.
+ */
+typedef enum {
+	CALDAV_TRACE_INFO,
+	CALDAV_TRACE_HEADER_OUT,
+	CALDAV_TRACE_DATA_OUT,
+	CALDAV_TRACE_HEADER_IN,
+	CALDAV_TRACE_DATA_IN
+} CALDAV_TRACE_TYPE;
+
+/**
+ * @typedef struct caldav_trace_event
+ * One event of a traced request. @see caldav_set_trace
+ */
+typedef struct {
+	CALDAV_TRACE_TYPE type;	/** @var CALDAV_TRACE_TYPE type
+							 * What data holds
+							 */
+	unsigned long request;	/** @var unsigned long request
+							 * Identifies the traced request within the
+							 * process. Requests sent one after another on
+							 * the same handle, eg. the OPTIONS check before
+							 * a PUT or a retried attempt, share the id.
+							 */
+	const char* operation;	/** @var const char* operation
+							 * Name of the public function making the request
+							 */
+	gint64 timestamp;		/** @var gint64 timestamp
+							 * Microseconds since the epoch
+							 */
+	gint64 elapsed;			/** @var gint64 elapsed
+							 * Microseconds since the first event of the
+							 * request
+							 */
+	const char* data;		/** @var const char* data
+							 * Span of the request or response. Not zero
+							 * terminated.
+							 */
+	size_t length;			/** @var size_t length
+							 * Number of bytes in data
+							 */
+	size_t offset;			/** @var size_t offset
+							 * Position of data in the body. 0 for headers
+							 * and text.
+							 */
+	int truncated;			/** @var int truncated
+							 * 1 if data was cut to the max body size. Later
+							 * parts of the body are not reported.
+							 */
+} caldav_trace_event;
+
+/**
+ * @typedef caldav_trace_callback
+ * Called for every event of a traced request on the thread making the
+ * request. @see caldav_set_trace
+ * @param event The event. Only valid during the call.
+ * @param user_data Pointer given to caldav_set_trace.
+ */
+typedef void (*caldav_trace_callback)(const caldav_trace_event* event,
+					 void* user_data);
+
+/**
+ * @typedef caldav_import_callback
+ * Called once for every object stored by an import.
+ * @param uid UID of the object. May be NULL.
+ * @param result Outcome for the object. @see CALDAV_RESPONSE
+ * @param code HTTP status for the object. < 0 internal error.
+ * @param id Identification for the stored object or NULL. Only valid during
+ * the call, use caldav_copy_caldav_id to keep it.
+ * @param user_data Pointer given to the import function.
+ * @see caldav_import_fd
+ */
+typedef void (*caldav_import_callback)(const char* uid,
+					 CALDAV_RESPONSE result,
+					 long code,
+					 CALDAV_ID* id,
+					 void* user_data);
+
+/**
+ * @typedef caldav_sink
+ * Receives a calendar while it is downloaded.
+ * @see caldav_getall_object_sink
+ * @param data Next part of the calendar. Not zero terminated. Only valid
+ * during the call.
+ * @param length Number of bytes in data
+ * @param user_data Pointer given to caldav_getall_object_sink.
+ * @return 0 to continue, anything else stops the download
+ */
+typedef int (*caldav_sink)(const char* data,
+					 size_t length,
+					 void* user_data);
+
+/**
+ * @typedef caldav_source
+ * Supplies an object to upload. The object is read once to find its UID
+ * before it is sent and again for every attempt to send it, so the same
+ * bytes must be returned every time they are asked for.
+ * @see caldav_id_add_object_source
+ * @param buffer Where to copy the data
+ * @param length Size of buffer
+ * @param offset Position in the object of the first byte wanted
+ * @param user_data Pointer given to the upload function.
+ * @return number of bytes copied, 0 at the end of the object, -1 on error
+ */
+typedef long (*caldav_source)(char* buffer,
+					 size_t length,
+					 gint64 offset,
+					 void* user_data);
 
 #ifndef __CALDAV_USERAGENT
 #define __CALDAV_USERAGENT "libcurl-agent/0.1"
 #endif
 
+/* Default milliseconds to wait for a connection */
+#define CALDAV_CONNECT_TIMEOUT 30000
+/* Default seconds without any data before a request is given up */
+#define CALDAV_LOW_SPEED_TIME 60
+
 
 /**
  * @deprecated since this function can cause lost updates.
@@ -271,6 +696,267 @@ CALDAV_RESPONSE caldav_id_modify_object(CALDAV_ID** id,
 				     const char* URL,
 				     runtime_info* info);
 
+/**
+ * Function for adding an event which is not held in memory. The object is
+ * read from source while it is sent, without copies. Like
+ * caldav_id_add_object a UID is added before END:VEVENT if the object has
+ * none, which is found by reading the object once before it is sent.
+ * id will contain unique identification for object. Either ETAG or Location.
+ * @param id @see CALDAV_ID
+ * @param source Function reading the object. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the object could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_add_object_source(CALDAV_ID** id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for adding an event read from a file descriptor.
+ * @see caldav_id_add_object_source
+ * @param id @see CALDAV_ID
+ * @param fd File descriptor for a regular file holding the object. It is
+ * read with pread so the file offset is not changed.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the file could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_add_object_fd(CALDAV_ID** id,
+					 int fd,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for modifying an event which is not held in memory.
+ * @see caldav_id_add_object_source
+ * If id is NULL the object is found on the server by its UID like
+ * caldav_modify_object does.
+ * @param id @see CALDAV_ID
+ * @param source Function reading the object. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the object could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_modify_object_source(CALDAV_ID** id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for modifying an event read from a file descriptor.
+ * @see caldav_id_modify_object_source
+ * @param id @see CALDAV_ID
+ * @param fd File descriptor for a regular file holding the object. It is
+ * read with pread so the file offset is not changed.
+ * @param length Size of the object in bytes
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if the file could not be
+ * read. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_modify_object_fd(CALDAV_ID** id,
+					 int fd,
+					 gint64 length,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for adding a managed attachment (RFC8607) to an event. The
+ * attachment is stored by the server, which references it from the event
+ * with an ATTACH property holding a URL, so the event itself stays small.
+ * id must hold the ETAG or Location of the event and will hold the new ETAG
+ * of the event afterwards, empty if the server did not return one.
+ * @param id @see CALDAV_ID
+ * @param source Function reading the attachment. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the attachment in bytes
+ * @param filename Name of the attachment. May be NULL.
+ * @param content_type Media type of the attachment. NULL for
+ * application/octet-stream.
+ * @param managed_id Pointer where the id the server gave the attachment is
+ * returned. Caller must free the memory. May be NULL.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, CONFLICT, or NOTIMPLEMENTED if the server does
+ * not support managed attachments. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_add_attachment(CALDAV_ID** id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+					 const char* filename,
+					 const char* content_type,
+					 char** managed_id,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for replacing the data of a managed attachment (RFC8607).
+ * @see caldav_id_add_attachment
+ * @param id @see CALDAV_ID
+ * @param managed_id Id the server gave the attachment
+ * @param source Function reading the attachment. @see caldav_source
+ * @param user_data Passed to source.
+ * @param length Size of the attachment in bytes
+ * @param filename Name of the attachment. May be NULL.
+ * @param content_type Media type of the attachment. NULL for
+ * application/octet-stream.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, CONFLICT, or NOTIMPLEMENTED if the server does
+ * not support managed attachments. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_update_attachment(CALDAV_ID** id,
+					 const char* managed_id,
+					 caldav_source source,
+					 void* user_data,
+					 gint64 length,
+					 const char* filename,
+					 const char* content_type,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for removing a managed attachment (RFC8607) from an event.
+ * @see caldav_id_add_attachment
+ * @param id @see CALDAV_ID
+ * @param managed_id Id the server gave the attachment
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, CONFLICT, or NOTIMPLEMENTED if the server does
+ * not support managed attachments. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_id_remove_attachment(CALDAV_ID** id,
+					 const char* managed_id,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for adding, modifying and deleting a number of events in one call.
+ * The server is only probed once and the requests are sent concurrently,
+ * with at most info->options->max_in_flight requests in transit, over
+ * connections which are reused. Locking is never used, every request is
+ * conditional (If-None-Match or If-Match) instead.
+ * The outcome for each object is stored in the corresponding item.
+ * @param items Array of caldav_batch_item. @see caldav_batch_item
+ * @param count Number of items in the array
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every item succeeded, otherwise the result for the first
+ * failed item. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_batch_objects(caldav_batch_item* items,
+					 int count,
+					 const char* URL,
+					 runtime_info* info);
+
+/**
+ * Function for adding every event in an iCalendar containing several
+ * events. Components sharing a UID (a recurring event and its overrides)
+ * are stored as one object along with the VTIMEZONEs they reference. @see caldav_batch_objects
+ * @param items Address to a pointer where an array of caldav_batch_item is
+ * returned. Caller is responsible for freeing the memory.
+ * @see caldav_free_batch_items
+ * @param count Pointer where the number of items is returned
+ * @param calendar iCalendar (RFC2445) containing one or more VEVENTs.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every event was added, otherwise the result for the first
+ * failed event. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_batch_add_calendar(caldav_batch_item** items,
+					 int* count,
+					 const char* calendar,
+					 const char* URL,
+					 runtime_info* info);
+
+/**
+ * Function for freeing memory for an array of caldav_batch_item returned
+ * by caldav_batch_add_calendar.
+ * @param items Address to a pointer to an array of caldav_batch_item
+ * @param count Number of items in the array
+ */
+void caldav_free_batch_items(caldav_batch_item** items, int count);
+
+/**
+ * Function for importing an iCalendar stream, eg. a full calendar export,
+ * into a collection. The stream is read and split incrementally so memory
+ * use does not depend on the size of the stream. The stream is stored in
+ * windows of 16 objects per request in transit (options->max_in_flight).
+ * Components sharing a UID are stored as one object when they are in the
+ * same window, even if they do not follow each other.
+ * The objects are sent concurrently like caldav_batch_objects.
+ * @param fd File descriptor to read the iCalendar (RFC2445) from. Read
+ * until end of file.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Called with the outcome for every object. May be NULL.
+ * @param user_data Passed to callback.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every object was stored, otherwise the result for the first
+ * failed object. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_import_fd(int fd,
+				 const char* URL,
+				 caldav_import_callback callback,
+				 void* user_data,
+				 runtime_info* info);
+
+/**
+ * Function for importing an iCalendar held in memory into a collection.
+ * @see caldav_import_fd
+ * @param buffer iCalendar (RFC2445). Need not be zero terminated.
+ * @param length Length of buffer.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Called with the outcome for every object. May be NULL.
+ * @param user_data Passed to callback.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every object was stored, otherwise the result for the first
+ * failed object. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_import_buffer(const char* buffer,
+				 size_t length,
+				 const char* URL,
+				 caldav_import_callback callback,
+				 void* user_data,
+				 runtime_info* info);
+
 /**
  * Function for getting a collection of events determined by time range.
  * @param result A pointer to struct _response where the result is to stored.
@@ -303,6 +989,50 @@ CALDAV_RESPONSE caldav_getall_object(response* result,
 				     const char* URL,
 				     runtime_info* info);
 
+/**
+ * Function for getting all events from the collection without holding
+ * them in memory. The calendar is handed to sink while the response
+ * arrives, so memory use is bounded by the largest single object rather
+ * than by the collection. Unlike caldav_getall_object XML entities in the
+ * calendar data are decoded. A time zone first found after an event was
+ * written follows that event. Since output cannot be taken back a download
+ * failing after it started is not retried.
+ * @param sink Function receiving the calendar. @see caldav_sink
+ * @param user_data Passed to sink.
+ * @param raw FALSE for one VCALENDAR with the events of the collection like
+ * caldav_getall_object returns, TRUE for the calendar data of every object
+ * as stored, one VCALENDAR after the other.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if sink stopped the
+ * download. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_getall_object_sink(caldav_sink sink,
+				     void* user_data,
+				     gboolean raw,
+				     const char* URL,
+				     runtime_info* info);
+
+/**
+ * Function for writing all events from the collection to a file
+ * descriptor. @see caldav_getall_object_sink
+ * @param fd File descriptor to write the calendar to
+ * @param raw FALSE for one VCALENDAR, TRUE for the calendar data of every
+ * object as stored.
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. CONFLICT if writing failed.
+ * @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_getall_object_fd(int fd,
+				     gboolean raw,
+				     const char* URL,
+				     runtime_info* info);
+
 /**
  * Function for getting the stored display name for the collection.
  * @param result A pointer to struct _response where the result is to stored.
@@ -331,7 +1061,9 @@ int caldav_enabled_resource(const char* URL, runtime_info* info);
 /**
  * Function for getting free/busy information.
  * @param result A pointer to struct _response where the result is to stored.
- * @see response. Caller is responsible for freeing the memory.
+ * May be NULL. @see response. Caller is responsible for freeing the memory.
+ * Besides the VFREEBUSY in msg the busy periods are returned in periods as
+ * UTC time_t.
  * @param start time_t variable specifying start and end for range. Both
  * are included in range.
  * @param end time_t variable specifying start and end for range. Both
@@ -347,6 +1079,39 @@ CALDAV_RESPONSE caldav_get_freebusy(response *result,
 				  					const char* URL,
 				  					runtime_info* info);
 
+/**
+ * Function for getting free/busy information from several calendars at
+ * once. The free-busy-query requests are sent concurrently, at most
+ * info->options->max_in_flight at a time, over connections shared between
+ * the requests. The FREEBUSY periods in each answer are parsed, merged and
+ * stored in the item for the calendar.
+ * @param items Array of caldav_freebusy_item with URL set for each
+ * calendar. @see caldav_freebusy_item. Free the periods with
+ * caldav_free_freebusy_items.
+ * @param count Number of items in the array
+ * @param start Start of range in UTC seconds since the epoch
+ * @param end End of range in UTC seconds since the epoch
+ * @param merged Pointer to a caldav_freebusy_item where the busy periods
+ * of all calendars merged together are stored. May be NULL.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok if every calendar answered, otherwise the result for the
+ * first failed calendar. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_get_freebusy_multi(caldav_freebusy_item* items,
+				int count,
+				time_t start,
+				time_t end,
+				caldav_freebusy_item* merged,
+				runtime_info* info);
+
+/**
+ * Function for freeing the periods in an array of caldav_freebusy_item.
+ * The array itself is owned by the caller.
+ * @param items Array of caldav_freebusy_item
+ * @param count Number of items in the array
+ */
+void caldav_free_freebusy_items(caldav_freebusy_item* items, int count);
+
 /** 
  * @deprecated Always returns an initialized empty caldav_error
  * Function to call in case of errors.
@@ -387,6 +1152,112 @@ void caldav_set_options(debug_curl curl_options);
  */
 char** caldav_get_server_options(const char* URL, runtime_info* info);
 
+/**
+ * Function for initializing the libraries used by libcaldav (libcurl,
+ * gnutls and libgcrypt). The first call must happen before any threads
+ * using the library are started. Calls can be nested and every call
+ * must be matched by a call to caldav_global_cleanup. A call to the
+ * library while it is not initialized, because this function was never
+ * called or everything was released again, does the same initialization
+ * itself and keeps it until the process ends.
+ * @return TRUE if initialization failed, FALSE otherwise.
+ */
+gboolean caldav_global_init(void);
+
+/**
+ * Function for releasing what caldav_global_init acquired. The last
+ * call must happen after all threads using the library are finished.
+ */
+void caldav_global_cleanup(void);
+
+/**
+ * Function for limiting the requests sent to a host. The limits apply to
+ * every thread in the process. A request waits until the host has a free
+ * slot and a token in its bucket. When a host answers 429 or 503 no more
+ * requests are sent to it until the time given by Retry-After has passed.
+ * By default there are no limits besides Retry-After.
+ * @param URL Any URL on the host. NULL sets the default for hosts without
+ * limits of their own.
+ * @param max_in_flight Max number of requests in transit. 0 is unlimited.
+ * @param rate Max number of requests per second. 0 is unlimited.
+ * @param burst Number of requests which can be sent at once before rate
+ * applies.
+ */
+void caldav_set_host_limit(const char* URL,
+				int max_in_flight,
+				double rate,
+				int burst);
+
+/**
+ * Function for setting how requests are retried after transient
+ * failures. The policy applies to every thread in the process. Requests
+ * which never reached the server and requests answered with 429 are
+ * always retried. Requests which broke off or were answered with 502,
+ * 503 or 504 are only retried when sending them twice is harmless: GET,
+ * OPTIONS, PROPFIND, REPORT and PUT or DELETE made conditional on an
+ * ETAG. The delay doubles for every attempt and half of it is random.
+ * By default a request is tried 3 times starting with 250 ms.
+ * @param max_attempts Number of attempts including the first. 1 disables
+ * retries.
+ * @param base_delay Delay in milliseconds before the first retry.
+ * @param max_delay Upper bound for the delay in milliseconds.
+ */
+void caldav_set_retry_policy(int max_attempts,
+				int base_delay,
+				int max_delay);
+
+/**
+ * Function for sending traces of requests to a callback instead of
+ * printing them to stderr. The choice whether a request is traced is made
+ * once per request, so requests which are not traced cost nothing extra.
+ * Requests made with the debug option are always traced. The setting
+ * applies to every thread in the process.
+ * @param callback Function receiving the events or NULL to go back to
+ * printing requests made with the debug option to stderr.
+ * @param user_data Passed to callback.
+ * @param sample Fraction of requests to trace, from 0 to 1.
+ * @param max_body Max number of bytes reported of each request and
+ * response body. 0 reports no body, -1 everything.
+ */
+void caldav_set_trace(caldav_trace_callback callback,
+				void* user_data,
+				double sample,
+				long max_body);
+
+/**
+ * Function for getting a cancellation token. Set it in the options of a
+ * runtime_info to make the calls using it cancellable. @see debug_curl
+ * @return caldav_cancel. @see caldav_free_cancel
+ */
+caldav_cancel* caldav_get_cancel(void);
+
+/**
+ * Function for cancelling every call using a token. Can be called from
+ * any thread. Requests in transit are aborted and calls return with an
+ * error as soon as possible, also from the executor and batch functions.
+ * @param cancel Pointer to a caldav_cancel. @see caldav_get_cancel
+ */
+void caldav_cancel_calls(caldav_cancel* cancel);
+
+/**
+ * Function for checking if a token was cancelled.
+ * @param cancel Pointer to a caldav_cancel. @see caldav_get_cancel
+ * @return 1 if cancelled, 0 otherwise.
+ */
+int caldav_is_cancelled(caldav_cancel* cancel);
+
+/**
+ * Function for making a cancelled token usable again.
+ * @param cancel Pointer to a caldav_cancel. @see caldav_get_cancel
+ */
+void caldav_reset_cancel(caldav_cancel* cancel);
+
+/**
+ * Function for freeing a token. It must not be used by any call anymore.
+ * @param cancel Address to a pointer to a caldav_cancel.
+ */
+void caldav_free_cancel(caldav_cancel** cancel);
+
 /**
  * Function for getting an initialized runtime_info structure
  * @return runtime_info. @see runtime_info
@@ -401,6 +1272,261 @@ runtime_info* caldav_get_runtime_info();
  */
 void caldav_free_runtime_info(runtime_info** info);
 
+/**
+ * Function for getting a new session. A session remembers where objects
+ * are stored so modifying or deleting the same object again does not need
+ * a search on the server. Information which turns out to be stale is
+ * dropped, and an update or delete refused because of a remembered ETAG
+ * is tried once more after a fresh search. Caching is off until the
+ * caller stores a session in runtime_info->session.
+ * @return caldav_session. @see caldav_session
+ */
+caldav_session* caldav_get_session();
+
+/**
+ * Function for freeing memory for a session.
+ * @param session Address to a pointer to a caldav_session.
+ */
+void caldav_free_session(caldav_session** session);
+
+/**
+ * Function for getting a callback after every HTTP request made with a
+ * session. The callback runs on the thread making the request, which for
+ * an executor is one of its workers. @see caldav_get_executor
+ * @param session Pointer to a caldav_session.
+ * @param callback Function to call or NULL to stop the calls.
+ * @param user_data Passed to callback.
+ */
+void caldav_set_stats_callback(caldav_session* session,
+				caldav_stats_callback callback,
+				void* user_data);
+
+/**
+ * Function for getting a snapshot of the totals per operation collected
+ * by a session and by the workers of executors created with it. May be
+ * called from any thread.
+ * @param session Pointer to a caldav_session.
+ * @param count Pointer where the number of operations is returned.
+ * @return Array of caldav_op_stats or NULL if nothing was collected.
+ * Free it with caldav_free_stats. @see caldav_op_stats
+ */
+caldav_op_stats* caldav_get_stats(caldav_session* session, int* count);
+
+/**
+ * Function for setting the totals of a session to zero.
+ * @param session Pointer to a caldav_session.
+ */
+void caldav_reset_stats(caldav_session* session);
+
+/**
+ * Function for freeing memory returned by caldav_get_stats.
+ * @param stats Address to a pointer to an array of caldav_op_stats.
+ */
+void caldav_free_stats(caldav_op_stats** stats);
+
+/**
+ * Function for getting the metrics of every call made by the process in
+ * the Prometheus text exposition format, version 0.0.4. Requests are
+ * counted per host, method and public function in
+ * caldav_request_duration_seconds, which is a histogram, and in counters
+ * for retries, errors, 423 Locked and bytes. Calls are counted per host
+ * and public function in caldav_operation_duration_seconds. Histogram
+ * buckets are 1/4 of a power of two apart from 1 ms to 67 s.
+ * May be called from any thread.
+ * @return Text to serve on a /metrics endpoint. Caller is responsible for
+ * freeing the memory.
+ */
+char* caldav_get_metrics(void);
+
+/**
+ * Function for finding an object in the local index of a collection
+ * without contacting the server. The index is built from the results of
+ * caldav_getall_object, caldav_getrange and from successful add, modify and
+ * delete calls made with the same runtime_info.
+ * @param uid UID of the object
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param start Pointer where DTSTART is returned as UTC time_t or
+ * (time_t) -1 if unknown. May be NULL.
+ * @param end Pointer where DTEND is returned as UTC time_t or
+ * (time_t) -1 if unknown. May be NULL.
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return CALDAV_ID of type CALDAV_ETAG_TYPE for use with the caldav_id_*
+ * functions or NULL if the object is not known. Caller is responsible for
+ * freeing the memory. @see caldav_free_caldav_id
+ */
+CALDAV_ID* caldav_lookup_object(const char* uid,
+				const char* URL,
+				time_t* start,
+				time_t* end,
+				runtime_info* info);
+
+/**
+ * Function for opening a local mirror of a collection. The file is created
+ * if it does not exist and otherwise mapped into memory, so a restart does
+ * not need to download the collection again. The objects in the mirror are
+ * added to the index of the session. @see caldav_lookup_object
+ * The file is locked until the mirror is closed, so opening it a second
+ * time, in this or another process, fails.
+ * @param path File holding the mirror
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return caldav_store or NULL in case of error. The error is found in
+ * info->error. @see caldav_close_store
+ */
+caldav_store* caldav_open_store(const char* path,
+				const char* URL,
+				runtime_info* info);
+
+/**
+ * Function for bringing a local mirror up to date. Only objects which
+ * changed since the last call are downloaded. sync-collection (RFC6578) is
+ * used if the server supports it, otherwise ETAGs are compared. The
+ * comparison is skipped while the CS:getctag of the collection is unchanged.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param info Pointer to a runtime_info structure. @see runtime_info
+ * @return Ok, FORBIDDEN, or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_sync_store(caldav_store* store,
+				const char* URL,
+				runtime_info* info);
+
+/**
+ * Function for getting an object from a local mirror.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param uid UID of the object
+ * @return The object or NULL if not found. Caller is responsible for
+ * freeing the memory.
+ */
+char* caldav_store_get_object(caldav_store* store, const char* uid);
+
+/**
+ * Function for getting all events from a local mirror.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @return Ok or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_store_getall_object(response* result,
+				caldav_store* store);
+
+/**
+ * Function for getting the events from a local mirror which have an
+ * instance overlapping a period. Recurring events are expanded locally so
+ * no request is sent to the server. Unlike caldav_getrange_object the
+ * period is given as plain UTC seconds since the epoch.
+ * @param result A pointer to struct _response where the result is to stored.
+ * @see response. Caller is responsible for freeing the memory.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return Ok or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_store_getrange_object(response* result,
+				caldav_store* store,
+				time_t start,
+				time_t end);
+
+/**
+ * Function for getting free/busy information from a local mirror without
+ * contacting the server. Recurring events are expanded, transparent and
+ * cancelled instances are left out and tentative instances are reported
+ * as BUSY-TENTATIVE. Unlike caldav_get_freebusy the period is given as
+ * plain UTC seconds since the epoch.
+ * @param result A pointer to struct _response where the VFREEBUSY and
+ * the busy periods are to stored. @see response. Caller is responsible
+ * for freeing the memory.
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param start Start of period in UTC
+ * @param end End of period in UTC
+ * @return Ok or CONFLICT. @see CALDAV_RESPONSE
+ */
+CALDAV_RESPONSE caldav_store_get_freebusy(response* result,
+				caldav_store* store,
+				time_t start,
+				time_t end);
+
+/**
+ * Function for closing a local mirror and freeing its memory.
+ * @param store Address to a pointer to a caldav_store.
+ */
+void caldav_close_store(caldav_store** store);
+
+/**
+ * Function for getting an executor which syncs local mirrors on a fixed
+ * pool of worker threads. Every worker owns its own session which is
+ * reused between jobs. Jobs are queued per host and at most max_per_host
+ * of them run against the same host at a time. A worker keeps serving
+ * the host it served last and takes jobs from the other hosts when that
+ * queue is empty or at its limit, so a slow server does not hold up the
+ * others.
+ * @param threads Number of worker threads
+ * @param max_per_host Max number of jobs running against one host
+ * @param info Pointer to a runtime_info structure whose options are used
+ * by the workers. May be NULL. @see runtime_info
+ * @return caldav_executor or NULL if no worker thread could be started.
+ * @see caldav_free_executor
+ */
+caldav_executor* caldav_get_executor(int threads,
+				int max_per_host,
+				runtime_info* info);
+
+/**
+ * Function for queueing a sync of a local mirror. @see caldav_sync_store
+ * A store queued again while a sync of it runs waits until that sync is
+ * done, so two workers never use the same store. The store must not be
+ * used by other threads meanwhile.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ * @param store Pointer to a caldav_store. @see caldav_open_store
+ * @param URL Defines CalDAV resource. Receiver is responsible for freeing
+ * the memory. [http://][username[:password]@]host[:port]/url-path.
+ * See (RFC1738).
+ * @param callback Called when the job is done. May be NULL.
+ * @param user_data Passed to callback.
+ */
+void caldav_executor_sync(caldav_executor* executor,
+				caldav_store* store,
+				const char* URL,
+				caldav_sync_callback callback,
+				void* user_data);
+
+/**
+ * Function for changing the max number of concurrent jobs for one host.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ * @param URL Any URL on the host
+ * @param limit Max number of jobs running against the host
+ */
+void caldav_executor_set_host_limit(caldav_executor* executor,
+				const char* URL,
+				int limit);
+
+/**
+ * Function for getting the number of jobs queued or running.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ * @param URL Count only the jobs for the host of this URL. NULL counts
+ * every job.
+ * @return Number of jobs
+ */
+int caldav_executor_queue_depth(caldav_executor* executor, const char* URL);
+
+/**
+ * Function for waiting until every queued job is done.
+ * @param executor Pointer to a caldav_executor. @see caldav_get_executor
+ */
+void caldav_executor_wait(caldav_executor* executor);
+
+/**
+ * Function for freeing an executor. Queued jobs are finished first.
+ * @param executor Address to a pointer to a caldav_executor.
+ */
+void caldav_free_executor(caldav_executor** executor);
+
 /**
  * Function for getting an initialized response structure
  * @return response. @see _response
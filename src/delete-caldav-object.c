@@ -22,7 +22,10 @@
 
 #include "delete-caldav-object.h"
 #include "lock-caldav-object.h"
+#include "caldav-session.h"
 #include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -49,6 +52,8 @@ gboolean caldav_delete(caldav_settings* settings, caldav_error* error) {
 	gchar* etag;
 	gchar* url = NULL;
 	gchar* file;
+	gchar* uid = NULL;
+	gchar* href = NULL;
 	long code;
 
 	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
@@ -88,28 +93,23 @@ gboolean caldav_delete(caldav_settings* settings, caldav_error* error) {
 			 */
 		}
 	}
+	if (settings->file)
+		uid = get_response_header("uid", settings->file, FALSE);
 	if (settings->ACTION == DELETE) {
-		etag = find_etag(&chunk, settings, error);
-		url = get_url(chunk.memory);
-		if (etag) {
+		file = find_etag(settings, &href, error);
+		if (file) {
 			gchar* host = get_host(settings->url);
+			etag = g_strconcat("\"", file, "\"", NULL);
+			g_free(file);
 			if (host) {
-				file = g_strdup(url);
-				g_free(url);
-				url = g_strdup_printf("%s%s", host, file);
-				g_free(file);
+				url = g_strdup_printf("%s%s", host, href);
 				g_free(host);
 			}
 			else {
 				g_free(etag);
-				g_free(url);
 				url = NULL;
 			}
 		}
-		else {
-			g_free(url);
-			url = NULL;
-		}
 	}
 	if (url) {
 		int lock = 0;
@@ -162,11 +162,7 @@ gboolean caldav_delete(caldav_settings* settings, caldav_error* error) {
 			curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 			data.trace_ascii = settings->trace_ascii;
-			if (settings->debug) {
-				curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-				curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-				curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-			}
+			caldav_trace_setup(curl, settings, &data);
 			curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(settings, url));
 			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
 			curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, 0);
@@ -174,7 +170,7 @@ gboolean caldav_delete(caldav_settings* settings, caldav_error* error) {
 			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 			curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 			curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-			res = curl_easy_perform(curl);
+			res = caldav_perform(curl, TRUE, &chunk, &headers);
 			if (LOCKSUPPORT && lock_token) {
 				caldav_unlock_object(
 						lock_token, url, settings, &lock_error);
@@ -219,6 +215,12 @@ gboolean caldav_delete(caldav_settings* settings, caldav_error* error) {
 		}
 		result = TRUE;
 	}
+	if (uid) {
+		/* deleted or stale, either way it must be searched for next time */
+		caldav_session_forget(settings->session, settings->url, uid);
+		g_free(uid);
+	}
+	g_free(href);
 	if (chunk.memory)
 		free(chunk.memory);
 	if (headers.memory)
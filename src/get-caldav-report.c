@@ -23,6 +23,11 @@
 
 #include "get-caldav-report.h"
 #include "response-parser.h"
+#include "caldav-session.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
+#include "caldav-stream.h"
+#include "caldav-attach.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -87,6 +92,7 @@ gboolean caldav_getall(caldav_settings* settings, caldav_error* error) {
 	struct MemoryStruct chunk;
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
+	caldav_stream* stream = NULL;
 	gboolean result = FALSE;
 	
 	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
@@ -109,10 +115,19 @@ gboolean caldav_getall(caldav_settings* settings, caldav_error* error) {
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
 	data.trace_ascii = settings->trace_ascii;
-	/* send all data to this function  */
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
-	/* we pass our 'chunk' struct to the callback function */
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	if (settings->sink) {
+		/* hand the calendar over while it arrives */
+		stream = caldav_stream_new(settings, curl, caldav_session_index(
+					settings->session, settings->url, TRUE), &chunk);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, caldav_stream_write);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) stream);
+	}
+	else {
+		/* send all data to this function  */
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+		/* we pass our 'chunk' struct to the callback function */
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+	}
 	/* send all data to this function  */
 	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
 	/* we pass our 'headers' struct to the callback function */
@@ -122,16 +137,13 @@ gboolean caldav_getall(caldav_settings* settings, caldav_error* error) {
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(getall_request));
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, settings, &data);
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "REPORT");
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	/* what a sink was given cannot be taken back for a retry */
+	res = caldav_perform(curl, (stream == NULL), &chunk, &headers);
 	if (res != 0) {
 		error->code = -1;
 		error->str = g_strdup_printf("%s", error_buf);
@@ -147,18 +159,36 @@ gboolean caldav_getall(caldav_settings* settings, caldav_error* error) {
 			error->str = g_strdup(headers.memory);
 			result = TRUE;
 		}
+		else if (stream) {
+			if (caldav_stream_finish(stream)) {
+				error->code = -1;
+				error->str = g_strdup("Output was not accepted");
+				result = TRUE;
+			}
+		}
 		else {
 			gchar* report;
+			caldav_index* index;
+			chunk.size = caldav_attach_filter(settings, chunk.memory,
+						chunk.size);
 			report = parse_caldav_report(
 						chunk.memory, "calendar-data", "VEVENT");
 			settings->file = g_strdup(report);
 			g_free(report);
+			/* the full collection replaces whatever was known */
+			index = caldav_session_index(
+						settings->session, settings->url, TRUE);
+			if (index) {
+				caldav_index_clear(index);
+				caldav_index_load_report(index, chunk.memory);
+			}
 		}
 	}
 	if (chunk.memory)
 		free(chunk.memory);
 	if (headers.memory)
 		free(headers.memory);
+	caldav_stream_free(stream);
 	curl_slist_free_all(http_header);
 	curl_easy_cleanup(curl);
 	return result;
@@ -211,11 +241,7 @@ gboolean caldav_getrange(caldav_settings* settings, caldav_error* error) {
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, settings, &data);
 	request = g_strdup_printf(
 		"%s\r\n<C:time-range start=\"%s\"\r\n end=\"%s\"/>\r\n%s",
 			getrange_request_head, get_caldav_datetime(&settings->start),
@@ -227,7 +253,7 @@ gboolean caldav_getrange(caldav_settings* settings, caldav_error* error) {
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	if (res != 0) {
 		error->code = -1;
 		error->str = g_strdup_printf("%s", error_buf);
@@ -245,10 +271,14 @@ gboolean caldav_getrange(caldav_settings* settings, caldav_error* error) {
 		}
 		else {
 			gchar* report;
+			chunk.size = caldav_attach_filter(settings, chunk.memory,
+						chunk.size);
 			report = parse_caldav_report(
 						chunk.memory, "calendar-data", "VEVENT");
 			settings->file = g_strdup(report);
 			g_free(report);
+			caldav_index_load_report(caldav_session_index(
+						settings->session, settings->url, TRUE), chunk.memory);
 		}
 	}
 	g_free(request);
@@ -261,97 +291,28 @@ gboolean caldav_getrange(caldav_settings* settings, caldav_error* error) {
 	return result;
 }
 
-const gchar* XML = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
-"<D:multistatus xmlns:D=\"DAV:\">"
-"  <D:response>"
-"    <D:href>/calendar/dav/mirtattoo%40gmail.com/events/20100712T"
-"182145Z-123401%40example.com.ics</D:href>"
-"    <D:propstat>"
-"      <D:status>HTTP/1.1 200 OK</D:status>"
-"      <D:prop>"
-"        <D:getetag>\"63420585899\"</D:getetag>"
-"        <C:calendar-data xmlns:C=\"urn:ietf:params:xml:ns:caldav\""
-">BEGIN:VCALENDAR"
-"PRODID:-//Google Inc//Google Calendar 70.9054//EN"
-"VERSION:2.0"
-"CALSCALE:GREGORIAN"
-"X-WR-CALNAME:mirtattoo@gmail.com"
-"X-WR-TIMEZONE:Europe/Copenhagen"
-"BEGIN:VEVENT"
-"DTSTART:20100712T151500Z"
-"DTEND:20100712T162500Z"
-"DTSTAMP:20100919T132459Z"
-"UID:20100712T182145Z-123401@example.com"
-"CREATED:20100824T203534Z"
-"DESCRIPTION:"
-"LAST-MODIFIED:20100919T132459Z"
-"LOCATION:"
-"SEQUENCE:268"
-"STATUS:CONFIRMED"
-"SUMMARY:Frodo's birthday party. Please respond."
-"TRANSP:OPAQUE"
-"X-MOZ-LASTACK:20100915T204535Z"
-"X-MOZ-GENERATION:1"
-"END:VEVENT"
-"END:VCALENDAR</C:calendar-data>"
-"      </D:prop>"
-"    </D:propstat>"
-"  </D:response>"
-"  <D:response>"
-"    <D:href>/calendar/dav/mirtattoo%40gmail.com/events/20100919T"
-"182145Z-123401%40example.com.ics</D:href>"
-"    <D:propstat>"
-"      <D:status>HTTP/1.1 200 OK</D:status>"
-"      <D:prop>"
-"        <D:getetag>\"63420591583\"</D:getetag>"
-"        <C:calendar-data xmlns:C=\"urn:ietf:params:xml:ns:caldav\""
-">BEGIN:VCALENDAR"
-"PRODID:-//Google Inc//Google Calendar 70.9054//EN"
-"VERSION:2.0"
-"CALSCALE:GREGORIAN"
-"X-WR-CALNAME:mirtattoo@gmail.com"
-"X-WR-TIMEZONE:Europe/Copenhagen"
-"BEGIN:VEVENT"
-"DTSTART:20100713T151500Z"
-"DTEND:20100713T162500Z"
-"DTSTAMP:20100919T145943Z"
-"UID:20100919T182145Z-123401@example.com"
-"CREATED:20100919T145920Z"
-"DESCRIPTION:"
-"LAST-MODIFIED:20100919T145943Z"
-"LOCATION:"
-"SEQUENCE:0"
-"STATUS:CONFIRMED"
-"SUMMARY:Frodo's birthday party. Please respond."
-"TRANSP:OPAQUE"
-"X-MOZ-LASTACK:20100919T145943Z"
-"X-MOZ-GENERATION:1"
-"BEGIN:VALARM"
-"ACTION:EMAIL"
-"DESCRIPTION:This is an event reminder"
-"SUMMARY:Alarm notification"
-"ATTENDEE:mailto:mirtattoo@gmail.com"
-"TRIGGER:-P0DT0H10M0S"
-"END:VALARM"
-"BEGIN:VALARM"
-"ACTION:DISPLAY"
-"DESCRIPTION:This is an event reminder"
-"TRIGGER:-P0DT0H10M0S"
-"END:VALARM"
-"END:VEVENT"
-"END:VCALENDAR</C:calendar-data>"
-"      </D:prop>"
-"    </D:propstat>"
-"  </D:response>"
-"</D:multistatus>";
+/**
+ * A static literal string containing the property query for fetching
+ * the ETAG of a single resource.
+ */
+static const char* getetag_request =
+"<?xml version=\"1.0\" encoding=\"utf-8\" ?>"
+"<D:propfind xmlns:D=\"DAV:\">"
+"  <D:prop>"
+"    <D:getetag/>"
+"  </D:prop>"
+"</D:propfind>\r\n";
 
 /**
- * Function for getting an ETAG from event within a time range from collection.
+ * Ask for the ETAG of a single resource either with PROPFIND or HEAD.
+ * @param url Absolute URL for the resource
+ * @param use_head Use HEAD instead of PROPFIND
  * @param settings A pointer to caldav_settings. @see caldav_settings
  * @param error A pointer to caldav_error. @see caldav_error
- * @return TRUE in case of error, FALSE otherwise.
+ * @return ETAG without quotes or NULL. Caller must free the memory.
  */
-gboolean caldav_request_etag(caldav_settings* settings, caldav_error* error) {
+static gchar* request_resource_etag(gchar* url, gboolean use_head,
+		caldav_settings* settings, caldav_error* error) {
 	CURL* curl;
 	CURLcode res = 0;
 	char error_buf[CURL_ERROR_SIZE + 1];
@@ -359,8 +320,7 @@ gboolean caldav_request_etag(caldav_settings* settings, caldav_error* error) {
 	struct MemoryStruct chunk;
 	struct MemoryStruct headers;
 	struct curl_slist *http_header = NULL;
-	gboolean result = FALSE;
-	gchar* request = NULL;
+	gchar* etag = NULL;
 
 	chunk.memory = NULL; /* we expect realloc(NULL, size) to work */
 	chunk.size = 0;    /* no data at this point */
@@ -371,14 +331,14 @@ gboolean caldav_request_etag(caldav_settings* settings, caldav_error* error) {
 	if (!curl) {
 		error->code = -1;
 		error->str = g_strdup("Could not initialize libcurl");
-		g_free(settings->file);
-		settings->file = NULL;
-		return TRUE;
+		return NULL;
 	}
 
-	http_header = curl_slist_append(http_header,
-			"Content-Type: application/xml; charset=\"utf-8\"");
-	http_header = curl_slist_append(http_header, "Depth: 1");
+	if (! use_head) {
+		http_header = curl_slist_append(http_header,
+				"Content-Type: application/xml; charset=\"utf-8\"");
+		http_header = curl_slist_append(http_header, "Depth: 0");
+	}
 	http_header = curl_slist_append(http_header, "Expect:");
 	http_header = curl_slist_append(http_header, "Transfer-Encoding:");
 	data.trace_ascii = settings->trace_ascii;
@@ -392,68 +352,91 @@ gboolean caldav_request_etag(caldav_settings* settings, caldav_error* error) {
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
+	caldav_trace_setup(curl, settings, &data);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	if (use_head) {
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 1);
+	}
+	else {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, getetag_request);
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, strlen(getetag_request));
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PROPFIND");
 	}
-	request = g_strdup_printf(
-		"%s\r\n<C:time-range start=\"%s\"\r\n end=\"%s\"/>\r\n%s",
-			getrange_request_head, get_caldav_datetime(&settings->start),
-			get_caldav_datetime(&settings->end), getrange_request_foot);
-	/* enable uploading */
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request);
-	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(request));
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "REPORT");
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	if (res != 0) {
 		error->code = -1;
 		error->str = g_strdup_printf("%s", error_buf);
-		g_free(settings->file);
-		settings->file = NULL;
-		result = TRUE;
 	}
 	else {
 		long code;
 		res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-		if (! parse_response(CALDAV_REPORT, code, chunk.memory)) {
+		if (! parse_response((use_head) ? CALDAV_GET : CALDAV_PROPFIND,
+					code, chunk.memory)) {
 			error->code = code;
 			error->str = g_strdup(headers.memory);
-			result = TRUE;
 		}
 		else {
-/*			free(chunk.memory);
-			chunk.memory = g_strdup(XML);	
-*/
-			GSList* head;
-			GSList* list = get_tag_list(chunk.memory);
-			for (head = list; list; list = g_slist_next(list)) {
-				Pair* pair = (Pair *) list->data;
-				if (g_str_has_suffix(settings->id->Ident.Location.location, pair->href)) {
-					settings->etag = g_strdup(pair->etag);
-					break;
-				}
-			}
-			list = head;
-			while (head) {
-				Pair* p = (Pair *) head->data;
-				g_free(p->href);
-				g_free(p->etag);
-				head = g_slist_next(head);
-			}
-			g_slist_free(list);
+			gchar* tmp;
+			if (use_head)
+				tmp = get_response_header("ETAG", headers.memory, FALSE);
+			else
+				tmp = get_etag(chunk.memory);
+			if (tmp && *tmp)
+				etag = sanitize(tmp);
+			g_free(tmp);
 		}
 	}
-	g_free(request);
 	if (chunk.memory)
 		free(chunk.memory);
 	if (headers.memory)
 		free(headers.memory);
 	curl_slist_free_all(http_header);
 	curl_easy_cleanup(curl);
-	return result;
+	return etag;
+}
+
+/**
+ * Function for getting the ETAG of the resource a server created at the
+ * Location returned from a PUT. Only the resource itself is queried using
+ * PROPFIND (Depth: 0) for getetag. If the server does not answer with an
+ * ETAG a HEAD request is used instead.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * settings->id must be of type CALDAV_LOCATION_TYPE. The ETAG found is
+ * stored in settings->etag.
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE in case of error, FALSE otherwise.
+ */
+gboolean caldav_request_etag(caldav_settings* settings, caldav_error* error) {
+	gchar* url;
+	gchar* etag;
+
+	if (! settings->id || settings->id->Type != CALDAV_LOCATION_TYPE ||
+			! settings->id->Ident.Location.location) {
+		error->code = -1;
+		error->str = g_strdup("No location to request ETAG from");
+		return TRUE;
+	}
+	url = resolve_location(settings, settings->id->Ident.Location.location);
+	etag = request_resource_etag(url, FALSE, settings, error);
+	if (! etag) {
+		g_free(error->str);
+		error->str = NULL;
+		error->code = 0;
+		etag = request_resource_etag(url, TRUE, settings, error);
+	}
+	g_free(url);
+	if (! etag) {
+		if (error->code == 0) {
+			error->code = -1;
+			error->str = g_strdup("Server did not return an ETAG");
+		}
+		return TRUE;
+	}
+	g_free(settings->etag);
+	settings->etag = etag;
+	return FALSE;
 }
 
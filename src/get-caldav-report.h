@@ -43,8 +43,11 @@ gboolean caldav_getall(caldav_settings* settings, caldav_error* error);
 gboolean caldav_getrange(caldav_settings* settings, caldav_error* error);
 
 /**
- * Function for getting an ETAG from event within a time range from collection.
+ * Function for getting the ETAG of the resource a server created at the
+ * Location returned from a PUT.
  * @param settings A pointer to caldav_settings. @see caldav_settings
+ * settings->id must be of type CALDAV_LOCATION_TYPE. The ETAG found is
+ * stored in settings->etag.
  * @param error A pointer to caldav_error. @see caldav_error
  * @return TRUE in case of error, FALSE otherwise.
  */
@@ -23,6 +23,8 @@
 
 #include "get-display-name.h"
 #include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -91,16 +93,12 @@ gboolean caldav_getname(caldav_settings* settings, caldav_error* error) {
 	curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, strlen(getname_request));
 	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, http_header);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, settings, &data);
 	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PROPFIND");
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	if (res != 0) {
 		error->code = -1;
 		error->str = g_strdup_printf("%s", error_buf);
@@ -22,9 +22,13 @@
 #endif
 
 #include "get-freebusy-report.h"
+#include "caldav-freebusy.h"
 #include "response-parser.h"
+#include "caldav-multi.h"
+#include "caldav-trace.h"
 #include <glib.h>
 #include <curl/curl.h>
+#include <stdlib.h>
 #include <string.h>
 
 /**
@@ -89,11 +93,7 @@ gboolean caldav_freebusy(caldav_settings* settings, caldav_error* error) {
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, settings, &data);
 	request = g_strdup_printf(
 		"%s\r\n<C:time-range start=\"%s\"\r\n end=\"%s\"/>\r\n%s",
 			getrange_request_head, get_caldav_datetime(&settings->start),
@@ -105,7 +105,7 @@ gboolean caldav_freebusy(caldav_settings* settings, caldav_error* error) {
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	if (res != 0) {
 		error->code = -1;
 		error->str = g_strdup_printf("%s", error_buf);
@@ -158,3 +158,197 @@ gboolean caldav_freebusy(caldav_settings* settings, caldav_error* error) {
 	curl_easy_cleanup(curl);
 	return result;
 }
+
+/**
+ * @typedef struct freebusy_job
+ * Holds everything belonging to one free-busy-query in transit
+ */
+typedef struct {
+	multi_job multi;		/* must come first */
+	caldav_freebusy_item* item;
+	struct curl_slist* http_header;
+	struct config_data data;
+	char error_buf[CURL_ERROR_SIZE];
+} freebusy_job;
+
+/**
+ * @typedef struct freebusy_multi
+ * Shared by the jobs of one caldav_freebusy_multi call
+ */
+typedef struct {
+	gchar* request;
+	time_t start;
+	time_t end;
+} freebusy_multi;
+
+static gboolean prepare_freebusy_job(multi_job* multi, gpointer data) {
+	freebusy_job* job = (freebusy_job *) multi;
+	const gchar* request = ((freebusy_multi *) data)->request;
+	caldav_settings* settings = multi->settings;
+
+	multi->curl = get_curl(settings);
+	if (! multi->curl) {
+		job->item->code = -1;
+		job->item->result = CONFLICT;
+		return FALSE;
+	}
+	multi->idempotent = TRUE;
+	job->http_header = curl_slist_append(job->http_header,
+			"Content-Type: application/xml; charset=\"utf-8\"");
+	job->http_header = curl_slist_append(job->http_header, "Depth: 1");
+	job->http_header = curl_slist_append(job->http_header, "Expect:");
+	job->http_header = curl_slist_append(job->http_header,
+			"Transfer-Encoding:");
+	job->data.trace_ascii = settings->trace_ascii;
+	curl_easy_setopt(multi->curl, CURLOPT_HTTPHEADER, job->http_header);
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEDATA, (void *) &multi->chunk);
+	curl_easy_setopt(multi->curl, CURLOPT_HEADERFUNCTION, WriteHeaderCallback);
+	curl_easy_setopt(multi->curl, CURLOPT_WRITEHEADER, (void *) &multi->headers);
+	curl_easy_setopt(multi->curl, CURLOPT_ERRORBUFFER, job->error_buf);
+	caldav_trace_setup(multi->curl, settings, &job->data);
+	/* the request is shared between jobs and outlives them */
+	curl_easy_setopt(multi->curl, CURLOPT_POSTFIELDS, request);
+	curl_easy_setopt(multi->curl, CURLOPT_POSTFIELDSIZE, strlen(request));
+	curl_easy_setopt(multi->curl, CURLOPT_CUSTOMREQUEST, "REPORT");
+	curl_easy_setopt(multi->curl, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(multi->curl, CURLOPT_UNRESTRICTED_AUTH, 1);
+	curl_easy_setopt(multi->curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+	return TRUE;
+}
+
+static void parse_freebusy_response(const gchar* response, gsize length,
+		const gchar* dav, const gchar* cal, gpointer data) {
+	gchar* calendar = get_element_text(response, length, cal, "calendar-data");
+
+	busy_parse(calendar, (GArray *) data);
+	g_free(calendar);
+}
+
+/**
+ * Store the busy periods of a finished request in its item.
+ */
+static void finish_freebusy_job(multi_job* multi, CURLcode res,
+		gpointer data) {
+	freebusy_job* job = (freebusy_job *) multi;
+	freebusy_multi* shared = (freebusy_multi *) data;
+	caldav_freebusy_item* item = job->item;
+	GArray* periods;
+	GArray* merged;
+	long code = 0;
+
+	if (res != CURLE_OK) {
+		item->code = -1;
+		item->result = CONFLICT;
+		return;
+	}
+	curl_easy_getinfo(multi->curl, CURLINFO_RESPONSE_CODE, &code);
+	item->code = code;
+	periods = g_array_new(FALSE, FALSE, sizeof(caldav_period));
+	if (parse_response(CALDAV_REPORT, code, multi->chunk.memory))
+		parse_multistatus(multi->chunk.memory, parse_freebusy_response,
+				periods);
+	else if (code == 200 && multi->chunk.memory) {
+		/* raw iCal as answered by most servers */
+		busy_parse(multi->chunk.memory, periods);
+	}
+	else {
+		switch (code) {
+			case 403: item->result = FORBIDDEN; break;
+			case 409: item->result = CONFLICT; break;
+			case 423: item->result = LOCKED; break;
+			case 501: item->result = NOTIMPLEMENTED; break;
+			default: item->result = CONFLICT; break;
+		}
+		g_array_free(periods, TRUE);
+		return;
+	}
+	merged = busy_merge(periods, shared->start, shared->end);
+	g_array_free(periods, TRUE);
+	item->result = OK;
+	item->count = merged->len;
+	item->periods = (caldav_period *) g_array_free(merged, FALSE);
+}
+
+static void free_freebusy_job(multi_job* multi, gpointer data) {
+	freebusy_job* job = (freebusy_job *) multi;
+
+	if (job->http_header)
+		curl_slist_free_all(job->http_header);
+	job->http_header = NULL;
+}
+
+static const multi_ops freebusy_ops = {
+	prepare_freebusy_job,
+	finish_freebusy_job,
+	free_freebusy_job
+};
+
+/**
+ * Function for getting freebusy within a time range from several
+ * collections. The requests are executed concurrently using the libcurl
+ * multi interface with at most settings->max_in_flight requests in transit
+ * and connections reused between requests to the same server. The merged
+ * busy periods for each collection are stored in its item.
+ * @param settings Array of caldav_settings, one for each item.
+ * @see caldav_settings
+ * @param items Array of caldav_freebusy_item. @see caldav_freebusy_item
+ * @param count Number of items in the arrays
+ * @param start Start of range in UTC
+ * @param end End of range in UTC
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if one or more collections failed, FALSE otherwise.
+ */
+gboolean caldav_freebusy_multi(caldav_settings* settings,
+		caldav_freebusy_item* items, int count, time_t start, time_t end,
+		caldav_error* error) {
+	freebusy_multi shared;
+	freebusy_job* jobs;
+	gchar* from;
+	gchar* to;
+	gboolean result;
+	int failed = 0;
+	int i;
+
+	if (! items || count <= 0)
+		return FALSE;
+
+	from = utc_to_ical_time(start);
+	to = utc_to_ical_time(end);
+	shared.request = g_strdup_printf(
+		"%s\r\n<C:time-range start=\"%s\"\r\n end=\"%s\"/>\r\n%s",
+			getrange_request_head, from, to, getrange_request_foot);
+	shared.start = start;
+	shared.end = end;
+	g_free(from);
+	g_free(to);
+
+	jobs = g_new0(freebusy_job, count);
+	for (i = 0; i < count; i++) {
+		jobs[i].multi.settings = &settings[i];
+		jobs[i].item = &items[i];
+		items[i].result = OK;
+		items[i].code = 0;
+		items[i].periods = NULL;
+		items[i].count = 0;
+	}
+	result = caldav_multi_run(settings, jobs, sizeof(freebusy_job), count,
+			&freebusy_ops, &shared, error);
+	g_free(jobs);
+	g_free(shared.request);
+	if (result)
+		return TRUE;
+
+	for (i = 0; i < count; i++) {
+		if (items[i].result != OK) {
+			if (failed++ == 0)
+				error->code = items[i].code;
+		}
+	}
+	if (failed > 0) {
+		error->str = g_strdup_printf(
+				"%d of %d calendars failed", failed, count);
+		return TRUE;
+	}
+	return FALSE;
+}
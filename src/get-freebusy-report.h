@@ -34,6 +34,25 @@ G_BEGIN_DECLS
  */
 gboolean caldav_freebusy(caldav_settings* settings, caldav_error* error);
 
+/**
+ * Function for getting freebusy within a time range from several
+ * collections. The requests are executed concurrently using the libcurl
+ * multi interface with at most settings->max_in_flight requests in transit
+ * and connections reused between requests to the same server. The merged
+ * busy periods for each collection are stored in its item.
+ * @param settings Array of caldav_settings, one for each item.
+ * @see caldav_settings
+ * @param items Array of caldav_freebusy_item. @see caldav_freebusy_item
+ * @param count Number of items in the arrays
+ * @param start Start of range in UTC
+ * @param end End of range in UTC
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if one or more collections failed, FALSE otherwise.
+ */
+gboolean caldav_freebusy_multi(caldav_settings* settings,
+		caldav_freebusy_item* items, int count, time_t start, time_t end,
+		caldav_error* error);
+
 G_END_DECLS
 
 #endif
@@ -0,0 +1,517 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "import-caldav-object.h"
+#include "batch-caldav-object.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static const char* RESOURCE_HEAD =
+"BEGIN:VCALENDAR\r\n"
+"PRODID:-//CalDAV Calendar//NONSGML libcaldav//EN\r\n"
+"VERSION:2.0\r\n";
+static const char* RESOURCE_FOOT = "END:VCALENDAR\r\n";
+
+#define READ_BUFFER 65536
+/* Resources per request in transit sent as one batch by caldav_import */
+#define IMPORT_WINDOW 16
+
+/**
+ * @typedef struct ical_group
+ * Components sharing a UID waiting to be emitted as one resource
+ */
+typedef struct {
+	gchar* uid;
+	GString* text;
+	GHashTable* tzrefs;		/* TZIDs referenced by the components */
+} ical_group;
+
+/**
+ * @struct _ical_splitter
+ * State kept between calls to ical_splitter_feed
+ */
+struct _ical_splitter {
+	ical_resource_func func;
+	gpointer data;
+	GString* line;			/* physical line not yet terminated */
+	GString* logical;		/* current unfolded content line */
+	int depth;
+	gboolean in_timezone;
+	GString* component;		/* component being read */
+	gchar* component_uid;
+	gchar* tzid;			/* TZID of the VTIMEZONE being read */
+	GHashTable* tzrefs;		/* TZIDs referenced by the component */
+	GHashTable* timezones;	/* TZID -> VTIMEZONE */
+	GQueue* groups;			/* pending resources in stream order */
+	GHashTable* pending;	/* UID -> pending ical_group */
+	guint window;			/* pending resources kept, 0 for all */
+	GHashTable* emitted;	/* UIDs already handed to func */
+};
+
+static gboolean has_name(const gchar* line, const gchar* name) {
+	gsize len = strlen(name);
+
+	return (g_ascii_strncasecmp(line, name, len) == 0 &&
+			(line[len] == ':' || line[len] == ';'));
+}
+
+static gchar* property_value(const gchar* line) {
+	const gchar* pos = line;
+	gboolean quoted = FALSE;
+
+	while (*pos && (quoted || *pos != ':')) {
+		if (*pos == '"')
+			quoted = ! quoted;
+		pos++;
+	}
+	if (! *pos)
+		return NULL;
+	return g_strstrip(g_strdup(pos + 1));
+}
+
+/**
+ * Record every TZID parameter in the parameter part of a content line
+ */
+static void property_tzrefs(ical_splitter* s, const gchar* line) {
+	const gchar* pos = line;
+	const gchar* start;
+	gboolean quoted = FALSE;
+
+	while (*pos && (quoted || *pos != ':')) {
+		if (*pos == '"')
+			quoted = ! quoted;
+		if (! quoted && *pos == ';' &&
+				g_ascii_strncasecmp(pos + 1, "TZID=", 5) == 0) {
+			pos += 6;
+			if (*pos == '"') {
+				start = ++pos;
+				while (*pos && *pos != '"')
+					pos++;
+			}
+			else {
+				start = pos;
+				while (*pos && *pos != ':' && *pos != ';' && *pos != ',')
+					pos++;
+			}
+			if (pos > start)
+				g_hash_table_replace(s->tzrefs,
+						g_strndup(start, pos - start), NULL);
+			continue;
+		}
+		pos++;
+	}
+}
+
+static void splitter_property(ical_splitter* s) {
+	const gchar* line = s->logical->str;
+
+	if (s->depth < 2 || s->logical->len == 0)
+		return;
+	if (s->in_timezone) {
+		if (s->depth == 2 && ! s->tzid && has_name(line, "TZID"))
+			s->tzid = property_value(line);
+	}
+	else {
+		if (s->depth == 2 && ! s->component_uid && has_name(line, "UID"))
+			s->component_uid = property_value(line);
+		property_tzrefs(s, line);
+	}
+}
+
+static void copy_tzref(gpointer key, gpointer value, gpointer data) {
+	g_hash_table_replace((GHashTable *) data, g_strdup((gchar *) key), NULL);
+}
+
+typedef struct {
+	GHashTable* timezones;
+	GString* resource;
+} tz_append;
+
+static void append_timezone(gpointer key, gpointer value, gpointer data) {
+	tz_append* append = (tz_append *) data;
+	gchar* tz = g_hash_table_lookup(append->timezones, key);
+
+	if (tz)
+		g_string_append(append->resource, tz);
+}
+
+static ical_group* group_new(const gchar* uid) {
+	ical_group* group = g_new0(ical_group, 1);
+
+	group->uid = g_strdup(uid);
+	group->text = g_string_new("");
+	group->tzrefs = g_hash_table_new_full(
+			g_str_hash, g_str_equal, CALDAV_FREE_FUNC, NULL);
+	return group;
+}
+
+static void group_free(ical_group* group) {
+	g_free(group->uid);
+	g_string_free(group->text, TRUE);
+	g_hash_table_destroy(group->tzrefs);
+	g_free(group);
+}
+
+/* Hand every pending resource to func in stream order */
+static void splitter_emit(ical_splitter* s) {
+	ical_group* group;
+	GString* resource;
+	tz_append append;
+
+	g_hash_table_remove_all(s->pending);
+	while ((group = g_queue_pop_head(s->groups)) != NULL) {
+		resource = g_string_new(RESOURCE_HEAD);
+		append.timezones = s->timezones;
+		append.resource = resource;
+		g_hash_table_foreach(group->tzrefs, append_timezone, &append);
+		g_string_append_len(resource, group->text->str, group->text->len);
+		g_string_append(resource, RESOURCE_FOOT);
+		if (group->uid)
+			g_hash_table_replace(s->emitted, g_strdup(group->uid), NULL);
+		s->func(group->uid, g_string_free(resource, FALSE), s->data);
+		group_free(group);
+	}
+}
+
+static void splitter_component_done(ical_splitter* s) {
+	if (s->in_timezone) {
+		if (s->tzid) {
+			g_hash_table_replace(s->timezones, s->tzid,
+					g_strdup(s->component->str));
+			s->tzid = NULL;
+		}
+	}
+	else {
+		gchar* uid = s->component_uid;
+		ical_group* group = (uid) ? g_hash_table_lookup(s->pending, uid) : NULL;
+
+		if (! group) {
+			if (uid && g_hash_table_lookup_extended(
+						s->emitted, uid, NULL, NULL)) {
+				/* override too far from its master, which is emitted */
+				s->func(uid, NULL, s->data);
+				g_free(s->component_uid);
+				s->component_uid = NULL;
+				g_hash_table_remove_all(s->tzrefs);
+				g_string_truncate(s->component, 0);
+				return;
+			}
+			if (s->window > 0 && g_queue_get_length(s->groups) >= s->window)
+				splitter_emit(s);
+			group = group_new(uid);
+			g_queue_push_tail(s->groups, group);
+			if (uid)
+				g_hash_table_replace(s->pending, group->uid, group);
+		}
+		g_string_append_len(group->text, s->component->str,
+				s->component->len);
+		g_hash_table_foreach(s->tzrefs, copy_tzref, group->tzrefs);
+		g_hash_table_remove_all(s->tzrefs);
+		g_free(s->component_uid);
+		s->component_uid = NULL;
+	}
+	g_string_truncate(s->component, 0);
+}
+
+static void splitter_line(ical_splitter* s, const gchar* line, gsize len) {
+	if (len > 0 && line[len - 1] == '\r')
+		len--;
+	if (len > 0 && (line[0] == ' ' || line[0] == '\t')) {
+		/* folded continuation of the previous content line */
+		g_string_append_len(s->logical, line + 1, len - 1);
+		if (s->depth >= 2) {
+			g_string_append_len(s->component, line, len);
+			g_string_append(s->component, "\r\n");
+		}
+		return;
+	}
+	splitter_property(s);
+	g_string_truncate(s->logical, 0);
+	g_string_append_len(s->logical, line, len);
+	line = s->logical->str;
+
+	if (g_ascii_strncasecmp(line, "BEGIN:", 6) == 0) {
+		if (s->depth == 0) {
+			if (g_ascii_strcasecmp(line + 6, "VCALENDAR") == 0)
+				s->depth = 1;
+			return;
+		}
+		if (s->depth == 1) {
+			s->in_timezone = (g_ascii_strcasecmp(line + 6, "VTIMEZONE") == 0);
+			g_string_truncate(s->component, 0);
+		}
+		s->depth++;
+	}
+	else if (g_ascii_strncasecmp(line, "END:", 4) == 0) {
+		if (s->depth == 1) {
+			s->depth = 0;
+			return;
+		}
+		if (s->depth == 2) {
+			g_string_append_len(s->component, line, len);
+			g_string_append(s->component, "\r\n");
+			g_string_truncate(s->logical, 0);
+			s->depth = 1;
+			splitter_component_done(s);
+			return;
+		}
+		if (s->depth > 2)
+			s->depth--;
+	}
+	if (s->depth >= 2) {
+		g_string_append_len(s->component, line, len);
+		g_string_append(s->component, "\r\n");
+	}
+}
+
+/**
+ * Create a new splitter.
+ * @param func Function receiving each resource
+ * @param data User data passed to func
+ * @param window Number of resources kept before they are emitted, 0 to
+ * keep all until ical_splitter_finish
+ * @return a new splitter
+ */
+ical_splitter* ical_splitter_new(ical_resource_func func, gpointer data,
+		guint window) {
+	ical_splitter* s;
+
+	s = g_new0(ical_splitter, 1);
+	s->func = func;
+	s->data = data;
+	s->window = window;
+	s->line = g_string_new("");
+	s->logical = g_string_new("");
+	s->component = g_string_new("");
+	s->groups = g_queue_new();
+	s->pending = g_hash_table_new(g_str_hash, g_str_equal);
+	s->tzrefs = g_hash_table_new_full(g_str_hash, g_str_equal,
+			CALDAV_FREE_FUNC, NULL);
+	s->timezones = g_hash_table_new_full(
+			g_str_hash, g_str_equal, CALDAV_FREE_FUNC, CALDAV_FREE_FUNC);
+	s->emitted = g_hash_table_new_full(g_str_hash, g_str_equal,
+			CALDAV_FREE_FUNC, NULL);
+	return s;
+}
+
+/**
+ * Feed the next part of the stream to the splitter.
+ * @param splitter @see ical_splitter
+ * @param buf Data
+ * @param len Length of data
+ */
+void ical_splitter_feed(ical_splitter* splitter, const gchar* buf, gsize len) {
+	const gchar* end = buf + len;
+	const gchar* nl;
+
+	while (buf < end) {
+		nl = memchr(buf, '\n', end - buf);
+		if (! nl) {
+			g_string_append_len(splitter->line, buf, end - buf);
+			break;
+		}
+		if (splitter->line->len > 0) {
+			g_string_append_len(splitter->line, buf, nl - buf);
+			splitter_line(splitter, splitter->line->str, splitter->line->len);
+			g_string_truncate(splitter->line, 0);
+		}
+		else {
+			splitter_line(splitter, buf, nl - buf);
+		}
+		buf = nl + 1;
+	}
+}
+
+/**
+ * Signal end of stream. Emits the pending resources.
+ * @param splitter @see ical_splitter
+ */
+void ical_splitter_finish(ical_splitter* splitter) {
+	if (splitter->line->len > 0) {
+		gchar* line = g_strdup(splitter->line->str);
+		g_string_truncate(splitter->line, 0);
+		splitter_line(splitter, line, strlen(line));
+		g_free(line);
+	}
+	splitter_property(splitter);
+	g_string_truncate(splitter->logical, 0);
+	splitter_emit(splitter);
+}
+
+/**
+ * Free a splitter
+ * @param splitter @see ical_splitter
+ */
+void ical_splitter_free(ical_splitter* splitter) {
+	if (! splitter)
+		return;
+	g_string_free(splitter->line, TRUE);
+	g_string_free(splitter->logical, TRUE);
+	g_string_free(splitter->component, TRUE);
+	g_queue_foreach(splitter->groups, (GFunc) group_free, NULL);
+	g_queue_free(splitter->groups);
+	g_hash_table_destroy(splitter->pending);
+	g_hash_table_destroy(splitter->tzrefs);
+	g_hash_table_destroy(splitter->timezones);
+	g_hash_table_destroy(splitter->emitted);
+	g_free(splitter->component_uid);
+	g_free(splitter->tzid);
+	g_free(splitter);
+}
+
+/**
+ * @typedef struct import_state
+ * Resources waiting to be sent as one batch
+ */
+typedef struct {
+	caldav_settings* settings;
+	caldav_import_callback callback;
+	void* user_data;
+	caldav_batch_item* items;
+	gchar** uids;
+	int count;
+	int window;
+	int total;
+	int failed;
+	long code;
+} import_state;
+
+static void import_flush(import_state* state) {
+	caldav_error error;
+	int i;
+
+	if (state->count == 0)
+		return;
+	error.code = 0;
+	error.str = NULL;
+	caldav_batch(state->settings, state->items, state->count, &error);
+	g_free(error.str);
+	for (i = 0; i < state->count; i++) {
+		caldav_batch_item* item = &state->items[i];
+
+		if (item->result != OK && state->failed++ == 0)
+			state->code = item->code;
+		if (state->callback)
+			state->callback(state->uids[i], item->result, item->code,
+					item->id, state->user_data);
+		g_free((gchar *) item->object);
+		if (item->id)
+			caldav_free_caldav_id(&item->id);
+		g_free(state->uids[i]);
+	}
+	memset(state->items, '\0', sizeof(caldav_batch_item) * state->window);
+	state->count = 0;
+}
+
+static void import_resource(const gchar* uid, gchar* resource, gpointer data) {
+	import_state* state = (import_state *) data;
+
+	state->total++;
+	if (! resource) {
+		/* cannot be merged with a resource which is already stored */
+		if (state->failed++ == 0)
+			state->code = -1;
+		if (state->callback)
+			state->callback(uid, CONFLICT, -1, NULL, state->user_data);
+		return;
+	}
+	state->items[state->count].action = ADD;
+	state->items[state->count].object = resource;
+	state->uids[state->count] = g_strdup(uid);
+	if (++state->count == state->window)
+		import_flush(state);
+}
+
+/**
+ * Function for importing an iCalendar stream into a collection.
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param fd File descriptor to read from or -1 to use buffer
+ * @param buffer iCalendar to import if fd is -1
+ * @param length Length of buffer
+ * @param callback Function called with the outcome for every object
+ * @param user_data Passed to callback
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if one or more objects failed, FALSE otherwise.
+ */
+gboolean caldav_import(caldav_settings* settings, int fd, const gchar* buffer,
+		gsize length, caldav_import_callback callback, void* user_data,
+		caldav_error* error) {
+	import_state state;
+	ical_splitter* splitter;
+	gboolean result = FALSE;
+
+	memset(&state, '\0', sizeof(import_state));
+	state.settings = settings;
+	state.callback = callback;
+	state.user_data = user_data;
+	/*
+	 * The stream is split one window at a time and each window is stored
+	 * before the next is split, so the transfers drain at every boundary.
+	 * The window bounds the resources held in memory and how far apart an
+	 * override may be from its master.
+	 */
+	state.window = ((settings->max_in_flight > 0) ?
+			settings->max_in_flight : 1) * IMPORT_WINDOW;
+	state.items = g_new0(caldav_batch_item, state.window);
+	state.uids = g_new0(gchar*, state.window);
+
+	splitter = ical_splitter_new(import_resource, &state, state.window);
+	if (fd >= 0) {
+		gchar* buf = g_malloc(READ_BUFFER);
+		ssize_t len;
+
+		while ((len = read(fd, buf, READ_BUFFER)) != 0) {
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				error->code = -1;
+				error->str = g_strdup_printf("Read error: %s",
+						g_strerror(errno));
+				result = TRUE;
+				break;
+			}
+			ical_splitter_feed(splitter, buf, len);
+		}
+		g_free(buf);
+	}
+	else if (buffer) {
+		ical_splitter_feed(splitter, buffer, length);
+	}
+	ical_splitter_finish(splitter);
+	import_flush(&state);
+	ical_splitter_free(splitter);
+	g_free(state.items);
+	g_free(state.uids);
+
+	if (! result && state.failed > 0) {
+		error->code = state.code;
+		error->str = g_strdup_printf(
+				"%d of %d objects failed", state.failed, state.total);
+		result = TRUE;
+	}
+	return result;
+}
@@ -0,0 +1,100 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __IMPORT_CALDAV_OBJECT_H__
+#define __IMPORT_CALDAV_OBJECT_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include "caldav-utils.h"
+#include "caldav.h"
+
+/**
+ * @typedef struct _ical_splitter ical_splitter
+ * Incremental splitter turning an iCalendar stream into CalDAV resources
+ */
+typedef struct _ical_splitter ical_splitter;
+
+/**
+ * Called by the splitter for every complete resource.
+ * @param uid UID shared by the components in the resource. May be NULL.
+ * @param resource A VCALENDAR holding the components and the VTIMEZONEs
+ * they reference. The receiver takes ownership of the memory.
+ * @param data User data given to ical_splitter_new
+ */
+typedef void (*ical_resource_func)(const gchar* uid, gchar* resource,
+		gpointer data);
+
+/**
+ * Create a new splitter. Components sharing a UID (master and overrides)
+ * end up in the same resource as long as the resource has not been
+ * emitted. Resources are kept until window of them are pending, then all
+ * are emitted in stream order. A component whose UID has already been
+ * emitted is handed to func with a NULL resource.
+ * @param func Function receiving each resource
+ * @param data User data passed to func
+ * @param window Number of resources kept before they are emitted, 0 to
+ * keep all until ical_splitter_finish
+ * @return a new splitter
+ */
+ical_splitter* ical_splitter_new(ical_resource_func func, gpointer data,
+		guint window);
+
+/**
+ * Feed the next part of the stream to the splitter.
+ * @param splitter @see ical_splitter
+ * @param buf Data
+ * @param len Length of data
+ */
+void ical_splitter_feed(ical_splitter* splitter, const gchar* buf, gsize len);
+
+/**
+ * Signal end of stream. Emits the pending resources.
+ * @param splitter @see ical_splitter
+ */
+void ical_splitter_finish(ical_splitter* splitter);
+
+/**
+ * Free a splitter
+ * @param splitter @see ical_splitter
+ */
+void ical_splitter_free(ical_splitter* splitter);
+
+/**
+ * Function for importing an iCalendar stream into a collection. Every
+ * group of components sharing a UID is stored as one object using the
+ * batch path. @see caldav_batch
+ * @param settings A pointer to caldav_settings. @see caldav_settings
+ * @param fd File descriptor to read from or -1 to use buffer
+ * @param buffer iCalendar to import if fd is -1
+ * @param length Length of buffer
+ * @param callback Function called with the outcome for every object. May
+ * be NULL.
+ * @param user_data Passed to callback
+ * @param error A pointer to caldav_error. @see caldav_error
+ * @return TRUE if one or more objects failed, FALSE otherwise.
+ */
+gboolean caldav_import(caldav_settings* settings, int fd, const gchar* buffer,
+		gsize length, caldav_import_callback callback, void* user_data,
+		caldav_error* error);
+
+G_END_DECLS
+
+#endif
@@ -23,6 +23,8 @@
 #include "lock-caldav-object.h"
 #include "options-caldav-server.h"
 #include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -90,11 +92,7 @@ gchar* caldav_lock_object(
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, settings, &data);
 	if (settings->usehttps) {
 		url = g_strdup_printf("https://%s", URI);
 	} else {
@@ -109,7 +107,7 @@ gchar* caldav_lock_object(
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, FALSE, &chunk, &headers);
 	curl_slist_free_all(http_header);
 	if (res != 0) {
 		error->code = -1;
@@ -196,11 +194,7 @@ gboolean caldav_unlock_object(gchar* lock_token, gchar* URI,
 	/* we pass our 'headers' struct to the callback function */
 	curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
-	if (settings->debug) {
-		curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-		curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-		curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-	}
+	caldav_trace_setup(curl, settings, &data);
 	if (settings->usehttps) {
 		url = g_strdup_printf("https://%s", URI);
 	} else {
@@ -213,7 +207,7 @@ gboolean caldav_unlock_object(gchar* lock_token, gchar* URI,
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, FALSE, &chunk, &headers);
 	curl_slist_free_all(http_header);
 	if (res != 0) {
 		error->code = -1;
@@ -435,6 +435,24 @@ void caldav_md5_hex_digest(char *hexdigest, const unsigned char *s) {
 	md5_hex_digest(hexdigest, s);
 }
 
+void caldav_md5_init(MD5_CONTEXT *ctx) {
+	md5_init(ctx);
+}
+
+void caldav_md5_update(MD5_CONTEXT *ctx, const unsigned char *data,
+                  size_t length) {
+	md5_update(ctx, data, length);
+}
+
+void caldav_md5_hex_final(char *hexdigest, MD5_CONTEXT *ctx) {
+	unsigned char digest[16];
+	int i;
+
+	md5_final(digest, ctx);
+	for (i = 0; i < 16; i++)
+		sprintf(hexdigest + 2 * i, "%02x", digest[i]);
+}
+
 void caldav_md5_hex_hmac(char *hexdigest,
                   const unsigned char* text, int text_len,
                   const unsigned char* key, int key_len) {
@@ -45,6 +45,13 @@ typedef struct {  /* Hmm, should be private */
 
 void caldav_md5_hex_digest(char *hexdigest, const unsigned char *s);
 
+void caldav_md5_init(MD5_CONTEXT *ctx);
+
+void caldav_md5_update(MD5_CONTEXT *ctx, const unsigned char *data,
+                  size_t length);
+
+void caldav_md5_hex_final(char *hexdigest, MD5_CONTEXT *ctx);
+
 void caldav_md5_hex_hmac(char *hexdigest,
                   const unsigned char* text, int text_len,
                   const unsigned char* key, int key_len);
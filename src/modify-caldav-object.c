@@ -23,7 +23,11 @@
 
 #include "modify-caldav-object.h"
 #include "lock-caldav-object.h"
+#include "caldav-session.h"
 #include "response-parser.h"
+#include "caldav-limiter.h"
+#include "caldav-trace.h"
+#include "caldav-upload.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -47,6 +51,8 @@ gboolean caldav_modify(caldav_settings* settings, caldav_error* error) {
 	gchar* etag;
 	gchar* url = NULL;
 	gchar* file;
+	gchar* uid = NULL;
+	gchar* href = NULL;
 	gboolean result = FALSE;
 	gboolean LOCKSUPPORT = FALSE;
 	gchar* lock_token = NULL;
@@ -91,28 +97,25 @@ gboolean caldav_modify(caldav_settings* settings, caldav_error* error) {
 			 */
 		}
 	}
+	if (settings->upload)
+		uid = g_strdup(caldav_upload_uid(settings->upload));
+	else if (settings->file)
+		uid = get_response_header("uid", settings->file, FALSE);
 	if (settings->ACTION == MODIFY) {
-		etag = find_etag(&chunk, settings, error);
-		url = get_url(chunk.memory);
-		if (etag) {
+		file = find_etag(settings, &href, error);
+		if (file) {
 			gchar* host = get_host(settings->url);
+			etag = g_strconcat("\"", file, "\"", NULL);
+			g_free(file);
 			if (host) {
-				file = g_strdup(url);
-				g_free(url);
-				url = g_strdup_printf("%s%s", host, file);
-				g_free(file);
+				url = g_strdup_printf("%s%s", host, href);
 				g_free(host);
 			}
 			else {
 				g_free(etag);
-				g_free(url);
 				url = NULL;
 			}
 		}
-		else {
-			g_free(url);
-			url = NULL;
-		}
 	}
 
 	if (url) {
@@ -165,20 +168,21 @@ gboolean caldav_modify(caldav_settings* settings, caldav_error* error) {
 			curl_easy_setopt(curl, CURLOPT_WRITEHEADER, (void *)&headers);
 			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, (char *) &error_buf);
 			data.trace_ascii = settings->trace_ascii;
-			if (settings->debug) {
-				curl_easy_setopt(curl, CURLOPT_DEBUGFUNCTION, my_trace);
-				curl_easy_setopt(curl, CURLOPT_DEBUGDATA, &data);
-				curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-			}
+			caldav_trace_setup(curl, settings, &data);
 			curl_easy_setopt(curl, CURLOPT_URL, rebuild_url(settings, url));
-			curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
-			curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, 
-						strlen(settings->file));
+			if (settings->upload) {
+				caldav_upload_setup(settings->upload, curl);
+			}
+			else {
+				curl_easy_setopt(curl, CURLOPT_POSTFIELDS, settings->file);
+				curl_easy_setopt (curl, CURLOPT_POSTFIELDSIZE, 
+							strlen(settings->file));
+			}
 			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 			curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 			curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
 			curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-			res = curl_easy_perform(curl);
+			res = caldav_perform(curl, TRUE, &chunk, &headers);
 			if (LOCKSUPPORT && lock_token) {
 				caldav_unlock_object(
 						lock_token, url, settings, &lock_error);
@@ -243,6 +247,20 @@ gboolean caldav_modify(caldav_settings* settings, caldav_error* error) {
 			g_free(location);
 		}
 	}
+	if (uid) {
+		/* times of an object which was not held in memory are unknown */
+		if (settings->upload)
+			caldav_session_forget(settings->session, settings->url, uid);
+		if (! result && settings->id->Type == CALDAV_ETAG_TYPE &&
+				settings->id->Ident.Etag.etag)
+			caldav_session_store(settings->session, settings->url, uid,
+					settings->id->Ident.Etag.uri,
+					settings->id->Ident.Etag.etag, settings->file);
+		else
+			caldav_session_forget(settings->session, settings->url, uid);
+		g_free(uid);
+	}
+	g_free(href);
 	g_free(settings->url);
 	settings->url = NULL;
 	if (chunk.memory)
@@ -23,6 +23,7 @@
 
 #include "options-caldav-server.h"
 #include "response-parser.h"
+#include "caldav-limiter.h"
 #include <glib.h>
 #include <curl/curl.h>
 #include <stdio.h>
@@ -76,7 +77,7 @@ gboolean caldav_getoptions(CURL* curl, caldav_settings* settings, response* resu
 	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(curl, CURLOPT_UNRESTRICTED_AUTH, 1);
 	curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-	res = curl_easy_perform(curl);
+	res = caldav_perform(curl, TRUE, &chunk, &headers);
 	if (res == 0) {
 		gchar* head;
 		long code;
@@ -86,6 +87,8 @@ gboolean caldav_getoptions(CURL* curl, caldav_settings* settings, response* resu
 		if (head && strstr(head, "calendar-access") != NULL &&
 				parse_response(CALDAV_OPTIONS, code, chunk.memory)) {
 			enabled = TRUE;
+			settings->managed_attachments =
+				(strstr(head, "calendar-managed-attachments") != NULL);
 			if (! test) {
 				result->msg = g_strdup(
 						get_response_header("Allow", headers.memory, FALSE));
@@ -39,6 +39,9 @@ static int CALDAV_LOCK_OK_SIZE = sizeof(CALDAV_LOCK_OK)/sizeof(int);
 static int CALDAV_OPTIONS_OK[] = {200};
 static int CALDAV_OPTIONS_OK_SIZE = sizeof(CALDAV_OPTIONS_OK)/sizeof(int);
 
+static int CALDAV_POST_OK[] = {200, 201, 204};
+static int CALDAV_POST_OK_SIZE = sizeof(CALDAV_POST_OK)/sizeof(int);
+
 static int CALDAV_PROPFIND_OK[] = {207};
 static int CALDAV_PROPFIND_OK_SIZE = sizeof(CALDAV_PROPFIND_OK)/sizeof(int);
 
@@ -96,6 +99,21 @@ caldav_propfind(int response_code, gchar* response_body) {
 	return result;
 }
 
+static gboolean
+caldav_post(int response_code, gchar* response_body) {
+	gboolean result = FALSE;
+	int i;
+	
+	for (i = 0; i < CALDAV_POST_OK_SIZE; i++) {
+		if (response_code == CALDAV_POST_OK[i]) {
+			result = TRUE;
+			break;
+		}
+	}
+	
+	return result;
+}
+
 static gboolean
 caldav_put(int response_code, gchar* response_body) {
 	gboolean result = FALSE;
@@ -188,6 +206,9 @@ parse_response(CALDAV_METHOD method, int response_code, gchar* response_body) {
 		case CALDAV_OPTIONS:
 			result = caldav_options(response_code, response_body);
 			break;
+		case CALDAV_POST:
+			result = caldav_post(response_code, response_body);
+			break;
 		case CALDAV_PROPFIND:
 			result = caldav_propfind(response_code, response_body);
 			break;
@@ -36,6 +36,7 @@ typedef enum {
 	CALDAV_GET,
 	CALDAV_LOCK,
 	CALDAV_OPTIONS,
+	CALDAV_POST,
 	CALDAV_PROPFIND,
 	CALDAV_PUT,
 	CALDAV_REPORT,
@@ -0,0 +1,612 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav.h"
+#include "mock-server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <glib.h>
+
+static const char* usage[] = {
+"caldav-bench is part of libcaldav.\n"
+"Runs every public API against a local stand-in server and reports\n"
+"calls per second, latency, round trips and allocations per call.\n"
+"\nusage:\n\tcaldav-bench [Options] [case ...]\n"
+"\n\tOptions:\n"
+"\t\t-e\tevents in the collection (default 1000)\n"
+"\t\t-i\titerations per case (default 200)\n"
+"\t\t-l\tuse locking for add, modify and delete\n"
+"\t\t-n\tno session, ie. no caching between calls\n"
+"\t\t-r\tsimulated round trip in microseconds (default 0)\n"
+"\t\t-d\tdebug library\n"
+"\t\t-h|-?\tusage\n"
+"\n\tCases are run in the order listed below unless named. The modify\n"
+"\tand delete cases work on the objects made by the add cases:\n"
+};
+
+/*
+ * Allocation counting. With glibc the allocator is wrapped so every
+ * malloc made by the calling thread while a case runs is counted. This
+ * includes glib, libcurl and libcaldav but not the server threads.
+ */
+typedef struct {
+	gboolean	active;
+	guint64		count;
+	guint64		bytes;
+} alloc_counter;
+
+static __thread alloc_counter allocs;
+
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void* malloc(size_t size) {
+	if (allocs.active) {
+		allocs.count++;
+		allocs.bytes += size;
+	}
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+	if (allocs.active) {
+		allocs.count++;
+		allocs.bytes += nmemb * size;
+	}
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	if (allocs.active) {
+		allocs.count++;
+		allocs.bytes += size;
+	}
+	return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+	__libc_free(ptr);
+}
+#define ALLOC_COUNTING TRUE
+#else
+#define ALLOC_COUNTING FALSE
+#endif
+
+typedef struct {
+	mock_server*	server;
+	const gchar*	url;
+	runtime_info*	info;
+	guint			events;
+	guint			iterations;
+	CALDAV_ID**		ids;
+	caldav_store*	store;
+	gchar*			store_path;
+} bench_context;
+
+/**
+ * One benchmarked call.
+ * @return TRUE in case of error, FALSE otherwise
+ */
+typedef gboolean (*bench_func)(bench_context* ctx, guint i);
+
+typedef struct {
+	const gchar*	name;
+	bench_func		run;
+	bench_func		setup;		/* run once before timing. May be NULL */
+} bench_case;
+
+static gint64 now_usec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+/* start of generated event i, wrapped to the collection */
+static time_t event_start(bench_context* ctx, guint i) {
+	return MOCK_EPOCH + (time_t) (i % ctx->events) * MOCK_SPACING;
+}
+
+/*
+ * caldav_get_object and caldav_get_freebusy take the time in the format
+ * used by the test programs: mktime of a struct tm with the full year and
+ * month 1-12.
+ */
+static time_t legacy_time(time_t t) {
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	tm.tm_year += 1900;
+	tm.tm_mon += 1;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+static gboolean check(CALDAV_RESPONSE res, bench_context* ctx) {
+	if (res != OK) {
+		fprintf(stderr, "error %ld: %s\n", ctx->info->error->code,
+			ctx->info->error->str ? ctx->info->error->str : "");
+		g_free(ctx->info->error->str);
+		ctx->info->error->str = NULL;
+		ctx->info->error->code = 0;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean run_options(bench_context* ctx, guint i) {
+	char** options = caldav_get_server_options(ctx->url, ctx->info);
+
+	if (! options)
+		return TRUE;
+	g_strfreev(options);
+	return FALSE;
+}
+
+static gboolean run_enabled(bench_context* ctx, guint i) {
+	return ! caldav_enabled_resource(ctx->url, ctx->info);
+}
+
+static gboolean run_displayname(bench_context* ctx, guint i) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_get_displayname(result, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static gboolean run_getall(bench_context* ctx, guint i) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_getall_object(result, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static int discard(const char* data, size_t length, void* user_data) {
+	return 0;
+}
+
+static gboolean run_getall_sink(bench_context* ctx, guint i) {
+	return check(caldav_getall_object_sink(discard, NULL, FALSE, ctx->url,
+				ctx->info), ctx);
+}
+
+/* a week of events starting at event i */
+static gboolean run_getrange(bench_context* ctx, guint i) {
+	response* result = caldav_get_response();
+	time_t start = event_start(ctx, i);
+	gboolean error = check(caldav_get_object(result, legacy_time(start),
+				legacy_time(start + 7 * 24 * 3600), ctx->url, ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static gboolean run_freebusy(bench_context* ctx, guint i) {
+	response* result = caldav_get_response();
+	time_t start = event_start(ctx, i);
+	gboolean error = check(caldav_get_freebusy(result, legacy_time(start),
+				legacy_time(start + 7 * 24 * 3600), ctx->url, ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static gboolean run_freebusy_multi(bench_context* ctx, guint i) {
+	caldav_freebusy_item items[4];
+	caldav_freebusy_item merged;
+	time_t start = event_start(ctx, i);
+	gboolean error;
+	int n;
+
+	memset(items, 0, sizeof(items));
+	memset(&merged, 0, sizeof(merged));
+	for (n = 0; n < 4; n++)
+		items[n].URL = ctx->url;
+	error = check(caldav_get_freebusy_multi(items, 4, start,
+				start + 7 * 24 * 3600, &merged, ctx->info), ctx);
+	caldav_free_freebusy_items(items, 4);
+	caldav_free_freebusy_items(&merged, 1);
+	return error;
+}
+
+static gboolean setup_lookup(bench_context* ctx, guint i) {
+	/* fills the index of the session */
+	return run_getall(ctx, i);
+}
+
+static gboolean run_lookup(bench_context* ctx, guint i) {
+	gchar* uid = g_strdup_printf("bench-%u@localhost", i % ctx->events);
+	CALDAV_ID* id = caldav_lookup_object(uid, ctx->url, NULL, NULL, ctx->info);
+
+	g_free(uid);
+	if (! id)
+		return TRUE;
+	caldav_free_caldav_id(&id);
+	return FALSE;
+}
+
+static gchar* new_event(const gchar* prefix, guint i, const gchar* summary) {
+	gchar* uid = g_strdup_printf("%s-%u@localhost", prefix, i);
+	gchar* event = mock_server_event(uid, MOCK_EPOCH + i * 60, summary);
+
+	g_free(uid);
+	return event;
+}
+
+static gboolean run_add(bench_context* ctx, guint i) {
+	gchar* event = new_event("add", i, "Added");
+	gboolean error = check(caldav_add_object(event, ctx->url, ctx->info), ctx);
+
+	g_free(event);
+	return error;
+}
+
+static gboolean run_modify(bench_context* ctx, guint i) {
+	gchar* event = new_event("add", i, "Modified");
+	gboolean error = check(caldav_modify_object(event, ctx->url, ctx->info),
+			ctx);
+
+	g_free(event);
+	return error;
+}
+
+static gboolean run_delete(bench_context* ctx, guint i) {
+	gchar* event = new_event("add", i, "Modified");
+	gboolean error = check(caldav_delete_object(event, ctx->url, ctx->info),
+			ctx);
+
+	g_free(event);
+	return error;
+}
+
+static gboolean run_id_add(bench_context* ctx, guint i) {
+	gchar* event = new_event("id", i, "Added");
+	gboolean error = check(caldav_id_add_object(&ctx->ids[i], event, ctx->url,
+				ctx->info), ctx);
+
+	g_free(event);
+	return error;
+}
+
+static gboolean run_id_modify(bench_context* ctx, guint i) {
+	gchar* event = new_event("id", i, "Modified");
+	gboolean error;
+
+	if (! ctx->ids[i]) {
+		g_free(event);
+		return TRUE;
+	}
+	error = check(caldav_id_modify_object(&ctx->ids[i], event, ctx->url,
+				ctx->info), ctx);
+	g_free(event);
+	return error;
+}
+
+/* reads the object from a string */
+static long from_string(char* buffer, size_t length, gint64 offset,
+		void* user_data) {
+	const gchar* object = user_data;
+	gsize size = strlen(object);
+
+	if (offset >= (gint64) size)
+		return 0;
+	length = MIN(length, size - offset);
+	memcpy(buffer, object + offset, length);
+	return length;
+}
+
+static gboolean run_id_modify_source(bench_context* ctx, guint i) {
+	gchar* event = new_event("id", i, "Streamed");
+	gboolean error;
+
+	if (! ctx->ids[i]) {
+		g_free(event);
+		return TRUE;
+	}
+	error = check(caldav_id_modify_object_source(&ctx->ids[i], from_string,
+				event, strlen(event), ctx->url, ctx->info), ctx);
+	g_free(event);
+	return error;
+}
+
+static gboolean run_id_delete(bench_context* ctx, guint i) {
+	gchar* event = new_event("id", i, "Modified");
+	gboolean error;
+
+	if (! ctx->ids[i]) {
+		g_free(event);
+		return TRUE;
+	}
+	error = check(caldav_id_delete_object(ctx->ids[i], event, ctx->url,
+				ctx->info), ctx);
+	caldav_free_caldav_id(&ctx->ids[i]);
+	g_free(event);
+	return error;
+}
+
+/* ten objects per call */
+static gboolean run_batch(bench_context* ctx, guint i) {
+	caldav_batch_item items[10];
+	gchar* events[10];
+	gboolean error;
+	int n;
+
+	memset(items, 0, sizeof(items));
+	for (n = 0; n < 10; n++) {
+		events[n] = new_event("batch", i * 10 + n, "Batch");
+		items[n].action = ADD;
+		items[n].object = events[n];
+	}
+	error = check(caldav_batch_objects(items, 10, ctx->url, ctx->info), ctx);
+	for (n = 0; n < 10; n++) {
+		caldav_free_caldav_id(&items[n].id);
+		g_free(events[n]);
+	}
+	return error;
+}
+
+/* ten events in one VCALENDAR per call */
+static gboolean run_import(bench_context* ctx, guint i) {
+	GString* calendar = g_string_new("BEGIN:VCALENDAR\r\nVERSION:2.0\r\n");
+	gboolean error;
+	int n;
+
+	for (n = 0; n < 10; n++) {
+		gchar* event = new_event("import", i * 10 + n, "Imported");
+		gchar* begin = strstr(event, "BEGIN:VEVENT");
+		gchar* end = strstr(event, "END:VCALENDAR");
+
+		g_string_append_len(calendar, begin, end - begin);
+		g_free(event);
+	}
+	g_string_append(calendar, "END:VCALENDAR\r\n");
+	error = check(caldav_import_buffer(calendar->str, calendar->len,
+				ctx->url, NULL, NULL, ctx->info), ctx);
+	g_string_free(calendar, TRUE);
+	return error;
+}
+
+static gboolean setup_store(bench_context* ctx, guint i) {
+	if (! ctx->store) {
+		ctx->store_path = g_build_filename(g_get_tmp_dir(),
+				"libcaldav-bench.store", NULL);
+		unlink(ctx->store_path);
+		ctx->store = caldav_open_store(ctx->store_path, ctx->url, ctx->info);
+	}
+	return ctx->store == NULL;
+}
+
+/* the first call is a full sync, the rest are incremental */
+static gboolean run_sync(bench_context* ctx, guint i) {
+	return check(caldav_sync_store(ctx->store, ctx->url, ctx->info), ctx);
+}
+
+static gboolean run_store_getall(bench_context* ctx, guint i) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_store_getall_object(result, ctx->store),
+			ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static gboolean run_store_getrange(bench_context* ctx, guint i) {
+	response* result = caldav_get_response();
+	time_t start = event_start(ctx, i);
+	gboolean error = check(caldav_store_getrange_object(result, ctx->store,
+				start, start + 7 * 24 * 3600), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static const bench_case cases[] = {
+	{"options",				run_options,		NULL},
+	{"enabled_resource",	run_enabled,		NULL},
+	{"get_displayname",		run_displayname,	NULL},
+	{"getall_object",		run_getall,			NULL},
+	{"getall_object_sink",	run_getall_sink,	NULL},
+	{"get_object",			run_getrange,		NULL},
+	{"get_freebusy",		run_freebusy,		NULL},
+	{"get_freebusy_multi",	run_freebusy_multi,	NULL},
+	{"lookup_object",		run_lookup,			setup_lookup},
+	{"add_object",			run_add,			NULL},
+	{"modify_object",		run_modify,			NULL},
+	{"delete_object",		run_delete,			NULL},
+	{"id_add_object",		run_id_add,			NULL},
+	{"id_modify_object",	run_id_modify,		NULL},
+	{"id_modify_source",	run_id_modify_source, NULL},
+	{"id_delete_object",	run_id_delete,		NULL},
+	{"batch_objects",		run_batch,			NULL},
+	{"import_buffer",		run_import,			NULL},
+	{"sync_store",			run_sync,			setup_store},
+	{"store_getall_object",	run_store_getall,	setup_store},
+	{"store_getrange_object", run_store_getrange, setup_store},
+	{NULL,					NULL,				NULL}
+};
+
+static int compare_gint64(const void* a, const void* b) {
+	gint64 x = *(const gint64 *) a;
+	gint64 y = *(const gint64 *) b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(gint64* samples, guint count, double p) {
+	guint i = (guint) (p * (count - 1) + 0.5);
+
+	return samples[i] / 1000.0;
+}
+
+static void run_case(bench_context* ctx, const bench_case* c) {
+	gint64* samples = g_new0(gint64, ctx->iterations);
+	gint64 start, total;
+	guint64 count, bytes;
+	guint i, errors = 0, requests;
+	double sum = 0;
+
+	if (c->setup && c->setup(ctx, 0)) {
+		printf("%-22s setup failed\n", c->name);
+		g_free(samples);
+		return;
+	}
+	mock_server_reset_requests(ctx->server);
+	allocs.count = allocs.bytes = 0;
+	start = now_usec();
+	for (i = 0; i < ctx->iterations; i++) {
+		gint64 t = now_usec();
+
+		allocs.active = TRUE;
+		if (c->run(ctx, i))
+			errors++;
+		allocs.active = FALSE;
+		samples[i] = now_usec() - t;
+		sum += samples[i];
+	}
+	total = now_usec() - start;
+	count = allocs.count;
+	bytes = allocs.bytes;
+	requests = mock_server_requests(ctx->server, NULL);
+	qsort(samples, ctx->iterations, sizeof(gint64), compare_gint64);
+	printf("%-22s %9.1f %8.3f %8.3f %8.3f %8.3f %6.1f",
+		c->name, ctx->iterations * (double) G_USEC_PER_SEC / total,
+		sum / ctx->iterations / 1000.0,
+		percentile(samples, ctx->iterations, 0.5),
+		percentile(samples, ctx->iterations, 0.95),
+		percentile(samples, ctx->iterations, 0.99),
+		requests / (double) ctx->iterations);
+	if (ALLOC_COUNTING)
+		printf(" %9.1f %10.1f", count / (double) ctx->iterations,
+			bytes / 1024.0 / ctx->iterations);
+	else
+		printf(" %9s %10s", "-", "-");
+	if (errors)
+		printf("  %u errors", errors);
+	printf("\n");
+	fflush(stdout);
+	g_free(samples);
+}
+
+int main(int argc, char** argv) {
+	bench_context ctx;
+	gulong latency = 0;
+	gboolean session = TRUE;
+	gboolean locking = FALSE;
+	gboolean debug = FALSE;
+	int c, i;
+
+	/* slices would hide most allocations from the counters */
+	setenv("G_SLICE", "always-malloc", 1);
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.events = 1000;
+	ctx.iterations = 200;
+	while ((c = getopt(argc, argv, "de:hi:lnr:?")) != -1) {
+		switch (c) {
+			case 'h':
+			case '?':
+				fprintf(stdout, "%s", usage[0]);
+				for (i = 0; cases[i].name; i++)
+					fprintf(stdout, "\t\t%s\n", cases[i].name);
+				return 0;
+			case 'd':
+				debug = TRUE;
+				break;
+			case 'e':
+				ctx.events = strtoul(optarg, NULL, 10);
+				break;
+			case 'i':
+				ctx.iterations = strtoul(optarg, NULL, 10);
+				break;
+			case 'l':
+				locking = TRUE;
+				break;
+			case 'n':
+				session = FALSE;
+				break;
+			case 'r':
+				latency = strtoul(optarg, NULL, 10);
+				break;
+		}
+	}
+	if (ctx.events < 1)
+		ctx.events = 1;
+	if (ctx.iterations < 1)
+		ctx.iterations = 1;
+
+	caldav_global_init();
+	ctx.server = mock_server_start(ctx.events);
+	if (! ctx.server) {
+		fprintf(stderr, "Could not start server\n");
+		return 1;
+	}
+	mock_server_set_latency(ctx.server, latency);
+	ctx.url = mock_server_url(ctx.server);
+	ctx.info = caldav_get_runtime_info();
+	ctx.info->options->debug = debug;
+	ctx.info->options->use_locking = locking;
+	if (session)
+		ctx.info->session = caldav_get_session();
+	ctx.ids = g_new0(CALDAV_ID*, ctx.iterations);
+
+	printf("%u events, %u iterations, round trip %lu us, locking %s, "
+		"session %s\n\n", ctx.events, ctx.iterations, latency,
+		locking ? "on" : "off", session ? "on" : "off");
+	printf("%-22s %9s %8s %8s %8s %8s %6s %9s %10s\n", "case", "calls/s",
+		"mean ms", "p50 ms", "p95 ms", "p99 ms", "req", "allocs", "KiB");
+	for (i = 0; cases[i].name; i++) {
+		int n;
+
+		if (optind < argc) {
+			for (n = optind; n < argc; n++) {
+				if (strcmp(argv[n], cases[i].name) == 0)
+					break;
+			}
+			if (n == argc)
+				continue;
+		}
+		run_case(&ctx, &cases[i]);
+	}
+
+	for (i = 0; i < (int) ctx.iterations; i++)
+		caldav_free_caldav_id(&ctx.ids[i]);
+	g_free(ctx.ids);
+	caldav_close_store(&ctx.store);
+	if (ctx.store_path) {
+		unlink(ctx.store_path);
+		g_free(ctx.store_path);
+	}
+	caldav_free_runtime_info(&ctx.info);
+	mock_server_stop(ctx.server);
+	caldav_global_cleanup();
+	return 0;
+}
@@ -0,0 +1,305 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-freebusy.h"
+#include "caldav-store.h"
+#include "caldav-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+/*
+ * Offline checks of the free/busy merge. Every case is parsed or expanded
+ * and merged within a fixed window and the result is compared with the
+ * expected periods written as START/END/TYPE, TYPE being T(entative),
+ * B(usy) or U(navailable).
+ */
+
+#define VFREEBUSY(lines) \
+	"BEGIN:VCALENDAR\r\nVERSION:2.0\r\nBEGIN:VFREEBUSY\r\n" \
+	lines \
+	"END:VFREEBUSY\r\nEND:VCALENDAR\r\n"
+
+#define VEVENT(lines) \
+	"BEGIN:VCALENDAR\r\nVERSION:2.0\r\nBEGIN:VEVENT\r\n" \
+	lines \
+	"END:VEVENT\r\nEND:VCALENDAR\r\n"
+
+typedef struct {
+	const gchar*	name;
+	const gchar*	calendar;
+	const gchar*	start;		/* window */
+	const gchar*	end;
+	const gchar*	expect;
+} freebusy_case;
+
+static const freebusy_case parse_cases[] = {
+	{"type precedence",
+		VFREEBUSY(
+		"FREEBUSY:20300101T100000Z/20300101T120000Z\r\n"
+		"FREEBUSY;FBTYPE=BUSY-UNAVAILABLE:20300101T110000Z/20300101T130000Z\r\n"
+		"FREEBUSY;FBTYPE=BUSY-TENTATIVE:20300101T090000Z/20300101T140000Z\r\n"),
+		"20300101T000000Z", "20300102T000000Z",
+		"20300101T090000Z/20300101T100000Z/T "
+		"20300101T100000Z/20300101T110000Z/B "
+		"20300101T110000Z/20300101T130000Z/U "
+		"20300101T130000Z/20300101T140000Z/T"},
+	{"adjacency joins",
+		VFREEBUSY(
+		"FREEBUSY:20300101T110000Z/20300101T120000Z,"
+		"20300101T100000Z/20300101T110000Z\r\n"
+		"FREEBUSY;FBTYPE=BUSY-TENTATIVE:20300101T120000Z/20300101T130000Z\r\n"),
+		"20300101T000000Z", "20300102T000000Z",
+		"20300101T100000Z/20300101T120000Z/B "
+		"20300101T120000Z/20300101T130000Z/T"},
+	{"clipping",
+		VFREEBUSY(
+		"FREEBUSY:20300101T100000Z/20300101T120000Z\r\n"
+		"FREEBUSY:20300101T130000Z/20300101T140000Z\r\n"
+		"FREEBUSY:20300101T080000Z/20300101T090000Z\r\n"),
+		"20300101T103000Z", "20300101T133000Z",
+		"20300101T103000Z/20300101T120000Z/B "
+		"20300101T130000Z/20300101T133000Z/B"},
+	{"FBTYPE=FREE",
+		VFREEBUSY(
+		"FREEBUSY;FBTYPE=FREE:20300101T080000Z/20300101T180000Z\r\n"
+		"freebusy;fbtype=free:20300101T200000Z/20300101T210000Z\r\n"
+		"FREEBUSY:20300101T100000Z/20300101T110000Z\r\n"),
+		"20300101T000000Z", "20300102T000000Z",
+		"20300101T100000Z/20300101T110000Z/B"},
+	{"DURATION periods",
+		VFREEBUSY(
+		"FREEBUSY:20300101T100000Z/PT1H30M\r\n"
+		"FREEBUSY;FBTYPE=BUSY-UNAVAILABLE:20300101T230000Z/P1D\r\n"),
+		"20300101T000000Z", "20300103T000000Z",
+		"20300101T100000Z/20300101T113000Z/B "
+		"20300101T230000Z/20300102T230000Z/U"},
+	{"folded FREEBUSY lines",
+		VFREEBUSY(
+		"FREEBUSY;FBTYPE=BUSY-TENTATIVE:20300101T100000Z/20300101T11\r\n"
+		" 0000Z,20300101T120000Z/\r\n"
+		"\t20300101T130000Z\r\n"
+		"FREEBUSY:20300101T140000Z/20300101T150000Z\r\n"),
+		"20300101T000000Z", "20300102T000000Z",
+		"20300101T100000Z/20300101T110000Z/T "
+		"20300101T120000Z/20300101T130000Z/T "
+		"20300101T140000Z/20300101T150000Z/B"},
+	{"BUSY-TENTATIVE under BUSY",
+		VFREEBUSY(
+		"FREEBUSY;FBTYPE=BUSY-TENTATIVE:20300101T100000Z/20300101T120000Z\r\n"
+		"FREEBUSY:20300101T110000Z/20300101T130000Z\r\n"
+		"FREEBUSY:20300101T140000Z/20300101T170000Z\r\n"
+		"FREEBUSY;FBTYPE=BUSY-TENTATIVE:20300101T150000Z/20300101T160000Z\r\n"),
+		"20300101T000000Z", "20300102T000000Z",
+		"20300101T100000Z/20300101T110000Z/T "
+		"20300101T110000Z/20300101T130000Z/B "
+		"20300101T140000Z/20300101T170000Z/B"},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+static const freebusy_case store_cases[] = {
+	{"opaque event",
+		VEVENT(
+		"UID:fb-opaque\r\n"
+		"DTSTART:20300101T100000Z\r\n"
+		"DTEND:20300101T110000Z\r\n"),
+		NULL, NULL, NULL},
+	{"transparent event",
+		VEVENT(
+		"UID:fb-transparent\r\n"
+		"DTSTART:20300101T120000Z\r\n"
+		"DTEND:20300101T130000Z\r\n"
+		"TRANSP:TRANSPARENT\r\n"),
+		NULL, NULL, NULL},
+	{"tentative event",
+		VEVENT(
+		"UID:fb-tentative\r\n"
+		"DTSTART:20300101T103000Z\r\n"
+		"DTEND:20300101T113000Z\r\n"
+		"STATUS:TENTATIVE\r\n"),
+		NULL, NULL, NULL},
+	{"daily event with a cancelled instance",
+		"BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+		"BEGIN:VEVENT\r\n"
+		"UID:fb-daily\r\n"
+		"DTSTART:20300101T150000Z\r\n"
+		"DTEND:20300101T160000Z\r\n"
+		"RRULE:FREQ=DAILY;COUNT=3\r\n"
+		"END:VEVENT\r\n"
+		"BEGIN:VEVENT\r\n"
+		"UID:fb-daily\r\n"
+		"RECURRENCE-ID:20300102T150000Z\r\n"
+		"DTSTART:20300102T150000Z\r\n"
+		"DTEND:20300102T160000Z\r\n"
+		"STATUS:CANCELLED\r\n"
+		"END:VEVENT\r\n"
+		"END:VCALENDAR\r\n",
+		NULL, NULL, NULL},
+	{"merged store",
+		NULL,
+		"20300101T000000Z", "20300104T000000Z",
+		"20300101T100000Z/20300101T110000Z/B "
+		"20300101T110000Z/20300101T113000Z/T "
+		"20300101T150000Z/20300101T160000Z/B "
+		"20300103T150000Z/20300103T160000Z/B"},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+static gchar* format_periods(GArray* periods) {
+	GString* buf = g_string_new("");
+	guint i;
+
+	for (i = 0; i < periods->len; i++) {
+		caldav_period* p = &g_array_index(periods, caldav_period, i);
+		gchar* start = utc_to_ical_time(p->start);
+		gchar* end = utc_to_ical_time(p->end);
+
+		g_string_append_printf(buf, "%s%s/%s/%c", (i > 0) ? " " : "",
+			start, end, "TBU"[p->type]);
+		g_free(start);
+		g_free(end);
+	}
+	return g_string_free(buf, FALSE);
+}
+
+static int compare(const gchar* name, GArray* periods, const gchar* expect) {
+	gchar* got = format_periods(periods);
+	int failed = (strcmp(got, expect) != 0);
+
+	if (failed)
+		printf("  %-38s FAILED\n    expected %s\n    got      %s\n",
+			name, expect, got);
+	else
+		printf("  %-38s ok\n", name);
+	g_free(got);
+	return failed;
+}
+
+/**
+ * Parse every case and merge it within its window.
+ * @return number of failed cases
+ */
+static int run_parse(void) {
+	int failed = 0;
+	int i;
+
+	printf("busy_parse and busy_merge\n");
+	for (i = 0; parse_cases[i].name; i++) {
+		const freebusy_case* c = &parse_cases[i];
+		GArray* periods = g_array_new(FALSE, FALSE, sizeof(caldav_period));
+		GArray* merged;
+
+		busy_parse(c->calendar, periods);
+		merged = busy_merge(periods, ical_time_to_utc(c->start, NULL),
+				ical_time_to_utc(c->end, NULL));
+		failed += compare(c->name, merged, c->expect);
+		g_array_free(merged, TRUE);
+		g_array_free(periods, TRUE);
+	}
+	printf("\n");
+	return failed;
+}
+
+static void record(GString* buf, const gchar* uid, const gchar* href,
+		const gchar* etag, const gchar* object) {
+	g_string_append_printf(buf, "O %lu %lu %lu %lu\n%s%s%s%s\n",
+		(unsigned long) strlen(uid), (unsigned long) strlen(href),
+		(unsigned long) strlen(etag), (unsigned long) strlen(object),
+		uid, href, etag, object);
+}
+
+/**
+ * Put the events of store_cases in a store and merge its instances. The
+ * last case holds the expected result.
+ * @return number of failed cases
+ */
+static int run_store(void) {
+	const gchar* collection = "localhost/calendars/test/";
+	caldav_error error;
+	caldav_store* store;
+	GString* buf;
+	GArray* merged;
+	gchar* path;
+	gchar* uid;
+	gchar* href;
+	int failed = 0;
+	int fd, i;
+
+	printf("caldav_store_busy\n");
+	buf = g_string_new("LIBCALDAV-STORE 1\n");
+	g_string_append_printf(buf, "C %lu\n%s\n",
+		(unsigned long) strlen(collection), collection);
+	for (i = 0; store_cases[i].calendar; i++) {
+		uid = g_strdup_printf("fb-%d", i);
+		href = g_strdup_printf("/calendars/test/%s.ics", uid);
+		record(buf, uid, href, "etag", store_cases[i].calendar);
+		g_free(href);
+		g_free(uid);
+	}
+	path = g_build_filename(g_get_tmp_dir(), "caldav-freebusy.XXXXXX", NULL);
+	fd = g_mkstemp(path);
+	if (fd < 0 || write(fd, buf->str, buf->len) != (ssize_t) buf->len) {
+		printf("  could not write %s\n", path);
+		failed++;
+	}
+	if (fd >= 0)
+		close(fd);
+	g_string_free(buf, TRUE);
+
+	error.code = 0;
+	error.str = NULL;
+	store = (failed) ? NULL : caldav_store_open(path, collection, &error);
+	if (store) {
+		const freebusy_case* c = &store_cases[i];
+
+		merged = caldav_store_busy(store, ical_time_to_utc(c->start, NULL),
+				ical_time_to_utc(c->end, NULL));
+		failed += compare(c->name, merged, c->expect);
+		g_array_free(merged, TRUE);
+		caldav_store_close(store);
+	}
+	else if (! failed) {
+		printf("  could not open store: %s\n", error.str);
+		failed++;
+	}
+	g_free(error.str);
+	unlink(path);
+	g_free(path);
+	printf("\n");
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	int failed = 0;
+
+	failed += run_parse();
+	failed += run_store();
+	if (failed) {
+		printf("%d free/busy cases failed\n", failed);
+		return 1;
+	}
+	printf("All free/busy cases passed\n");
+	return 0;
+}
@@ -0,0 +1,920 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "mock-server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Milliseconds between checks for stop in the accept loop */
+#define MOCK_POLL 100
+
+typedef struct {
+	gchar*	etag;
+	gchar*	data;		/* NULL once deleted, kept for sync-collection */
+	time_t	start;
+	time_t	end;
+	guint64	token;		/* sync token of the last change */
+} mock_object;
+
+struct _mock_server {
+	int				fd;
+	gchar*			url;
+	pthread_t		thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	idle;
+	GHashTable*		objects;	/* href -> mock_object */
+	GHashTable*		counts;		/* method -> number of requests */
+	GString*		log;		/* "METHOD path" lines */
+	GSList*			clients;	/* open connections */
+	guint			connections;
+	guint			requests;
+	guint64			token;
+	gulong			latency;
+	gboolean		stop;
+};
+
+typedef struct {
+	gchar*		method;
+	gchar*		path;
+	gchar*		if_match;
+	gchar*		if_none_match;
+	gchar*		body;
+	gsize		length;
+	gboolean	expect;
+	gboolean	close;
+} mock_request;
+
+typedef struct {
+	mock_server*	server;
+	int				fd;
+} mock_client;
+
+static void mock_object_free(gpointer data) {
+	mock_object* object = (mock_object *) data;
+
+	g_free(object->etag);
+	g_free(object->data);
+	g_free(object);
+}
+
+static gchar* format_time(time_t t) {
+	struct tm tm;
+	gchar buf[20];
+
+	gmtime_r(&t, &tm);
+	strftime(buf, sizeof(buf), "%Y%m%dT%H%M%SZ", &tm);
+	return g_strdup(buf);
+}
+
+static time_t parse_time(const gchar* text) {
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(text, "%4d%2d%2dT%2d%2d%2d", &tm.tm_year, &tm.tm_mon,
+			&tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 3)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	return timegm(&tm);
+}
+
+/* value of a property like DTSTART;TZID=x:20300101T000000Z */
+static time_t property_time(const gchar* data, const gchar* name) {
+	gchar* key = g_strconcat("\n", name, NULL);
+	const gchar* pos = strstr(data, key);
+	time_t t = -1;
+
+	if (pos) {
+		pos += strlen(key);
+		if (*pos == ':' || *pos == ';') {
+			pos = strchr(pos, ':');
+			if (pos)
+				t = parse_time(pos + 1);
+		}
+	}
+	g_free(key);
+	return t;
+}
+
+/**
+ * Generate the iCalendar of an event in the format used by the server.
+ * @param uid UID of the event
+ * @param start Start in seconds since the epoch
+ * @param summary Summary of the event
+ * @return a VCALENDAR. Free with g_free.
+ */
+gchar* mock_server_event(const gchar* uid, time_t start, const gchar* summary) {
+	gchar* dtstart = format_time(start);
+	gchar* dtend = format_time(start + MOCK_DURATION);
+	gchar* event;
+
+	event = g_strdup_printf(
+		"BEGIN:VCALENDAR\r\n"
+		"VERSION:2.0\r\n"
+		"PRODID:-//libcaldav//mock server//EN\r\n"
+		"BEGIN:VEVENT\r\n"
+		"UID:%s\r\n"
+		"DTSTAMP:20300101T000000Z\r\n"
+		"DTSTART:%s\r\n"
+		"DTEND:%s\r\n"
+		"SUMMARY:%s\r\n"
+		"END:VEVENT\r\n"
+		"END:VCALENDAR\r\n", uid, dtstart, dtend, summary);
+	g_free(dtstart);
+	g_free(dtend);
+	return event;
+}
+
+/* caller holds the lock */
+static void store_object(mock_server* server, const gchar* href, gchar* data) {
+	mock_object* object = g_new0(mock_object, 1);
+
+	object->token = ++server->token;
+	object->etag = g_strdup_printf("%" G_GUINT64_FORMAT "-%08x",
+			object->token, g_str_hash(data));
+	object->data = data;
+	object->start = property_time(data, "DTSTART");
+	object->end = property_time(data, "DTEND");
+	if (object->end < object->start)
+		object->end = object->start;
+	g_hash_table_replace(server->objects, g_strdup(href), object);
+}
+
+/**
+ * Replace the collection with freshly generated events.
+ * @param server @see mock_server
+ * @param events Number of events
+ */
+void mock_server_populate(mock_server* server, guint events) {
+	guint i;
+
+	pthread_mutex_lock(&server->lock);
+	g_hash_table_remove_all(server->objects);
+	for (i = 0; i < events; i++) {
+		gchar* uid = g_strdup_printf("bench-%u@localhost", i);
+		gchar* href = g_strdup_printf(MOCK_COLLECTION "bench-%u.ics", i);
+		gchar* summary = g_strdup_printf("Event %u", i);
+
+		store_object(server, href, mock_server_event(uid,
+				MOCK_EPOCH + (time_t) i * MOCK_SPACING, summary));
+		g_free(uid);
+		g_free(href);
+		g_free(summary);
+	}
+	pthread_mutex_unlock(&server->lock);
+}
+
+/* live object at path or NULL. Caller holds the lock */
+static mock_object* lookup(mock_server* server, const gchar* path) {
+	mock_object* object = g_hash_table_lookup(server->objects, path);
+
+	return (object && object->data) ? object : NULL;
+}
+
+static gboolean etag_matches(const gchar* header, const gchar* etag) {
+	gchar* value = g_strstrip(g_strdup(header));
+	gsize len = strlen(value);
+	gboolean match;
+
+	if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+		value[len - 1] = '\0';
+		match = strcmp(value + 1, etag) == 0 || strcmp(value + 1, "*") == 0;
+	}
+	else
+		match = strcmp(value, etag) == 0 || strcmp(value, "*") == 0;
+	g_free(value);
+	return match;
+}
+
+/* text of the first element whose name ends with name, eg. ":text-match" */
+static gchar* element_text(const gchar* body, const gchar* name) {
+	const gchar* pos = body;
+
+	while ((pos = strstr(pos, name)) != NULL) {
+		const gchar* start;
+		const gchar* end;
+
+		pos += strlen(name);
+		if (*pos != '>' && *pos != ' ')
+			continue;
+		start = strchr(pos, '>');
+		if (! start || start[-1] == '/')
+			return NULL;
+		end = strchr(++start, '<');
+		if (! end)
+			return NULL;
+		return g_strstrip(g_strndup(start, end - start));
+	}
+	return NULL;
+}
+
+/* value of attribute attr in the first element matching name */
+static time_t element_time(const gchar* body, const gchar* name,
+		const gchar* attr) {
+	const gchar* pos = strstr(body, name);
+	const gchar* end;
+	gchar* key;
+	time_t t = -1;
+
+	if (! pos)
+		return -1;
+	end = strchr(pos, '>');
+	key = g_strconcat(attr, "=\"", NULL);
+	pos = strstr(pos, key);
+	if (pos && (! end || pos < end))
+		t = parse_time(pos + strlen(key));
+	g_free(key);
+	return t;
+}
+
+static void respond(GString* out, int code, const gchar* reason,
+		const gchar* headers, const gchar* type, const gchar* body,
+		gboolean head) {
+	gsize length = body ? strlen(body) : 0;
+
+	g_string_append_printf(out, "HTTP/1.1 %d %s\r\n", code, reason);
+	if (headers)
+		g_string_append(out, headers);
+	if (length)
+		g_string_append_printf(out, "Content-Type: %s\r\n", type);
+	g_string_append_printf(out, "Content-Length: %lu\r\n\r\n",
+			(unsigned long) length);
+	if (length && ! head)
+		g_string_append_len(out, body, length);
+}
+
+static void multistatus_response(GString* xml, const gchar* href,
+		const mock_object* object, gboolean data) {
+	g_string_append_printf(xml, "<D:response><D:href>%s</D:href>", href);
+	if (! object || ! object->data) {
+		g_string_append(xml,
+			"<D:status>HTTP/1.1 404 Not Found</D:status></D:response>");
+		return;
+	}
+	g_string_append_printf(xml,
+		"<D:propstat><D:prop><D:getetag>\"%s\"</D:getetag>", object->etag);
+	if (data)
+		g_string_append_printf(xml,
+			"<C:calendar-data>%s</C:calendar-data>", object->data);
+	g_string_append(xml, "</D:prop><D:status>HTTP/1.1 200 OK</D:status>"
+		"</D:propstat></D:response>");
+}
+
+static const gchar* multistatus_head =
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+	"<D:multistatus xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:caldav\""
+	" xmlns:CS=\"http://calendarserver.org/ns/\">";
+
+static void do_propfind(mock_server* server, mock_request* req, GString* out) {
+	GString* xml = g_string_new(multistatus_head);
+	gboolean collection = g_str_has_prefix(req->path, MOCK_COLLECTION) &&
+		req->path[strlen(MOCK_COLLECTION)] == '\0';
+	gboolean found = TRUE;
+
+	if (! collection && strcmp(req->path, "/cal") == 0)
+		collection = TRUE;
+	pthread_mutex_lock(&server->lock);
+	if (collection) {
+		g_string_append_printf(xml,
+			"<D:response><D:href>" MOCK_COLLECTION "</D:href><D:propstat>"
+			"<D:prop><D:displayname>Bench</D:displayname>"
+			"<D:resourcetype><D:collection/><C:calendar/></D:resourcetype>"
+			"<CS:getctag>%" G_GUINT64_FORMAT "</CS:getctag>"
+			"<D:sync-token>tok-%" G_GUINT64_FORMAT "</D:sync-token>"
+			"</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat>"
+			"</D:response>", server->token, server->token);
+	}
+	else {
+		mock_object* object = lookup(server, req->path);
+
+		if (object)
+			multistatus_response(xml, req->path, object, FALSE);
+		else
+			found = FALSE;
+	}
+	pthread_mutex_unlock(&server->lock);
+	g_string_append(xml, "</D:multistatus>");
+	if (found)
+		respond(out, 207, "Multi-Status", NULL,
+			"application/xml; charset=\"utf-8\"", xml->str, FALSE);
+	else
+		respond(out, 404, "Not Found", NULL, NULL, NULL, FALSE);
+	g_string_free(xml, TRUE);
+}
+
+static void do_freebusy(mock_server* server, mock_request* req, GString* out) {
+	time_t start = element_time(req->body, ":time-range", "start");
+	time_t end = element_time(req->body, ":time-range", "end");
+	GString* ics = g_string_new("BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+		"PRODID:-//libcaldav//mock server//EN\r\nBEGIN:VFREEBUSY\r\n");
+	GHashTableIter iter;
+	gpointer value;
+
+	pthread_mutex_lock(&server->lock);
+	g_hash_table_iter_init(&iter, server->objects);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		mock_object* object = (mock_object *) value;
+		gchar* from;
+		gchar* to;
+
+		if (! object->data || object->start < 0)
+			continue;
+		if ((start >= 0 && object->end <= start) ||
+				(end >= 0 && object->start >= end))
+			continue;
+		from = format_time(object->start);
+		to = format_time(object->end);
+		g_string_append_printf(ics, "FREEBUSY:%s/%s\r\n", from, to);
+		g_free(from);
+		g_free(to);
+	}
+	pthread_mutex_unlock(&server->lock);
+	g_string_append(ics, "END:VFREEBUSY\r\nEND:VCALENDAR\r\n");
+	respond(out, 200, "OK", NULL, "text/calendar", ics->str, FALSE);
+	g_string_free(ics, TRUE);
+}
+
+static void do_report(mock_server* server, mock_request* req, GString* out) {
+	GString* xml;
+	GHashTableIter iter;
+	gpointer key, value;
+	const gchar* prop_end;
+	const gchar* data_pos;
+	gboolean data;
+
+	if (strstr(req->body, "free-busy-query")) {
+		do_freebusy(server, req, out);
+		return;
+	}
+	/* calendar-data asked for in the prop element and not in a filter */
+	prop_end = strstr(req->body, "prop>");
+	if (prop_end)
+		prop_end = strstr(prop_end + 5, "prop>");
+	data_pos = strstr(req->body, "calendar-data");
+	data = data_pos && (! prop_end || data_pos < prop_end);
+	xml = g_string_new(multistatus_head);
+	pthread_mutex_lock(&server->lock);
+	if (strstr(req->body, "sync-collection")) {
+		gchar* token = element_text(req->body, ":sync-token");
+		guint64 since = 0;
+
+		if (token && g_str_has_prefix(token, "tok-"))
+			since = g_ascii_strtoull(token + 4, NULL, 10);
+		g_free(token);
+		g_hash_table_iter_init(&iter, server->objects);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			if (((mock_object *) value)->token > since)
+				multistatus_response(xml, key, value, FALSE);
+		}
+		g_string_append_printf(xml,
+			"<D:sync-token>tok-%" G_GUINT64_FORMAT "</D:sync-token>",
+			server->token);
+	}
+	else if (strstr(req->body, "calendar-multiget")) {
+		const gchar* pos = req->body;
+
+		while ((pos = strstr(pos, "href>")) != NULL) {
+			const gchar* tag = pos;
+			const gchar* end;
+			gchar* href;
+			gchar* path;
+
+			pos += 5;
+			/* skip closing tags */
+			while (tag > req->body && tag[-1] != '<' && tag[-1] != '/')
+				tag--;
+			if (tag == req->body || tag[-1] == '/')
+				continue;
+			end = strchr(pos, '<');
+			if (! end)
+				break;
+			href = g_strndup(pos, end - pos);
+			path = g_uri_unescape_string(href, NULL);
+			multistatus_response(xml, href,
+				g_hash_table_lookup(server->objects, path ? path : href), TRUE);
+			g_free(path);
+			g_free(href);
+			pos = end;
+		}
+	}
+	else {
+		gchar* uid = element_text(req->body, ":text-match");
+		gchar* needle = uid ? g_strconcat("\nUID:", uid, "\r\n", NULL) : NULL;
+		time_t start = element_time(req->body, ":time-range", "start");
+		time_t end = element_time(req->body, ":time-range", "end");
+
+		g_hash_table_iter_init(&iter, server->objects);
+		while (g_hash_table_iter_next(&iter, &key, &value)) {
+			mock_object* object = (mock_object *) value;
+
+			if (! object->data)
+				continue;
+			if (needle && ! strstr(object->data, needle))
+				continue;
+			if (object->start >= 0 && ((start >= 0 && object->end <= start) ||
+					(end >= 0 && object->start >= end)))
+				continue;
+			multistatus_response(xml, key, object, data);
+		}
+		g_free(needle);
+		g_free(uid);
+	}
+	pthread_mutex_unlock(&server->lock);
+	g_string_append(xml, "</D:multistatus>");
+	respond(out, 207, "Multi-Status", NULL,
+		"application/xml; charset=\"utf-8\"", xml->str, FALSE);
+	g_string_free(xml, TRUE);
+}
+
+static void do_put(mock_server* server, mock_request* req, GString* out) {
+	mock_object* object;
+	gchar* header;
+	gboolean created;
+
+	pthread_mutex_lock(&server->lock);
+	object = lookup(server, req->path);
+	if ((req->if_none_match && object) ||
+			(req->if_match && (! object ||
+				! etag_matches(req->if_match, object->etag)))) {
+		pthread_mutex_unlock(&server->lock);
+		respond(out, 412, "Precondition Failed", NULL, NULL, NULL, FALSE);
+		return;
+	}
+	created = (object == NULL);
+	store_object(server, req->path, g_strndup(req->body, req->length));
+	object = lookup(server, req->path);
+	header = g_strdup_printf("ETag: \"%s\"\r\n", object->etag);
+	pthread_mutex_unlock(&server->lock);
+	if (created)
+		respond(out, 201, "Created", header, NULL, NULL, FALSE);
+	else
+		respond(out, 204, "No Content", header, NULL, NULL, FALSE);
+	g_free(header);
+}
+
+static void do_delete(mock_server* server, mock_request* req, GString* out) {
+	mock_object* object;
+
+	pthread_mutex_lock(&server->lock);
+	object = lookup(server, req->path);
+	if (! object) {
+		pthread_mutex_unlock(&server->lock);
+		respond(out, 404, "Not Found", NULL, NULL, NULL, FALSE);
+		return;
+	}
+	if (req->if_match && ! etag_matches(req->if_match, object->etag)) {
+		pthread_mutex_unlock(&server->lock);
+		respond(out, 412, "Precondition Failed", NULL, NULL, NULL, FALSE);
+		return;
+	}
+	g_free(object->data);
+	object->data = NULL;
+	object->token = ++server->token;
+	pthread_mutex_unlock(&server->lock);
+	respond(out, 204, "No Content", NULL, NULL, NULL, FALSE);
+}
+
+static void do_get(mock_server* server, mock_request* req, GString* out,
+		gboolean head) {
+	mock_object* object;
+	gchar* header;
+
+	pthread_mutex_lock(&server->lock);
+	object = lookup(server, req->path);
+	if (! object) {
+		pthread_mutex_unlock(&server->lock);
+		respond(out, 404, "Not Found", NULL, NULL, NULL, head);
+		return;
+	}
+	header = g_strdup_printf("ETag: \"%s\"\r\n", object->etag);
+	respond(out, 200, "OK", header, "text/calendar", object->data, head);
+	pthread_mutex_unlock(&server->lock);
+	g_free(header);
+}
+
+/* managed attachments (RFC8607). The attachment is referenced, not kept */
+static void do_post(mock_server* server, mock_request* req, GString* out) {
+	mock_object* object;
+	gchar** parts = g_strsplit(req->path, "?", 2);
+	gchar* header;
+	gchar* data;
+	gchar* pos;
+
+	pthread_mutex_lock(&server->lock);
+	object = lookup(server, parts[0]);
+	if (! object || ! parts[1] || ! strstr(parts[1], "action=attachment-")) {
+		pthread_mutex_unlock(&server->lock);
+		respond(out, (object) ? 400 : 404, (object) ? "Bad Request" :
+			"Not Found", NULL, NULL, NULL, FALSE);
+		g_strfreev(parts);
+		return;
+	}
+	if (req->if_match && ! etag_matches(req->if_match, object->etag)) {
+		pthread_mutex_unlock(&server->lock);
+		respond(out, 412, "Precondition Failed", NULL, NULL, NULL, FALSE);
+		g_strfreev(parts);
+		return;
+	}
+	pos = strstr(object->data, "END:VEVENT");
+	data = (pos) ? g_strdup_printf("%.*sATTACH;MANAGED-ID=mock:%sattachments/"
+			"mock\r\n%s", (int) (pos - object->data), object->data,
+			server->url, pos) : g_strdup(object->data);
+	store_object(server, parts[0], data);
+	object = lookup(server, parts[0]);
+	header = g_strdup_printf("Cal-Managed-ID: mock\r\nETag: \"%s\"\r\n",
+			object->etag);
+	pthread_mutex_unlock(&server->lock);
+	respond(out, 201, "Created", header, NULL, NULL, FALSE);
+	g_free(header);
+	g_strfreev(parts);
+}
+
+static void dispatch(mock_server* server, mock_request* req, GString* out) {
+	const gchar* m = req->method;
+
+	if (strcmp(m, "OPTIONS") == 0)
+		respond(out, 200, "OK",
+			"DAV: 1, 2, access-control, calendar-access, "
+			"calendar-managed-attachments\r\n"
+			"Allow: OPTIONS, GET, HEAD, PUT, DELETE, PROPFIND, REPORT, "
+			"LOCK, UNLOCK, POST\r\n", NULL, NULL, FALSE);
+	else if (strcmp(m, "GET") == 0)
+		do_get(server, req, out, FALSE);
+	else if (strcmp(m, "HEAD") == 0)
+		do_get(server, req, out, TRUE);
+	else if (strcmp(m, "PUT") == 0)
+		do_put(server, req, out);
+	else if (strcmp(m, "DELETE") == 0)
+		do_delete(server, req, out);
+	else if (strcmp(m, "POST") == 0)
+		do_post(server, req, out);
+	else if (strcmp(m, "PROPFIND") == 0)
+		do_propfind(server, req, out);
+	else if (strcmp(m, "REPORT") == 0)
+		do_report(server, req, out);
+	else if (strcmp(m, "LOCK") == 0)
+		respond(out, 200, "OK", "Lock-Token: <opaquelocktoken:mock>\r\n",
+			"application/xml; charset=\"utf-8\"",
+			"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+			"<D:prop xmlns:D=\"DAV:\"><D:lockdiscovery><D:activelock>"
+			"<D:locktype><D:write/></D:locktype>"
+			"<D:lockscope><D:exclusive/></D:lockscope>"
+			"<D:locktoken><D:href>opaquelocktoken:mock</D:href></D:locktoken>"
+			"</D:activelock></D:lockdiscovery></D:prop>", FALSE);
+	else if (strcmp(m, "UNLOCK") == 0)
+		respond(out, 204, "No Content", NULL, NULL, NULL, FALSE);
+	else
+		respond(out, 405, "Method Not Allowed", NULL, NULL, NULL, FALSE);
+}
+
+/* parse request line and headers. Returns FALSE on malformed input */
+static gboolean parse_head(const gchar* head, mock_request* req) {
+	gchar** lines = g_strsplit(head, "\r\n", 0);
+	gchar** parts;
+	gint i;
+
+	parts = g_strsplit(lines[0], " ", 3);
+	if (! parts[0] || ! parts[1]) {
+		g_strfreev(parts);
+		g_strfreev(lines);
+		return FALSE;
+	}
+	req->method = g_strdup(parts[0]);
+	req->path = g_strdup(parts[1]);
+	g_strfreev(parts);
+	for (i = 1; lines[i]; i++) {
+		gchar* colon = strchr(lines[i], ':');
+		gchar* value;
+
+		if (! colon)
+			continue;
+		*colon = '\0';
+		value = g_strstrip(colon + 1);
+		if (g_ascii_strcasecmp(lines[i], "Content-Length") == 0)
+			req->length = strtoul(value, NULL, 10);
+		else if (g_ascii_strcasecmp(lines[i], "If-Match") == 0)
+			req->if_match = g_strdup(value);
+		else if (g_ascii_strcasecmp(lines[i], "If-None-Match") == 0)
+			req->if_none_match = g_strdup(value);
+		else if (g_ascii_strcasecmp(lines[i], "Expect") == 0)
+			req->expect = g_ascii_strcasecmp(value, "100-continue") == 0;
+		else if (g_ascii_strcasecmp(lines[i], "Connection") == 0)
+			req->close = g_ascii_strcasecmp(value, "close") == 0;
+	}
+	g_strfreev(lines);
+	return TRUE;
+}
+
+static void request_clear(mock_request* req) {
+	g_free(req->method);
+	g_free(req->path);
+	g_free(req->if_match);
+	g_free(req->if_none_match);
+	g_free(req->body);
+	memset(req, 0, sizeof(mock_request));
+}
+
+static gboolean send_all(int fd, const gchar* buf, gsize len) {
+	while (len > 0) {
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FALSE;
+		buf += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+static gboolean receive(int fd, GString* buf) {
+	gchar tmp[16384];
+	ssize_t n;
+
+	do {
+		n = recv(fd, tmp, sizeof(tmp), 0);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return FALSE;
+	g_string_append_len(buf, tmp, n);
+	return TRUE;
+}
+
+static void count_request(mock_server* server, mock_request* req) {
+	gpointer count;
+
+	pthread_mutex_lock(&server->lock);
+	server->requests++;
+	count = g_hash_table_lookup(server->counts, req->method);
+	g_hash_table_replace(server->counts, g_strdup(req->method),
+		GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+	g_string_append_printf(server->log, "%s %s\n", req->method, req->path);
+	pthread_mutex_unlock(&server->lock);
+}
+
+static void* client_thread(void* data) {
+	mock_client* client = (mock_client *) data;
+	mock_server* server = client->server;
+	GString* buf = g_string_new(NULL);
+	GString* out = g_string_new(NULL);
+	mock_request req;
+	gboolean alive = TRUE;
+
+	memset(&req, 0, sizeof(mock_request));
+	while (alive) {
+		gchar* end = strstr(buf->str, "\r\n\r\n");
+		gsize head_len;
+		gboolean continued = FALSE;
+
+		if (! end) {
+			alive = receive(client->fd, buf);
+			continue;
+		}
+		head_len = end - buf->str + 4;
+		*end = '\0';
+		if (! parse_head(buf->str, &req)) {
+			request_clear(&req);
+			break;
+		}
+		while (buf->len < head_len + req.length) {
+			if (req.expect && ! continued) {
+				send_all(client->fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+				continued = TRUE;
+			}
+			if (! receive(client->fd, buf)) {
+				alive = FALSE;
+				break;
+			}
+		}
+		if (! alive) {
+			request_clear(&req);
+			break;
+		}
+		req.body = g_strndup(buf->str + head_len, req.length);
+		g_string_erase(buf, 0, head_len + req.length);
+		count_request(server, &req);
+		if (server->latency)
+			g_usleep(server->latency);
+		g_string_truncate(out, 0);
+		dispatch(server, &req, out);
+		alive = send_all(client->fd, out->str, out->len) && ! req.close;
+		request_clear(&req);
+	}
+	g_string_free(buf, TRUE);
+	g_string_free(out, TRUE);
+	pthread_mutex_lock(&server->lock);
+	server->clients = g_slist_remove(server->clients, GINT_TO_POINTER(client->fd));
+	close(client->fd);
+	server->connections--;
+	pthread_cond_broadcast(&server->idle);
+	pthread_mutex_unlock(&server->lock);
+	g_free(client);
+	return NULL;
+}
+
+static void* accept_thread(void* data) {
+	mock_server* server = (mock_server *) data;
+	struct pollfd pfd;
+
+	pfd.fd = server->fd;
+	pfd.events = POLLIN;
+	while (! server->stop) {
+		mock_client* client;
+		pthread_t thread;
+		int fd, one = 1;
+
+		if (poll(&pfd, 1, MOCK_POLL) <= 0)
+			continue;
+		fd = accept(server->fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		client = g_new0(mock_client, 1);
+		client->server = server;
+		client->fd = fd;
+		pthread_mutex_lock(&server->lock);
+		server->clients = g_slist_prepend(server->clients, GINT_TO_POINTER(fd));
+		server->connections++;
+		pthread_mutex_unlock(&server->lock);
+		if (pthread_create(&thread, NULL, client_thread, client) != 0) {
+			pthread_mutex_lock(&server->lock);
+			server->clients = g_slist_remove(server->clients,
+					GINT_TO_POINTER(fd));
+			server->connections--;
+			pthread_mutex_unlock(&server->lock);
+			close(fd);
+			g_free(client);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+/**
+ * Start a server on a free port.
+ * @param events Number of events generated in the collection. The UID of
+ * event i is "bench-<i>@localhost", its href /cal/bench-<i>.ics and it
+ * starts at MOCK_EPOCH + i * MOCK_SPACING.
+ * @return the server or NULL if no socket could be opened
+ */
+mock_server* mock_server_start(guint events) {
+	mock_server* server;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return NULL;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+			listen(fd, 128) != 0 ||
+			getsockname(fd, (struct sockaddr *) &addr, &len) != 0) {
+		close(fd);
+		return NULL;
+	}
+	server = g_new0(mock_server, 1);
+	server->fd = fd;
+	server->url = g_strdup_printf("http://127.0.0.1:%d" MOCK_COLLECTION,
+			ntohs(addr.sin_port));
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->idle, NULL);
+	server->objects = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, mock_object_free);
+	server->counts = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, NULL);
+	server->log = g_string_new(NULL);
+	mock_server_populate(server, events);
+	if (pthread_create(&server->thread, NULL, accept_thread, server) != 0) {
+		server->thread = 0;
+		mock_server_stop(server);
+		return NULL;
+	}
+	return server;
+}
+
+/**
+ * Stop a server and free it. Open connections are closed.
+ * @param server @see mock_server
+ */
+void mock_server_stop(mock_server* server) {
+	GSList* l;
+
+	if (! server)
+		return;
+	server->stop = TRUE;
+	if (server->thread)
+		pthread_join(server->thread, NULL);
+	close(server->fd);
+	pthread_mutex_lock(&server->lock);
+	for (l = server->clients; l; l = l->next)
+		shutdown(GPOINTER_TO_INT(l->data), SHUT_RDWR);
+	while (server->connections > 0)
+		pthread_cond_wait(&server->idle, &server->lock);
+	pthread_mutex_unlock(&server->lock);
+	g_hash_table_destroy(server->objects);
+	g_hash_table_destroy(server->counts);
+	g_string_free(server->log, TRUE);
+	pthread_cond_destroy(&server->idle);
+	pthread_mutex_destroy(&server->lock);
+	g_free(server->url);
+	g_free(server);
+}
+
+/**
+ * URL of the collection.
+ * @param server @see mock_server
+ * @return http://127.0.0.1:<port>/cal/. Owned by the server.
+ */
+const gchar* mock_server_url(mock_server* server) {
+	return server->url;
+}
+
+/**
+ * Delay every response to simulate a network round trip.
+ * @param server @see mock_server
+ * @param usec Microseconds to wait before answering
+ */
+void mock_server_set_latency(mock_server* server, gulong usec) {
+	server->latency = usec;
+}
+
+/**
+ * Number of requests answered since start or the last reset.
+ * @param server @see mock_server
+ * @param method Only count this method. NULL counts all.
+ * @return number of requests
+ */
+guint mock_server_requests(mock_server* server, const gchar* method) {
+	guint count;
+
+	pthread_mutex_lock(&server->lock);
+	if (method)
+		count = GPOINTER_TO_UINT(g_hash_table_lookup(server->counts, method));
+	else
+		count = server->requests;
+	pthread_mutex_unlock(&server->lock);
+	return count;
+}
+
+/**
+ * Requests answered since start or the last reset.
+ * @param server @see mock_server
+ * @return one "METHOD path" line per request. Free with g_free.
+ */
+gchar* mock_server_log(mock_server* server) {
+	gchar* log;
+
+	pthread_mutex_lock(&server->lock);
+	log = g_strndup(server->log->str, server->log->len);
+	pthread_mutex_unlock(&server->lock);
+	return log;
+}
+
+/**
+ * Clear the request counters and the log.
+ * @param server @see mock_server
+ */
+void mock_server_reset_requests(mock_server* server) {
+	pthread_mutex_lock(&server->lock);
+	g_hash_table_remove_all(server->counts);
+	g_string_truncate(server->log, 0);
+	server->requests = 0;
+	pthread_mutex_unlock(&server->lock);
+}
@@ -0,0 +1,119 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __MOCK_SERVER_H__
+#define __MOCK_SERVER_H__
+
+#include <glib.h>
+G_BEGIN_DECLS
+
+#include <time.h>
+
+/**
+ * A CalDAV stand-in listening on 127.0.0.1 for tests and benchmarks. It
+ * serves one collection at /cal/ holding generated events and answers
+ * OPTIONS, GET, HEAD, PUT, DELETE, PROPFIND, REPORT (calendar-query,
+ * calendar-multiget, free-busy-query, sync-collection), LOCK and UNLOCK
+ * over HTTP/1.1 with keep-alive. Every connection gets its own thread.
+ */
+
+/* Path of the collection */
+#define MOCK_COLLECTION "/cal/"
+/* First generated event starts at 2030-01-01 00:00:00 UTC */
+#define MOCK_EPOCH 1893456000
+/* Seconds between the starts of generated events */
+#define MOCK_SPACING 10800
+/* Duration of generated events in seconds */
+#define MOCK_DURATION 3600
+
+/**
+ * @typedef struct _mock_server mock_server
+ * A running stand-in server
+ */
+typedef struct _mock_server mock_server;
+
+/**
+ * Start a server on a free port.
+ * @param events Number of events generated in the collection. The UID of
+ * event i is "bench-<i>@localhost", its href /cal/bench-<i>.ics and it
+ * starts at MOCK_EPOCH + i * MOCK_SPACING.
+ * @return the server or NULL if no socket could be opened
+ */
+mock_server* mock_server_start(guint events);
+
+/**
+ * Stop a server and free it. Open connections are closed.
+ * @param server @see mock_server
+ */
+void mock_server_stop(mock_server* server);
+
+/**
+ * URL of the collection.
+ * @param server @see mock_server
+ * @return http://127.0.0.1:<port>/cal/. Owned by the server.
+ */
+const gchar* mock_server_url(mock_server* server);
+
+/**
+ * Delay every response to simulate a network round trip.
+ * @param server @see mock_server
+ * @param usec Microseconds to wait before answering
+ */
+void mock_server_set_latency(mock_server* server, gulong usec);
+
+/**
+ * Number of requests answered since start or the last reset.
+ * @param server @see mock_server
+ * @param method Only count this method. NULL counts all.
+ * @return number of requests
+ */
+guint mock_server_requests(mock_server* server, const gchar* method);
+
+/**
+ * Requests answered since start or the last reset.
+ * @param server @see mock_server
+ * @return one "METHOD path" line per request. Free with g_free.
+ */
+gchar* mock_server_log(mock_server* server);
+
+/**
+ * Clear the request counters and the log.
+ * @param server @see mock_server
+ */
+void mock_server_reset_requests(mock_server* server);
+
+/**
+ * Replace the collection with freshly generated events.
+ * @param server @see mock_server
+ * @param events Number of events
+ */
+void mock_server_populate(mock_server* server, guint events);
+
+/**
+ * Generate the iCalendar of an event in the format used by the server.
+ * @param uid UID of the event
+ * @param start Start in seconds since the epoch
+ * @param summary Summary of the event
+ * @return a VCALENDAR. Free with g_free.
+ */
+gchar* mock_server_event(const gchar* uid, time_t start, const gchar* summary);
+
+G_END_DECLS
+
+#endif
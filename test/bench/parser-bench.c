@@ -0,0 +1,339 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <glib.h>
+
+static const char* usage[] = {
+"caldav-parser-bench is part of libcaldav.\n"
+"Feeds the response parsers with generated multistatus documents and\n"
+"reports throughput and peak memory for each parser, style and size.\n"
+"\nusage:\n\tcaldav-parser-bench [Options] [parser ...]\n"
+"\n\tOptions:\n"
+"\t\t-m\tlargest number of responses (default 100000)\n"
+"\t\t-s\tseconds to repeat each measurement (default 0.5)\n"
+"\t\t-t\tseconds before a measurement is given up (default 60)\n"
+"\t\t-h|-?\tusage\n"
+"\n\tParsers: parse_caldav_report get_tag_list get_response_header "
+"single_resource\n"
+};
+
+/*
+ * Documents are built in the styles seen from servers:
+ * prefixed - D: and C: declared on multistatus
+ * default  - DAV: as default namespace, CalDAV declared on calendar-data
+ * google   - D: on multistatus, caldav: declared on every calendar-data
+ */
+typedef enum {
+	STYLE_PREFIXED,
+	STYLE_DEFAULT,
+	STYLE_GOOGLE
+} corpus_style;
+
+static const gchar* style_names[] = {"prefixed", "default", "google"};
+
+static const gchar* vtimezone =
+"BEGIN:VTIMEZONE\r\n"
+"TZID:Europe/Copenhagen\r\n"
+"BEGIN:DAYLIGHT\r\n"
+"TZOFFSETFROM:+0100\r\n"
+"TZOFFSETTO:+0200\r\n"
+"TZNAME:CEST\r\n"
+"DTSTART:19700329T020000\r\n"
+"RRULE:FREQ=YEARLY;BYMONTH=3;BYDAY=-1SU\r\n"
+"END:DAYLIGHT\r\n"
+"BEGIN:STANDARD\r\n"
+"TZOFFSETFROM:+0200\r\n"
+"TZOFFSETTO:+0100\r\n"
+"TZNAME:CET\r\n"
+"DTSTART:19701025T030000\r\n"
+"RRULE:FREQ=YEARLY;BYMONTH=10;BYDAY=-1SU\r\n"
+"END:STANDARD\r\n"
+"END:VTIMEZONE\r\n";
+
+static gchar* build_corpus(guint responses, corpus_style style,
+		gboolean timezone) {
+	GString* xml = g_string_new("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n");
+	const gchar* d = (style == STYLE_DEFAULT) ? "" : "D:";
+	const gchar* c;
+	const gchar* cdecl;
+	guint i;
+
+	switch (style) {
+		case STYLE_PREFIXED:
+			g_string_append(xml, "<D:multistatus xmlns:D=\"DAV:\" "
+				"xmlns:C=\"urn:ietf:params:xml:ns:caldav\">");
+			c = "C:";
+			cdecl = "";
+			break;
+		case STYLE_DEFAULT:
+			g_string_append(xml, "<multistatus xmlns=\"DAV:\">");
+			c = "";
+			cdecl = " xmlns=\"urn:ietf:params:xml:ns:caldav\"";
+			break;
+		default:
+			g_string_append(xml, "<D:multistatus xmlns:D=\"DAV:\">");
+			c = "caldav:";
+			cdecl = " xmlns:caldav=\"urn:ietf:params:xml:ns:caldav\"";
+			break;
+	}
+	for (i = 0; i < responses; i++) {
+		g_string_append_printf(xml,
+			"<%sresponse><%shref>/cal/event-%u.ics</%shref><%spropstat>"
+			"<%sprop><%sgetetag>\"%08x\"</%sgetetag>"
+			"<%scalendar-data%s>BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+			"PRODID:-//libcaldav//parser bench//EN\r\n%s"
+			"BEGIN:VEVENT\r\nUID:event-%u@localhost\r\n"
+			"DTSTAMP:20300101T000000Z\r\n",
+			d, d, i, d, d, d, d, g_int_hash(&i), d, c, cdecl,
+			timezone ? vtimezone : "", i);
+		if (timezone)
+			g_string_append_printf(xml,
+				"DTSTART;TZID=Europe/Copenhagen:203001%02uT%02u0000\r\n"
+				"DTEND;TZID=Europe/Copenhagen:203001%02uT%02u3000\r\n",
+				i % 28 + 1, i % 24, i % 28 + 1, i % 24);
+		else
+			g_string_append_printf(xml,
+				"DTSTART:203001%02uT%02u0000Z\r\n"
+				"DTEND:203001%02uT%02u3000Z\r\n",
+				i % 28 + 1, i % 24, i % 28 + 1, i % 24);
+		g_string_append_printf(xml,
+			"SUMMARY:Event %u\r\nEND:VEVENT\r\nEND:VCALENDAR\r\n"
+			"</%scalendar-data></%sprop><%sstatus>HTTP/1.1 200 OK</%sstatus>"
+			"</%spropstat></%sresponse>", i, c, d, d, d, d, d);
+	}
+	g_string_append_printf(xml, "</%smultistatus>", d);
+	return g_string_free(xml, FALSE);
+}
+
+static guint count_string(const gchar* text, const gchar* needle) {
+	guint count = 0;
+
+	while (text && (text = strstr(text, needle)) != NULL) {
+		count++;
+		text += strlen(needle);
+	}
+	return count;
+}
+
+/**
+ * One parser run over a document.
+ * @return number of items found, eg. events or responses
+ */
+typedef guint (*parser_func)(gchar* doc);
+
+static guint run_report(gchar* doc) {
+	gchar* result = parse_caldav_report(doc, "calendar-data", "VEVENT");
+	guint found = count_string(result, "BEGIN:VEVENT");
+
+	g_free(result);
+	return found;
+}
+
+static guint run_tag_list(gchar* doc) {
+	GSList* list = get_tag_list(doc);
+	GSList* head;
+	guint found = 0;
+
+	for (head = list; head; head = g_slist_next(head)) {
+		Pair* p = (Pair *) head->data;
+
+		if (p->href && p->etag)
+			found++;
+		g_free(p->href);
+		g_free(p->etag);
+		g_free(p);
+	}
+	g_slist_free(list);
+	return found;
+}
+
+static guint run_header(gchar* doc) {
+	gchar* uid = get_response_header("uid", doc, FALSE);
+	guint found = uid ? count_string(uid, "@localhost") : 0;
+
+	g_free(uid);
+	return found;
+}
+
+static guint run_single(gchar* doc) {
+	return single_resource(doc, "VEVENT") ? 1 : 0;
+}
+
+typedef struct {
+	const gchar*	name;
+	parser_func		run;
+} parser_case;
+
+static const parser_case parsers[] = {
+	{"parse_caldav_report",	run_report},
+	{"get_tag_list",		run_tag_list},
+	{"get_response_header",	run_header},
+	{"single_resource",		run_single},
+	{NULL,					NULL}
+};
+
+static gint64 now_usec(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static long max_rss(void) {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+/*
+ * Measure in a child process so the peak RSS of one measurement is not
+ * hidden by an earlier one. The child writes
+ * "<size> <iterations> <usec> <found> <rss kB> <peak kB>" to the pipe.
+ */
+static void measure(const parser_case* parser, guint responses,
+		corpus_style style, gboolean timezone, double seconds,
+		unsigned timeout) {
+	int fds[2];
+	pid_t pid;
+	int status;
+	gchar line[256];
+	ssize_t n;
+	unsigned long size, iterations, found;
+	long long usec;
+	long rss, peak;
+
+	if (pipe(fds) != 0)
+		return;
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		gchar* doc;
+		gint64 start, elapsed;
+		gulong i = 0;
+		guint hits = 0;
+		long base;
+
+		close(fds[0]);
+		alarm(timeout);
+		doc = build_corpus(responses, style, timezone);
+		base = max_rss();
+		start = now_usec();
+		do {
+			hits = parser->run(doc);
+			i++;
+			elapsed = now_usec() - start;
+		} while (elapsed < seconds * G_USEC_PER_SEC);
+		g_snprintf(line, sizeof(line), "%lu %lu %lld %u %ld %ld\n",
+			(unsigned long) strlen(doc), i, (long long) elapsed, hits,
+			base, max_rss());
+		if (write(fds[1], line, strlen(line)) < 0)
+			_exit(1);
+		g_free(doc);
+		_exit(0);
+	}
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		return;
+	}
+	n = read(fds[0], line, sizeof(line) - 1);
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	printf("%-20s %-8s %-3s %7u ", parser->name, style_names[style],
+		timezone ? "tz" : "-", responses);
+	if (n <= 0 || sscanf(line, "%lu %lu %lld %lu %ld %ld", &size, &iterations,
+				&usec, &found, &rss, &peak) != 6) {
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM)
+			printf("gave up after %u s\n", timeout);
+		else
+			printf("failed\n");
+		return;
+	}
+	printf("%9.2f %6lu %10.3f %9.1f %11.0f %8lu %9.1f %9.1f\n",
+		size / 1048576.0, iterations, usec / 1000.0 / iterations,
+		size * (double) iterations / usec,
+		responses * (double) iterations * G_USEC_PER_SEC / usec,
+		found, rss / 1024.0, (peak - rss) / 1024.0);
+}
+
+int main(int argc, char** argv) {
+	guint max = 100000;
+	double seconds = 0.5;
+	unsigned timeout = 60;
+	guint responses;
+	int c, i, style, timezone;
+
+	while ((c = getopt(argc, argv, "hm:s:t:?")) != -1) {
+		switch (c) {
+			case 'h':
+			case '?':
+				fprintf(stdout, "%s", usage[0]);
+				return 0;
+			case 'm':
+				max = strtoul(optarg, NULL, 10);
+				break;
+			case 's':
+				seconds = g_ascii_strtod(optarg, NULL);
+				break;
+			case 't':
+				timeout = strtoul(optarg, NULL, 10);
+				break;
+		}
+	}
+
+	printf("%-20s %-8s %-3s %7s %9s %6s %10s %9s %11s %8s %9s %9s\n",
+		"parser", "style", "tz", "resp", "MiB", "runs", "ms/run", "MB/s",
+		"resp/s", "found", "rss MiB", "peak MiB");
+	for (i = 0; parsers[i].name; i++) {
+		int n;
+
+		if (optind < argc) {
+			for (n = optind; n < argc; n++) {
+				if (strcmp(argv[n], parsers[i].name) == 0)
+					break;
+			}
+			if (n == argc)
+				continue;
+		}
+		for (style = STYLE_PREFIXED; style <= STYLE_GOOGLE; style++) {
+			for (timezone = 0; timezone <= 1; timezone++) {
+				for (responses = 10; responses <= max; responses *= 10)
+					measure(&parsers[i], responses, style, timezone,
+						seconds, timeout);
+			}
+		}
+	}
+	return 0;
+}
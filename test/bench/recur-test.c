@@ -0,0 +1,313 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav-recur.h"
+#include "caldav-timeline.h"
+#include "caldav-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+/*
+ * Offline checks of the recurrence expansion and the timeline. Every case
+ * runs in a fixed window and the instances found are compared with the
+ * expected ones written as START/END in UTC, sorted by start for
+ * ical_expand and in the order found for the timeline.
+ */
+
+#define VEVENT(lines) \
+	"BEGIN:VCALENDAR\r\nVERSION:2.0\r\nBEGIN:VEVENT\r\n" \
+	lines \
+	"END:VEVENT\r\nEND:VCALENDAR\r\n"
+
+typedef struct {
+	const gchar*	name;
+	const gchar*	object;
+	const gchar*	from;		/* window */
+	const gchar*	to;
+	const gchar*	expect;
+} expand_case;
+
+static const expand_case expand_cases[] = {
+	{"RRULE with COUNT",
+		VEVENT(
+		"UID:daily\r\n"
+		"DTSTART:20300101T100000Z\r\n"
+		"DTEND:20300101T110000Z\r\n"
+		"RRULE:FREQ=DAILY;COUNT=3\r\n"),
+		"20300101T000000Z", "20300201T000000Z",
+		"20300101T100000Z/20300101T110000Z "
+		"20300102T100000Z/20300102T110000Z "
+		"20300103T100000Z/20300103T110000Z"},
+	{"RRULE with UNTIL",
+		VEVENT(
+		"UID:weekly\r\n"
+		"DTSTART:20300101T100000Z\r\n"
+		"DTEND:20300101T110000Z\r\n"
+		"RRULE:FREQ=WEEKLY;UNTIL=20300115T100000Z\r\n"),
+		"20300101T000000Z", "20300201T000000Z",
+		"20300101T100000Z/20300101T110000Z "
+		"20300108T100000Z/20300108T110000Z "
+		"20300115T100000Z/20300115T110000Z"},
+	{"window",
+		VEVENT(
+		"UID:window\r\n"
+		"DTSTART:20300101T100000Z\r\n"
+		"DTEND:20300101T110000Z\r\n"
+		"RRULE:FREQ=DAILY\r\n"),
+		"20300110T103000Z", "20300112T100000Z",
+		"20300110T100000Z/20300110T110000Z "
+		"20300111T100000Z/20300111T110000Z"},
+	{"BYDAY",
+		VEVENT(
+		"UID:byday\r\n"
+		"DTSTART:20300107T090000Z\r\n"
+		"DTEND:20300107T093000Z\r\n"
+		"RRULE:FREQ=WEEKLY;BYDAY=MO,WE;COUNT=4\r\n"),
+		"20300101T000000Z", "20300201T000000Z",
+		"20300107T090000Z/20300107T093000Z "
+		"20300109T090000Z/20300109T093000Z "
+		"20300114T090000Z/20300114T093000Z "
+		"20300116T090000Z/20300116T093000Z"},
+	{"BYSETPOS",
+		VEVENT(
+		"UID:bysetpos\r\n"
+		"DTSTART:20300131T160000Z\r\n"
+		"DTEND:20300131T170000Z\r\n"
+		"RRULE:FREQ=MONTHLY;BYDAY=MO,TU,WE,TH,FR;BYSETPOS=-1;COUNT=3\r\n"),
+		"20300101T000000Z", "20300501T000000Z",
+		"20300131T160000Z/20300131T170000Z "
+		"20300228T160000Z/20300228T170000Z "
+		"20300329T160000Z/20300329T170000Z"},
+	{"EXDATE",
+		VEVENT(
+		"UID:exdate\r\n"
+		"DTSTART:20300101T100000Z\r\n"
+		"DTEND:20300101T110000Z\r\n"
+		"RRULE:FREQ=DAILY;COUNT=4\r\n"
+		"EXDATE:20300102T100000Z,20300104T100000Z\r\n"),
+		"20300101T000000Z", "20300201T000000Z",
+		"20300101T100000Z/20300101T110000Z "
+		"20300103T100000Z/20300103T110000Z"},
+	{"RECURRENCE-ID",
+		"BEGIN:VCALENDAR\r\nVERSION:2.0\r\n"
+		"BEGIN:VEVENT\r\n"
+		"UID:override\r\n"
+		"DTSTART:20300101T100000Z\r\n"
+		"DTEND:20300101T110000Z\r\n"
+		"RRULE:FREQ=DAILY;COUNT=3\r\n"
+		"END:VEVENT\r\n"
+		"BEGIN:VEVENT\r\n"
+		"UID:override\r\n"
+		"RECURRENCE-ID:20300102T100000Z\r\n"
+		"DTSTART:20300102T140000Z\r\n"
+		"DTEND:20300102T153000Z\r\n"
+		"END:VEVENT\r\n"
+		"END:VCALENDAR\r\n",
+		"20300101T000000Z", "20300201T000000Z",
+		"20300101T100000Z/20300101T110000Z "
+		"20300102T140000Z/20300102T153000Z "
+		"20300103T100000Z/20300103T110000Z"},
+	{"weekly across DST",
+		VEVENT(
+		"UID:dst-weekly\r\n"
+		"DTSTART;TZID=Europe/Copenhagen:20300324T100000\r\n"
+		"DTEND;TZID=Europe/Copenhagen:20300324T110000\r\n"
+		"RRULE:FREQ=WEEKLY;COUNT=2\r\n"),
+		"20300301T000000Z", "20300501T000000Z",
+		"20300324T090000Z/20300324T100000Z "
+		"20300331T080000Z/20300331T090000Z"},
+	{"nominal DURATION across DST",
+		VEVENT(
+		"UID:dst-day\r\n"
+		"DTSTART;TZID=Europe/Copenhagen:20300330T120000\r\n"
+		"DURATION:P1D\r\n"),
+		"20300301T000000Z", "20300501T000000Z",
+		"20300330T110000Z/20300331T100000Z"},
+	{NULL, NULL, NULL, NULL, NULL}
+};
+
+static gint compare_instance(gconstpointer a, gconstpointer b) {
+	const ical_instance* x = (const ical_instance *) a;
+	const ical_instance* y = (const ical_instance *) b;
+
+	return (x->start > y->start) - (x->start < y->start);
+}
+
+static void append_instance(GString* buf, const gchar* key,
+		const ical_instance* instance) {
+	gchar* start = utc_to_ical_time(instance->start);
+	gchar* end = utc_to_ical_time(instance->end);
+
+	g_string_append_printf(buf, "%s%s%s%s/%s", (buf->len > 0) ? " " : "",
+		(key) ? key : "", (key) ? "@" : "", start, end);
+	g_free(start);
+	g_free(end);
+}
+
+static int compare(const gchar* name, const gchar* got, const gchar* expect) {
+	int failed = (strcmp(got, expect) != 0);
+
+	if (failed)
+		printf("  %-38s FAILED\n    expected %s\n    got      %s\n",
+			name, expect, got);
+	else
+		printf("  %-38s ok\n", name);
+	return failed;
+}
+
+/**
+ * Expand every case within its window.
+ * @return number of failed cases
+ */
+static int run_expand(void) {
+	int failed = 0;
+	guint j;
+	int i;
+
+	printf("ical_expand\n");
+	for (i = 0; expand_cases[i].name; i++) {
+		const expand_case* c = &expand_cases[i];
+		GArray* instances = g_array_new(FALSE, FALSE, sizeof(ical_instance));
+		GString* got = g_string_new("");
+
+		ical_expand(c->object, ical_time_to_utc(c->from, NULL),
+			ical_time_to_utc(c->to, NULL), instances, NULL, NULL);
+		g_array_sort(instances, compare_instance);
+		for (j = 0; j < instances->len; j++)
+			append_instance(got, NULL,
+				&g_array_index(instances, ical_instance, j));
+		failed += compare(c->name, got->str, c->expect);
+		g_string_free(got, TRUE);
+		g_array_free(instances, TRUE);
+	}
+	printf("\n");
+	return failed;
+}
+
+static void collect(const gchar* key, const ical_instance* instance,
+		gpointer data) {
+	append_instance((GString *) data, key, instance);
+}
+
+static int query(caldav_timeline* timeline, const gchar* name,
+		const gchar* from, const gchar* to, const gchar* expect) {
+	GString* got = g_string_new("");
+	int failed;
+
+	caldav_timeline_query(timeline, ical_time_to_utc(from, NULL),
+		ical_time_to_utc(to, NULL), collect, got);
+	failed = compare(name, got->str, expect);
+	g_string_free(got, TRUE);
+	return failed;
+}
+
+/**
+ * Put, remove and query objects in a timeline covering January 2030.
+ * @return number of failed cases
+ */
+static int run_timeline(void) {
+	caldav_timeline* timeline;
+	int failed = 0;
+
+	printf("caldav_timeline\n");
+	timeline = caldav_timeline_new_range(
+		ical_time_to_utc("20300101T000000Z", NULL),
+		ical_time_to_utc("20300201T000000Z", NULL));
+	caldav_timeline_put(timeline, "daily", VEVENT(
+		"UID:daily\r\n"
+		"DTSTART:20291228T100000Z\r\n"
+		"DTEND:20291228T110000Z\r\n"
+		"RRULE:FREQ=DAILY;COUNT=10\r\n"));
+	caldav_timeline_put(timeline, "weekly", VEVENT(
+		"UID:weekly\r\n"
+		"DTSTART:20300102T120000Z\r\n"
+		"DTEND:20300102T130000Z\r\n"
+		"RRULE:FREQ=WEEKLY\r\n"));
+	failed += query(timeline, "inside the range",
+		"20300104T000000Z", "20300106T000000Z",
+		"daily@20300104T100000Z/20300104T110000Z "
+		"daily@20300105T100000Z/20300105T110000Z");
+	failed += query(timeline, "extend backwards",
+		"20291229T103000Z", "20291231T000000Z",
+		"daily@20291229T100000Z/20291229T110000Z "
+		"daily@20291230T100000Z/20291230T110000Z");
+	failed += query(timeline, "beyond the horizon",
+		"20300212T000000Z", "20300220T000000Z",
+		"weekly@20300213T120000Z/20300213T130000Z");
+
+	caldav_timeline_put(timeline, "once", VEVENT(
+		"UID:once\r\n"
+		"DTSTART:20300102T103000Z\r\n"
+		"DTEND:20300102T113000Z\r\n"));
+	failed += query(timeline, "merge in start order",
+		"20300102T000000Z", "20300103T000000Z",
+		"daily@20300102T100000Z/20300102T110000Z "
+		"once@20300102T103000Z/20300102T113000Z "
+		"weekly@20300102T120000Z/20300102T130000Z");
+
+	caldav_timeline_put(timeline, "long", VEVENT(
+		"UID:long\r\n"
+		"DTSTART:20300103T000000Z\r\n"
+		"DTEND:20300120T000000Z\r\n"));
+	failed += query(timeline, "long instance",
+		"20300115T000000Z", "20300116T000000Z",
+		"long@20300103T000000Z/20300120T000000Z");
+
+	caldav_timeline_remove(timeline, "long");
+	caldav_timeline_remove(timeline, "daily");
+	failed += query(timeline, "tombstones",
+		"20300101T000000Z", "20300117T000000Z",
+		"once@20300102T103000Z/20300102T113000Z "
+		"weekly@20300102T120000Z/20300102T130000Z "
+		"weekly@20300109T120000Z/20300109T130000Z "
+		"weekly@20300116T120000Z/20300116T130000Z");
+
+	caldav_timeline_put(timeline, "weekly", VEVENT(
+		"UID:weekly\r\n"
+		"DTSTART:20300102T140000Z\r\n"
+		"DTEND:20300102T150000Z\r\n"
+		"RRULE:FREQ=WEEKLY;COUNT=2\r\n"));
+	failed += query(timeline, "replaced series",
+		"20300101T000000Z", "20300201T000000Z",
+		"once@20300102T103000Z/20300102T113000Z "
+		"weekly@20300102T140000Z/20300102T150000Z "
+		"weekly@20300109T140000Z/20300109T150000Z");
+	caldav_timeline_free(timeline);
+	printf("\n");
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	int failed = 0;
+
+	failed += run_expand();
+	failed += run_timeline();
+	if (failed) {
+		printf("%d recurrence cases failed\n", failed);
+		return 1;
+	}
+	printf("All recurrence cases passed\n");
+	return 0;
+}
@@ -0,0 +1,526 @@
+/* vim: set textwidth=80 tabstop=4: */
+
+/* Copyright (c) 2008 Michael Rasmussen (mir@datanom.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "caldav.h"
+#include "mock-server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+static const char* usage[] = {
+"caldav-roundtrip is part of libcaldav.\n"
+"Runs the public API against a local stand-in server, counts the HTTP\n"
+"requests each call makes and fails if a call needs more than its budget.\n"
+"\nusage:\n\tcaldav-roundtrip [Options]\n"
+"\n\tOptions:\n"
+"\t\t-v\tshow the requests of every call\n"
+"\t\t-h|-?\tusage\n"
+};
+
+/* Number of generated events in the collection */
+#define ROUNDTRIP_EVENTS 20
+
+typedef struct {
+	mock_server*	server;
+	const gchar*	url;
+	runtime_info*	info;
+	guint			serial;		/* makes UIDs unique between cases */
+	guint			foreign;	/* next generated event to change */
+	gchar*			event;		/* object prepared by setup */
+	CALDAV_ID*		id;
+	caldav_store*	store;
+	gchar*			store_path;
+} roundtrip_context;
+
+/**
+ * A call or its preparation.
+ * @return TRUE in case of error, FALSE otherwise
+ */
+typedef gboolean (*roundtrip_func)(roundtrip_context* ctx);
+
+typedef struct {
+	const gchar*	operation;
+	roundtrip_func	setup;		/* not counted. May be NULL */
+	roundtrip_func	run;		/* counted */
+	guint			budget[2][2];	/* [locking][session] */
+} roundtrip_case;
+
+static gboolean check(CALDAV_RESPONSE res, roundtrip_context* ctx) {
+	if (res != OK) {
+		fprintf(stderr, "  error %ld: %s\n", ctx->info->error->code,
+			ctx->info->error->str ? ctx->info->error->str : "");
+		g_free(ctx->info->error->str);
+		ctx->info->error->str = NULL;
+		ctx->info->error->code = 0;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static gchar* new_event(roundtrip_context* ctx, const gchar* summary) {
+	gchar* uid = g_strdup_printf("roundtrip-%u@localhost", ++ctx->serial);
+	gchar* event = mock_server_event(uid, MOCK_EPOCH + ctx->serial * 60,
+			summary);
+
+	g_free(uid);
+	return event;
+}
+
+/* same UID as the prepared event with another summary */
+static gchar* changed_event(roundtrip_context* ctx) {
+	gchar* uid = g_strdup_printf("roundtrip-%u@localhost", ctx->serial);
+	gchar* event = mock_server_event(uid, MOCK_EPOCH + ctx->serial * 60,
+			"Changed");
+
+	g_free(uid);
+	return event;
+}
+
+static gboolean run_options(roundtrip_context* ctx) {
+	char** options = caldav_get_server_options(ctx->url, ctx->info);
+
+	if (! options)
+		return TRUE;
+	g_strfreev(options);
+	return FALSE;
+}
+
+static gboolean run_enabled(roundtrip_context* ctx) {
+	return ! caldav_enabled_resource(ctx->url, ctx->info);
+}
+
+static gboolean run_displayname(roundtrip_context* ctx) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_get_displayname(result, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static gboolean run_getall(roundtrip_context* ctx) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_getall_object(result, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static int discard(const char* data, size_t length, void* user_data) {
+	return 0;
+}
+
+static gboolean run_getall_sink(roundtrip_context* ctx) {
+	return check(caldav_getall_object_sink(discard, NULL, FALSE, ctx->url,
+				ctx->info), ctx);
+}
+
+static gboolean run_get(roundtrip_context* ctx) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_get_object(result, 0, 0, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+static gboolean run_freebusy(roundtrip_context* ctx) {
+	response* result = caldav_get_response();
+	gboolean error = check(caldav_get_freebusy(result, 0, 0, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_response(&result);
+	return error;
+}
+
+/* the response is optional */
+static gboolean run_freebusy_discard(roundtrip_context* ctx) {
+	return check(caldav_get_freebusy(NULL, 0, 0, ctx->url, ctx->info), ctx);
+}
+
+static gboolean run_freebusy_multi(roundtrip_context* ctx) {
+	caldav_freebusy_item items[2];
+	gboolean error;
+
+	memset(items, 0, sizeof(items));
+	items[0].URL = items[1].URL = ctx->url;
+	error = check(caldav_get_freebusy_multi(items, 2, MOCK_EPOCH,
+				MOCK_EPOCH + 7 * 24 * 3600, NULL, ctx->info), ctx);
+	caldav_free_freebusy_items(items, 2);
+	return error;
+}
+
+static gboolean run_add(roundtrip_context* ctx) {
+	gchar* event = new_event(ctx, "Added");
+	gboolean error = check(caldav_add_object(event, ctx->url, ctx->info), ctx);
+
+	g_free(event);
+	return error;
+}
+
+/* an object on the server for modify and delete */
+static gboolean setup_existing(roundtrip_context* ctx) {
+	g_free(ctx->event);
+	caldav_free_caldav_id(&ctx->id);
+	ctx->event = new_event(ctx, "Existing");
+	return check(caldav_id_add_object(&ctx->id, ctx->event, ctx->url,
+				ctx->info), ctx);
+}
+
+static gboolean run_modify(roundtrip_context* ctx) {
+	gchar* event = changed_event(ctx);
+	gboolean error = check(caldav_modify_object(event, ctx->url, ctx->info),
+			ctx);
+
+	g_free(event);
+	return error;
+}
+
+static gboolean run_delete(roundtrip_context* ctx) {
+	return check(caldav_delete_object(ctx->event, ctx->url, ctx->info), ctx);
+}
+
+/*
+ * A generated event, ie. one stored by another client under an href the
+ * library cannot derive from the UID.
+ */
+static gboolean setup_foreign(roundtrip_context* ctx) {
+	guint i = ctx->foreign++ % ROUNDTRIP_EVENTS;
+	gchar* uid = g_strdup_printf("bench-%u@localhost", i);
+
+	g_free(ctx->event);
+	ctx->event = mock_server_event(uid, MOCK_EPOCH + (time_t) i * MOCK_SPACING,
+			"Changed");
+	g_free(uid);
+	return FALSE;
+}
+
+static gboolean run_modify_foreign(roundtrip_context* ctx) {
+	return check(caldav_modify_object(ctx->event, ctx->url, ctx->info), ctx);
+}
+
+static gboolean run_id_add(roundtrip_context* ctx) {
+	gchar* event = new_event(ctx, "Added");
+	CALDAV_ID* id = NULL;
+	gboolean error = check(caldav_id_add_object(&id, event, ctx->url,
+				ctx->info), ctx);
+
+	caldav_free_caldav_id(&id);
+	g_free(event);
+	return error;
+}
+
+static gboolean run_id_modify(roundtrip_context* ctx) {
+	gchar* event = changed_event(ctx);
+	gboolean error = check(caldav_id_modify_object(&ctx->id, event, ctx->url,
+				ctx->info), ctx);
+
+	g_free(event);
+	return error;
+}
+
+/* reads the object from a string */
+static long from_string(char* buffer, size_t length, gint64 offset,
+		void* user_data) {
+	const gchar* object = user_data;
+	gsize size = strlen(object);
+
+	if (offset >= (gint64) size)
+		return 0;
+	length = MIN(length, size - offset);
+	memcpy(buffer, object + offset, length);
+	return length;
+}
+
+static gboolean run_id_add_source(roundtrip_context* ctx) {
+	gchar* event = new_event(ctx, "Added");
+	CALDAV_ID* id = NULL;
+	gboolean error = check(caldav_id_add_object_source(&id, from_string, event,
+				strlen(event), ctx->url, ctx->info), ctx);
+
+	caldav_free_caldav_id(&id);
+	g_free(event);
+	return error;
+}
+
+static gboolean run_id_modify_source(roundtrip_context* ctx) {
+	gchar* event = changed_event(ctx);
+	gboolean error = check(caldav_id_modify_object_source(&ctx->id, from_string,
+				event, strlen(event), ctx->url, ctx->info), ctx);
+
+	g_free(event);
+	return error;
+}
+
+static gboolean run_id_add_attachment(roundtrip_context* ctx) {
+	const gchar* attachment = "Attached";
+	gchar* managed_id = NULL;
+	gboolean error = check(caldav_id_add_attachment(&ctx->id, from_string,
+				(void *) attachment, strlen(attachment), "note.txt",
+				"text/plain", &managed_id, ctx->url, ctx->info), ctx);
+
+	g_free(managed_id);
+	return error;
+}
+
+static gboolean run_id_delete(roundtrip_context* ctx) {
+	return check(caldav_id_delete_object(ctx->id, ctx->event, ctx->url,
+				ctx->info), ctx);
+}
+
+/* four new objects */
+static gboolean run_batch(roundtrip_context* ctx) {
+	caldav_batch_item items[4];
+	gchar* events[4];
+	gboolean error;
+	int n;
+
+	memset(items, 0, sizeof(items));
+	for (n = 0; n < 4; n++) {
+		events[n] = new_event(ctx, "Batch");
+		items[n].action = ADD;
+		items[n].object = events[n];
+	}
+	error = check(caldav_batch_objects(items, 4, ctx->url, ctx->info), ctx);
+	for (n = 0; n < 4; n++) {
+		caldav_free_caldav_id(&items[n].id);
+		g_free(events[n]);
+	}
+	return error;
+}
+
+/* four events in one VCALENDAR */
+static gboolean run_import(roundtrip_context* ctx) {
+	GString* calendar = g_string_new("BEGIN:VCALENDAR\r\nVERSION:2.0\r\n");
+	gboolean error;
+	int n;
+
+	for (n = 0; n < 4; n++) {
+		gchar* event = new_event(ctx, "Imported");
+		gchar* begin = strstr(event, "BEGIN:VEVENT");
+		gchar* end = strstr(event, "END:VCALENDAR");
+
+		g_string_append_len(calendar, begin, end - begin);
+		g_free(event);
+	}
+	g_string_append(calendar, "END:VCALENDAR\r\n");
+	error = check(caldav_import_buffer(calendar->str, calendar->len,
+				ctx->url, NULL, NULL, ctx->info), ctx);
+	g_string_free(calendar, TRUE);
+	return error;
+}
+
+static gboolean setup_store(roundtrip_context* ctx) {
+	caldav_close_store(&ctx->store);
+	if (! ctx->store_path)
+		ctx->store_path = g_build_filename(g_get_tmp_dir(),
+				"libcaldav-roundtrip.store", NULL);
+	unlink(ctx->store_path);
+	ctx->store = caldav_open_store(ctx->store_path, ctx->url, ctx->info);
+	return ctx->store == NULL;
+}
+
+static gboolean run_sync(roundtrip_context* ctx) {
+	return check(caldav_sync_store(ctx->store, ctx->url, ctx->info), ctx);
+}
+
+/* a synced store and one changed object on the server */
+static gboolean setup_sync_changed(roundtrip_context* ctx) {
+	if (setup_store(ctx) || run_sync(ctx))
+		return TRUE;
+	return run_add(ctx);
+}
+
+static const roundtrip_case cases[] = {
+	/* operation			setup			run
+	 *						budget: {{lock off: session off, on},
+	 *								 {lock on: session off, on}} */
+	{"options",				NULL,			run_options,
+							{{1, 1}, {1, 1}}},
+	{"enabled_resource",	NULL,			run_enabled,
+							{{1, 1}, {1, 1}}},
+	{"get_displayname",		NULL,			run_displayname,
+							{{2, 2}, {2, 2}}},
+	{"get_object",			NULL,			run_get,
+							{{2, 2}, {2, 2}}},
+	{"getall_object",		NULL,			run_getall,
+							{{2, 2}, {2, 2}}},
+	{"getall_object_sink",	NULL,			run_getall_sink,
+							{{2, 2}, {2, 2}}},
+	{"get_freebusy",		NULL,			run_freebusy,
+							{{2, 2}, {2, 2}}},
+	{"get_freebusy discard", NULL,			run_freebusy_discard,
+							{{2, 2}, {2, 2}}},
+	{"get_freebusy_multi",	NULL,			run_freebusy_multi,
+							{{2, 2}, {2, 2}}},
+	{"add_object",			NULL,			run_add,
+							{{2, 2}, {2, 2}}},
+	{"modify_object",		setup_existing,	run_modify,
+							{{3, 2}, {8, 7}}},
+	{"delete_object",		setup_existing,	run_delete,
+							{{3, 2}, {8, 7}}},
+	{"modify_object foreign", setup_foreign, run_modify_foreign,
+							{{3, 2}, {8, 7}}},
+	{"delete_object foreign", setup_foreign, run_delete,
+							{{3, 2}, {8, 7}}},
+	{"id_add_object",		NULL,			run_id_add,
+							{{2, 2}, {2, 2}}},
+	{"id_modify_object",	setup_existing,	run_id_modify,
+							{{2, 2}, {7, 7}}},
+	{"id_add_source",		NULL,			run_id_add_source,
+							{{2, 2}, {2, 2}}},
+	{"id_modify_source",	setup_existing,	run_id_modify_source,
+							{{2, 2}, {7, 7}}},
+	{"id_add_attachment",	setup_existing,	run_id_add_attachment,
+							{{2, 2}, {2, 2}}},
+	{"id_delete_object",	setup_existing,	run_id_delete,
+							{{2, 2}, {7, 7}}},
+	{"batch_objects",		NULL,			run_batch,
+							{{5, 5}, {5, 5}}},
+	{"import_buffer",		NULL,			run_import,
+							{{5, 5}, {5, 5}}},
+	{"sync_store full",		setup_store,	run_sync,
+							{{2, 2}, {2, 2}}},
+	{"sync_store changed",	setup_sync_changed,	run_sync,
+							{{2, 2}, {2, 2}}},
+	{NULL,					NULL,			NULL,
+							{{0, 0}, {0, 0}}}
+};
+
+static void print_log(const gchar* log) {
+	gchar** lines = g_strsplit(log, "\n", 0);
+	gint i;
+
+	for (i = 0; lines[i]; i++) {
+		if (*lines[i])
+			printf("    %s\n", lines[i]);
+	}
+	g_strfreev(lines);
+}
+
+/**
+ * Run every case in one mode.
+ * @return number of failed cases
+ */
+static int run_mode(mock_server* server, gboolean locking, gboolean session,
+		gboolean verbose) {
+	roundtrip_context ctx;
+	int failed = 0;
+	int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.server = server;
+	ctx.url = mock_server_url(server);
+	ctx.info = caldav_get_runtime_info();
+	ctx.info->options->use_locking = locking;
+	if (session)
+		ctx.info->session = caldav_get_session();
+	/* the UIDs of earlier modes must not clash */
+	ctx.serial = (locking * 2 + session) * 10000;
+	ctx.foreign = (locking * 2 + session) * 4;
+
+	printf("locking %s, session %s\n", locking ? "on" : "off",
+		session ? "on" : "off");
+	for (i = 0; cases[i].operation; i++) {
+		const roundtrip_case* c = &cases[i];
+		guint budget = c->budget[locking][session];
+		guint requests;
+		gboolean error;
+		gchar* log;
+
+		if (c->setup && c->setup(&ctx)) {
+			printf("  %-22s setup failed\n", c->operation);
+			failed++;
+			continue;
+		}
+		mock_server_reset_requests(server);
+		error = c->run(&ctx);
+		requests = mock_server_requests(server, NULL);
+		log = mock_server_log(server);
+		if (error || requests > budget) {
+			failed++;
+			printf("  %-22s %2u requests, budget %2u  FAILED%s\n",
+				c->operation, requests, budget, error ? " (error)" : "");
+			print_log(log);
+		}
+		else {
+			printf("  %-22s %2u requests, budget %2u\n", c->operation,
+				requests, budget);
+			if (verbose)
+				print_log(log);
+		}
+		g_free(log);
+	}
+	printf("\n");
+
+	g_free(ctx.event);
+	caldav_free_caldav_id(&ctx.id);
+	caldav_close_store(&ctx.store);
+	if (ctx.store_path) {
+		unlink(ctx.store_path);
+		g_free(ctx.store_path);
+	}
+	caldav_free_runtime_info(&ctx.info);
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	mock_server* server;
+	gboolean verbose = FALSE;
+	int failed = 0;
+	int c, locking, session;
+
+	while ((c = getopt(argc, argv, "hv?")) != -1) {
+		switch (c) {
+			case 'h':
+			case '?':
+				fprintf(stdout, "%s", usage[0]);
+				return 0;
+			case 'v':
+				verbose = TRUE;
+				break;
+		}
+	}
+
+	caldav_global_init();
+	server = mock_server_start(ROUNDTRIP_EVENTS);
+	if (! server) {
+		fprintf(stderr, "Could not start server\n");
+		return 1;
+	}
+	for (locking = 0; locking <= 1; locking++) {
+		for (session = 0; session <= 1; session++)
+			failed += run_mode(server, locking, session, verbose);
+	}
+	mock_server_stop(server);
+	caldav_global_cleanup();
+
+	if (failed)
+		printf("%d case(s) over budget or failing\n", failed);
+	else
+		printf("All round trips within budget\n");
+	return failed ? 1 : 0;
+}
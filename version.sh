@@ -1,8 +1,9 @@
 #!/bin/sh
 
 if [ "x$1" = "xLIBTOOL" ]; then
+    # current:revision from minor.patch, a new minor breaks the ABI
     grep -m 1 libcaldav ChangeLog | awk '{print $2}' | \
-    cut -c2-4 | sed 's/\./:/g'
+    tr -d '()' | cut -d. -f2,3 | sed 's/\./:/g'
 else
     grep -m 1 libcaldav ChangeLog | awk '{print $2}' | cut -c2-6
 fi